@@ -0,0 +1,376 @@
+/**
+ *  Locate the ACPI tables provided by the firmware, and parse the MADT.
+ *
+ *  The tables are found through the root system description pointer
+ *  (RSDP), which the BIOS leaves either in the first KiB of the extended
+ *  BIOS data area, or somewhere in the BIOS ROM area between 0xE0000 and
+ *  0xFFFFF, on a 16 byte boundary. The RSDP points to the root system
+ *  description table (RSDT), which is a list of pointers to all of the
+ *  other tables.
+ *
+ *  The tables are often at the top of memory, beyond the direct map, so
+ *  each one is mapped when the RSDT is read.
+ */
+
+#include "acpi.h"
+#include "stdint.h"
+#include "memutils.h"
+#include "paging.h"
+#include "utils.h"
+
+/** real mode segment of the extended BIOS data area is stored here */
+#define EBDA_SEGMENT_POINTER    0x040E
+#define EBDA_SEARCH_LENGTH      1024
+
+#define BIOS_AREA_START         0x000E0000
+#define BIOS_AREA_END           0x00100000
+
+/** most tables that we keep track of */
+#define MAX_TABLES              32
+
+/** types of entry in the MADT */
+#define MADT_LOCAL_APIC         0
+#define MADT_IOAPIC             1
+#define MADT_SOURCE_OVERRIDE    2
+
+/** flags of MADT local APIC entries */
+#define MADT_CPU_ENABLED        0x01
+
+/** flags of the MADT itself */
+#define MADT_PCAT_COMPATIBLE    0x01
+
+/**********************************************************/
+
+/**
+ *  The RSDP. The fields after rsdt_address only exist in ACPI 2.0 and
+ *  later, and we do not need them.
+ */
+struct rsdp
+{
+    char signature [8];
+    uint8_t checksum;
+    char oem_id [6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+}
+__attribute__ ((packed));
+
+/**
+ *  The RSDT is the header followed by an array of table addresses.
+ */
+struct rsdt
+{
+    struct acpi_header header;
+    uint32_t tables [];
+}
+__attribute__ ((packed));
+
+/**
+ *  The MADT has the local APIC address and flags, followed by a list of
+ *  variable length entries, each starting with its type and length.
+ */
+struct madt
+{
+    struct acpi_header header;
+    uint32_t local_apic_address;
+    uint32_t flags;
+    uint8_t entries [];
+}
+__attribute__ ((packed));
+
+struct madt_entry_header
+{
+    uint8_t type;
+    uint8_t length;
+}
+__attribute__ ((packed));
+
+struct madt_local_apic
+{
+    struct madt_entry_header header;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+}
+__attribute__ ((packed));
+
+struct madt_ioapic
+{
+    struct madt_entry_header header;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+}
+__attribute__ ((packed));
+
+struct madt_source_override
+{
+    struct madt_entry_header header;
+    uint8_t bus;
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+}
+__attribute__ ((packed));
+
+/**********************************************************/
+
+PRIVATE const struct rsdp *find_rsdp (void);
+PRIVATE const struct rsdp *search_rsdp (uint32_t start, uint32_t end);
+PRIVATE bool checksum_ok (const void *table, size_t length);
+PRIVATE bool parse_madt (const struct madt *table);
+PRIVATE const struct acpi_header *map_table (uint32_t physical);
+
+/**********************************************************/
+
+/** every table listed in the RSDT */
+PRIVATE const struct acpi_header *tables [MAX_TABLES];
+PRIVATE int num_tables;
+
+PRIVATE struct madt_info madt_info;
+PRIVATE bool have_madt;
+
+/**********************************************************/
+
+/**
+ *  Find the RSDT, and read the interrupt controller configuration from
+ *  the MADT if there is one.
+ */
+    PUBLIC void
+acpi_initialise (void)
+{
+    const struct rsdp *rsdp = find_rsdp ();
+    const struct acpi_header *header;
+    const struct rsdt *rsdt;
+    int count;
+
+    if (rsdp == NULL)
+        return;
+
+    header = map_table (rsdp->rsdt_address);
+
+    if (memcompare (header->signature, "RSDT", 4) != 0 ||
+      !checksum_ok (header, header->length))
+        return;
+
+    rsdt = (const struct rsdt *) header;
+    count = (rsdt->header.length - sizeof (struct acpi_header)) /
+        sizeof (uint32_t);
+
+    for (int i = 0; i < count && num_tables < MAX_TABLES; i ++)
+        tables [num_tables ++] = map_table (rsdt->tables [i]);
+
+    header = acpi_find_table ("APIC");
+
+    if (header != NULL)
+        have_madt = parse_madt ((const struct madt *) header);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the table with the given 4 character signature, or NULL if
+ *  there isn't one.
+ */
+    PUBLIC const struct acpi_header *
+acpi_find_table (signature)
+    const char *signature;
+{
+    for (int i = 0; i < num_tables; i ++)
+    {
+        const struct acpi_header *table = tables [i];
+
+        if (memcompare (table->signature, signature, 4) == 0 &&
+          checksum_ok (table, table->length))
+            return table;
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns what was found in the MADT, or NULL if the machine has no
+ *  MADT.
+ */
+    PUBLIC const struct madt_info *
+acpi_madt (void)
+{
+    return have_madt ? &madt_info : NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Look for the RSDP, first in the extended BIOS data area, and then in
+ *  the BIOS ROM area.
+ */
+    PRIVATE const struct rsdp *
+find_rsdp (void)
+{
+    uint32_t ebda =
+        (uint32_t) *(uint16_t *) physical_to_virtual (EBDA_SEGMENT_POINTER)
+        << 4;
+    const struct rsdp *rsdp = NULL;
+
+    if (ebda != 0)
+        rsdp = search_rsdp (ebda, ebda + EBDA_SEARCH_LENGTH);
+
+    if (rsdp == NULL)
+        rsdp = search_rsdp (BIOS_AREA_START, BIOS_AREA_END);
+
+    return rsdp;
+}
+
+/**********************************************************/
+
+/**
+ *  Search a range of memory for the RSDP signature.
+ */
+    PRIVATE const struct rsdp *
+search_rsdp (start, end)
+    uint32_t start;             // first address to look at
+    uint32_t end;               // address after the end of the range
+{
+    for (uint32_t address = start; address < end; address += 16)
+    {
+        const struct rsdp *rsdp = physical_to_virtual (address);
+
+        if (memcompare (rsdp->signature, "RSD PTR ", 8) == 0 &&
+          checksum_ok (rsdp, sizeof (struct rsdp)))
+            return rsdp;
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Map a table into the kernel's address space. The header has to be
+ *  mapped first, to find out how long the table is, so the rest of its
+ *  page is mapped with it; most tables fit in that, and only the ones
+ *  that do not are mapped again, whole. Virtual space for mappings is
+ *  never given back, so each table takes at most two.
+ */
+    PRIVATE const struct acpi_header *
+map_table (physical)
+    uint32_t physical;
+{
+    uint32_t window = PAGE_SIZE - (physical & (PAGE_SIZE - 1));
+    const struct acpi_header *header;
+
+    if (window < sizeof (struct acpi_header))
+        window += PAGE_SIZE;
+
+    header = paging_map_physical (physical, window, PAGE_KERNEL);
+
+    if (header->length <= window)
+        return header;
+
+    return paging_map_physical (physical, header->length, PAGE_KERNEL);
+}
+
+/**********************************************************/
+
+/**
+ *  ACPI structures have a checksum byte chosen so that all of the bytes
+ *  of the structure add up to zero.
+ */
+    PRIVATE bool
+checksum_ok (table, length)
+    const void *table;
+    size_t length;
+{
+    const uint8_t *bytes = table;
+    uint8_t sum = 0;
+
+    for (size_t i = 0; i < length; i ++)
+        sum += bytes [i];
+
+    return sum == 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Step through the entries of the MADT, recording the processors, IO
+ *  APICs and ISA interrupt overrides. Returns false if the table does not
+ *  describe at least one processor and one IO APIC.
+ */
+    PRIVATE bool
+parse_madt (table)
+    const struct madt *table;
+{
+    const uint8_t *entry = table->entries;
+    const uint8_t *end = (const uint8_t *) table + table->header.length;
+
+    madt_info.local_apic_address = table->local_apic_address;
+    madt_info.has_pic = (table->flags & MADT_PCAT_COMPATIBLE) != 0;
+
+    for (int irq = 0; irq < NUM_ISA_IRQS; irq ++)
+    {
+        madt_info.isa_gsi [irq] = irq;
+        madt_info.isa_flags [irq] = 0;
+    }
+
+    while (entry < end)
+    {
+        const struct madt_entry_header *header =
+            (const struct madt_entry_header *) entry;
+        const struct madt_local_apic *cpu;
+        const struct madt_ioapic *ioapic;
+        const struct madt_source_override *override;
+
+        if (header->length < sizeof (struct madt_entry_header))
+            break;
+
+        switch (header->type)
+        {
+        case MADT_LOCAL_APIC:
+            cpu = (const struct madt_local_apic *) entry;
+
+            if ((cpu->flags & MADT_CPU_ENABLED) &&
+              madt_info.num_cpus < MAX_CPUS)
+                madt_info.cpu_apic_ids [madt_info.num_cpus ++] = cpu->apic_id;
+
+            break;
+
+        case MADT_IOAPIC:
+            ioapic = (const struct madt_ioapic *) entry;
+
+            if (madt_info.num_ioapics < MAX_IOAPICS)
+            {
+                struct ioapic_info *info =
+                    &madt_info.ioapics [madt_info.num_ioapics ++];
+
+                info->id = ioapic->id;
+                info->address = ioapic->address;
+                info->gsi_base = ioapic->gsi_base;
+            }
+
+            break;
+
+        case MADT_SOURCE_OVERRIDE:
+            override = (const struct madt_source_override *) entry;
+
+            if (override->bus == 0 && override->source < NUM_ISA_IRQS)
+            {
+                madt_info.isa_gsi [override->source] = override->gsi;
+                madt_info.isa_flags [override->source] = override->flags;
+            }
+
+            break;
+        }
+
+        entry += header->length;
+    }
+
+    return madt_info.num_cpus > 0 && madt_info.num_ioapics > 0;
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
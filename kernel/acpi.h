@@ -0,0 +1,91 @@
+/**
+ *  Just enough of the ACPI tables to find out about the interrupt
+ *  controllers and processors in the machine.
+ */
+
+#ifndef _ACPI_H
+#define _ACPI_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** limits on the number of each kind of device we keep track of */
+#define MAX_CPUS                16
+#define MAX_IOAPICS             4
+#define NUM_ISA_IRQS            16
+
+/** bits of the flags field of an ISA interrupt source override */
+#define MADT_POLARITY_MASK      0x03
+#define MADT_ACTIVE_LOW         0x03
+#define MADT_TRIGGER_MASK       0x0C
+#define MADT_LEVEL_TRIGGERED    0x0C
+
+/**********************************************************/
+
+/**
+ *  Every ACPI table starts with this header.
+ */
+struct acpi_header
+{
+    char signature [4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id [6];
+    char oem_table_id [8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+}
+__attribute__ ((packed));
+
+/**********************************************************/
+
+/**
+ *  An IO APIC, and the first global system interrupt (GSI) number that
+ *  it handles.
+ */
+struct ioapic_info
+{
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+};
+
+/**
+ *  What we learn from the multiple APIC description table (MADT).
+ */
+struct madt_info
+{
+    /** physical address of the local APIC registers */
+    uint32_t local_apic_address;
+
+    /** true if the machine also has a pair of 8259 PICs */
+    bool has_pic;
+
+    /** local APIC IDs of the usable processors */
+    int num_cpus;
+    uint8_t cpu_apic_ids [MAX_CPUS];
+
+    int num_ioapics;
+    struct ioapic_info ioapics [MAX_IOAPICS];
+
+    /** the GSI that each ISA IRQ is connected to, and its polarity and
+     *  trigger mode flags. Most ISA IRQs are connected to the GSI with
+     *  the same number. */
+    uint32_t isa_gsi [NUM_ISA_IRQS];
+    uint16_t isa_flags [NUM_ISA_IRQS];
+};
+
+/**********************************************************/
+
+void acpi_initialise (void);
+const struct acpi_header *acpi_find_table (const char *signature);
+const struct madt_info *acpi_madt (void);
+
+/**********************************************************/
+
+
+#endif /** _ACPI_H */
+
+/** vim: set ts=4 sw=4 et : */
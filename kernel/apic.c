@@ -0,0 +1,208 @@
+/**
+ *  Driver for the local APIC.
+ */
+
+#include "apic.h"
+#include "stdint.h"
+#include "clock.h"
+#include "cpu.h"
+#include "paging.h"
+#include "utils.h"
+
+/** cpuid leaf 1 sets this bit of edx if there is a local APIC */
+#define CPUID_FEATURE_APIC      0x00000200
+
+/** the APIC base address register, and its global enable bit */
+#define MSR_APIC_BASE           0x1B
+#define APIC_BASE_ENABLE        0x00000800
+
+/** bit of the spurious interrupt register that enables the APIC */
+#define APIC_SOFTWARE_ENABLE    0x00000100
+
+/** cpuid leaf 1 sets this bit of ecx if the timer has TSC deadline mode,
+ *  in which it fires when the TSC reaches the value in this MSR */
+#define CPUID_FEATURE_DEADLINE  0x01000000
+#define MSR_TSC_DEADLINE        0x6E0
+
+/** timer modes, in the LVT timer register */
+#define TIMER_ONE_SHOT          0x00000000
+#define TIMER_TSC_DEADLINE      0x00040000
+
+/** the timer counts down at the bus clock rate divided by 16 */
+#define TIMER_DIVIDE_BY_16      0x03
+
+/** the timer rate is measured over this period */
+#define CALIBRATION_NS          (10 * NS_PER_MILLISECOND)
+
+/**********************************************************/
+
+volatile uint32_t *local_apic;
+
+/** physical address of the registers, for enabling the other
+ *  processors' APICs */
+PRIVATE uint32_t apic_physical;
+
+/** true if the timer is currently set up for TSC deadline mode */
+PRIVATE bool deadline_mode;
+
+/**********************************************************/
+
+/**
+ *  Returns true if the processor has a local APIC.
+ */
+    PUBLIC bool
+apic_available (void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid (1, &eax, &ebx, &ecx, &edx);
+    return (edx & CPUID_FEATURE_APIC) != 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Map the local APIC registers, and enable the local APIC of the boot
+ *  processor.
+ */
+    PUBLIC void
+apic_initialise (physical_address)
+    uint32_t physical_address;  // where the APIC registers are
+{
+    apic_physical = physical_address;
+    local_apic = paging_map_physical (physical_address, PAGE_SIZE,
+      PAGE_KERNEL_IO);
+
+    apic_enable ();
+}
+
+/**********************************************************/
+
+/**
+ *  Enable the local APIC of the processor we are running on, so that it
+ *  will accept interrupts from the IO APIC and other processors. Every
+ *  processor sees its own APIC at the same address, so the mapping made
+ *  by apic_initialise does for all of them.
+ */
+    PUBLIC void
+apic_enable (void)
+{
+    write_msr (MSR_APIC_BASE, (read_msr (MSR_APIC_BASE) & 0xFFF) |
+      apic_physical | APIC_BASE_ENABLE);
+
+    // accept interrupts of every priority.
+    apic_write (APIC_TASK_PRIORITY, 0);
+    apic_write (APIC_SPURIOUS, APIC_SOFTWARE_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+/**********************************************************/
+
+/**
+ *  Send an inter-processor interrupt to the processor with the given
+ *  APIC ID, and wait for the APIC to accept it for delivery.
+ */
+    PUBLIC void
+apic_send_ipi (apic_id, command)
+    uint8_t apic_id;            // destination processor
+    uint32_t command;           // APIC_ICR_ bits and vector
+{
+    apic_write (APIC_ICR_HIGH, (uint32_t) apic_id << 24);
+    apic_write (APIC_ICR_LOW, command);
+
+    while (apic_read (APIC_ICR_LOW) & APIC_ICR_PENDING)
+        cpu_relax ();
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if the local APIC timer supports TSC deadline mode.
+ */
+    PUBLIC bool
+apic_timer_has_tsc_deadline (void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    cpuid (1, &eax, &ebx, &ecx, &edx);
+    return (ecx & CPUID_FEATURE_DEADLINE) != 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Measure how fast the timer counts down in one shot mode, against the
+ *  TSC based clock. Returns the number of timer ticks per second.
+ */
+    PUBLIC uint32_t
+apic_timer_calibrate (void)
+{
+    uint32_t elapsed;
+
+    apic_write (APIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    apic_write (APIC_LVT_TIMER, APIC_LVT_MASKED | TIMER_ONE_SHOT |
+      APIC_TIMER_VECTOR);
+    apic_write (APIC_TIMER_INITIAL, 0xFFFFFFFF);
+    deadline_mode = false;
+
+    clock_delay_ns (CALIBRATION_NS);
+
+    elapsed = 0xFFFFFFFF - apic_read (APIC_TIMER_CURRENT);
+    apic_write (APIC_TIMER_INITIAL, 0);
+
+    return elapsed * (NS_PER_SECOND / CALIBRATION_NS);
+}
+
+/**********************************************************/
+
+/**
+ *  Raise APIC_TIMER_VECTOR once, after the timer has counted down from
+ *  the given count.
+ */
+    PUBLIC void
+apic_timer_one_shot (count)
+    uint32_t count;             // number of timer ticks, at least 1
+{
+    apic_write (APIC_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    apic_write (APIC_LVT_TIMER, TIMER_ONE_SHOT | APIC_TIMER_VECTOR);
+    apic_write (APIC_TIMER_INITIAL, count);
+    deadline_mode = false;
+}
+
+/**********************************************************/
+
+/**
+ *  Raise APIC_TIMER_VECTOR once, when the TSC reaches the given value.
+ *  The timer must be put in deadline mode before the deadline MSR is
+ *  written, otherwise the write is ignored. Once it is in deadline mode,
+ *  rearming the timer is just the MSR write.
+ */
+    PUBLIC void
+apic_timer_deadline (tsc)
+    uint64_t tsc;
+{
+    if (!deadline_mode)
+    {
+        apic_write (APIC_LVT_TIMER, TIMER_TSC_DEADLINE | APIC_TIMER_VECTOR);
+        deadline_mode = true;
+    }
+
+    write_msr (MSR_TSC_DEADLINE, tsc);
+}
+
+/**********************************************************/
+
+/**
+ *  Cancel any pending timer interrupt.
+ */
+    PUBLIC void
+apic_timer_stop (void)
+{
+    if (deadline_mode)
+        write_msr (MSR_TSC_DEADLINE, 0);
+    else
+        apic_write (APIC_TIMER_INITIAL, 0);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,108 @@
+/**
+ *  Driver for the local APIC, the interrupt controller built into each
+ *  processor.
+ */
+
+#ifndef _APIC_H
+#define _APIC_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** offsets of some of the local APIC registers */
+#define APIC_ID                 0x020
+#define APIC_VERSION            0x030
+#define APIC_TASK_PRIORITY      0x080
+#define APIC_EOI                0x0B0
+#define APIC_SPURIOUS           0x0F0
+#define APIC_ICR_LOW            0x300
+#define APIC_ICR_HIGH           0x310
+#define APIC_LVT_TIMER          0x320
+#define APIC_LVT_LINT0          0x350
+#define APIC_LVT_LINT1          0x360
+#define APIC_LVT_ERROR          0x370
+#define APIC_TIMER_INITIAL      0x380
+#define APIC_TIMER_CURRENT      0x390
+#define APIC_TIMER_DIVIDE       0x3E0
+
+/** vector for spurious interrupts from the local APIC. The low 4 bits
+ *  must be set on older processors. */
+#define APIC_SPURIOUS_VECTOR    0xFF
+
+/** bit in the LVT registers to mask the interrupt */
+#define APIC_LVT_MASKED         0x00010000
+
+/** delivery modes and flags of the interrupt command register */
+#define APIC_ICR_INIT           0x00000500
+#define APIC_ICR_STARTUP        0x00000600
+#define APIC_ICR_PENDING        0x00001000
+#define APIC_ICR_ASSERT         0x00004000
+#define APIC_ICR_LEVEL          0x00008000
+
+/** vector raised by the local APIC timer */
+#define APIC_TIMER_VECTOR       0x40
+
+/**********************************************************/
+
+/** the local APIC registers, mapped at the same address on every CPU */
+extern volatile uint32_t *local_apic;
+
+/**********************************************************/
+
+bool apic_available (void);
+void apic_initialise (uint32_t physical_address);
+void apic_enable (void);
+void apic_send_ipi (uint8_t apic_id, uint32_t command);
+
+bool apic_timer_has_tsc_deadline (void);
+uint32_t apic_timer_calibrate (void);
+void apic_timer_one_shot (uint32_t count);
+void apic_timer_deadline (uint64_t tsc);
+void apic_timer_stop (void);
+
+/**********************************************************/
+
+/**
+ *  Read or write a local APIC register.
+ */
+    static inline uint32_t
+apic_read (uint32_t reg)
+{
+    return local_apic [reg / sizeof (uint32_t)];
+}
+
+    static inline void
+apic_write (uint32_t reg, uint32_t value)
+{
+    local_apic [reg / sizeof (uint32_t)] = value;
+}
+
+/**********************************************************/
+
+/**
+ *  Signal the end of the interrupt being handled. This is a single
+ *  memory write, compared with one or two port writes for the PIC.
+ */
+    static inline void
+apic_eoi (void)
+{
+    apic_write (APIC_EOI, 0);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the local APIC ID of the processor we are running on.
+ */
+    static inline uint8_t
+apic_id (void)
+{
+    return (uint8_t) (apic_read (APIC_ID) >> 24);
+}
+
+/**********************************************************/
+
+
+#endif /** _APIC_H */
+
+/** vim: set ts=4 sw=4 et : */
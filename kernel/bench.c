@@ -0,0 +1,276 @@
+/**
+ *  The benchmark harness.
+ *
+ *  Each benchmark's run function is called warmup times untimed, to fill
+ *  the caches and TLB, and then iterations times with the time stamp
+ *  counter read either side of each call. The cycles of each call are
+ *  sorted, and the minimum, median and 99th percentile are written to
+ *  the serial port as a line of CSV:
+ *
+ *      bench,<name>,<iterations>,<min>,<median>,<p99>
+ *
+ *  after a header line of the same shape, so that they can be picked out
+ *  of the rest of the output with grep. The minimum is what the code
+ *  costs with nothing in its way; interrupts are left on, so the 99th
+ *  percentile shows what they and other rare events add.
+ *
+ *  The cost of the timing itself, an indirect call to an empty function
+ *  between two reads of the counter, is measured first and reported as
+ *  the benchmark "empty". Its minimum is taken off every other result.
+ */
+
+#include "bench.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "io.h"
+#include "output.h"
+#include "serial.h"
+#include "utils.h"
+
+/** longest line of CSV */
+#define LINE_SIZE               128
+
+/**********************************************************/
+
+PRIVATE uint32_t run_bench (struct bench *bench, uint32_t overhead);
+PRIVATE void empty_run (void *data);
+PRIVATE void sort (uint32_t *values, uint32_t count);
+PRIVATE void sift_down (uint32_t *values, uint32_t root, uint32_t count);
+PRIVATE void write_line (const char *line);
+
+/**********************************************************/
+
+/** the registered benchmarks, in the order they were registered */
+PRIVATE struct bench *first_bench;
+PRIVATE struct bench *last_bench;
+
+/** cycles taken by each timed run of the benchmark being run */
+PRIVATE uint32_t samples [BENCH_MAX_ITERATIONS];
+
+/** the measure of the harness's own cost */
+PRIVATE struct bench empty_bench =
+{
+    .name = "empty",
+    .run = empty_run,
+    .iterations = BENCH_ITERATIONS,
+    .warmup = BENCH_WARMUP
+};
+
+/**********************************************************/
+
+/**
+ *  Add a benchmark to the end of the list that bench_run_all runs.
+ */
+    PUBLIC void
+bench_register (bench)
+    struct bench *bench;
+{
+    bench->next = NULL;
+
+    if (bench->iterations > BENCH_MAX_ITERATIONS)
+        bench->iterations = BENCH_MAX_ITERATIONS;
+
+    if (last_bench == NULL)
+        first_bench = bench;
+    else
+        last_bench->next = bench;
+
+    last_bench = bench;
+}
+
+/**********************************************************/
+
+/**
+ *  Run every registered benchmark, writing a line of CSV for each.
+ */
+    PUBLIC void
+bench_run_all (void)
+{
+    uint32_t overhead;
+
+    write_line ("bench,name,iterations,min,median,p99\n");
+    overhead = run_bench (&empty_bench, 0);
+
+    for (struct bench *bench = first_bench; bench != NULL;
+      bench = bench->next)
+    {
+        run_bench (bench, overhead);
+    }
+
+    serial_flush ();
+}
+
+/**********************************************************/
+
+/**
+ *  Say that a benchmark could not run, on the screen and as a line of
+ *  the serial output that the CSV is not picked out of, so that a
+ *  missing device shows up in the log of a run:
+ *
+ *      skip,<name>,<reason>
+ */
+    PUBLIC void
+bench_skip (name, reason)
+    const char *name;
+    const char *reason;
+{
+    char line [LINE_SIZE];
+
+    ksnprintf (line, LINE_SIZE, "skip,%s,%s\n", name, reason);
+    print_string (line);
+    write_line (line);
+}
+
+/**********************************************************/
+
+/**
+ *  Make QEMU exit with a status that says how the run went, once all of
+ *  the output has been sent. Returns if there is no isa-debug-exit
+ *  device, as on a real machine.
+ */
+    PUBLIC void
+bench_exit (status)
+    uint32_t status;
+{
+    serial_flush ();
+    outl (BENCH_EXIT_PORT, status);
+}
+
+/**********************************************************/
+
+/**
+ *  Warm up and time one benchmark, and write its line. Returns the
+ *  fewest cycles a run took.
+ */
+    PRIVATE uint32_t
+run_bench (bench, overhead)
+    struct bench *bench;
+    uint32_t overhead;          // cycles to take off each run
+{
+    uint32_t count = bench->iterations;
+    char line [LINE_SIZE];
+
+    if (count == 0)
+        return 0;
+
+    for (uint32_t i = 0; i < bench->warmup; i ++)
+        bench->run (bench->data);
+
+    for (uint32_t i = 0; i < count; i ++)
+    {
+        uint64_t begin = read_tsc ();
+        uint64_t cycles;
+
+        bench->run (bench->data);
+        cycles = read_tsc () - begin;
+
+        if (cycles > ~0u)
+            cycles = ~0u;
+
+        samples [i] = (uint32_t) cycles > overhead ?
+          (uint32_t) cycles - overhead : 0;
+    }
+
+    sort (samples, count);
+
+    /** the 99th percentile is the smallest value that is at least as
+     *  big as 99% of them */
+    ksnprintf (line, LINE_SIZE, "bench,%s,%u,%u,%u,%u\n", bench->name,
+      count, samples [0], samples [count / 2],
+      samples [(count * 99 + 99) / 100 - 1]);
+    write_line (line);
+
+    return samples [0];
+}
+
+/**********************************************************/
+
+/**
+ *  The run function of the benchmark that measures the harness itself.
+ */
+    PRIVATE void
+empty_run (data)
+    void *data;
+{
+    (void) data;
+    compiler_barrier ();
+}
+
+/**********************************************************/
+
+/**
+ *  Sort the samples into ascending order, with a heap sort, which needs
+ *  no more space and has no bad cases.
+ */
+    PRIVATE void
+sort (values, count)
+    uint32_t *values;
+    uint32_t count;
+{
+    for (uint32_t i = count / 2; i > 0; i --)
+        sift_down (values, i - 1, count);
+
+    for (uint32_t end = count - 1; end > 0; end --)
+    {
+        uint32_t largest = values [0];
+
+        values [0] = values [end];
+        values [end] = largest;
+        sift_down (values, 0, end);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Move a value down a max heap in the first count values until it is no
+ *  smaller than either child.
+ */
+    PRIVATE void
+sift_down (values, root, count)
+    uint32_t *values;
+    uint32_t root;              // index of the value to move
+    uint32_t count;
+{
+    for (;;)
+    {
+        uint32_t child = root * 2 + 1;
+        uint32_t value;
+
+        if (child >= count)
+            return;
+
+        if (child + 1 < count && values [child + 1] > values [child])
+            child ++;
+
+        if (values [root] >= values [child])
+            return;
+
+        value = values [root];
+        values [root] = values [child];
+        values [child] = value;
+        root = child;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Send a line to the serial port only, so that it is not mixed in with
+ *  what is on the screen.
+ */
+    PRIVATE void
+write_line (line)
+    const char *line;
+{
+    size_t length = 0;
+
+    while (line [length] != '\0')
+        length ++;
+
+    serial_write (line, length);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,52 @@
+/**
+ *  A harness for timing small pieces of kernel code. Benchmarks are
+ *  registered by name, and each is run a number of times after warming
+ *  up, with the cycles each run takes written to the serial port as a
+ *  line of CSV.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** most timed runs of a benchmark, and the usual numbers of runs */
+#define BENCH_MAX_ITERATIONS    4096
+#define BENCH_ITERATIONS        1000
+#define BENCH_WARMUP            100
+
+/** port of QEMU's isa-debug-exit device. Writing a value v to it makes
+ *  QEMU exit with the status (v << 1) | 1. */
+#define BENCH_EXIT_PORT         0xF4
+
+/**********************************************************/
+
+/**
+ *  A benchmark. The fields up to warmup are filled in by the caller of
+ *  bench_register, and the struct must stay in place after that.
+ */
+struct bench
+{
+    const char *name;           // no commas, since it goes in the CSV
+    void (*run) (void *data);   // the code being timed, once
+    void *data;
+    uint32_t iterations;        // timed runs, up to BENCH_MAX_ITERATIONS
+    uint32_t warmup;            // runs first, that are not timed
+
+    struct bench *next;
+};
+
+/**********************************************************/
+
+void bench_register (struct bench *bench);
+void bench_run_all (void);
+void bench_skip (const char *name, const char *reason);
+void bench_exit (uint32_t status);
+
+/**********************************************************/
+
+
+#endif /** _BENCH_H */
+
+/** vim: set ts=4 sw=4 et : */
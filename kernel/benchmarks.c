@@ -0,0 +1,2132 @@
+/**
+ *  Boot time benchmarks of kernel primitives.
+ *
+ *  Each benchmark times an operation with the time stamp counter and
+ *  prints the best of several runs, in CPU cycles. Taking the minimum
+ *  filters out runs that were slowed down by something else, such as an
+ *  interrupt or the emulator doing work of its own.
+ *
+ *  The small, frequent operations are also registered with the bench
+ *  harness, which reports the spread of their costs as CSV on the serial
+ *  port, after everything else has run.
+ *
+ *  These are only run if the kernel is built with BENCHMARKS defined,
+ *  which "make BENCH=1" does.
+ */
+
+#include "benchmarks.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "apic.h"
+#include "bench.h"
+#include "block.h"
+#include "clock.h"
+#include "buffer.h"
+#include "ext2.h"
+#include "frames.h"
+#include "ide.h"
+#include "initrd.h"
+#include "interrupt.h"
+#include "io.h"
+#include "irq.h"
+#include "klog.h"
+#include "lock.h"
+#include "paging.h"
+#include "pic.h"
+#include "serial.h"
+#include "slab.h"
+#include "smp.h"
+#include "thread.h"
+#include "timer.h"
+#include "vga.h"
+#include "virtio_blk.h"
+#include "vm.h"
+#include "work.h"
+#include "memutils.h"
+#include "output.h"
+#include "utils.h"
+
+/** size of each of the two scratch buffers, as a frame order. They have
+ *  to hold the largest memory benchmark buffer, plus its offset. */
+#define SCRATCH_ORDER           9
+
+/** number of timed runs of each operation */
+#define REPEATS                 8
+
+/** port used by the port IO benchmarks. Nothing is attached to it, so
+ *  reading and writing it is harmless. */
+#define BENCH_PORT              IO_WAIT_PORT
+
+/** number of port accesses timed in each run of the port IO benchmarks */
+#define PORT_ACCESSES           256
+
+/** unused vectors, and the number of software interrupts raised on each
+ *  in each run of the interrupt benchmark */
+#define BENCH_FAST_VECTOR       0xF0
+#define BENCH_FULL_VECTOR       0xF1
+#define SOFT_INTERRUPTS         256
+
+/** number of clock reads timed in each run of the clock benchmark, and
+ *  the delay of the timer used to measure timer lateness */
+#define CLOCK_READS             256
+#define TIMER_TEST_DELAY_NS     NS_PER_MILLISECOND
+
+/** number of timers armed at once by the timer stress benchmark, and
+ *  the number of times they are all armed and cancelled. The delays are
+ *  spread over about 17 seconds, so that every level of the timer wheel
+ *  is used. */
+#define STRESS_TIMERS           4096
+#define STRESS_ROUNDS           256
+#define STRESS_DELAY_MASK       ((1ull << 34) - 1)
+
+/** number of objects allocated at once by the slab benchmark, and their
+ *  size */
+#define SLAB_OBJECTS            1024
+#define SLAB_OBJECT_SIZE        64
+
+/** the TLB benchmark walks a buffer made of this many 4 MiB blocks */
+#define TLB_BLOCKS              4
+#define TLB_PAGES               (TLB_BLOCKS << (LARGE_PAGE_SHIFT - PAGE_SHIFT))
+
+/** size of the region used by the demand paging benchmark, and how far
+ *  apart the pages that are touched are */
+#define VM_REGION_SIZE          (32 * 1024 * 1024)
+#define VM_TOUCH_STRIDE         (16 * PAGE_SIZE)
+
+/** number of times each processor takes the lock in the lock
+ *  benchmark */
+#define LOCK_ROUNDS             10000
+
+/** size of the burst of deferred work, and how long each item takes */
+#define WORK_ITEMS              256
+#define WORK_ITEM_CYCLES        20000
+
+/** number of messages timed together that are below the log level. Each
+ *  message that is kept is timed on its own, so as not to fill the
+ *  screen. */
+#define KLOG_DROPPED_CALLS      256
+
+/** bytes read from the start of the first disk by each run of the disk
+ *  benchmark, in transfers of the biggest size the driver allows. The
+ *  scratch buffer is reused every SCRATCH_ORDER frames' worth. */
+#define DISK_READ_BYTES         (8 * 1024 * 1024)
+#define DISK_TRANSFER_BYTES     (IDE_MAX_SECTORS * IDE_SECTOR_SIZE)
+
+/** random 4 KiB reads made by each run of the virtio benchmark, and the
+ *  most kept in flight at once */
+#define VIRTIO_READS            4096
+#define VIRTIO_DEPTH            32
+#define VIRTIO_READ_SECTORS     (PAGE_SIZE / VIRTIO_BLK_SECTOR_SIZE)
+
+/** sequential 4 KiB reads submitted at once by each run of the block
+ *  layer benchmark, which fill the scratch buffer */
+#define BLOCK_READS             512
+#define BLOCK_READ_BYTES        PAGE_SIZE
+
+/** the ext2 benchmark reads the biggest file it finds, up to a limit, in
+ *  chunks of this size, and walks directories this deep */
+#define EXT2_CHUNK_BYTES        (64 * 1024)
+#define EXT2_READ_LIMIT         (64 * 1024 * 1024)
+#define EXT2_WALK_DEPTH         16
+
+/** bytes copied by each run of the memcopy benchmark of the harness */
+#define BENCH_COPY_BYTES        PAGE_SIZE
+
+/** longest path that the file benchmarks build */
+#define SCRATCH_PATH_MAX        1024
+
+/** lines of dashes written to the serial port by each of its runs */
+#define SERIAL_LINES            4
+#define SERIAL_LINE_LENGTH      64
+
+/** number of times the ping pong benchmark passes control back and
+ *  forth between its two threads */
+#define PING_PONG_ROUNDS        10000
+
+/** smallest and largest buffer sizes for the memory benchmarks */
+#define MIN_SIZE                8
+#define MAX_SIZE                (1024 * 1024)
+
+/**********************************************************/
+
+/** the operations that the memory benchmark can time. They are run in
+ *  this order, so that the buffers are the same by the time memcompare
+ *  runs, and it has to look at every byte. */
+enum mem_operation
+{
+    OP_BYTE_LOOP,
+    OP_MEMSET,
+    OP_MEMCOPY,
+    OP_MEMMOVE,
+    OP_MEMCOMPARE,
+    NUM_MEM_OPERATIONS
+};
+
+/** kinds of lock compared by the lock benchmark */
+enum lock_kind
+{
+    LOCK_SPIN,
+    LOCK_TICKET,
+    LOCK_MCS,
+    NUM_LOCK_KINDS
+};
+
+PRIVATE const char *lock_names [NUM_LOCK_KINDS] =
+{
+    "spinlock",
+    "ticket",
+    "mcs",
+};
+
+/**
+ *  State shared by the processors taking part in a lock benchmark run.
+ *  Each waits at the start line until all are ready.
+ */
+struct lock_test
+{
+    enum lock_kind kind;
+    volatile uint32_t ready;
+    volatile bool go;
+
+    /** protected by the lock being tested */
+    uint32_t counter;
+
+    uint64_t cycles [MAX_CPUS];
+};
+
+PRIVATE const char *operation_names [NUM_MEM_OPERATIONS] =
+{
+    "byte loop ",
+    "memset    ",
+    "memcopy   ",
+    "memmove   ",
+    "memcompare",
+};
+
+/**********************************************************/
+
+PRIVATE void benchmark_memutils (void);
+PRIVATE uint32_t time_mem_operation (enum mem_operation operation,
+  uint8_t *source, uint8_t *dest, size_t size);
+PRIVATE void byte_loop (const uint8_t *source, uint8_t *dest,
+  size_t count) __attribute__ ((noinline));
+PRIVATE void benchmark_port_io (void);
+PRIVATE uint8_t called_inb (uint16_t port) __attribute__ ((noinline));
+PRIVATE void called_outb (uint16_t port, uint8_t value)
+    __attribute__ ((noinline));
+PRIVATE void benchmark_interrupts (void);
+PRIVATE void benchmark_eoi (void);
+PRIVATE void benchmark_clock (void);
+PRIVATE void record_expiry (struct timer *timer, void *data);
+PRIVATE void benchmark_timers (void);
+PRIVATE void empty_timer_callback (struct timer *timer, void *data);
+PRIVATE void benchmark_frames (void);
+PRIVATE void time_frames (uint32_t *addresses, int order);
+PRIVATE void benchmark_slab (void);
+PRIVATE void benchmark_tlb (void);
+PRIVATE uint32_t time_page_walk (uint8_t *blocks [TLB_BLOCKS]);
+PRIVATE void benchmark_vm (void);
+PRIVATE void time_vm_region (bool lazy);
+PRIVATE void benchmark_locks (void);
+PRIVATE void time_locks (enum lock_kind kind, int cpus);
+PRIVATE void lock_worker (void *data);
+PRIVATE void benchmark_work (void);
+PRIVATE void busy_work (struct work *work, void *data);
+PRIVATE void benchmark_klog (void);
+PRIVATE void benchmark_serial (void);
+PRIVATE void benchmark_ide (void);
+PRIVATE void time_disk_reads (bool dma);
+PRIVATE void benchmark_virtio (void);
+PRIVATE void time_virtio_reads (int depth);
+PRIVATE void start_virtio_read (struct block_request *request);
+PRIVATE void virtio_read_done (struct block_request *request);
+PRIVATE void benchmark_block (void);
+PRIVATE void time_block_reads (struct block_device *device, bool plug);
+PRIVATE void block_read_done (struct block_request *request);
+PRIVATE void benchmark_ext2 (void);
+PRIVATE void time_ext2_walk (bool cold);
+PRIVATE void walk_directory (uint32_t directory, uint32_t length,
+  int depth);
+PRIVATE void time_ext2_read (bool cold);
+PRIVATE void benchmark_initrd (void);
+PRIVATE void register_benches (void);
+PRIVATE void bench_print_char (void *data);
+PRIVATE void bench_scroll (void *data);
+PRIVATE void bench_memcopy (void *data);
+PRIVATE void benchmark_threads (void);
+PRIVATE void ping (void *data);
+PRIVATE void pong (void *data);
+PRIVATE void empty_fast_handler (uint32_t vector, uint32_t error_code);
+PRIVATE void empty_handler (struct interrupt_frame *frame);
+
+/**********************************************************/
+
+/** scratch buffers for the memory benchmarks, and anything else that
+ *  needs more space than the stack has */
+PRIVATE uint8_t *scratch_source;
+PRIVATE uint8_t *scratch_dest;
+
+/** the lock benchmark's run, and the locks it takes */
+PRIVATE struct lock_test lock_test;
+PRIVATE struct spinlock test_spinlock;
+PRIVATE struct ticket_lock test_ticket_lock;
+PRIVATE struct mcs_lock test_mcs_lock;
+
+/** the burst of deferred work, and the number of items finished */
+PRIVATE struct work work_items [WORK_ITEMS];
+PRIVATE volatile uint32_t work_done;
+
+/** threads of the ping pong benchmark, and the thread waiting for it to
+ *  finish */
+PRIVATE struct thread *ping_thread;
+PRIVATE struct thread *pong_thread;
+PRIVATE struct thread *ping_pong_waiter;
+
+/** switches made and cycles taken by the ping pong rounds */
+PRIVATE uint32_t ping_pong_switches;
+PRIVATE uint64_t ping_pong_cycles;
+
+/** the virtio benchmark's disk, its requests and when each was
+ *  submitted, the reads started and finished, and the thread waiting for
+ *  the end */
+PRIVATE struct block_device *virtio_disk;
+PRIVATE struct block_request virtio_requests [VIRTIO_DEPTH];
+PRIVATE uint64_t virtio_submitted [VIRTIO_DEPTH];
+PRIVATE uint32_t virtio_started;
+PRIVATE volatile uint32_t virtio_finished;
+PRIVATE uint32_t virtio_errors;
+PRIVATE uint64_t virtio_total_latency;
+PRIVATE uint64_t virtio_max_latency;
+PRIVATE uint32_t virtio_random;
+PRIVATE struct thread *virtio_waiter;
+
+/** reads finished and failed in a run of the block layer benchmark, and
+ *  the thread waiting for them */
+PRIVATE volatile uint32_t block_finished;
+PRIVATE uint32_t block_errors;
+PRIVATE struct thread *block_waiter;
+
+/** a path built by the file benchmarks */
+PRIVATE char scratch_path [SCRATCH_PATH_MAX];
+
+/** the entry the ext2 benchmark's walk has just read, what it has found,
+ *  and the biggest file */
+PRIVATE struct ext2_dirent ext2_entry;
+PRIVATE uint32_t ext2_files;
+PRIVATE uint32_t ext2_directories;
+PRIVATE uint32_t ext2_errors;
+PRIVATE uint32_t ext2_biggest;
+PRIVATE uint32_t ext2_biggest_size;
+
+/** the operations that the bench harness times */
+PRIVATE struct bench print_char_bench =
+{
+    .name = "print_char",
+    .run = bench_print_char,
+    .iterations = BENCH_ITERATIONS,
+    .warmup = BENCH_WARMUP
+};
+
+PRIVATE struct bench scroll_bench =
+{
+    .name = "scroll",
+    .run = bench_scroll,
+    .iterations = BENCH_ITERATIONS,
+    .warmup = BENCH_WARMUP
+};
+
+PRIVATE struct bench memcopy_bench =
+{
+    .name = "memcopy",
+    .run = bench_memcopy,
+    .iterations = BENCH_ITERATIONS,
+    .warmup = BENCH_WARMUP
+};
+
+/**********************************************************/
+
+/**
+ *  Run all of the benchmarks, printing the results to the screen.
+ */
+    PUBLIC void
+run_benchmarks (void)
+{
+    uint32_t source = frame_alloc (SCRATCH_ORDER);
+    uint32_t dest = frame_alloc (SCRATCH_ORDER);
+
+    if (source == 0 || dest == 0)
+        panic ("No memory for the benchmarks\n");
+
+    scratch_source = physical_to_virtual (source);
+    scratch_dest = physical_to_virtual (dest);
+
+    benchmark_frames ();
+    benchmark_slab ();
+    benchmark_tlb ();
+    benchmark_vm ();
+    benchmark_memutils ();
+    benchmark_port_io ();
+    benchmark_interrupts ();
+    benchmark_eoi ();
+    benchmark_clock ();
+    benchmark_timers ();
+    benchmark_threads ();
+    benchmark_locks ();
+    benchmark_work ();
+    benchmark_klog ();
+    benchmark_serial ();
+    benchmark_ide ();
+    benchmark_virtio ();
+    benchmark_block ();
+    benchmark_ext2 ();
+    benchmark_initrd ();
+    irq_latency_dump ();
+
+    register_benches ();
+    bench_run_all ();
+}
+
+/**********************************************************/
+
+/**
+ *  Time each of the memory functions for each power of two buffer size
+ *  from 8 bytes up to 1 MiB, with the source and the destination at each
+ *  possible pair of offsets from a word boundary. A plain C byte copy
+ *  loop is timed as well, as a baseline.
+ */
+    PRIVATE void
+benchmark_memutils (void)
+{
+    print_string ("memutils: cycles for size/source offset, with the "
+      "destination offset 0 to 3\n");
+
+    for (size_t size = MIN_SIZE; size <= MAX_SIZE; size *= 2)
+    {
+        for (int offset = 0; offset < 4; offset ++)
+        {
+            for (int op = 0; op < NUM_MEM_OPERATIONS; op ++)
+            {
+                uint32_t cycles [4];
+
+                for (int dest_offset = 0; dest_offset < 4; dest_offset ++)
+                {
+                    cycles [dest_offset] = time_mem_operation (op,
+                      scratch_source + offset, scratch_dest + dest_offset,
+                      size);
+                }
+
+                kprintf ("%s %7u/%u: %u %u %u %u\n", operation_names [op],
+                  size, offset, cycles [0], cycles [1], cycles [2],
+                  cycles [3]);
+            }
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the smallest number of cycles taken by the given operation
+ *  over REPEATS runs.
+ */
+    PRIVATE uint32_t
+time_mem_operation (operation, source, dest, size)
+    enum mem_operation operation;
+    uint8_t *source;
+    uint8_t *dest;
+    size_t size;
+{
+    uint32_t best = ~0u;
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t start = read_tsc ();
+
+        switch (operation)
+        {
+        case OP_BYTE_LOOP:
+            byte_loop (source, dest, size);
+            break;
+
+        case OP_MEMCOPY:
+            memcopy (source, dest, size);
+            break;
+
+        case OP_MEMMOVE:
+            memmove (source, dest, size);
+            break;
+
+        case OP_MEMSET:
+            memset (dest, 0xA5, size);
+            break;
+
+        case OP_MEMCOMPARE:
+            memcompare (source, dest, size);
+            break;
+
+        default:
+            break;
+        }
+
+        uint32_t elapsed = (uint32_t) (read_tsc () - start);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/**********************************************************/
+
+/**
+ *  The simplest possible copy, for comparison with memcopy.
+ */
+    PRIVATE void
+byte_loop (source, dest, count)
+    const uint8_t *source;
+    uint8_t *dest;
+    size_t count;
+{
+    while (count -- > 0)
+        *dest ++ = *source ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Compare the cost of port accesses through a function call, as the
+ *  old assembly wrappers needed, with the inline accessors, and a loop of
+ *  single word reads with one rep insw. Results are cycles per access.
+ */
+    PRIVATE void
+benchmark_port_io (void)
+{
+    uint16_t *buffer = (uint16_t *) scratch_dest;
+    uint32_t best [6] = { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u };
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t times [7];
+
+        times [0] = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            called_inb (BENCH_PORT);
+
+        times [1] = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            inb (BENCH_PORT);
+
+        times [2] = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            called_outb (BENCH_PORT, 0);
+
+        times [3] = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            outb (BENCH_PORT, 0);
+
+        times [4] = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            buffer [j] = inw (BENCH_PORT);
+
+        times [5] = read_tsc ();
+
+        insw (BENCH_PORT, buffer, PORT_ACCESSES);
+
+        times [6] = read_tsc ();
+
+        for (int j = 0; j < 6; j ++)
+        {
+            uint32_t elapsed = (uint32_t) (times [j + 1] - times [j]);
+
+            if (elapsed < best [j])
+                best [j] = elapsed;
+        }
+    }
+
+    kprintf ("port io: cycles per access\n");
+    kprintf ("inb: called %u, inline %u\n", best [0] / PORT_ACCESSES,
+      best [1] / PORT_ACCESSES);
+    kprintf ("outb: called %u, inline %u\n", best [2] / PORT_ACCESSES,
+      best [3] / PORT_ACCESSES);
+    kprintf ("inw: loop %u, rep insw %u\n", best [4] / PORT_ACCESSES,
+      best [5] / PORT_ACCESSES);
+}
+
+/**********************************************************/
+
+/**
+ *  Out of line port accessors, to measure the cost of calling a function
+ *  for every port access.
+ */
+    PRIVATE uint8_t
+called_inb (port)
+    uint16_t port;
+{
+    return inb (port);
+}
+
+    PRIVATE void
+called_outb (port, value)
+    uint16_t port;
+    uint8_t value;
+{
+    outb (port, value);
+}
+
+/**********************************************************/
+
+/**
+ *  Time a round trip through the interrupt entry code with a software
+ *  interrupt, for a fast handler and for one that needs the full
+ *  register set.
+ */
+    PRIVATE void
+benchmark_interrupts (void)
+{
+    uint32_t best_fast = ~0u;
+    uint32_t best_full = ~0u;
+
+    register_fast_interrupt_handler (BENCH_FAST_VECTOR, empty_fast_handler);
+    register_interrupt_handler (BENCH_FULL_VECTOR, empty_handler);
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t start = read_tsc ();
+
+        for (int j = 0; j < SOFT_INTERRUPTS; j ++)
+            __asm__ volatile ("int %0" : : "i" (BENCH_FAST_VECTOR));
+
+        uint64_t middle = read_tsc ();
+
+        for (int j = 0; j < SOFT_INTERRUPTS; j ++)
+            __asm__ volatile ("int %0" : : "i" (BENCH_FULL_VECTOR));
+
+        uint64_t end = read_tsc ();
+
+        if ((uint32_t) (middle - start) < best_fast)
+            best_fast = (uint32_t) (middle - start);
+
+        if ((uint32_t) (end - middle) < best_full)
+            best_full = (uint32_t) (end - middle);
+    }
+
+    unregister_interrupt_handler (BENCH_FAST_VECTOR);
+    unregister_interrupt_handler (BENCH_FULL_VECTOR);
+
+    kprintf ("interrupt round trip: fast %u, full %u cycles\n",
+      best_fast / SOFT_INTERRUPTS, best_full / SOFT_INTERRUPTS);
+}
+
+/**********************************************************/
+
+/**
+ *  Handlers that do nothing, so that only the entry and exit code is
+ *  timed.
+ */
+    PRIVATE void
+empty_fast_handler (vector, error_code)
+    uint32_t vector;
+    uint32_t error_code;
+{
+}
+
+    PRIVATE void
+empty_handler (frame)
+    struct interrupt_frame *frame;
+{
+}
+
+/**********************************************************/
+
+/**
+ *  Compare the cost of signalling the end of an interrupt to the PIC,
+ *  which takes a port write, with the APIC, which takes a memory write.
+ *  Interrupts are disabled, so there is no interrupt in service and the
+ *  EOIs have no effect.
+ */
+    PRIVATE void
+benchmark_eoi (void)
+{
+    uint32_t best_pic = ~0u;
+    uint32_t best_apic = ~0u;
+
+    interrupts_disable ();
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t start = read_tsc ();
+
+        for (int j = 0; j < PORT_ACCESSES; j ++)
+            pic_eoi (0);
+
+        uint64_t middle = read_tsc ();
+
+        if (irq_using_apic ())
+        {
+            for (int j = 0; j < PORT_ACCESSES; j ++)
+                apic_eoi ();
+        }
+
+        uint64_t end = read_tsc ();
+
+        if ((uint32_t) (middle - start) < best_pic)
+            best_pic = (uint32_t) (middle - start);
+
+        if ((uint32_t) (end - middle) < best_apic)
+            best_apic = (uint32_t) (end - middle);
+    }
+
+    interrupts_enable ();
+
+    if (irq_using_apic ())
+    {
+        kprintf ("eoi: pic %u, apic %u cycles\n", best_pic / PORT_ACCESSES,
+          best_apic / PORT_ACCESSES);
+    }
+    else
+    {
+        kprintf ("eoi: pic %u cycles, no apic\n", best_pic / PORT_ACCESSES);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Time how long it takes to read the clock, and how late a timer fires.
+ */
+    PRIVATE void
+benchmark_clock (void)
+{
+    uint32_t best = ~0u;
+    struct timer timer = { 0 };
+    volatile uint64_t fired = 0;
+    uint64_t start;
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t begin = read_tsc ();
+
+        for (int j = 0; j < CLOCK_READS; j ++)
+            clock_now_ns ();
+
+        uint32_t elapsed = (uint32_t) (read_tsc () - begin);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    kprintf ("clock: tsc %u kHz, clock_now_ns %u cycles\n",
+      clock_tsc_khz (), best / CLOCK_READS);
+
+    start = clock_now_ns ();
+    timer_start (&timer, TIMER_TEST_DELAY_NS, 0, record_expiry,
+      (void *) &fired);
+
+    for (;;)
+    {
+        interrupts_disable ();
+
+        if (fired != 0)
+            break;
+
+        wait_for_interrupt ();
+    }
+
+    interrupts_enable ();
+
+    kprintf ("timer (%s): %u ns late\n", timer_event_source (),
+      (uint32_t) (fired - start - TIMER_TEST_DELAY_NS));
+}
+
+/**********************************************************/
+
+/**
+ *  Timer callback for the clock benchmark, which stores the time that the
+ *  timer fired.
+ */
+    PRIVATE void
+record_expiry (timer, data)
+    struct timer *timer;
+    void *data;
+{
+    *(volatile uint64_t *) data = clock_now_ns ();
+}
+
+/**********************************************************/
+
+/**
+ *  Time arming and cancelling a large number of timers with random
+ *  delays, and print the average cost of each in cycles. Each round arms
+ *  all of the timers then cancels them all, so the wheel holds thousands
+ *  of timers at a time.
+ */
+    PRIVATE void
+benchmark_timers (void)
+{
+    uint64_t start_cycles = 0;
+    uint64_t cancel_cycles = 0;
+    uint32_t random = 0x12345678;
+
+    // the timers are too big for the stack, so they go in the scratch
+    // area.
+    struct timer *stress_timers = (struct timer *) scratch_dest;
+
+    memset (stress_timers, 0, STRESS_TIMERS * sizeof (struct timer));
+
+    for (int round = 0; round < STRESS_ROUNDS; round ++)
+    {
+        uint64_t begin = read_tsc ();
+
+        for (int i = 0; i < STRESS_TIMERS; i ++)
+        {
+            // xorshift, which is plenty random enough to spread the
+            // timers over the wheel.
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+
+            timer_start (&stress_timers [i],
+              ((uint64_t) random << 4 & STRESS_DELAY_MASK) +
+              NS_PER_MILLISECOND, 0, empty_timer_callback, NULL);
+        }
+
+        uint64_t middle = read_tsc ();
+
+        for (int i = 0; i < STRESS_TIMERS; i ++)
+            timer_cancel (&stress_timers [i]);
+
+        start_cycles += middle - begin;
+        cancel_cycles += read_tsc () - middle;
+    }
+
+    kprintf ("timers: %u starts, %u cycles each; %u cancels, "
+      "%u cycles each\n", STRESS_TIMERS * STRESS_ROUNDS,
+      (uint32_t) udiv64 (start_cycles, STRESS_TIMERS * STRESS_ROUNDS, NULL),
+      STRESS_TIMERS * STRESS_ROUNDS,
+      (uint32_t) udiv64 (cancel_cycles, STRESS_TIMERS * STRESS_ROUNDS,
+      NULL));
+}
+
+/**********************************************************/
+
+/**
+ *  Timer callback for the stress benchmark. The timers are cancelled
+ *  long before they are due, so this should never run.
+ */
+    PRIVATE void
+empty_timer_callback (timer, data)
+    struct timer *timer;
+    void *data;
+{
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate every free frame, in blocks of one frame and of larger
+ *  orders, then free them all again. This is a self test of the frame
+ *  allocator as much as a benchmark: afterwards, the free blocks must be
+ *  exactly as they were, or something has failed to merge.
+ */
+    PRIVATE void
+benchmark_frames (void)
+{
+    uint32_t list;
+    int list_order = 0;
+
+    // the addresses of the allocated blocks are kept in a block of
+    // frames that is allocated up front.
+    while ((uint64_t) frames_free_count () * sizeof (uint32_t) >
+      (uint64_t) FRAME_SIZE << list_order)
+        list_order ++;
+
+    list = frame_alloc (list_order);
+
+    if (list == 0)
+    {
+        print_string ("frames: no room for the list of frames\n");
+        return;
+    }
+
+    for (int order = 0; order <= MAX_FRAME_ORDER; order += 5)
+        time_frames (physical_to_virtual (list), order);
+
+    frame_free (list, list_order);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate all of the free memory in blocks of the given order, then
+ *  free it, and check that the allocator is back where it started.
+ */
+    PRIVATE void
+time_frames (addresses, order)
+    uint32_t *addresses;        // room for the address of every frame
+    int order;
+{
+    uint32_t free_count = frames_free_count ();
+    uint32_t blocks [MAX_FRAME_ORDER + 1];
+    uint32_t count = 0;
+    uint32_t expected = 0;
+    uint32_t address;
+    uint64_t begin;
+    uint64_t alloc_cycles;
+    uint64_t free_cycles;
+    uint32_t ns;
+
+    for (int i = 0; i <= MAX_FRAME_ORDER; i ++)
+    {
+        blocks [i] = frames_free_blocks (i);
+
+        if (i >= order)
+            expected += blocks [i] << (i - order);
+    }
+
+    begin = read_tsc ();
+
+    while ((address = frame_alloc (order)) != 0)
+        addresses [count ++] = address;
+
+    alloc_cycles = read_tsc () - begin;
+
+    if (count != expected ||
+      (order == 0 && (frames_free_count () != 0)))
+        panic ("frames: allocated %u blocks of order %d, expected %u\n",
+          count, order, expected);
+
+    begin = read_tsc ();
+
+    for (uint32_t i = 0; i < count; i ++)
+        frame_free (addresses [i], order);
+
+    free_cycles = read_tsc () - begin;
+
+    for (int i = 0; i <= MAX_FRAME_ORDER; i ++)
+    {
+        if (frames_free_blocks (i) != blocks [i])
+            panic ("frames: %u free blocks of order %d, expected %u\n",
+              frames_free_blocks (i), i, blocks [i]);
+    }
+
+    if (frames_free_count () != free_count)
+        panic ("frames: %u frames free, expected %u\n",
+          frames_free_count (), free_count);
+
+    if (count == 0)
+        return;
+
+    // throughput is the number of frames allocated and freed per
+    // millisecond.
+    ns = (uint32_t) clock_cycles_to_ns (alloc_cycles + free_cycles);
+
+    kprintf ("frames: order %2d: %6u blocks, alloc %u cycles, "
+      "free %u cycles, %u frames/ms\n", order, count,
+      (uint32_t) udiv64 (alloc_cycles, count, NULL),
+      (uint32_t) udiv64 (free_cycles, count, NULL),
+      (uint32_t) udiv64 ((uint64_t) (count << order) * NS_PER_MILLISECOND,
+      ns > 0 ? ns : 1, NULL));
+}
+
+/**********************************************************/
+
+/**
+ *  Compare allocating and freeing small objects from a slab cache and
+ *  with kmalloc against taking a whole frame for each one. All of the
+ *  objects are allocated, then all of them are freed, and the best of
+ *  several runs is printed, in cycles per object.
+ */
+    PRIVATE void
+benchmark_slab (void)
+{
+    const char *names [] = { "slab_alloc", "kmalloc", "frame_alloc" };
+    struct slab_cache *cache = slab_cache_create ("benchmark",
+      SLAB_OBJECT_SIZE, NULL);
+    void **objects = (void **) scratch_dest;
+
+    if (cache == NULL)
+        panic ("No memory for the slab benchmark\n");
+
+    for (int method = 0; method < 3; method ++)
+    {
+        uint32_t best_alloc = ~0u;
+        uint32_t best_free = ~0u;
+
+        for (int i = 0; i < REPEATS; i ++)
+        {
+            uint64_t begin = read_tsc ();
+
+            for (int j = 0; j < SLAB_OBJECTS; j ++)
+            {
+                if (method == 0)
+                    objects [j] = slab_alloc (cache);
+                else if (method == 1)
+                    objects [j] = kmalloc (SLAB_OBJECT_SIZE);
+                else
+                    objects [j] = (void *) frame_alloc (0);
+            }
+
+            uint64_t middle = read_tsc ();
+
+            for (int j = 0; j < SLAB_OBJECTS; j ++)
+            {
+                if (method == 0)
+                    slab_free (cache, objects [j]);
+                else if (method == 1)
+                    kfree (objects [j]);
+                else
+                    frame_free ((uint32_t) objects [j], 0);
+            }
+
+            uint32_t alloc = (uint32_t) (middle - begin);
+            uint32_t free = (uint32_t) (read_tsc () - middle);
+
+            if (alloc < best_alloc)
+                best_alloc = alloc;
+
+            if (free < best_free)
+                best_free = free;
+        }
+
+        kprintf ("slab: %-11s %u objects of %u bytes, alloc %u cycles, "
+          "free %u cycles\n", names [method], SLAB_OBJECTS,
+          SLAB_OBJECT_SIZE, best_alloc / SLAB_OBJECTS,
+          best_free / SLAB_OBJECTS);
+    }
+
+    kprintf ("slab: %u objects take %u frames from a cache, or %u frames "
+      "with a frame each\n", SLAB_OBJECTS,
+      (SLAB_OBJECTS + cache->slab_objects - 1) / cache->slab_objects
+      << cache->order, SLAB_OBJECTS);
+
+    slab_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  Compare the cost of TLB misses with 4 KiB and 4 MiB pages, by reading
+ *  one word from each page of a 16 MiB buffer, once through the direct
+ *  map and once through 4 KiB mappings of the same frames. The words are
+ *  at different offsets in each page so that they do not all compete for
+ *  the same cache sets; there are few enough of them to stay in the
+ *  cache, so the difference is down to the TLB.
+ */
+    PRIVATE void
+benchmark_tlb (void)
+{
+    uint32_t frames [TLB_BLOCKS];
+    uint8_t *large [TLB_BLOCKS];
+    uint8_t *small [TLB_BLOCKS];
+    uint32_t small_area = paging_reserve (TLB_BLOCKS * LARGE_PAGE_SIZE);
+    uint32_t large_cycles;
+    uint32_t small_cycles;
+
+    for (int i = 0; i < TLB_BLOCKS; i ++)
+    {
+        frames [i] = frame_alloc (LARGE_PAGE_SHIFT - FRAME_SHIFT);
+
+        if (frames [i] == 0 || small_area == 0)
+            panic ("No memory for the TLB benchmark\n");
+
+        large [i] = physical_to_virtual (frames [i]);
+        small [i] = (uint8_t *) small_area + i * LARGE_PAGE_SIZE;
+
+        for (uint32_t page = 0; page < LARGE_PAGE_SIZE; page += PAGE_SIZE)
+            paging_map ((uint32_t) small [i] + page, frames [i] + page,
+              PAGE_KERNEL);
+    }
+
+    large_cycles = time_page_walk (large);
+    small_cycles = time_page_walk (small);
+
+    kprintf ("tlb: %u pages, %u cycles per access with 4 MiB pages, "
+      "%u with 4 KiB pages\n", TLB_PAGES, large_cycles / TLB_PAGES,
+      small_cycles / TLB_PAGES);
+
+    for (int i = 0; i < TLB_BLOCKS; i ++)
+    {
+        for (uint32_t page = 0; page < LARGE_PAGE_SIZE; page += PAGE_SIZE)
+            paging_unmap ((uint32_t) small [i] + page);
+
+        frame_free (frames [i], LARGE_PAGE_SHIFT - FRAME_SHIFT);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the best time over REPEATS runs to read a word from every
+ *  page of the blocks.
+ */
+    PRIVATE uint32_t
+time_page_walk (blocks)
+    uint8_t *blocks [TLB_BLOCKS];
+{
+    uint32_t best = ~0u;
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t begin = read_tsc ();
+        uint32_t sum = 0;
+
+        for (int page = 0; page < TLB_PAGES; page ++)
+        {
+            uint8_t *block = blocks [page >> (LARGE_PAGE_SHIFT - PAGE_SHIFT)];
+            uint32_t offset = (page << PAGE_SHIFT & (LARGE_PAGE_SIZE - 1))
+                + (page * CACHE_LINE_SIZE & (PAGE_SIZE - 1));
+
+            sum += *(volatile uint32_t *) (block + offset);
+        }
+
+        uint32_t elapsed = (uint32_t) (read_tsc () - begin);
+
+        if (elapsed < best)
+            best = elapsed;
+    }
+
+    return best;
+}
+
+/**********************************************************/
+
+/**
+ *  Time clearing a page with clear_page and with memset, then compare
+ *  lazy and up front backing of a sparsely used region.
+ */
+    PRIVATE void
+benchmark_vm (void)
+{
+    uint32_t best_clear = ~0u;
+    uint32_t best_memset = ~0u;
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t begin = read_tsc ();
+
+        clear_page (scratch_dest);
+
+        uint64_t middle = read_tsc ();
+
+        memset (scratch_dest, 0, PAGE_SIZE);
+
+        uint32_t clear = (uint32_t) (middle - begin);
+        uint32_t set = (uint32_t) (read_tsc () - middle);
+
+        if (clear < best_clear)
+            best_clear = clear;
+
+        if (set < best_memset)
+            best_memset = set;
+    }
+
+    kprintf ("vm: clear_page %u cycles, memset %u cycles\n", best_clear,
+      best_memset);
+
+    time_vm_region (true);
+    time_vm_region (false);
+    vm_set_lazy (true);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate a region, touch one page in every VM_TOUCH_STRIDE bytes of it
+ *  and free it again, printing how long that took, how many frames the
+ *  region ended up using and how many page faults there were.
+ */
+    PRIVATE void
+time_vm_region (lazy)
+    bool lazy;                  // whether to back pages on first use
+{
+    uint32_t resident = vm_resident_pages ();
+    uint32_t faults = vm_fault_count ();
+    uint64_t begin;
+    uint64_t touched;
+    uint8_t *region;
+
+    vm_set_lazy (lazy);
+
+    begin = read_tsc ();
+    region = vm_alloc (VM_REGION_SIZE, 0);
+
+    if (region == NULL)
+    {
+        kprintf ("vm: no memory for a %u MiB region\n",
+          VM_REGION_SIZE >> 20);
+        return;
+    }
+
+    for (uint32_t offset = 0; offset < VM_REGION_SIZE;
+      offset += VM_TOUCH_STRIDE)
+        region [offset] = 1;
+
+    touched = read_tsc ();
+    resident = vm_resident_pages () - resident;
+    faults = vm_fault_count () - faults;
+
+    vm_free (region);
+
+    kprintf ("vm: %s %u MiB region, %u pages used: %u us, %u KiB "
+      "resident, %u faults\n", lazy ? "lazy" : "eager",
+      VM_REGION_SIZE >> 20, VM_REGION_SIZE / VM_TOUCH_STRIDE,
+      (uint32_t) udiv64 (clock_cycles_to_ns (touched - begin),
+      NS_PER_MICROSECOND, NULL), resident << (PAGE_SHIFT - 10), faults);
+}
+
+/**********************************************************/
+
+/**
+ *  Time two threads of the same priority waking each other and blocking,
+ *  so that each round is two switches, and print the cost of a switch
+ *  in cycles and how many switches that allows in a second.
+ */
+    PRIVATE void
+benchmark_threads (void)
+{
+    uint64_t ns;
+
+    ping_pong_waiter = thread_current ();
+    pong_thread = thread_create ("pong", THREAD_PRIORITY_NORMAL, pong, NULL);
+
+    if (pong_thread == NULL)
+    {
+        print_string ("threads: no memory for the ping pong threads\n");
+        return;
+    }
+
+    ping_thread = thread_create ("ping", THREAD_PRIORITY_NORMAL, ping, NULL);
+
+    if (ping_thread == NULL)
+    {
+        /** let pong see that it has no partner, and exit */
+        thread_wake (pong_thread);
+        print_string ("threads: no memory for the ping pong threads\n");
+        return;
+    }
+
+    thread_block ();
+
+    ns = clock_cycles_to_ns (ping_pong_cycles);
+
+    kprintf ("threads: %u switches, %u cycles per switch, %u switches/s\n",
+      ping_pong_switches,
+      (uint32_t) udiv64 (ping_pong_cycles, ping_pong_switches, NULL),
+      (uint32_t) udiv64 ((uint64_t) ping_pong_switches * NS_PER_SECOND,
+      (uint32_t) ns, NULL));
+}
+
+/**********************************************************/
+
+/**
+ *  The two halves of the ping pong benchmark. Ping starts each round by
+ *  waking pong and blocking; pong is woken, wakes ping and blocks.
+ */
+    PRIVATE void
+ping (data)
+    void *data;
+{
+    uint32_t switches = thread_switch_count ();
+    uint64_t begin = read_tsc ();
+
+    for (int i = 0; i < PING_PONG_ROUNDS; i ++)
+    {
+        thread_wake (pong_thread);
+        thread_block ();
+    }
+
+    ping_pong_cycles = read_tsc () - begin;
+    ping_pong_switches = thread_switch_count () - switches;
+    thread_wake (ping_pong_waiter);
+}
+
+    PRIVATE void
+pong (data)
+    void *data;
+{
+    for (int i = 0; i < PING_PONG_ROUNDS; i ++)
+    {
+        thread_block ();
+
+        if (ping_thread == NULL)
+            return;
+
+        thread_wake (ping_thread);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Compare the three kinds of lock, first with the boot processor alone
+ *  and then with every processor taking the same lock as fast as it can.
+ */
+    PRIVATE void
+benchmark_locks (void)
+{
+    for (int kind = 0; kind < NUM_LOCK_KINDS; kind ++)
+    {
+        time_locks (kind, 1);
+
+        if (smp_cpu_count () > 1)
+            time_locks (kind, smp_cpu_count ());
+    }
+
+#ifdef LOCK_STATS
+    lock_stats_print ("spinlock", &test_spinlock.stats);
+    lock_stats_print ("ticket", &test_ticket_lock.stats);
+    lock_stats_print ("mcs", &test_mcs_lock.stats);
+#endif
+}
+
+/**********************************************************/
+
+/**
+ *  Have the first cpus processors each take and release a lock
+ *  LOCK_ROUNDS times, incrementing a counter while holding it. Prints
+ *  the average cycles per acquisition, and whether the counter came out
+ *  right, which it only does if the lock excluded the other processors.
+ */
+    PRIVATE void
+time_locks (kind, cpus)
+    enum lock_kind kind;
+    int cpus;                   // number of processors taking part
+{
+    uint64_t total = 0;
+    uint32_t expected = cpus * LOCK_ROUNDS;
+
+    lock_test.kind = kind;
+    lock_test.ready = 0;
+    lock_test.go = false;
+    lock_test.counter = 0;
+
+    for (int i = 1; i < cpus; i ++)
+        smp_call (smp_cpu (i), lock_worker, &lock_test);
+
+    while (lock_test.ready != cpus - 1)
+        cpu_relax ();
+
+    lock_test.go = true;
+    lock_worker (&lock_test);
+
+    for (int i = 1; i < cpus; i ++)
+        smp_call_wait (smp_cpu (i));
+
+    for (int i = 0; i < cpus; i ++)
+        total += lock_test.cycles [i];
+
+    kprintf ("locks: %s on %u cpus: %u cycles per acquire%s\n",
+      lock_names [kind], cpus, (uint32_t) udiv64 (total, expected, NULL),
+      lock_test.counter == expected ? "" : ", counter is WRONG");
+}
+
+/**********************************************************/
+
+/**
+ *  One processor's part of the lock benchmark. The irqsave variants are
+ *  used so that an interrupt cannot stretch the time a lock is held.
+ */
+    PRIVATE void
+lock_worker (data)
+    void *data;                 // the struct lock_test
+{
+    struct lock_test *test = data;
+    struct mcs_node node;
+    uint64_t begin;
+    uint32_t flags;
+
+    if (this_cpu ()->index != 0)
+    {
+        atomic_fetch_add (&test->ready, 1);
+
+        while (!test->go)
+            cpu_relax ();
+    }
+
+    begin = read_tsc ();
+
+    for (int i = 0; i < LOCK_ROUNDS; i ++)
+    {
+        switch (test->kind)
+        {
+        case LOCK_SPIN:
+            flags = spin_acquire_irqsave (&test_spinlock);
+            test->counter ++;
+            spin_release_irqrestore (&test_spinlock, flags);
+            break;
+
+        case LOCK_TICKET:
+            flags = ticket_acquire_irqsave (&test_ticket_lock);
+            test->counter ++;
+            ticket_release_irqrestore (&test_ticket_lock, flags);
+            break;
+
+        default:
+            flags = mcs_acquire_irqsave (&test_mcs_lock, &node);
+            test->counter ++;
+            mcs_release_irqrestore (&test_mcs_lock, &node, flags);
+            break;
+        }
+    }
+
+    test->cycles [this_cpu ()->index] = read_tsc () - begin;
+}
+
+/**********************************************************/
+
+/**
+ *  Queue a burst of deferred work with interrupts disabled, as an
+ *  interrupt handler would, then help run it while any idle processors
+ *  steal from us. Prints how long the burst took, and the counters that
+ *  show where the items ran.
+ */
+    PRIVATE void
+benchmark_work (void)
+{
+    uint64_t begin = read_tsc ();
+    uint32_t flags = interrupts_save ();
+
+    work_done = 0;
+
+    for (int i = 0; i < WORK_ITEMS; i ++)
+    {
+        work_init (&work_items [i], busy_work, NULL);
+        work_queue (&work_items [i]);
+    }
+
+    interrupts_restore (flags);
+    work_run ();
+
+    while (work_done != WORK_ITEMS)
+        cpu_relax ();
+
+    kprintf ("work: %u items of %u cycles on %u cpus in %u us\n",
+      WORK_ITEMS, WORK_ITEM_CYCLES, smp_cpu_count (),
+      (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () - begin),
+      NS_PER_MICROSECOND, NULL));
+
+    work_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  A work item that keeps the processor busy for WORK_ITEM_CYCLES.
+ */
+    PRIVATE void
+busy_work (work, data)
+    struct work *work;
+    void *data;
+{
+    uint64_t end = read_tsc () + WORK_ITEM_CYCLES;
+
+    while (read_tsc () < end)
+        cpu_relax ();
+
+    atomic_fetch_add (&work_done, 1);
+}
+
+/**********************************************************/
+
+/**
+ *  Time logging a message with klog, against formatting the same message
+ *  with ksnprintf, and time a message that is dropped because of its
+ *  level. The logged messages are written out by the flush afterwards.
+ */
+    PRIVATE void
+benchmark_klog (void)
+{
+    uint32_t best_kept = ~0u;
+    uint32_t best_dropped = ~0u;
+    uint32_t best_format = ~0u;
+    char line [80];
+
+    for (int i = 0; i < REPEATS; i ++)
+    {
+        uint64_t begin = read_tsc ();
+
+        klog (KLOG_INFO, "klog: benchmark message %u of %u\n", i, REPEATS);
+
+        uint32_t elapsed = (uint32_t) (read_tsc () - begin);
+
+        if (elapsed < best_kept)
+            best_kept = elapsed;
+
+        begin = read_tsc ();
+        ksnprintf (line, sizeof (line), "klog: benchmark message %u of %u\n",
+          i, REPEATS);
+        elapsed = (uint32_t) (read_tsc () - begin);
+
+        if (elapsed < best_format)
+            best_format = elapsed;
+
+        begin = read_tsc ();
+
+        for (int j = 0; j < KLOG_DROPPED_CALLS; j ++)
+            klog (KLOG_DEBUG, "klog: dropped message %u\n", j);
+
+        elapsed = (uint32_t) (read_tsc () - begin);
+
+        if (elapsed < best_dropped)
+            best_dropped = elapsed;
+    }
+
+    klog_flush ();
+
+    kprintf ("klog: %u cycles, dropped %u, ksnprintf %u\n", best_kept,
+      best_dropped / KLOG_DROPPED_CALLS, best_format);
+}
+
+/**********************************************************/
+
+/**
+ *  Write a few lines to the serial port with interrupts disabled, so
+ *  that the caller sends every byte by polling, then with interrupts
+ *  enabled, so that the caller only fills the ring and the transmit
+ *  interrupt does the rest. Prints the caller's cycles per byte for
+ *  each, and how long the interrupts took to send the second lot.
+ */
+    PRIVATE void
+benchmark_serial (void)
+{
+    char *text = (char *) scratch_source;
+    size_t length = SERIAL_LINES * SERIAL_LINE_LENGTH;
+    uint32_t polled;
+    uint32_t queued;
+    uint32_t flags;
+    uint64_t begin;
+    uint64_t sent;
+
+    if (!serial_present ())
+        return;
+
+    for (size_t i = 0; i < length; i ++)
+        text [i] = (i + 1) % SERIAL_LINE_LENGTH == 0 ? '\n' : '-';
+
+    serial_flush ();
+
+    flags = interrupts_save ();
+    begin = read_tsc ();
+    serial_write (text, length);
+    serial_done ();
+    polled = (uint32_t) (read_tsc () - begin);
+    interrupts_restore (flags);
+
+    begin = read_tsc ();
+    serial_write (text, length);
+    serial_done ();
+    queued = (uint32_t) (read_tsc () - begin);
+    serial_flush ();
+    sent = read_tsc () - begin;
+
+    kprintf ("serial: polled %u, interrupts %u cycles per byte, "
+      "all sent in %u us\n", polled / length, queued / length,
+      (uint32_t) udiv64 (clock_cycles_to_ns (sent), NS_PER_MICROSECOND,
+      NULL));
+
+    serial_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  Read the start of the first disk sequentially, by programmed IO and
+ *  then by DMA, and compare the throughput with the processor time that
+ *  the driver took.
+ */
+    PRIVATE void
+benchmark_ide (void)
+{
+    if (ide_drive_count () == 0)
+    {
+        bench_skip ("ide", "no drive");
+        return;
+    }
+
+    time_disk_reads (false);
+
+    if (ide_dma_available ())
+        time_disk_reads (true);
+
+    ide_use_dma (true);
+}
+
+/**********************************************************/
+
+/**
+ *  Time one run of the disk benchmark, and print the throughput in MB/s
+ *  and the driver's cycles per KiB read. The rest of the time the
+ *  processor was free to run something else.
+ */
+    PRIVATE void
+time_disk_reads (dma)
+    bool dma;
+{
+    uint32_t buffer_bytes = PAGE_SIZE << SCRATCH_ORDER;
+    uint32_t bytes = DISK_READ_BYTES;
+    uint32_t sectors = DISK_TRANSFER_BYTES / IDE_SECTOR_SIZE;
+    uint64_t cycles = ide_cpu_cycles ();
+    uint64_t begin;
+    uint32_t elapsed_us;
+    uint32_t rate;
+
+    if (bytes > ide_drive_sectors (0) * IDE_SECTOR_SIZE)
+        bytes = ide_drive_sectors (0) * IDE_SECTOR_SIZE &
+          ~(DISK_TRANSFER_BYTES - 1);
+
+    ide_use_dma (dma);
+    begin = read_tsc ();
+
+    for (uint32_t offset = 0; offset < bytes; offset += DISK_TRANSFER_BYTES)
+    {
+        if (!ide_read (0, offset / IDE_SECTOR_SIZE, sectors,
+          scratch_dest + offset % buffer_bytes))
+        {
+            kprintf ("ide: read failed at sector %u\n",
+              offset / IDE_SECTOR_SIZE);
+            return;
+        }
+    }
+
+    elapsed_us = (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () -
+      begin), NS_PER_MICROSECOND, NULL);
+    cycles = ide_cpu_cycles () - cycles;
+
+    /** bytes per microsecond are MB/s */
+    rate = (uint32_t) udiv64 ((uint64_t) bytes * 100, elapsed_us + 1, NULL);
+
+    kprintf ("ide (%s): %u KiB in %u us, %u.%02u MB/s, %u cycles per KiB\n",
+      dma ? "dma" : "pio", bytes / 1024, elapsed_us, rate / 100, rate % 100,
+      (uint32_t) udiv64 (cycles, bytes / 1024, NULL));
+}
+
+/**********************************************************/
+
+/**
+ *  Make random 4 KiB reads from the virtio disk, one at a time and then
+ *  with many in flight, and print the IOPS and latency of each.
+ */
+    PRIVATE void
+benchmark_virtio (void)
+{
+    virtio_disk = block_find ("vda");
+
+    if (virtio_disk == NULL)
+    {
+        bench_skip ("virtio-blk", "no disk vda");
+        return;
+    }
+
+    time_virtio_reads (1);
+    time_virtio_reads (VIRTIO_DEPTH);
+    virtio_blk_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  One run of the virtio benchmark. The first lot of requests is
+ *  submitted under a plug, so that they reach the driver as one list,
+ *  and each completion callback starts the next read until VIRTIO_READS
+ *  have been made.
+ */
+    PRIVATE void
+time_virtio_reads (depth)
+    int depth;                  // reads in flight
+{
+    uint64_t begin;
+    uint32_t elapsed_us;
+
+    virtio_started = 0;
+    virtio_finished = 0;
+    virtio_errors = 0;
+    virtio_total_latency = 0;
+    virtio_max_latency = 0;
+    virtio_random = 0x2545F491;
+    virtio_waiter = thread_current ();
+
+    begin = read_tsc ();
+    block_plug (virtio_disk);
+
+    for (int i = 0; i < depth; i ++)
+    {
+        struct block_request *request = &virtio_requests [i];
+
+        request->count = VIRTIO_READ_SECTORS;
+        request->buffer = scratch_dest + i * PAGE_SIZE;
+        request->write = false;
+        request->done = virtio_read_done;
+        start_virtio_read (request);
+        block_submit (virtio_disk, request);
+    }
+
+    block_unplug (virtio_disk);
+
+    while (virtio_finished != VIRTIO_READS)
+        thread_block ();
+
+    elapsed_us = (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () -
+      begin), NS_PER_MICROSECOND, NULL);
+
+    kprintf ("virtio-blk (depth %u): %u IOPS, latency %u us average, "
+      "%u us max, %u errors\n", depth,
+      (uint32_t) udiv64 ((uint64_t) VIRTIO_READS * 1000000, elapsed_us + 1,
+      NULL), (uint32_t) udiv64 (clock_cycles_to_ns (udiv64 (
+      virtio_total_latency, VIRTIO_READS, NULL)), NS_PER_MICROSECOND, NULL),
+      (uint32_t) udiv64 (clock_cycles_to_ns (virtio_max_latency),
+      NS_PER_MICROSECOND, NULL), virtio_errors);
+}
+
+/**********************************************************/
+
+/**
+ *  Point a request at a random 4 KiB block of the disk, and note when it
+ *  was started.
+ */
+    PRIVATE void
+start_virtio_read (request)
+    struct block_request *request;
+{
+    uint64_t blocks = virtio_blk_sectors () / VIRTIO_READ_SECTORS;
+    uint32_t block;
+
+    virtio_random ^= virtio_random << 13;
+    virtio_random ^= virtio_random >> 17;
+    virtio_random ^= virtio_random << 5;
+
+    udiv64 (virtio_random, blocks > ~0u ? ~0u : (uint32_t) blocks, &block);
+
+    request->sector = (uint64_t) block * VIRTIO_READ_SECTORS;
+    virtio_submitted [request - virtio_requests] = read_tsc ();
+    virtio_started ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Completion callback of the virtio benchmark, in the interrupt
+ *  handler. Records the latency, and reuses the request for the next
+ *  read if there are more to make.
+ */
+    PRIVATE void
+virtio_read_done (request)
+    struct block_request *request;
+{
+    uint64_t latency = read_tsc () -
+      virtio_submitted [request - virtio_requests];
+
+    virtio_total_latency += latency;
+
+    if (latency > virtio_max_latency)
+        virtio_max_latency = latency;
+
+    if (request->error)
+        virtio_errors ++;
+
+    if (virtio_started < VIRTIO_READS)
+    {
+        start_virtio_read (request);
+        block_submit (virtio_disk, request);
+    }
+
+    if (++ virtio_finished == VIRTIO_READS)
+        thread_wake (virtio_waiter);
+}
+
+/**********************************************************/
+
+/**
+ *  Read the start of a disk in 4 KiB requests, submitted all at once,
+ *  first as they come and then under a plug, and print how the block
+ *  layer merged them. Without the plug, the first few go to the driver
+ *  on their own, and the rest are merged while they wait for room.
+ */
+    PRIVATE void
+benchmark_block (void)
+{
+    struct block_device *device = block_find ("vda");
+
+    if (device == NULL && block_device_count () != 0)
+        device = block_device (0);
+
+    if (device == NULL ||
+      device->sectors < BLOCK_READS * BLOCK_READ_BYTES / BLOCK_SECTOR_SIZE)
+    {
+        bench_skip ("block", "no disk big enough");
+        return;
+    }
+
+    time_block_reads (device, false);
+    time_block_reads (device, true);
+}
+
+/**********************************************************/
+
+/**
+ *  One run of the block layer benchmark. The requests are kept in the
+ *  scratch source buffer, and read into the scratch destination.
+ */
+    PRIVATE void
+time_block_reads (device, plug)
+    struct block_device *device;
+    bool plug;
+{
+    struct block_request *requests = (struct block_request *) scratch_source;
+    uint64_t begin;
+    uint32_t elapsed_us;
+
+    block_reset_stats (device);
+    block_finished = 0;
+    block_errors = 0;
+    block_waiter = thread_current ();
+
+    begin = read_tsc ();
+
+    if (plug)
+        block_plug (device);
+
+    for (int i = 0; i < BLOCK_READS; i ++)
+    {
+        struct block_request *request = &requests [i];
+
+        request->sector = i * (BLOCK_READ_BYTES / BLOCK_SECTOR_SIZE);
+        request->count = BLOCK_READ_BYTES / BLOCK_SECTOR_SIZE;
+        request->buffer = scratch_dest + i * BLOCK_READ_BYTES;
+        request->write = false;
+        request->done = block_read_done;
+        block_submit (device, request);
+    }
+
+    if (plug)
+        block_unplug (device);
+
+    while (block_finished != BLOCK_READS)
+        thread_block ();
+
+    elapsed_us = (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () -
+      begin), NS_PER_MICROSECOND, NULL);
+
+    kprintf ("block (%s, %s): %u reads of %u KiB in %u us, %u errors\n",
+      device->name, plug ? "plugged" : "unplugged", BLOCK_READS,
+      BLOCK_READ_BYTES / 1024, elapsed_us, block_errors);
+    block_dump_stats (device);
+}
+
+/**********************************************************/
+
+/**
+ *  Completion callback of the block layer benchmark.
+ */
+    PRIVATE void
+block_read_done (request)
+    struct block_request *request;
+{
+    if (request->error)
+        block_errors ++;
+
+    if (++ block_finished == BLOCK_READS)
+        thread_wake (block_waiter);
+}
+
+/**********************************************************/
+
+/**
+ *  Walk the whole directory tree of the mounted filesystem, looking up
+ *  each path found, and then read the biggest file in it, each first
+ *  with the caches empty and then again with them warm.
+ */
+    PRIVATE void
+benchmark_ext2 (void)
+{
+    if (!ext2_mounted ())
+    {
+        bench_skip ("ext2", "no filesystem mounted");
+        return;
+    }
+
+    time_ext2_walk (true);
+    time_ext2_walk (false);
+
+    if (ext2_biggest != 0)
+    {
+        time_ext2_read (true);
+        time_ext2_read (false);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  One walk of the directory tree, from the root.
+ */
+    PRIVATE void
+time_ext2_walk (cold)
+    bool cold;
+{
+    uint64_t begin;
+    uint32_t elapsed_us;
+
+    if (cold)
+        ext2_drop_caches ();
+
+    ext2_reset_stats ();
+    buffer_reset_stats ();
+    ext2_files = 0;
+    ext2_directories = 0;
+    ext2_errors = 0;
+    ext2_biggest = 0;
+    ext2_biggest_size = 0;
+
+    begin = read_tsc ();
+    walk_directory (EXT2_ROOT_INODE, 0, 0);
+    elapsed_us = (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () -
+      begin), NS_PER_MICROSECOND, NULL);
+
+    kprintf ("ext2 walk (%s): %u directories, %u files in %u us, "
+      "%u errors\n", cold ? "cold" : "warm", ext2_directories, ext2_files,
+      elapsed_us, ext2_errors);
+    ext2_dump_stats ();
+    buffer_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  Look up and describe each entry of a directory, whose path is the
+ *  first length characters of scratch_path, and go into those that are
+ *  directories too.
+ */
+    PRIVATE void
+walk_directory (directory, length, depth)
+    uint32_t directory;
+    uint32_t length;            // of its path
+    int depth;
+{
+    uint32_t offset = 0;
+
+    ext2_directories ++;
+
+    while (ext2_read_dir (directory, &offset, &ext2_entry))
+    {
+        struct ext2_stat stat;
+        uint32_t number;
+
+        if ((ext2_entry.length == 1 && ext2_entry.name [0] == '.') ||
+          (ext2_entry.length == 2 && ext2_entry.name [0] == '.' &&
+          ext2_entry.name [1] == '.') ||
+          length + 1 + ext2_entry.length >= SCRATCH_PATH_MAX)
+        {
+            continue;
+        }
+
+        scratch_path [length] = '/';
+        memcopy (ext2_entry.name, scratch_path + length + 1,
+          ext2_entry.length + 1);
+
+        number = ext2_lookup (scratch_path);
+
+        if (number != ext2_entry.inode || !ext2_stat (number, &stat))
+        {
+            ext2_errors ++;
+            continue;
+        }
+
+        if ((stat.mode & EXT2_MODE_TYPE) == EXT2_MODE_DIRECTORY)
+        {
+            if (depth + 1 < EXT2_WALK_DEPTH)
+                walk_directory (number, length + 1 + ext2_entry.length,
+                  depth + 1);
+        }
+        else
+        {
+            ext2_files ++;
+
+            if (stat.size > ext2_biggest_size)
+            {
+                ext2_biggest = number;
+                ext2_biggest_size = stat.size;
+            }
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  One read of the biggest file found by the walk, from start to end, in
+ *  chunks that go into the scratch destination buffer.
+ */
+    PRIVATE void
+time_ext2_read (cold)
+    bool cold;
+{
+    uint32_t size = ext2_biggest_size < EXT2_READ_LIMIT ?
+      ext2_biggest_size : EXT2_READ_LIMIT;
+    uint32_t done = 0;
+    uint64_t begin;
+    uint32_t elapsed_us;
+
+    if (cold)
+        ext2_drop_caches ();
+
+    ext2_reset_stats ();
+    buffer_reset_stats ();
+
+    begin = read_tsc ();
+
+    while (done < size)
+    {
+        int32_t got = ext2_read (ext2_biggest, done, scratch_dest,
+          EXT2_CHUNK_BYTES);
+
+        if (got <= 0)
+            break;
+
+        done += got;
+    }
+
+    elapsed_us = (uint32_t) udiv64 (clock_cycles_to_ns (read_tsc () -
+      begin), NS_PER_MICROSECOND, NULL);
+
+    kprintf ("ext2 read (%s): inode %u, %u KiB in %u us, %u MB/s\n",
+      cold ? "cold" : "warm", ext2_biggest, done / 1024, elapsed_us,
+      (uint32_t) udiv64 (done, elapsed_us != 0 ? elapsed_us : 1, NULL));
+    ext2_dump_stats ();
+    buffer_dump_stats ();
+}
+
+/**********************************************************/
+
+/**
+ *  Look up every file in the ramdisk by its name, and then read every
+ *  byte of the files through the pointers that initrd_read returns, to
+ *  show that neither depends on the size of the files.
+ */
+    PRIVATE void
+benchmark_initrd (void)
+{
+    uint32_t count = initrd_file_count ();
+    uint32_t found = 0;
+    uint32_t bytes = 0;
+    uint32_t sum = 0;
+    uint64_t lookup_cycles;
+    uint64_t read_cycles;
+    uint64_t begin;
+
+    if (!initrd_present () || count == 0)
+    {
+        bench_skip ("initrd", "no ramdisk, or it is empty");
+        return;
+    }
+
+    begin = read_tsc ();
+
+    for (uint32_t i = 0; i < count; i ++)
+    {
+        const struct initrd_file *file = initrd_file (i);
+
+        if (file->length >= SCRATCH_PATH_MAX)
+            continue;
+
+        memcopy (file->name, scratch_path, file->length);
+        scratch_path [file->length] = '\0';
+
+        if (initrd_lookup (scratch_path) != NULL)
+            found ++;
+    }
+
+    lookup_cycles = read_tsc () - begin;
+    begin = read_tsc ();
+
+    for (uint32_t i = 0; i < count; i ++)
+    {
+        const struct initrd_file *file = initrd_file (i);
+        const uint8_t *data;
+        uint32_t size;
+
+        if (file->length >= SCRATCH_PATH_MAX)
+            continue;
+
+        memcopy (file->name, scratch_path, file->length);
+        scratch_path [file->length] = '\0';
+        data = initrd_read (scratch_path, &size);
+
+        for (uint32_t j = 0; data != NULL && j < size; j ++)
+            sum += data [j];
+
+        if (data != NULL)
+            bytes += size;
+    }
+
+    read_cycles = read_tsc () - begin;
+
+    kprintf ("initrd: %u of %u files found, %u cycles a lookup\n", found,
+      count, (uint32_t) udiv64 (lookup_cycles, count, NULL));
+    kprintf ("initrd: read %u KiB in place in %u cycles, sum %u\n",
+      bytes >> 10, (uint32_t) read_cycles, sum);
+}
+
+/**********************************************************/
+
+/**
+ *  Register the operations that the bench harness times.
+ */
+    PRIVATE void
+register_benches (void)
+{
+    bench_register (&print_char_bench);
+    bench_register (&scroll_bench);
+    bench_register (&memcopy_bench);
+}
+
+/**********************************************************/
+
+/**
+ *  Print one character on the screen, without updating it. Once the
+ *  screen is full, one run in 80 scrolls it.
+ */
+    PRIVATE void
+bench_print_char (data)
+    void *data;
+{
+    (void) data;
+    print_char ('.');
+}
+
+/**********************************************************/
+
+/**
+ *  Scroll the screen a line, by printing a newline on the last line,
+ *  and show the result.
+ */
+    PRIVATE void
+bench_scroll (data)
+    void *data;
+{
+    (void) data;
+    print_char ('\n');
+    vga_flush ();
+}
+
+/**********************************************************/
+
+/**
+ *  Copy a page between the scratch buffers.
+ */
+    PRIVATE void
+bench_memcopy (data)
+    void *data;
+{
+    (void) data;
+    memcopy (scratch_source, scratch_dest, BENCH_COPY_BYTES);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,13 @@
+/**
+ *  Boot time benchmarks of kernel primitives.
+ */
+
+#ifndef _BENCHMARKS_H
+#define _BENCHMARKS_H
+
+void run_benchmarks (void);
+
+
+#endif /** _BENCHMARKS_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,788 @@
+/**
+ *  The block layer.
+ *
+ *  Filesystems tend to make lots of small requests for sectors next to
+ *  each other, and each transfer has a fixed cost in the driver and the
+ *  disk, so requests are queued for a while and merged:
+ *
+ *  - the queue of each device is kept in order of sector. A new request
+ *    that carries on from the end of one in the queue, or ends where one
+ *    starts, is added to it rather than queued on its own, as long as
+ *    the transfer stays within the device's limits on size and on the
+ *    number of pages its buffers span. The buffers do not have to be
+ *    next to each other in memory; the driver gathers them.
+ *  - a thread that is about to make a batch of requests plugs the
+ *    device first, so that none of them are started until the batch is
+ *    complete and merged. A plug that is held too long is let go by a
+ *    timer. Requests that arrive while the device has as many transfers
+ *    as it can take wait in the queue anyway, and get merged there.
+ *  - transfers are started in order of sector, sweeping up the disk and
+ *    starting again from the bottom (a one way elevator), so that the
+ *    disk's head does not go back and forth. Each request also has a
+ *    deadline, and the oldest read or write is started ahead of its turn
+ *    once its deadline has passed, so that a stream of requests in one
+ *    place cannot hold up one somewhere else for ever.
+ *
+ *  The queues are short, since they only hold what the drivers have not
+ *  yet taken, so finding a place in them is a linear search. It starts
+ *  from the end, where a sequential stream adds its requests.
+ */
+
+#include "block.h"
+#include "stdint.h"
+#include "clock.h"
+#include "cpu.h"
+#include "lock.h"
+#include "output.h"
+#include "paging.h"
+#include "thread.h"
+#include "timer.h"
+#include "utils.h"
+
+/**********************************************************/
+
+PRIVATE bool plugged (struct block_device *device);
+PRIVATE uint32_t pages_spanned (void *buffer, uint32_t count);
+PRIVATE bool merge (struct block_device *device,
+  struct block_request *request, struct block_request *before);
+PRIVATE bool can_merge (struct block_device *device,
+  struct block_request *first, struct block_request *second);
+PRIVATE void append (struct block_request *first,
+  struct block_request *second);
+PRIVATE void insert (struct block_device *device,
+  struct block_request *request, struct block_request *before);
+PRIVATE void unlink (struct block_device *device,
+  struct block_request *request);
+PRIVATE void replace (struct block_device *device,
+  struct block_request *old, struct block_request *request);
+PRIVATE struct block_request *dispatch (struct block_device *device);
+PRIVATE struct block_request *choose (struct block_device *device,
+  uint64_t now);
+PRIVATE void run_queue (struct block_device *device);
+PRIVATE void plug_timeout (struct timer *timer, void *data);
+PRIVATE bool transfer (struct block_device *device, uint64_t sector,
+  uint32_t count, void *buffer, bool write);
+PRIVATE void wake_waiter (struct block_request *request);
+
+/**********************************************************/
+
+PRIVATE struct block_device *devices [MAX_BLOCK_DEVICES];
+PRIVATE int device_count;
+
+/** how long reads and writes may wait, in cycles */
+PRIVATE uint64_t deadline_cycles [2];
+
+/**********************************************************/
+
+/**
+ *  Add a device, once the driver has filled in its description. Returns
+ *  false if there is no room for it.
+ */
+    PUBLIC bool
+block_register (device)
+    struct block_device *device;
+{
+    if (device_count == MAX_BLOCK_DEVICES)
+        return false;
+
+    /** the clock is calibrated by the time the first driver registers */
+    if (device_count == 0)
+    {
+        deadline_cycles [false] = clock_ns_to_cycles (BLOCK_READ_DEADLINE_NS);
+        deadline_cycles [true] = clock_ns_to_cycles (BLOCK_WRITE_DEADLINE_NS);
+    }
+
+    device->queue = NULL;
+    device->queue_tail = NULL;
+
+    for (int i = 0; i < 2; i ++)
+    {
+        device->fifo [i] = NULL;
+        device->fifo_tail [i] = NULL;
+    }
+
+    device->position = 0;
+    device->in_flight = 0;
+    device->plugs = 0;
+    device->plug_expired = false;
+    block_reset_stats (device);
+
+    devices [device_count ++] = device;
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  The number of devices, and each of them by number.
+ */
+    PUBLIC int
+block_device_count (void)
+{
+    return device_count;
+}
+
+    PUBLIC struct block_device *
+block_device (index)
+    int index;
+{
+    return devices [index];
+}
+
+/**********************************************************/
+
+/**
+ *  Find a device by name. Returns NULL if there is none.
+ */
+    PUBLIC struct block_device *
+block_find (name)
+    const char *name;
+{
+    for (int i = 0; i < device_count; i ++)
+    {
+        const char *a = devices [i]->name;
+        const char *b = name;
+
+        while (*a != '\0' && *a == *b)
+        {
+            a ++;
+            b ++;
+        }
+
+        if (*a == *b)
+            return devices [i];
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Queue a request, merging it with any that it is next to, and start
+ *  what the device has room for unless it is plugged. A request that is
+ *  out of range or too big for the device completes straight away with
+ *  an error. Can be called from a completion callback.
+ */
+    PUBLIC void
+block_submit (device, request)
+    struct block_device *device;
+    struct block_request *request;
+{
+    struct block_request *before;
+    struct block_request *list;
+    uint32_t flags;
+
+    request->device = device;
+    request->error = false;
+    request->next = NULL;
+    request->prev = NULL;
+    request->fifo_next = NULL;
+    request->fifo_prev = NULL;
+    request->merged = NULL;
+    request->last = request;
+    request->total = request->count;
+    request->segments = pages_spanned (request->buffer, request->count);
+    request->queued = read_tsc ();
+    request->deadline = request->queued + deadline_cycles [request->write];
+
+    if (request->count == 0 || request->count > device->max_sectors ||
+      request->segments > device->max_segments ||
+      request->sector >= device->sectors ||
+      request->count > device->sectors - request->sector)
+    {
+        request->error = true;
+        request->done (request);
+        return;
+    }
+
+    flags = spin_acquire_irqsave (&device->lock);
+    device->submitted ++;
+
+    before = device->queue_tail;
+
+    while (before != NULL && before->sector > request->sector)
+        before = before->prev;
+
+    if (!merge (device, request, before))
+        insert (device, request, before);
+
+    list = dispatch (device);
+    spin_release_irqrestore (&device->lock, flags);
+
+    if (list != NULL)
+        device->start (device, list);
+}
+
+/**********************************************************/
+
+/**
+ *  Hold back the requests made to a device until block_unplug, or until
+ *  BLOCK_PLUG_NS has passed, so that they can be merged. Plugs nest.
+ *  Must be called from a thread.
+ */
+    PUBLIC void
+block_plug (device)
+    struct block_device *device;
+{
+    uint32_t flags = spin_acquire_irqsave (&device->lock);
+    bool first = device->plugs ++ == 0;
+
+    if (first)
+        device->plug_expired = false;
+
+    spin_release_irqrestore (&device->lock, flags);
+
+    if (first)
+        timer_start (&device->plug_timer, BLOCK_PLUG_NS, 0, plug_timeout,
+          device);
+}
+
+    PUBLIC void
+block_unplug (device)
+    struct block_device *device;
+{
+    uint32_t flags = spin_acquire_irqsave (&device->lock);
+    bool last = -- device->plugs == 0;
+
+    spin_release_irqrestore (&device->lock, flags);
+
+    if (last)
+    {
+        timer_cancel (&device->plug_timer);
+        run_queue (device);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Called by a driver when a transfer is done, with error set if it
+ *  failed, in which case every part of it fails. Runs the callbacks of
+ *  the parts, then starts whatever the device now has room for.
+ */
+    PUBLIC void
+block_complete (request)
+    struct block_request *request;
+{
+    struct block_device *device = request->device;
+    bool error = request->error;
+    uint64_t now = read_tsc ();
+    uint32_t flags = spin_acquire_irqsave (&device->lock);
+
+    device->in_flight --;
+    device->service_cycles += now - request->started;
+    spin_release_irqrestore (&device->lock, flags);
+
+    /** a callback may reuse its request, so move on first */
+    while (request != NULL)
+    {
+        struct block_request *part = request;
+
+        request = request->merged;
+        part->error = error;
+        part->done (part);
+    }
+
+    run_queue (device);
+}
+
+/**********************************************************/
+
+/**
+ *  Complete a list of transfers, linked through next, which a driver
+ *  gathers under its own lock and hands over once it has let go of it.
+ *  The list is taken apart first, since a callback may reuse its request.
+ */
+    PUBLIC void
+block_complete_list (list)
+    struct block_request *list;
+{
+    while (list != NULL)
+    {
+        struct block_request *request = list;
+
+        list = list->next;
+        request->next = NULL;
+        block_complete (request);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Read or write sectors, blocking the thread until it is done. Returns
+ *  false if the request failed.
+ */
+    PUBLIC bool
+block_read (device, sector, count, buffer)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t count;
+    void *buffer;
+{
+    return transfer (device, sector, count, buffer, false);
+}
+
+    PUBLIC bool
+block_write (device, sector, count, buffer)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t count;
+    const void *buffer;
+{
+    return transfer (device, sector, count, (void *) buffer, true);
+}
+
+/**********************************************************/
+
+/**
+ *  Start a device's statistics again.
+ */
+    PUBLIC void
+block_reset_stats (device)
+    struct block_device *device;
+{
+    uint32_t flags = spin_acquire_irqsave (&device->lock);
+
+    device->submitted = 0;
+    device->merged = 0;
+    device->transfers = 0;
+    device->expired = 0;
+    device->sectors_moved = 0;
+    device->queue_cycles = 0;
+    device->service_cycles = 0;
+
+    spin_release_irqrestore (&device->lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Print how well a device's requests have been merged: the number of
+ *  requests for each transfer, the average size of a transfer, how long
+ *  a request waited in the queue, and how long the driver took over a
+ *  transfer, on average.
+ */
+    PUBLIC void
+block_dump_stats (device)
+    struct block_device *device;
+{
+    uint32_t transfers = device->transfers != 0 ? device->transfers : 1;
+    uint32_t submitted = device->submitted != 0 ? device->submitted : 1;
+    uint32_t ratio = (uint32_t) udiv64 ((uint64_t) device->submitted * 100,
+      transfers, NULL);
+
+    kprintf ("block: %s: %u requests, %u merged, %u transfers, ratio "
+      "%u.%02u, average %u KiB\n", device->name, device->submitted,
+      device->merged, device->transfers, ratio / 100, ratio % 100,
+      (uint32_t) udiv64 (device->sectors_moved * BLOCK_SECTOR_SIZE / 1024,
+      transfers, NULL));
+
+    kprintf ("block: %s: queued %u us, transfer %u us on average, %u "
+      "past their deadline\n", device->name,
+      (uint32_t) udiv64 (clock_cycles_to_ns (udiv64 (device->queue_cycles,
+      submitted, NULL)), NS_PER_MICROSECOND, NULL),
+      (uint32_t) udiv64 (clock_cycles_to_ns (udiv64 (device->service_cycles,
+      transfers, NULL)), NS_PER_MICROSECOND, NULL), device->expired);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if requests to a device are being held back.
+ */
+    PRIVATE bool
+plugged (device)
+    struct block_device *device;
+{
+    return device->plugs != 0 && !device->plug_expired;
+}
+
+/**********************************************************/
+
+/**
+ *  The number of pages that a buffer of count sectors touches, which is
+ *  the most pieces a driver might have to split it into.
+ */
+    PRIVATE uint32_t
+pages_spanned (buffer, count)
+    void *buffer;
+    uint32_t count;             // sectors
+{
+    uint32_t offset = (uint32_t) buffer & (PAGE_SIZE - 1);
+
+    return (offset + count * BLOCK_SECTOR_SIZE + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+/**********************************************************/
+
+/**
+ *  Add a new request to the queued transfer that ends where it starts,
+ *  or the one that starts where it ends, with the device's lock held.
+ *  before is the last transfer in the queue that starts no later than
+ *  the request, or NULL if there is none.
+ *  Adding to the end of one can close the gap to the next, in which
+ *  case they are merged too. Returns false if there is none that it can
+ *  join.
+ */
+    PRIVATE bool
+merge (device, request, before)
+    struct block_device *device;
+    struct block_request *request;
+    struct block_request *before;
+{
+    struct block_request *after;
+
+    after = before != NULL ? before->next : device->queue;
+
+    if (before != NULL && before->sector + before->total == request->sector &&
+      can_merge (device, before, request))
+    {
+        append (before, request);
+        device->merged ++;
+
+        if (after != NULL &&
+          before->sector + before->total == after->sector &&
+          can_merge (device, before, after))
+        {
+            unlink (device, after);
+            append (before, after);
+            device->merged ++;
+        }
+
+        return true;
+    }
+
+    if (after != NULL && request->sector + request->count == after->sector &&
+      can_merge (device, request, after))
+    {
+        replace (device, after, request);
+        append (request, after);
+        device->merged ++;
+        return true;
+    }
+
+    return false;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if one transfer can be followed by another without
+ *  going over the device's limits.
+ */
+    PRIVATE bool
+can_merge (device, first, second)
+    struct block_device *device;
+    struct block_request *first;
+    struct block_request *second;
+{
+    return first->write == second->write &&
+      first->total + second->total <= device->max_sectors &&
+      first->segments + second->segments <= device->max_segments;
+}
+
+/**********************************************************/
+
+/**
+ *  Put the parts of one transfer on the end of another. The result is
+ *  due when the earlier of the two was.
+ */
+    PRIVATE void
+append (first, second)
+    struct block_request *first;
+    struct block_request *second;
+{
+    first->last->merged = second;
+    first->last = second->last;
+    first->total += second->total;
+    first->segments += second->segments;
+
+    if (second->deadline < first->deadline)
+        first->deadline = second->deadline;
+}
+
+/**********************************************************/
+
+/**
+ *  Put a transfer in the queue after another, or at the front if before
+ *  is NULL, and at the end of the list of its direction in order of
+ *  arrival.
+ */
+    PRIVATE void
+insert (device, request, before)
+    struct block_device *device;
+    struct block_request *request;
+    struct block_request *before;
+{
+    int direction = request->write;
+
+    request->prev = before;
+    request->next = before != NULL ? before->next : device->queue;
+
+    if (request->prev != NULL)
+        request->prev->next = request;
+    else
+        device->queue = request;
+
+    if (request->next != NULL)
+        request->next->prev = request;
+    else
+        device->queue_tail = request;
+
+    request->fifo_prev = device->fifo_tail [direction];
+    request->fifo_next = NULL;
+
+    if (request->fifo_prev != NULL)
+        request->fifo_prev->fifo_next = request;
+    else
+        device->fifo [direction] = request;
+
+    device->fifo_tail [direction] = request;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a transfer out of the queue and the list of its direction.
+ */
+    PRIVATE void
+unlink (device, request)
+    struct block_device *device;
+    struct block_request *request;
+{
+    int direction = request->write;
+
+    if (request->prev != NULL)
+        request->prev->next = request->next;
+    else
+        device->queue = request->next;
+
+    if (request->next != NULL)
+        request->next->prev = request->prev;
+    else
+        device->queue_tail = request->prev;
+
+    if (request->fifo_prev != NULL)
+        request->fifo_prev->fifo_next = request->fifo_next;
+    else
+        device->fifo [direction] = request->fifo_next;
+
+    if (request->fifo_next != NULL)
+        request->fifo_next->fifo_prev = request->fifo_prev;
+    else
+        device->fifo_tail [direction] = request->fifo_prev;
+
+    request->next = NULL;
+    request->prev = NULL;
+    request->fifo_next = NULL;
+    request->fifo_prev = NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Put a new request in the place of a queued transfer, in both lists,
+ *  so that the transfer can be added to it. The two are going the same
+ *  way, and the new request keeps the old one's place in order of
+ *  arrival, since its deadline is the old one's.
+ */
+    PRIVATE void
+replace (device, old, request)
+    struct block_device *device;
+    struct block_request *old;
+    struct block_request *request;
+{
+    int direction = request->write;
+
+    request->prev = old->prev;
+    request->next = old->next;
+    request->fifo_prev = old->fifo_prev;
+    request->fifo_next = old->fifo_next;
+
+    if (request->prev != NULL)
+        request->prev->next = request;
+    else
+        device->queue = request;
+
+    if (request->next != NULL)
+        request->next->prev = request;
+    else
+        device->queue_tail = request;
+
+    if (request->fifo_prev != NULL)
+        request->fifo_prev->fifo_next = request;
+    else
+        device->fifo [direction] = request;
+
+    if (request->fifo_next != NULL)
+        request->fifo_next->fifo_prev = request;
+    else
+        device->fifo_tail [direction] = request;
+
+    old->next = NULL;
+    old->prev = NULL;
+    old->fifo_next = NULL;
+    old->fifo_prev = NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Take as many transfers from the queue as the driver has room for,
+ *  with the device's lock held, and return them as a list for its
+ *  start function. Nothing is taken while the device is plugged.
+ */
+    PRIVATE struct block_request *
+dispatch (device)
+    struct block_device *device;
+{
+    struct block_request *list = NULL;
+    struct block_request **tail = &list;
+    uint64_t now = read_tsc ();
+
+    while (device->queue != NULL && device->in_flight < device->queue_depth
+      && !plugged (device))
+    {
+        struct block_request *request = choose (device, now);
+
+        unlink (device, request);
+        device->position = request->sector + request->total;
+        device->in_flight ++;
+        device->transfers ++;
+        device->sectors_moved += request->total;
+
+        for (struct block_request *part = request; part != NULL;
+          part = part->merged)
+        {
+            device->queue_cycles += now - part->queued;
+        }
+
+        request->started = now;
+        *tail = request;
+        tail = &request->next;
+    }
+
+    return list;
+}
+
+/**********************************************************/
+
+/**
+ *  Choose the next transfer: the oldest read or write if it is past its
+ *  deadline, or else the first one at or above where the last transfer
+ *  ended, going back to the bottom of the disk if there is none.
+ */
+    PRIVATE struct block_request *
+choose (device, now)
+    struct block_device *device;
+    uint64_t now;
+{
+    for (int i = 0; i < 2; i ++)
+    {
+        if (device->fifo [i] != NULL && device->fifo [i]->deadline <= now)
+        {
+            device->expired ++;
+            return device->fifo [i];
+        }
+    }
+
+    for (struct block_request *request = device->queue; request != NULL;
+      request = request->next)
+    {
+        if (request->sector >= device->position)
+            return request;
+    }
+
+    return device->queue;
+}
+
+/**********************************************************/
+
+/**
+ *  Start whatever the device has room for.
+ */
+    PRIVATE void
+run_queue (device)
+    struct block_device *device;
+{
+    uint32_t flags = spin_acquire_irqsave (&device->lock);
+    struct block_request *list = dispatch (device);
+
+    spin_release_irqrestore (&device->lock, flags);
+
+    if (list != NULL)
+        device->start (device, list);
+}
+
+/**********************************************************/
+
+/**
+ *  Timer callback for a plug that has been held too long, which lets
+ *  the requests go. The plug itself is still held.
+ */
+    PRIVATE void
+plug_timeout (timer, data)
+    struct timer *timer;
+    void *data;                 // the device
+{
+    struct block_device *device = data;
+
+    spin_acquire (&device->lock);
+    device->plug_expired = true;
+    spin_release (&device->lock);
+
+    run_queue (device);
+}
+
+/**********************************************************/
+
+/**
+ *  Make one request and wait for it.
+ */
+    PRIVATE bool
+transfer (device, sector, count, buffer, write)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t count;
+    void *buffer;
+    bool write;
+{
+    struct block_request request;
+
+    request.sector = sector;
+    request.count = count;
+    request.buffer = buffer;
+    request.write = write;
+    request.done = wake_waiter;
+    request.data = thread_current ();
+
+    block_submit (device, &request);
+
+    while (*(void *volatile *) &request.data != NULL)
+        thread_block ();
+
+    return !request.error;
+}
+
+/**********************************************************/
+
+/**
+ *  Completion callback of transfer, which clears the request's data to
+ *  say that it is done.
+ */
+    PRIVATE void
+wake_waiter (request)
+    struct block_request *request;
+{
+    struct thread *waiter = request->data;
+
+    compiler_barrier ();
+    *(void *volatile *) &request->data = NULL;
+    thread_wake (waiter);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,143 @@
+/**
+ *  The block layer, which sits between filesystems and disk drivers. It
+ *  queues requests for each device, merges adjacent ones into bigger
+ *  transfers, and decides the order in which they go to the driver.
+ */
+
+#ifndef _BLOCK_H
+#define _BLOCK_H
+
+#include "stdint.h"
+#include "clock.h"
+#include "lock.h"
+#include "timer.h"
+#include "utils.h"
+
+#define BLOCK_SECTOR_SIZE       512
+
+/** most devices that can be registered */
+#define MAX_BLOCK_DEVICES       8
+
+/** how long a plugged device holds on to requests at most */
+#define BLOCK_PLUG_NS           (NS_PER_MILLISECOND)
+
+/** how long a request waits before it is sent ahead of the elevator */
+#define BLOCK_READ_DEADLINE_NS  (50 * NS_PER_MILLISECOND)
+#define BLOCK_WRITE_DEADLINE_NS (500 * NS_PER_MILLISECOND)
+
+/**********************************************************/
+
+struct block_device;
+struct block_request;
+
+/** completion callbacks may be run from an interrupt handler */
+typedef void (*block_callback) (struct block_request *request);
+
+/**
+ *  A read or write. The caller fills in the first group of fields and
+ *  keeps the request until its callback has been called. error is set
+ *  by then.
+ *
+ *  Requests for adjacent sectors are merged: the first one stands for
+ *  the whole transfer, and the rest hang off it in order of sector
+ *  through merged. A driver is handed the first request of each
+ *  transfer, moves total sectors to or from the buffers of all of its
+ *  parts, and calls block_complete on it.
+ */
+struct block_request
+{
+    uint64_t sector;
+    uint32_t count;             // sectors
+    void *buffer;
+    bool write;
+
+    block_callback done;
+    void *data;
+
+    bool error;
+
+    /** used by the block layer. next and prev link the device's queue
+     *  in order of sector, and next also links a list of transfers given
+     *  to a driver. */
+    struct block_device *device;
+    struct block_request *next;
+    struct block_request *prev;
+    struct block_request *fifo_next;
+    struct block_request *fifo_prev;
+    struct block_request *merged;
+    struct block_request *last;
+    uint32_t total;             // sectors of all of the parts
+    uint32_t segments;          // pages that the parts' buffers span
+    uint64_t queued;            // time stamps, in cycles
+    uint64_t deadline;
+    uint64_t started;
+
+    /** for the driver */
+    int slot;
+    uint16_t tag;
+};
+
+/**
+ *  A disk. The driver fills in the first group of fields and registers
+ *  it. start is given a list of transfers, linked through their next
+ *  fields, and may be called from an interrupt handler; the driver
+ *  calls block_complete on each of them when it is done, from any
+ *  context.
+ */
+struct block_device
+{
+    const char *name;
+    uint64_t sectors;
+    uint32_t max_sectors;       // biggest transfer
+    uint32_t max_segments;      // most pages a transfer's buffers can span
+    int queue_depth;            // most transfers given to the driver
+    void (*start) (struct block_device *device, struct block_request *list);
+    void *data;
+
+    /** the rest is private to the block layer */
+    struct spinlock lock;
+    struct block_request *queue;
+    struct block_request *queue_tail;
+    struct block_request *fifo [2];     // oldest read and write
+    struct block_request *fifo_tail [2];
+    uint64_t position;          // where the elevator has got to
+    int in_flight;
+    int plugs;
+    bool plug_expired;
+    struct timer plug_timer;
+
+    /** statistics */
+    uint32_t submitted;
+    uint32_t merged;
+    uint32_t transfers;
+    uint32_t expired;
+    uint64_t sectors_moved;
+    uint64_t queue_cycles;
+    uint64_t service_cycles;
+};
+
+/**********************************************************/
+
+bool block_register (struct block_device *device);
+int block_device_count (void);
+struct block_device *block_device (int index);
+struct block_device *block_find (const char *name);
+void block_submit (struct block_device *device,
+  struct block_request *request);
+void block_plug (struct block_device *device);
+void block_unplug (struct block_device *device);
+void block_complete (struct block_request *request);
+void block_complete_list (struct block_request *list);
+bool block_read (struct block_device *device, uint64_t sector,
+  uint32_t count, void *buffer);
+bool block_write (struct block_device *device, uint64_t sector,
+  uint32_t count, const void *buffer);
+void block_reset_stats (struct block_device *device);
+void block_dump_stats (struct block_device *device);
+
+/**********************************************************/
+
+
+#endif /** _BLOCK_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,735 @@
+/**
+ *  The buffer cache.
+ *
+ *  Each buffer holds one block of a filesystem, named by its device and
+ *  first sector, in a frame of its own. Buffers are found through a hash
+ *  table, and kept in a list in order of use, so that when the cache is
+ *  full the one that has gone unused longest is taken for a new block.
+ *  A buffer is not taken while anyone holds a reference to it, while it
+ *  is being read or written, or while it is dirty.
+ *
+ *  Writes are held back: a changed buffer is only marked dirty, and the
+ *  dirty buffers are written together when buffer_sync is called, when
+ *  too many have piled up, or when the cache is full of them. They are
+ *  submitted with the devices plugged, so that the block layer can merge
+ *  neighbouring blocks into big transfers.
+ *
+ *  buffer_read_ahead starts a read without waiting for it, so that a
+ *  caller who can guess what it will want next can have it on its way.
+ *
+ *  Buffers are only used from threads, but reads and writes complete in
+ *  interrupt handlers, so the cache's lock is taken with interrupts
+ *  disabled.
+ */
+
+#include "buffer.h"
+#include "stdint.h"
+#include "block.h"
+#include "frames.h"
+#include "lock.h"
+#include "output.h"
+#include "paging.h"
+#include "slab.h"
+#include "thread.h"
+#include "utils.h"
+
+/**********************************************************/
+
+PRIVATE struct buffer *get (struct block_device *device, uint64_t sector,
+  uint32_t size);
+PRIVATE struct buffer *find (struct block_device *device, uint64_t sector);
+PRIVATE struct buffer *victim (void);
+PRIVATE struct buffer *allocate (void);
+PRIVATE void hash_insert (struct buffer *buffer);
+PRIVATE void hash_remove (struct buffer *buffer);
+PRIVATE void lru_remove (struct buffer *buffer);
+PRIVATE void lru_touch (struct buffer *buffer);
+PRIVATE bool start_read (struct buffer *buffer, bool read_ahead);
+PRIVATE void submit (struct buffer *buffer, bool write);
+PRIVATE void wait_io (struct buffer *buffer);
+PRIVATE void buffer_done (struct block_request *request);
+
+/**********************************************************/
+
+PRIVATE struct slab_cache *buffer_slab;
+
+PRIVATE struct buffer *hash [BUFFER_HASH_BUCKETS];
+
+/** every buffer, most recently used first */
+PRIVATE struct buffer *lru_head;
+PRIVATE struct buffer *lru_tail;
+
+PRIVATE uint32_t buffer_count;
+PRIVATE uint32_t dirty_count;
+
+PRIVATE struct spinlock cache_lock;
+
+/** statistics */
+PRIVATE uint32_t lookups;
+PRIVATE uint32_t hits;
+PRIVATE uint32_t read_ahead_hits;
+PRIVATE uint32_t reads;
+PRIVATE uint32_t read_aheads;
+PRIVATE uint32_t writes;
+PRIVATE uint32_t evictions;
+PRIVATE uint32_t errors;
+
+/**********************************************************/
+
+/**
+ *  Create the slab cache for the buffer headers.
+ */
+    PUBLIC void
+buffer_initialise (void)
+{
+    buffer_slab = slab_cache_create ("buffer", sizeof (struct buffer), NULL);
+}
+
+/**********************************************************/
+
+/**
+ *  Get a block, reading it if it is not in the cache, and waiting for
+ *  the read. The caller gets a reference to the buffer, which it must
+ *  release. Returns NULL if the block could not be read, or there is no
+ *  memory.
+ */
+    PUBLIC struct buffer *
+buffer_read (device, sector, size)
+    struct block_device *device;
+    uint64_t sector;            // first sector of the block
+    uint32_t size;              // bytes, a multiple of the sector size
+{
+    struct buffer *buffer = get (device, sector, size);
+
+    if (buffer == NULL)
+        return NULL;
+
+    if (start_read (buffer, false))
+        reads ++;
+
+    wait_io (buffer);
+
+    if (!buffer->valid)
+    {
+        buffer_release (buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Get a buffer for a block that the caller is going to fill in all of,
+ *  without reading it. The caller must mark it dirty once it has.
+ */
+    PUBLIC struct buffer *
+buffer_get (device, sector, size)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t size;
+{
+    struct buffer *buffer = get (device, sector, size);
+
+    if (buffer != NULL)
+        wait_io (buffer);
+
+    return buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Start reading a block into the cache, if it is not there already,
+ *  and do not wait for it. Callers making several of these should plug
+ *  the device around them.
+ */
+    PUBLIC void
+buffer_read_ahead (device, sector, size)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t size;
+{
+    struct buffer *buffer = get (device, sector, size);
+
+    if (buffer == NULL)
+        return;
+
+    if (start_read (buffer, true))
+        read_aheads ++;
+
+    buffer_release (buffer);
+}
+
+/**********************************************************/
+
+/**
+ *  Mark a buffer as changed, so that it is written back later. If there
+ *  are too many dirty buffers, they are all written now.
+ */
+    PUBLIC void
+buffer_dirty (buffer)
+    struct buffer *buffer;
+{
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+    bool sync;
+
+    if (!buffer->dirty)
+    {
+        buffer->dirty = true;
+        dirty_count ++;
+    }
+
+    buffer->valid = true;
+    sync = dirty_count >= BUFFER_DIRTY_LIMIT;
+    spin_release_irqrestore (&cache_lock, flags);
+
+    if (sync)
+        buffer_sync (NULL);
+}
+
+/**********************************************************/
+
+/**
+ *  Give up a reference to a buffer.
+ */
+    PUBLIC void
+buffer_release (buffer)
+    struct buffer *buffer;
+{
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+
+    buffer->references --;
+    spin_release_irqrestore (&cache_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Write back every dirty buffer of a device, or of all devices if it
+ *  is NULL, and wait for them. Returns false if any of the writes
+ *  failed, in which case those buffers are still dirty.
+ */
+    PUBLIC bool
+buffer_sync (device)
+    struct block_device *device;
+{
+    struct buffer *list = NULL;
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+    bool ok = true;
+
+    for (struct buffer *buffer = lru_head; buffer != NULL;
+      buffer = buffer->lru_next)
+    {
+        if (buffer->dirty && !buffer->io &&
+          (device == NULL || buffer->device == device))
+        {
+            buffer->dirty = false;
+            dirty_count --;
+            buffer->io = true;
+            buffer->writing = true;
+            buffer->references ++;
+            buffer->sync_next = list;
+            list = buffer;
+        }
+    }
+
+    spin_release_irqrestore (&cache_lock, flags);
+
+    if (list == NULL)
+        return true;
+
+    for (int i = 0; i < block_device_count (); i ++)
+        block_plug (block_device (i));
+
+    for (struct buffer *buffer = list; buffer != NULL;
+      buffer = buffer->sync_next)
+    {
+        submit (buffer, true);
+        writes ++;
+    }
+
+    for (int i = 0; i < block_device_count (); i ++)
+        block_unplug (block_device (i));
+
+    while (list != NULL)
+    {
+        struct buffer *buffer = list;
+
+        list = list->sync_next;
+        wait_io (buffer);
+
+        if (buffer->dirty)
+            ok = false;
+
+        buffer_release (buffer);
+    }
+
+    return ok;
+}
+
+/**********************************************************/
+
+/**
+ *  Write back the dirty buffers of a device, or of all devices if it is
+ *  NULL, then throw away every buffer of it that is not in use, so that
+ *  the next reads go to the disk.
+ */
+    PUBLIC void
+buffer_drop (device)
+    struct block_device *device;
+{
+    struct buffer *buffer;
+    uint32_t flags;
+
+    buffer_sync (device);
+    flags = spin_acquire_irqsave (&cache_lock);
+    buffer = lru_head;
+
+    while (buffer != NULL)
+    {
+        struct buffer *next = buffer->lru_next;
+
+        if (buffer->references == 0 && !buffer->io && !buffer->dirty &&
+          (device == NULL || buffer->device == device))
+        {
+            hash_remove (buffer);
+            lru_remove (buffer);
+            frame_free (virtual_to_physical (buffer->data), 0);
+            slab_free (buffer_slab, buffer);
+            buffer_count --;
+        }
+
+        buffer = next;
+    }
+
+    spin_release_irqrestore (&cache_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Start the cache's counters again.
+ */
+    PUBLIC void
+buffer_reset_stats (void)
+{
+    lookups = 0;
+    hits = 0;
+    read_ahead_hits = 0;
+    reads = 0;
+    read_aheads = 0;
+    writes = 0;
+    evictions = 0;
+    errors = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Print the cache's counters: how many lookups found their block in
+ *  the cache, and how many of those it was there because it had been
+ *  read ahead.
+ */
+    PUBLIC void
+buffer_dump_stats (void)
+{
+    uint32_t rate = (uint32_t) udiv64 ((uint64_t) hits * 1000,
+      lookups != 0 ? lookups : 1, NULL);
+
+    kprintf ("buffer: %u lookups, %u hits (%u.%u%%), %u of them read "
+      "ahead\n", lookups, hits, rate / 10, rate % 10, read_ahead_hits);
+    kprintf ("buffer: %u reads, %u read ahead, %u writes, %u evictions, "
+      "%u errors, %u buffers\n", reads, read_aheads, writes, evictions,
+      errors, buffer_count);
+}
+
+/**********************************************************/
+
+/**
+ *  Find a block's buffer, or set one up for it, and take a reference to
+ *  it. The buffer is taken from the least recently used end of the list
+ *  once the cache is full, after writing back the dirty buffers if they
+ *  are all that there is. The cache goes over its size rather than fail
+ *  if every buffer is in use.
+ */
+    PRIVATE struct buffer *
+get (device, sector, size)
+    struct block_device *device;
+    uint64_t sector;
+    uint32_t size;
+{
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+    struct buffer *buffer;
+    struct buffer *spare;
+
+    lookups ++;
+    buffer = find (device, sector);
+
+    if (buffer != NULL)
+    {
+        hits ++;
+
+        if (buffer->read_ahead)
+        {
+            read_ahead_hits ++;
+            buffer->read_ahead = false;
+        }
+
+        buffer->references ++;
+        lru_touch (buffer);
+        spin_release_irqrestore (&cache_lock, flags);
+        return buffer;
+    }
+
+    buffer = buffer_count >= BUFFER_CACHE_BLOCKS ? victim () : NULL;
+
+    if (buffer == NULL && buffer_count >= BUFFER_CACHE_BLOCKS &&
+      dirty_count != 0)
+    {
+        spin_release_irqrestore (&cache_lock, flags);
+        buffer_sync (NULL);
+        flags = spin_acquire_irqsave (&cache_lock);
+
+        /** another thread can add the block while this one writes */
+        buffer = find (device, sector);
+
+        if (buffer != NULL)
+        {
+            buffer->references ++;
+            lru_touch (buffer);
+            spin_release_irqrestore (&cache_lock, flags);
+            return buffer;
+        }
+
+        buffer = victim ();
+    }
+
+    if (buffer != NULL)
+    {
+        hash_remove (buffer);
+        evictions ++;
+    }
+    else
+    {
+        /** the thread can be switched while the lock is released, and
+         *  another can add the block in the meantime */
+        spin_release_irqrestore (&cache_lock, flags);
+        spare = allocate ();
+        flags = spin_acquire_irqsave (&cache_lock);
+
+        buffer = find (device, sector);
+
+        if (buffer != NULL || spare == NULL)
+        {
+            if (buffer != NULL)
+            {
+                buffer->references ++;
+                lru_touch (buffer);
+            }
+
+            spin_release_irqrestore (&cache_lock, flags);
+
+            if (spare != NULL)
+            {
+                frame_free (virtual_to_physical (spare->data), 0);
+                slab_free (buffer_slab, spare);
+            }
+
+            return buffer;
+        }
+
+        buffer = spare;
+        buffer_count ++;
+    }
+
+    buffer->device = device;
+    buffer->sector = sector;
+    buffer->size = size;
+    buffer->references = 1;
+    buffer->valid = false;
+    buffer->dirty = false;
+    buffer->io = false;
+    buffer->writing = false;
+    buffer->read_ahead = false;
+    buffer->waiter = NULL;
+
+    hash_insert (buffer);
+    lru_touch (buffer);
+    spin_release_irqrestore (&cache_lock, flags);
+
+    return buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Look up a block in the hash table, with the lock held.
+ */
+    PRIVATE struct buffer *
+find (device, sector)
+    struct block_device *device;
+    uint64_t sector;
+{
+    uint32_t bucket = ((uint32_t) sector ^ (uint32_t) device >> 4) %
+      BUFFER_HASH_BUCKETS;
+
+    for (struct buffer *buffer = hash [bucket]; buffer != NULL;
+      buffer = buffer->hash_next)
+    {
+        if (buffer->sector == sector && buffer->device == device)
+            return buffer;
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  The least recently used buffer that can be reused, or NULL if there
+ *  is none.
+ */
+    PRIVATE struct buffer *
+victim (void)
+{
+    for (struct buffer *buffer = lru_tail; buffer != NULL;
+      buffer = buffer->lru_prev)
+    {
+        if (buffer->references == 0 && !buffer->io && !buffer->dirty)
+            return buffer;
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate a new buffer and its frame. Returns NULL if there is no
+ *  memory.
+ */
+    PRIVATE struct buffer *
+allocate (void)
+{
+    struct buffer *buffer = slab_alloc (buffer_slab);
+    uint32_t frame;
+
+    if (buffer == NULL)
+        return NULL;
+
+    frame = frame_alloc (0);
+
+    if (frame == 0)
+    {
+        slab_free (buffer_slab, buffer);
+        return NULL;
+    }
+
+    buffer->data = physical_to_virtual (frame);
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+    return buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Add a buffer to its bucket of the hash table, or take it out again.
+ */
+    PRIVATE void
+hash_insert (buffer)
+    struct buffer *buffer;
+{
+    uint32_t bucket = ((uint32_t) buffer->sector ^
+      (uint32_t) buffer->device >> 4) % BUFFER_HASH_BUCKETS;
+
+    buffer->hash_next = hash [bucket];
+    hash [bucket] = buffer;
+}
+
+    PRIVATE void
+hash_remove (buffer)
+    struct buffer *buffer;
+{
+    uint32_t bucket = ((uint32_t) buffer->sector ^
+      (uint32_t) buffer->device >> 4) % BUFFER_HASH_BUCKETS;
+    struct buffer **link = &hash [bucket];
+
+    while (*link != buffer)
+        link = &(*link)->hash_next;
+
+    *link = buffer->hash_next;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a buffer out of the list in order of use.
+ */
+    PRIVATE void
+lru_remove (buffer)
+    struct buffer *buffer;
+{
+    if (buffer->lru_prev != NULL)
+        buffer->lru_prev->lru_next = buffer->lru_next;
+    else if (lru_head == buffer)
+        lru_head = buffer->lru_next;
+
+    if (buffer->lru_next != NULL)
+        buffer->lru_next->lru_prev = buffer->lru_prev;
+    else if (lru_tail == buffer)
+        lru_tail = buffer->lru_prev;
+
+    buffer->lru_prev = NULL;
+    buffer->lru_next = NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Move a buffer to the front of the list, as the most recently used.
+ */
+    PRIVATE void
+lru_touch (buffer)
+    struct buffer *buffer;
+{
+    if (lru_head == buffer)
+        return;
+
+    lru_remove (buffer);
+    buffer->lru_next = lru_head;
+
+    if (lru_head != NULL)
+        lru_head->lru_prev = buffer;
+    else
+        lru_tail = buffer;
+
+    lru_head = buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Start reading a buffer unless it already has its data or is being
+ *  read. Returns true if a read was started.
+ */
+    PRIVATE bool
+start_read (buffer, read_ahead)
+    struct buffer *buffer;
+    bool read_ahead;
+{
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+
+    if (buffer->valid || buffer->io)
+    {
+        spin_release_irqrestore (&cache_lock, flags);
+        return false;
+    }
+
+    buffer->io = true;
+    buffer->writing = false;
+    buffer->read_ahead = read_ahead;
+    spin_release_irqrestore (&cache_lock, flags);
+
+    submit (buffer, false);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Hand a buffer's read or write to the block layer.
+ */
+    PRIVATE void
+submit (buffer, write)
+    struct buffer *buffer;
+    bool write;
+{
+    struct block_request *request = &buffer->request;
+
+    request->sector = buffer->sector;
+    request->count = buffer->size / BLOCK_SECTOR_SIZE;
+    request->buffer = buffer->data;
+    request->write = write;
+    request->done = buffer_done;
+    request->data = buffer;
+
+    block_submit (buffer->device, request);
+}
+
+/**********************************************************/
+
+/**
+ *  Wait until a buffer is not being read or written. The first thread
+ *  to wait blocks, and any others yield until it is done.
+ */
+    PRIVATE void
+wait_io (buffer)
+    struct buffer *buffer;
+{
+    struct thread *self = thread_current ();
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+
+    while (buffer->io)
+    {
+        bool block = buffer->waiter == NULL || buffer->waiter == self;
+
+        if (block)
+            buffer->waiter = self;
+
+        spin_release_irqrestore (&cache_lock, flags);
+
+        if (block)
+            thread_block ();
+        else
+            thread_yield ();
+
+        flags = spin_acquire_irqsave (&cache_lock);
+    }
+
+    spin_release_irqrestore (&cache_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Completion callback of a buffer's read or write, usually in an
+ *  interrupt handler. A failed write leaves the buffer dirty, to be
+ *  tried again.
+ */
+    PRIVATE void
+buffer_done (request)
+    struct block_request *request;
+{
+    struct buffer *buffer = request->data;
+    uint32_t flags = spin_acquire_irqsave (&cache_lock);
+    struct thread *waiter;
+
+    if (request->error)
+        errors ++;
+
+    if (buffer->writing && request->error && !buffer->dirty)
+    {
+        buffer->dirty = true;
+        dirty_count ++;
+    }
+    else if (!buffer->writing)
+    {
+        buffer->valid = !request->error;
+    }
+
+    buffer->io = false;
+    buffer->writing = false;
+    waiter = buffer->waiter;
+    buffer->waiter = NULL;
+    spin_release_irqrestore (&cache_lock, flags);
+
+    if (waiter != NULL)
+        thread_wake (waiter);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,69 @@
+/**
+ *  The buffer cache, which keeps recently used disk blocks in memory,
+ *  and holds on to changes to them until they are written back.
+ */
+
+#ifndef _BUFFER_H
+#define _BUFFER_H
+
+#include "stdint.h"
+#include "block.h"
+#include "utils.h"
+
+/** most buffers kept, and how many of them can be dirty before they are
+ *  written back. Each takes a frame. */
+#define BUFFER_CACHE_BLOCKS     2048
+#define BUFFER_DIRTY_LIMIT      (BUFFER_CACHE_BLOCKS / 4)
+
+#define BUFFER_HASH_BUCKETS     512
+
+/**********************************************************/
+
+/**
+ *  A disk block in memory. The fields up to data can be read by whoever
+ *  holds a reference; the rest are private to buffer.c.
+ */
+struct buffer
+{
+    struct block_device *device;
+    uint64_t sector;            // first sector of the block
+    uint32_t size;              // bytes, up to a page
+    uint8_t *data;
+
+    int references;
+    bool valid;                 // data is what is on the disk, or newer
+    bool dirty;                 // data has to be written back
+    bool io;                    // a read or write is in progress
+    bool writing;
+    bool read_ahead;            // read ahead, and not yet asked for
+    struct thread *waiter;
+
+    struct buffer *hash_next;
+    struct buffer *lru_prev;
+    struct buffer *lru_next;
+    struct buffer *sync_next;
+    struct block_request request;
+};
+
+/**********************************************************/
+
+void buffer_initialise (void);
+struct buffer *buffer_read (struct block_device *device, uint64_t sector,
+  uint32_t size);
+struct buffer *buffer_get (struct block_device *device, uint64_t sector,
+  uint32_t size);
+void buffer_read_ahead (struct block_device *device, uint64_t sector,
+  uint32_t size);
+void buffer_dirty (struct buffer *buffer);
+void buffer_release (struct buffer *buffer);
+bool buffer_sync (struct block_device *device);
+void buffer_drop (struct block_device *device);
+void buffer_reset_stats (void);
+void buffer_dump_stats (void);
+
+/**********************************************************/
+
+
+#endif /** _BUFFER_H */
+
+/** vim: set ts=4 sw=4 et : */
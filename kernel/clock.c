@@ -0,0 +1,174 @@
+/**
+ *  The kernel clock.
+ *
+ *  At boot, the TSC frequency is measured against channel 2 of the PIT,
+ *  whose frequency is fixed. After that, reading the clock is just an
+ *  rdtsc and a conversion from cycles to nanoseconds, with no port IO.
+ *
+ *  Conversions use a fixed point multiply rather than a division:
+ *  ns = cycles * ns_mult >> SCALE_SHIFT, where ns_mult is the number of
+ *  nanoseconds per cycle scaled up by 2^SCALE_SHIFT. The reverse
+ *  conversion works the same way with cycle_mult.
+ */
+
+#include "clock.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "pit.h"
+#include "utils.h"
+
+/** fixed point scale of the conversion factors */
+#define SCALE_SHIFT             24
+
+/** the TSC is timed over this many PIT ticks (10 ms), several times,
+ *  and the shortest time is used. Anything that delays the measurement,
+ *  such as the emulator being descheduled, can only make it longer. */
+#define CALIBRATION_TICKS       (PIT_FREQUENCY / 100)
+#define CALIBRATION_RUNS        3
+
+/**********************************************************/
+
+PRIVATE uint64_t scale (uint64_t value, uint32_t mult);
+
+/**********************************************************/
+
+/** TSC frequency in kHz, and its value when the clock was initialised.
+ *  Keeping the frequency in kHz lets it fit in 32 bits on any CPU. */
+PRIVATE uint32_t tsc_khz;
+PRIVATE uint64_t boot_tsc;
+
+/** conversion factors, see above */
+PRIVATE uint32_t ns_mult;
+PRIVATE uint32_t cycle_mult;
+
+/**********************************************************/
+
+/**
+ *  Measure the TSC frequency and start the clock at zero.
+ */
+    PUBLIC void
+clock_initialise (void)
+{
+    uint64_t best = ~0ull;
+
+    for (int i = 0; i < CALIBRATION_RUNS; i ++)
+    {
+        uint64_t cycles = pit_measure_tsc (CALIBRATION_TICKS);
+
+        if (cycles < best)
+            best = cycles;
+    }
+
+    tsc_khz = (uint32_t) udiv64 (best * PIT_FREQUENCY,
+      CALIBRATION_TICKS * 1000, NULL);
+
+    ns_mult = (uint32_t) udiv64 ((uint64_t) NS_PER_MILLISECOND <<
+      SCALE_SHIFT, tsc_khz, NULL);
+    cycle_mult = (uint32_t) udiv64 ((uint64_t) tsc_khz << SCALE_SHIFT,
+      NS_PER_MILLISECOND, NULL);
+
+    boot_tsc = read_tsc ();
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the number of nanoseconds since the clock was initialised.
+ */
+    PUBLIC uint64_t
+clock_now_ns (void)
+{
+    return scale (read_tsc () - boot_tsc, ns_mult);
+}
+
+/**********************************************************/
+
+/**
+ *  Convert between a number of TSC cycles and nanoseconds.
+ */
+    PUBLIC uint64_t
+clock_cycles_to_ns (cycles)
+    uint64_t cycles;
+{
+    return scale (cycles, ns_mult);
+}
+
+    PUBLIC uint64_t
+clock_ns_to_cycles (ns)
+    uint64_t ns;
+{
+    return scale (ns, cycle_mult);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the value the TSC will have at the given clock time.
+ */
+    PUBLIC uint64_t
+clock_ns_to_tsc (ns)
+    uint64_t ns;                // time since boot
+{
+    return boot_tsc + scale (ns, cycle_mult);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the clock time at which the TSC had the given value, or 0 for
+ *  a value from before the clock was started.
+ */
+    PUBLIC uint64_t
+clock_tsc_to_ns (tsc)
+    uint64_t tsc;               // a value read from the TSC
+{
+    return tsc < boot_tsc ? 0 : scale (tsc - boot_tsc, ns_mult);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the measured TSC frequency in kHz.
+ */
+    PUBLIC uint32_t
+clock_tsc_khz (void)
+{
+    return tsc_khz;
+}
+
+/**********************************************************/
+
+/**
+ *  Busy wait for at least the given number of nanoseconds.
+ */
+    PUBLIC void
+clock_delay_ns (ns)
+    uint64_t ns;
+{
+    uint64_t end = read_tsc () + scale (ns, cycle_mult);
+
+    while (read_tsc () < end)
+        __asm__ volatile ("pause");
+}
+
+/**********************************************************/
+
+/**
+ *  Compute value * mult >> SCALE_SHIFT without overflowing. The 64 bit
+ *  value is multiplied in two halves, each giving a product of at most
+ *  64 bits.
+ */
+    PRIVATE uint64_t
+scale (value, mult)
+    uint64_t value;
+    uint32_t mult;
+{
+    uint64_t high = (value >> 32) * mult;
+    uint64_t low = (value & 0xFFFFFFFF) * mult;
+
+    return (high << (32 - SCALE_SHIFT)) + (low >> SCALE_SHIFT);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,31 @@
+/**
+ *  The kernel clock, which counts nanoseconds since boot using the time
+ *  stamp counter.
+ */
+
+#ifndef _CLOCK_H
+#define _CLOCK_H
+
+#include "stdint.h"
+
+#define NS_PER_SECOND           1000000000u
+#define NS_PER_MILLISECOND      1000000u
+#define NS_PER_MICROSECOND      1000u
+
+/**********************************************************/
+
+void clock_initialise (void);
+uint64_t clock_now_ns (void);
+uint64_t clock_cycles_to_ns (uint64_t cycles);
+uint64_t clock_ns_to_cycles (uint64_t ns);
+uint64_t clock_ns_to_tsc (uint64_t ns);
+uint64_t clock_tsc_to_ns (uint64_t tsc);
+uint32_t clock_tsc_khz (void);
+void clock_delay_ns (uint64_t ns);
+
+/**********************************************************/
+
+
+#endif /** _CLOCK_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,69 @@
+/**
+ *  The console, which hands text to every registered output device.
+ *
+ *  Devices are registered once while the kernel starts up and are never
+ *  removed, so the list is read without a lock. Each device takes care of
+ *  its own locking.
+ */
+
+#include "console.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "utils.h"
+
+/**********************************************************/
+
+PRIVATE const struct console *consoles [MAX_CONSOLES];
+PRIVATE volatile int console_count;
+
+/**********************************************************/
+
+/**
+ *  Add an output device. Returns false if there is no room for it.
+ */
+    PUBLIC bool
+console_register (console)
+    const struct console *console;
+{
+    if (console_count == MAX_CONSOLES)
+        return false;
+
+    consoles [console_count] = console;
+    compiler_barrier ();
+    console_count ++;
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Write a block of text to every device. The text may not appear until
+ *  console_done is called.
+ */
+    PUBLIC void
+console_write (buffer, length)
+    const char *buffer;         // characters to be written
+    size_t length;              // number of characters in the buffer
+{
+    for (int i = 0; i < console_count; i ++)
+        consoles [i]->write (buffer, length);
+}
+
+/**********************************************************/
+
+/**
+ *  Finish a run of writes, updating each device. This can be slow, so
+ *  call it once at the end of a batch of text rather than after every
+ *  write.
+ */
+    PUBLIC void
+console_done (void)
+{
+    for (int i = 0; i < console_count; i ++)
+        consoles [i]->done ();
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
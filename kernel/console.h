@@ -0,0 +1,40 @@
+/**
+ *  The console: everything the kernel prints goes to each of the output
+ *  devices registered here, such as the VGA display and the serial port.
+ */
+
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** most output devices that can be registered */
+#define MAX_CONSOLES            4
+
+/**********************************************************/
+
+/**
+ *  An output device. write takes a block of text, which it may hold back
+ *  until done is called; done should make sure that everything written
+ *  so far is on its way to the device.
+ */
+struct console
+{
+    const char *name;
+    void (*write) (const char *buffer, size_t length);
+    void (*done) (void);
+};
+
+/**********************************************************/
+
+bool console_register (const struct console *console);
+void console_write (const char *buffer, size_t length);
+void console_done (void);
+
+/**********************************************************/
+
+
+#endif /** _CONSOLE_H */
+
+/** vim: set ts=4 sw=4 et : */
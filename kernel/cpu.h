@@ -0,0 +1,270 @@
+/**
+ *  Wrappers for CPU instructions that have no equivalent in C.
+ *
+ *  These are all small enough that they are defined inline, so using
+ *  them costs no more than the instruction itself.
+ */
+
+#ifndef _CPU_H
+#define _CPU_H
+
+#include "stdint.h"
+
+/** interrupt enable bit of the flags register */
+#define EFLAGS_INTERRUPT        0x00000200
+
+/**********************************************************/
+
+/**
+ *  Read the time stamp counter, which counts CPU clock cycles since the
+ *  processor was reset.
+ */
+    static inline uint64_t
+read_tsc (void)
+{
+    uint32_t low, high;
+
+    __asm__ volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return (uint64_t) high << 32 | low;
+}
+
+/**********************************************************/
+
+/**
+ *  Execute the cpuid instruction for the given leaf, returning the four
+ *  result registers.
+ */
+    static inline void
+cpuid (uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx,
+  uint32_t *edx)
+{
+    __asm__ volatile ("cpuid"
+      : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+      : "a" (leaf), "c" (0));
+}
+
+/**********************************************************/
+
+/**
+ *  Read the address that caused the last page fault.
+ */
+    static inline uint32_t
+read_cr2 (void)
+{
+    uint32_t value;
+
+    __asm__ volatile ("mov %%cr2, %0" : "=r" (value));
+    return value;
+}
+
+/**
+ *  Read or write the page directory base register. Writing it flushes
+ *  every TLB entry that is not global.
+ */
+    static inline uint32_t
+read_cr3 (void)
+{
+    uint32_t value;
+
+    __asm__ volatile ("mov %%cr3, %0" : "=r" (value));
+    return value;
+}
+
+    static inline void
+write_cr3 (uint32_t value)
+{
+    __asm__ volatile ("mov %0, %%cr3" : : "r" (value) : "memory");
+}
+
+/**
+ *  Flush the TLB entry for the page containing an address, even if it is
+ *  global.
+ */
+    static inline void
+invalidate_page (const void *address)
+{
+    __asm__ volatile ("invlpg (%0)" : : "r" (address) : "memory");
+}
+
+/**********************************************************/
+
+/**
+ *  Read or write a model specific register.
+ */
+    static inline uint64_t
+read_msr (uint32_t msr)
+{
+    uint32_t low, high;
+
+    __asm__ volatile ("rdmsr" : "=a" (low), "=d" (high) : "c" (msr));
+    return (uint64_t) high << 32 | low;
+}
+
+    static inline void
+write_msr (uint32_t msr, uint64_t value)
+{
+    __asm__ volatile ("wrmsr"
+      : : "c" (msr), "a" ((uint32_t) value), "d" ((uint32_t) (value >> 32)));
+}
+
+/**********************************************************/
+
+/**
+ *  Enable or disable maskable interrupts.
+ */
+    static inline void
+interrupts_enable (void)
+{
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+    static inline void
+interrupts_disable (void)
+{
+    __asm__ volatile ("cli" : : : "memory");
+}
+
+/**********************************************************/
+
+/**
+ *  Disable interrupts, returning the previous state of the flags
+ *  register so that it can be put back by interrupts_restore. These can
+ *  be nested, unlike interrupts_disable and interrupts_enable.
+ */
+    static inline uint32_t
+interrupts_save (void)
+{
+    uint32_t flags;
+
+    __asm__ volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+    static inline void
+interrupts_restore (uint32_t flags)
+{
+    __asm__ volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+/**********************************************************/
+
+/**
+ *  Enable interrupts and wait for one to arrive. This should be called
+ *  with interrupts disabled, after checking that there is nothing to do.
+ *  sti does not take effect until after the next instruction, so no
+ *  interrupt can slip in between the check and the hlt, which would
+ *  leave us waiting for an interrupt that had already happened.
+ */
+    static inline void
+wait_for_interrupt (void)
+{
+    __asm__ volatile ("sti; hlt" : : : "memory");
+}
+
+/**********************************************************/
+
+/**
+ *  Hint to the processor that we are in a spin wait loop. pause saves
+ *  power, and stops the loop from filling the pipeline with reads that
+ *  have to be thrown away when the value changes. Older processors
+ *  treat it as a nop.
+ */
+    static inline void
+cpu_relax (void)
+{
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+/**********************************************************/
+
+/**
+ *  Atomic operations on a 32 bit word in memory, which are safe against
+ *  other processors. Each is a full memory barrier. xchg with memory is
+ *  always locked, so it does not need the lock prefix.
+ *
+ *  atomic_exchange stores value and returns the old contents.
+ *  atomic_fetch_add adds value and returns the old contents.
+ *  atomic_compare_exchange stores value only if the word holds expected,
+ *  and returns the old contents either way.
+ */
+    static inline uint32_t
+atomic_exchange (volatile uint32_t *word, uint32_t value)
+{
+    __asm__ volatile ("xchg %0, %1"
+      : "+r" (value), "+m" (*word) : : "memory");
+    return value;
+}
+
+    static inline uint32_t
+atomic_fetch_add (volatile uint32_t *word, uint32_t value)
+{
+    __asm__ volatile ("lock xadd %0, %1"
+      : "+r" (value), "+m" (*word) : : "memory", "cc");
+    return value;
+}
+
+    static inline uint32_t
+atomic_compare_exchange (volatile uint32_t *word, uint32_t expected,
+  uint32_t value)
+{
+    __asm__ volatile ("lock cmpxchg %2, %1"
+      : "+a" (expected), "+m" (*word) : "r" (value) : "memory", "cc");
+    return expected;
+}
+
+/**
+ *  Add to a word and return the old contents, atomically with respect to
+ *  interrupts on this processor but not to other processors. A single
+ *  instruction cannot be split by an interrupt, so this needs no lock
+ *  prefix, and costs little more than an ordinary add.
+ */
+    static inline uint32_t
+local_fetch_add (volatile uint32_t *word, uint32_t value)
+{
+    __asm__ volatile ("xadd %0, %1"
+      : "+r" (value), "+m" (*word) : : "memory", "cc");
+    return value;
+}
+
+/**
+ *  Stop the compiler from moving memory accesses across this point.
+ *  Loads are not reordered with other loads, nor stores with other
+ *  stores, on x86, so this is all that a release needs.
+ */
+    static inline void
+compiler_barrier (void)
+{
+    __asm__ volatile ("" : : : "memory");
+}
+
+/**
+ *  A full barrier, which also stops a store from being delayed past a
+ *  later load, for when we publish something and then look at what
+ *  another processor or a device has published. A locked add to the top
+ *  of the stack is cheaper than mfence, and works on every processor.
+ */
+    static inline void
+memory_barrier (void)
+{
+    __asm__ volatile ("lock addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+/**********************************************************/
+
+/**
+ *  Stop the CPU for good. Interrupts are disabled first, so that nothing
+ *  can wake it up again.
+ */
+    static inline void __attribute__ ((noreturn))
+halt_forever (void)
+{
+    for (;;)
+        __asm__ volatile ("cli; hlt");
+}
+
+/**********************************************************/
+
+
+#endif /** _CPU_H */
+
+/** vim: set ts=4 sw=4 et : */
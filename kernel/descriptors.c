@@ -29,7 +29,7 @@ make_gdt_entry (entry, base, limit, flags, access_bits)
 
     entry->limit_low = (uint16_t) limit & 0xFFFF;
     entry->flags_and_limit_high = (uint8_t) ((limit >> 16) & 0x0F) | 
-        (flags & 0x0F);
+        (flags & 0xF0);
 
     entry->access_bits = access_bits | GDT_PRESENT (1);
 }
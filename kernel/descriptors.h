@@ -52,6 +52,10 @@ __attribute__ ((packed));
  *  mode, 3 means userland/lowest privilege */
 #define GDT_RING_LEVEL(x)       (((x) & 0x03) << 5)
 
+/** must be set for code and data segments, and clear for system segments
+ *  such as a TSS */
+#define GDT_CODE_OR_DATA(x)     ((x) << 4)
+
 /** if executable=1, the contents of this segment can be executed */
 #define GDT_EXECUTABLE(x)       ((x) << 3)
 
@@ -100,6 +104,10 @@ __attribute__ ((packed));
 /** define whether this is a trap or task call */
 #define IDT_TYPE(x)             ((x) & 0x0F)
 
+/** 32 bit interrupt gate. Interrupts are disabled on entry to the
+ *  handler. */
+#define IDT_INTERRUPT_GATE      0x0E
+
 
 /**********************************************************/
 
@@ -0,0 +1,1976 @@
+/**
+ *  The ext2 filesystem.
+ *
+ *  The disk is divided into blocks of 1, 2 or 4 KiB, and the blocks into
+ *  groups. The superblock, 1 KiB from the start, describes the whole,
+ *  and is followed by a table with a descriptor for each group, which
+ *  says where the group's block bitmap, inode bitmap and inode table
+ *  are. An inode holds a file's size and the numbers of its first 12
+ *  blocks, then of a block of block numbers, a block of those, and a
+ *  block of those again. A directory is a file of variable length
+ *  entries, each naming an inode.
+ *
+ *  Every block is read and written through the buffer cache, and three
+ *  more caches keep the filesystem from going back to it too often:
+ *
+ *  - the inode cache keeps the inodes in use and recently used, in a
+ *    hash table and a list in order of use. Changes are written through
+ *    to the inode table's buffer straight away.
+ *  - the directory entry cache keeps the results of looking up names in
+ *    directories, including names that were not found, so walking a
+ *    path does not have to search each directory.
+ *  - each cached inode remembers where the last read of it ended. While
+ *    a file is read in order, the blocks ahead of the reader are read
+ *    ahead in growing batches, with the disk plugged so that the block
+ *    layer merges them into big transfers. A read somewhere else stops
+ *    it.
+ *
+ *  Writes can overwrite and extend files and create new ones; blocks
+ *  and inodes are taken from the bitmaps of the group they are wanted
+ *  in, or the next group with room. Files cannot be deleted or
+ *  truncated. A filesystem with features we do not know that would
+ *  change what we write is mounted read only.
+ *
+ *  Only one thread is in the filesystem at a time.
+ */
+
+#include "ext2.h"
+#include "stdint.h"
+#include "block.h"
+#include "buffer.h"
+#include "cpu.h"
+#include "memutils.h"
+#include "output.h"
+#include "paging.h"
+#include "slab.h"
+#include "thread.h"
+#include "utils.h"
+
+/** where the superblock is, and its magic number */
+#define SUPERBLOCK_OFFSET       1024
+#define SUPERBLOCK_SIZE         1024
+#define EXT2_MAGIC              0xEF53
+
+/** revision 0 filesystems have fixed inodes */
+#define OLD_INODE_SIZE          128
+#define OLD_FIRST_INODE         11
+
+/** features. Of the incompatible ones we only know the type field of
+ *  directory entries; of the read only ones, we can write to a
+ *  filesystem with fewer superblock copies and with large files. */
+#define INCOMPAT_FILETYPE       0x0002
+#define RO_COMPAT_SPARSE_SUPER  0x0001
+#define RO_COMPAT_LARGE_FILE    0x0002
+
+/** a directory with a hashed index, which is only valid until an entry
+ *  is added by something that does not know about it */
+#define INODE_FLAG_INDEX        0x00001000
+
+/** the block numbers in an inode: direct, then single, double and
+ *  triple indirect */
+#define DIRECT_BLOCKS           12
+#define BLOCK_POINTERS          15
+
+/** the partition table in the first sector of a disk */
+#define MBR_PARTITIONS          446
+#define MBR_SIGNATURE           510
+#define MBR_MAGIC               0xAA55
+#define NUM_PARTITIONS          4
+#define PARTITION_SIZE          16
+#define PARTITION_TYPE          4
+#define PARTITION_START         8
+#define PARTITION_LINUX         0x83
+
+/** a directory entry's header, and its size with a name */
+#define ENTRY_HEADER            8
+#define ENTRY_SIZE(length)      (((length) + ENTRY_HEADER + 3) & ~3u)
+
+/** sizes of the inode and directory entry caches, and the longest name
+ *  that is kept in the directory entry cache */
+#define CACHE_BUCKETS           128
+#define INODE_CACHE_SIZE        256
+#define DENTRY_CACHE_SIZE       1024
+#define DENTRY_NAME_MAX         27
+
+/** the first and biggest batches of blocks read ahead */
+#define READ_AHEAD_MIN_BYTES    (16 * 1024)
+#define READ_AHEAD_MAX_BYTES    (256 * 1024)
+
+/** mode of new files */
+#define NEW_FILE_MODE           (EXT2_MODE_FILE | 0644)
+
+/**********************************************************/
+
+struct superblock
+{
+    uint32_t inodes;
+    uint32_t blocks;
+    uint32_t reserved_blocks;
+    uint32_t free_blocks;
+    uint32_t free_inodes;
+    uint32_t first_data_block;
+    uint32_t log_block_size;
+    uint32_t log_fragment_size;
+    uint32_t blocks_per_group;
+    uint32_t fragments_per_group;
+    uint32_t inodes_per_group;
+    uint32_t mount_time;
+    uint32_t write_time;
+    uint16_t mount_count;
+    uint16_t max_mount_count;
+    uint16_t magic;
+    uint16_t state;
+    uint16_t errors;
+    uint16_t minor_revision;
+    uint32_t check_time;
+    uint32_t check_interval;
+    uint32_t creator;
+    uint32_t revision;
+    uint16_t reserved_uid;
+    uint16_t reserved_gid;
+    uint32_t first_inode;
+    uint16_t inode_size;
+    uint16_t block_group;
+    uint32_t compatible;
+    uint32_t incompatible;
+    uint32_t read_only_compatible;
+}
+__attribute__ ((packed));
+
+struct group_descriptor
+{
+    uint32_t block_bitmap;
+    uint32_t inode_bitmap;
+    uint32_t inode_table;
+    uint16_t free_blocks;
+    uint16_t free_inodes;
+    uint16_t directories;
+    uint16_t pad;
+    uint32_t reserved [3];
+}
+__attribute__ ((packed));
+
+struct disk_inode
+{
+    uint16_t mode;
+    uint16_t uid;
+    uint32_t size;
+    uint32_t access_time;
+    uint32_t change_time;
+    uint32_t modify_time;
+    uint32_t delete_time;
+    uint16_t gid;
+    uint16_t links;
+    uint32_t sectors;
+    uint32_t flags;
+    uint32_t os1;
+    uint32_t block [BLOCK_POINTERS];
+    uint32_t generation;
+    uint32_t file_acl;
+    uint32_t size_high;
+    uint32_t fragment;
+    uint8_t os2 [12];
+};
+
+struct dir_entry
+{
+    uint32_t inode;
+    uint16_t length;
+    uint8_t name_length;
+    uint8_t type;
+    char name [];
+}
+__attribute__ ((packed));
+
+/**
+ *  The links of an entry in one of the caches, which comes first in it.
+ */
+struct cache_entry
+{
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+    uint32_t key;
+    int references;
+};
+
+/**
+ *  A hash table of entries, and a list of them in order of use. Once
+ *  there are limit of them, the least recently used one that is not
+ *  referenced is reused.
+ */
+struct cache
+{
+    struct cache_entry *buckets [CACHE_BUCKETS];
+    struct cache_entry *head;
+    struct cache_entry *tail;
+    uint32_t count;
+    uint32_t limit;
+    struct slab_cache *slab;
+
+    uint32_t hits;
+    uint32_t misses;
+};
+
+struct inode
+{
+    struct cache_entry entry;
+    uint32_t number;
+    struct disk_inode disk;
+
+    /** read ahead: the block a sequential reader would read next, the
+     *  next batch's size, and the first block not yet read ahead */
+    uint32_t next_block;
+    uint32_t window;
+    uint32_t ahead;
+};
+
+struct dentry
+{
+    struct cache_entry entry;
+    uint32_t directory;
+    uint32_t inode;             // 0 if the name is not there
+    uint8_t length;
+    char name [DENTRY_NAME_MAX + 1];
+};
+
+/**********************************************************/
+
+PRIVATE bool mount_at (struct block_device *device, uint64_t start,
+  const struct superblock *copy);
+PRIVATE void lock_fs (void);
+PRIVATE void unlock_fs (void);
+PRIVATE struct buffer *read_block (uint32_t block);
+PRIVATE struct buffer *zero_block (uint32_t block);
+PRIVATE struct group_descriptor *get_group (uint32_t group,
+  struct buffer **buffer);
+PRIVATE struct inode *get_inode (uint32_t number);
+PRIVATE void put_inode (struct inode *inode);
+PRIVATE bool write_inode (struct inode *inode, bool clear);
+PRIVATE uint32_t map_block (struct inode *inode, uint32_t logical,
+  bool allocate, bool *fresh);
+PRIVATE uint32_t allocate_block (struct inode *inode, uint32_t goal);
+PRIVATE void free_block (struct inode *inode, uint32_t block);
+PRIVATE uint32_t allocate_inode (uint32_t goal_group, bool directory);
+PRIVATE void free_inode (uint32_t number, bool directory);
+PRIVATE int find_free_bit (uint8_t *bitmap, uint32_t bits, uint32_t start);
+PRIVATE void read_ahead (struct inode *inode, uint32_t logical);
+PRIVATE uint32_t lookup_name (struct inode *directory, const char *name,
+  uint32_t length);
+PRIVATE uint32_t search_directory (struct inode *directory,
+  const char *name, uint32_t length);
+PRIVATE bool add_entry (struct inode *directory, const char *name,
+  uint32_t length, uint32_t number, int type);
+PRIVATE uint32_t walk_path (const char *path, uint32_t length);
+PRIVATE uint32_t name_hash (uint32_t directory, const char *name,
+  uint32_t length);
+PRIVATE void remember_name (uint32_t directory, const char *name,
+  uint32_t length, uint32_t number);
+PRIVATE struct cache_entry *cache_new (struct cache *cache);
+PRIVATE void cache_insert (struct cache *cache, struct cache_entry *entry);
+PRIVATE void cache_remove (struct cache *cache, struct cache_entry *entry);
+PRIVATE void cache_touch (struct cache *cache, struct cache_entry *entry);
+PRIVATE void cache_clear (struct cache *cache);
+
+/**********************************************************/
+
+PRIVATE bool mounted;
+PRIVATE bool read_only;
+PRIVATE volatile uint32_t fs_busy;
+
+PRIVATE struct block_device *disk;
+PRIVATE uint64_t first_sector;  // of the partition
+
+PRIVATE uint32_t block_size;
+PRIVATE uint32_t sectors_per_block;
+PRIVATE uint32_t pointers_per_block;
+PRIVATE uint32_t group_count;
+PRIVATE uint32_t inode_size;
+PRIVATE uint32_t first_inode;
+PRIVATE bool entry_types;
+
+/** the superblock is kept in its buffer, which stays referenced */
+PRIVATE struct buffer *super_buffer;
+PRIVATE struct superblock *super;
+
+PRIVATE struct cache inodes;
+PRIVATE struct cache dentries;
+
+/** number of batches read ahead */
+PRIVATE uint32_t read_ahead_batches;
+
+/**********************************************************/
+
+/**
+ *  Set up the caches, and mount the first ext2 filesystem found on any
+ *  block device. Needs interrupts, since it reads the disks.
+ */
+    PUBLIC void
+ext2_initialise (void)
+{
+    inodes.limit = INODE_CACHE_SIZE;
+    inodes.slab = slab_cache_create ("ext2_inode", sizeof (struct inode),
+      NULL);
+    dentries.limit = DENTRY_CACHE_SIZE;
+    dentries.slab = slab_cache_create ("ext2_dentry", sizeof (struct dentry),
+      NULL);
+
+    for (int i = 0; i < block_device_count () && !mounted; i ++)
+        ext2_mount (block_device (i));
+}
+
+/**********************************************************/
+
+/**
+ *  Mount the ext2 filesystem on a device, which is either the first
+ *  Linux partition in its partition table or the whole device. Returns
+ *  false if there is none, or one is already mounted.
+ */
+    PUBLIC bool
+ext2_mount (device)
+    struct block_device *device;
+{
+    uint64_t starts [NUM_PARTITIONS + 1];
+    int count = 0;
+    uint8_t *sector;
+    bool found = false;
+
+    if (mounted)
+        return false;
+
+    sector = kmalloc (SUPERBLOCK_SIZE);
+
+    if (sector == NULL)
+        return false;
+
+    if (block_read (device, 0, 1, sector) &&
+      *(uint16_t *) (sector + MBR_SIGNATURE) == MBR_MAGIC)
+    {
+        for (int i = 0; i < NUM_PARTITIONS; i ++)
+        {
+            uint8_t *entry = sector + MBR_PARTITIONS + i * PARTITION_SIZE;
+
+            if (entry [PARTITION_TYPE] == PARTITION_LINUX)
+                starts [count ++] = *(uint32_t *) (entry + PARTITION_START);
+        }
+    }
+
+    starts [count ++] = 0;
+
+    for (int i = 0; i < count && !found; i ++)
+    {
+        const struct superblock *copy = (const struct superblock *) sector;
+
+        if (block_read (device, starts [i] + SUPERBLOCK_OFFSET /
+          BLOCK_SECTOR_SIZE, SUPERBLOCK_SIZE / BLOCK_SECTOR_SIZE, sector) &&
+          copy->magic == EXT2_MAGIC)
+        {
+            found = mount_at (device, starts [i], copy);
+        }
+    }
+
+    kfree (sector);
+    return found;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if there is a filesystem mounted.
+ */
+    PUBLIC bool
+ext2_mounted (void)
+{
+    return mounted;
+}
+
+/**********************************************************/
+
+/**
+ *  Find a file by its path from the root, with its parts separated by
+ *  slashes. Returns its inode number, or 0 if there is no such file.
+ */
+    PUBLIC uint32_t
+ext2_lookup (path)
+    const char *path;
+{
+    uint32_t length = 0;
+    uint32_t number;
+
+    if (!mounted)
+        return 0;
+
+    while (path [length] != '\0')
+        length ++;
+
+    lock_fs ();
+    number = walk_path (path, length);
+    unlock_fs ();
+
+    return number;
+}
+
+/**********************************************************/
+
+/**
+ *  Describe a file. Returns false if there is no such inode.
+ */
+    PUBLIC bool
+ext2_stat (number, stat)
+    uint32_t number;
+    struct ext2_stat *stat;
+{
+    struct inode *inode;
+
+    if (!mounted)
+        return false;
+
+    lock_fs ();
+    inode = get_inode (number);
+
+    if (inode != NULL)
+    {
+        stat->inode = number;
+        stat->mode = inode->disk.mode;
+        stat->links = inode->disk.links;
+        stat->size = inode->disk.size;
+        stat->blocks = inode->disk.sectors;
+        put_inode (inode);
+    }
+
+    unlock_fs ();
+    return inode != NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Read from a file. Returns the number of bytes read, which is less
+ *  than asked for at the end of the file, or -1 if there is no such
+ *  inode or the disk failed. Holes in the file read as zeroes.
+ */
+    PUBLIC int32_t
+ext2_read (number, offset, buffer, size)
+    uint32_t number;
+    uint32_t offset;            // bytes from the start of the file
+    void *buffer;
+    uint32_t size;              // bytes
+{
+    uint8_t *dest = buffer;
+    struct inode *inode;
+    uint32_t done = 0;
+
+    if (!mounted)
+        return -1;
+
+    lock_fs ();
+    inode = get_inode (number);
+
+    if (inode == NULL)
+    {
+        unlock_fs ();
+        return -1;
+    }
+
+    if (offset >= inode->disk.size)
+        size = 0;
+    else if (size > inode->disk.size - offset)
+        size = inode->disk.size - offset;
+
+    while (done < size)
+    {
+        uint32_t logical = (offset + done) / block_size;
+        uint32_t within = (offset + done) % block_size;
+        uint32_t chunk = block_size - within;
+        uint32_t physical;
+
+        if (chunk > size - done)
+            chunk = size - done;
+
+        read_ahead (inode, logical);
+        physical = map_block (inode, logical, false, NULL);
+
+        if (physical == 0)
+        {
+            memset (dest + done, 0, chunk);
+        }
+        else
+        {
+            struct buffer *block = read_block (physical);
+
+            if (block == NULL)
+                break;
+
+            memcopy (block->data + within, dest + done, chunk);
+            buffer_release (block);
+        }
+
+        done += chunk;
+    }
+
+    put_inode (inode);
+    unlock_fs ();
+
+    return done < size ? -1 : (int32_t) done;
+}
+
+/**********************************************************/
+
+/**
+ *  Write to a file, allocating blocks for it and making it longer as
+ *  needed. Returns the number of bytes written, which is less than
+ *  asked for if the disk is full, or -1 if nothing could be written.
+ *  The data goes to the disk when the buffer cache writes it back.
+ */
+    PUBLIC int32_t
+ext2_write (number, offset, buffer, size)
+    uint32_t number;
+    uint32_t offset;
+    const void *buffer;
+    uint32_t size;
+{
+    const uint8_t *source = buffer;
+    struct inode *inode;
+    uint32_t done = 0;
+
+    if (!mounted || read_only)
+        return -1;
+
+    lock_fs ();
+    inode = get_inode (number);
+
+    if (inode == NULL)
+    {
+        unlock_fs ();
+        return -1;
+    }
+
+    /** no more than 4 GiB */
+    if (size > ~0u - offset)
+        size = ~0u - offset;
+
+    while (done < size)
+    {
+        uint32_t logical = (offset + done) / block_size;
+        uint32_t within = (offset + done) % block_size;
+        uint32_t chunk = block_size - within;
+        struct buffer *block;
+        uint32_t physical;
+        bool fresh;
+
+        if (chunk > size - done)
+            chunk = size - done;
+
+        physical = map_block (inode, logical, true, &fresh);
+
+        if (physical == 0)
+            break;
+
+        if (fresh)
+            block = zero_block (physical);
+        else if (chunk == block_size)
+            block = buffer_get (disk, first_sector +
+              (uint64_t) physical * sectors_per_block, block_size);
+        else
+            block = read_block (physical);
+
+        if (block == NULL)
+            break;
+
+        memcopy (source + done, block->data + within, chunk);
+        buffer_dirty (block);
+        buffer_release (block);
+
+        done += chunk;
+    }
+
+    if (offset + done > inode->disk.size)
+        inode->disk.size = offset + done;
+
+    write_inode (inode, false);
+    put_inode (inode);
+    unlock_fs ();
+
+    return done == 0 && size != 0 ? -1 : (int32_t) done;
+}
+
+/**********************************************************/
+
+/**
+ *  Make a new, empty file. The directory it goes in must exist. Returns
+ *  its inode number, or 0 if it could not be made, or there is already
+ *  something with that name.
+ */
+    PUBLIC uint32_t
+ext2_create (path)
+    const char *path;
+{
+    struct inode *directory;
+    struct inode *inode;
+    uint32_t length = 0;
+    uint32_t slash = 0;
+    uint32_t parent;
+    uint32_t number = 0;
+    const char *name;
+
+    if (!mounted || read_only)
+        return 0;
+
+    while (path [length] != '\0')
+    {
+        if (path [length] == '/')
+            slash = length + 1;
+
+        length ++;
+    }
+
+    name = path + slash;
+
+    if (slash == length || length - slash > EXT2_NAME_MAX)
+        return 0;
+
+    lock_fs ();
+    parent = walk_path (path, slash);
+    directory = parent != 0 ? get_inode (parent) : NULL;
+
+    if (directory == NULL || (directory->disk.mode & EXT2_MODE_TYPE) !=
+      EXT2_MODE_DIRECTORY || lookup_name (directory, name, length - slash)
+      != 0)
+    {
+        goto done;
+    }
+
+    number = allocate_inode ((parent - 1) / super->inodes_per_group, false);
+
+    if (number == 0 || (inode = get_inode (number)) == NULL)
+    {
+        number = 0;
+        goto done;
+    }
+
+    memset (&inode->disk, 0, sizeof (struct disk_inode));
+    inode->disk.mode = NEW_FILE_MODE;
+    inode->disk.links = 1;
+    write_inode (inode, true);
+
+    /** if it cannot be named, it is cleared and given back */
+    if (!add_entry (directory, name, length - slash, number,
+      EXT2_TYPE_FILE))
+    {
+        memset (&inode->disk, 0, sizeof (struct disk_inode));
+        write_inode (inode, true);
+        free_inode (number, false);
+        number = 0;
+    }
+
+    put_inode (inode);
+
+done:
+    if (directory != NULL)
+        put_inode (directory);
+
+    unlock_fs ();
+    return number;
+}
+
+/**********************************************************/
+
+/**
+ *  Read the next entry of a directory, starting at *offset, which
+ *  should be 0 the first time, and is moved past the entry. Returns
+ *  false at the end of the directory, or if it is not one.
+ */
+    PUBLIC bool
+ext2_read_dir (number, offset, entry)
+    uint32_t number;
+    uint32_t *offset;           // bytes into the directory
+    struct ext2_dirent *entry;
+{
+    struct inode *inode;
+    bool found = false;
+
+    if (!mounted)
+        return false;
+
+    lock_fs ();
+    inode = get_inode (number);
+
+    if (inode == NULL || (inode->disk.mode & EXT2_MODE_TYPE) !=
+      EXT2_MODE_DIRECTORY)
+    {
+        goto done;
+    }
+
+    while (!found && *offset < inode->disk.size)
+    {
+        uint32_t logical = *offset / block_size;
+        uint32_t physical = map_block (inode, logical, false, NULL);
+        struct buffer *block;
+        struct dir_entry *dirent;
+
+        if (physical == 0 || (block = read_block (physical)) == NULL)
+            break;
+
+        dirent = (struct dir_entry *) (block->data + *offset % block_size);
+
+        if (dirent->length < ENTRY_HEADER ||
+          *offset % block_size + dirent->length > block_size)
+        {
+            buffer_release (block);
+            break;
+        }
+
+        *offset += dirent->length;
+
+        if (dirent->inode != 0)
+        {
+            entry->inode = dirent->inode;
+            entry->type = entry_types ? dirent->type : EXT2_TYPE_UNKNOWN;
+            entry->length = dirent->name_length;
+            memcopy (dirent->name, entry->name, dirent->name_length);
+            entry->name [dirent->name_length] = '\0';
+            found = true;
+        }
+
+        buffer_release (block);
+    }
+
+done:
+    if (inode != NULL)
+        put_inode (inode);
+
+    unlock_fs ();
+    return found;
+}
+
+/**********************************************************/
+
+/**
+ *  Write everything that has changed back to the disk. Returns false if
+ *  any of the writes failed.
+ */
+    PUBLIC bool
+ext2_sync (void)
+{
+    bool ok;
+
+    if (!mounted)
+        return true;
+
+    lock_fs ();
+    ok = buffer_sync (disk);
+    unlock_fs ();
+
+    return ok;
+}
+
+/**********************************************************/
+
+/**
+ *  Write back what has changed, and empty the caches, so that what is
+ *  read next comes from the disk.
+ */
+    PUBLIC void
+ext2_drop_caches (void)
+{
+    if (!mounted)
+        return;
+
+    lock_fs ();
+    cache_clear (&dentries);
+    cache_clear (&inodes);
+    buffer_drop (disk);
+    unlock_fs ();
+}
+
+/**********************************************************/
+
+/**
+ *  Start the caches' counters again.
+ */
+    PUBLIC void
+ext2_reset_stats (void)
+{
+    inodes.hits = 0;
+    inodes.misses = 0;
+    dentries.hits = 0;
+    dentries.misses = 0;
+    read_ahead_batches = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Print the hit rates of the inode and directory entry caches.
+ */
+    PUBLIC void
+ext2_dump_stats (void)
+{
+    uint32_t inode_lookups = inodes.hits + inodes.misses;
+    uint32_t name_lookups = dentries.hits + dentries.misses;
+    uint32_t inode_rate = (uint32_t) udiv64 ((uint64_t) inodes.hits * 1000,
+      inode_lookups != 0 ? inode_lookups : 1, NULL);
+    uint32_t name_rate = (uint32_t) udiv64 ((uint64_t) dentries.hits * 1000,
+      name_lookups != 0 ? name_lookups : 1, NULL);
+
+    kprintf ("ext2: inodes %u lookups, %u.%u%% hits; names %u lookups, "
+      "%u.%u%% hits; %u batches read ahead\n", inode_lookups,
+      inode_rate / 10, inode_rate % 10, name_lookups, name_rate / 10,
+      name_rate % 10, read_ahead_batches);
+}
+
+/**********************************************************/
+
+/**
+ *  Check the superblock of the filesystem at the start of a partition,
+ *  and mount it if we can.
+ */
+    PRIVATE bool
+mount_at (device, start, copy)
+    struct block_device *device;
+    uint64_t start;             // first sector of the partition
+    const struct superblock *copy;
+{
+    uint32_t super_block;
+
+    if (copy->log_block_size > 2 || copy->blocks_per_group == 0 ||
+      copy->inodes_per_group == 0 ||
+      (copy->incompatible & ~INCOMPAT_FILETYPE) != 0)
+    {
+        return false;
+    }
+
+    disk = device;
+    first_sector = start;
+    block_size = 1024 << copy->log_block_size;
+    sectors_per_block = block_size / BLOCK_SECTOR_SIZE;
+    pointers_per_block = block_size / sizeof (uint32_t);
+    group_count = (copy->blocks - copy->first_data_block +
+      copy->blocks_per_group - 1) / copy->blocks_per_group;
+    inode_size = copy->revision == 0 ? OLD_INODE_SIZE : copy->inode_size;
+    first_inode = copy->revision == 0 ? OLD_FIRST_INODE : copy->first_inode;
+    entry_types = (copy->incompatible & INCOMPAT_FILETYPE) != 0;
+    read_only = (copy->read_only_compatible &
+      ~(RO_COMPAT_SPARSE_SUPER | RO_COMPAT_LARGE_FILE)) != 0;
+
+    if (inode_size < sizeof (struct disk_inode) || inode_size > block_size)
+        return false;
+
+    super_block = SUPERBLOCK_OFFSET / block_size;
+    super_buffer = read_block (super_block);
+
+    if (super_buffer == NULL)
+        return false;
+
+    super = (struct superblock *) (super_buffer->data + SUPERBLOCK_OFFSET %
+      block_size);
+    mounted = true;
+
+    kprintf ("ext2: %s at sector %u, %u KiB blocks, %u groups, %u inodes, "
+      "%u MiB free%s\n", device->name, (uint32_t) start, block_size / 1024,
+      group_count, super->inodes, (uint32_t) udiv64 ((uint64_t)
+      super->free_blocks * block_size, 1024 * 1024, NULL),
+      read_only ? ", read only" : "");
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Keep other threads out of the filesystem, or let them in again.
+ */
+    PRIVATE void
+lock_fs (void)
+{
+    while (atomic_exchange (&fs_busy, 1) != 0)
+        thread_yield ();
+}
+
+    PRIVATE void
+unlock_fs (void)
+{
+    compiler_barrier ();
+    fs_busy = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Get a block of the filesystem from the buffer cache, reading it if it
+ *  is not there. Returns NULL if the read failed.
+ */
+    PRIVATE struct buffer *
+read_block (block)
+    uint32_t block;
+{
+    return buffer_read (disk, first_sector + (uint64_t) block *
+      sectors_per_block, block_size);
+}
+
+/**********************************************************/
+
+/**
+ *  Get a buffer for a block that has just been allocated, filled with
+ *  zeroes and marked dirty, without reading it.
+ */
+    PRIVATE struct buffer *
+zero_block (block)
+    uint32_t block;
+{
+    struct buffer *buffer = buffer_get (disk, first_sector +
+      (uint64_t) block * sectors_per_block, block_size);
+
+    if (buffer != NULL)
+    {
+        memset (buffer->data, 0, block_size);
+        buffer_dirty (buffer);
+    }
+
+    return buffer;
+}
+
+/**********************************************************/
+
+/**
+ *  Find the descriptor of a group, in its buffer, which the caller must
+ *  release. Returns NULL if it could not be read.
+ */
+    PRIVATE struct group_descriptor *
+get_group (group, buffer)
+    uint32_t group;
+    struct buffer **buffer;     // set to the descriptor's buffer
+{
+    uint32_t offset = group * sizeof (struct group_descriptor);
+
+    *buffer = read_block (super->first_data_block + 1 + offset / block_size);
+
+    if (*buffer == NULL)
+        return NULL;
+
+    return (struct group_descriptor *) ((*buffer)->data + offset %
+      block_size);
+}
+
+/**********************************************************/
+
+/**
+ *  Get an inode from the cache, reading it from the inode table if it is
+ *  not there, and take a reference to it. Returns NULL if the number is
+ *  out of range or the table could not be read.
+ */
+    PRIVATE struct inode *
+get_inode (number)
+    uint32_t number;
+{
+    struct group_descriptor *group;
+    struct buffer *group_buffer;
+    struct buffer *block;
+    struct inode *inode;
+    uint32_t index;
+    uint32_t offset;
+
+    if (number == 0 || number > super->inodes)
+        return NULL;
+
+    for (struct cache_entry *entry = inodes.buckets [number % CACHE_BUCKETS];
+      entry != NULL; entry = entry->hash_next)
+    {
+        if (entry->key == number)
+        {
+            inodes.hits ++;
+            entry->references ++;
+            cache_touch (&inodes, entry);
+            return (struct inode *) entry;
+        }
+    }
+
+    inodes.misses ++;
+    index = (number - 1) % super->inodes_per_group;
+    group = get_group ((number - 1) / super->inodes_per_group,
+      &group_buffer);
+
+    if (group == NULL)
+        return NULL;
+
+    offset = index * inode_size;
+    block = read_block (group->inode_table + offset / block_size);
+    buffer_release (group_buffer);
+
+    if (block == NULL)
+        return NULL;
+
+    inode = (struct inode *) cache_new (&inodes);
+
+    if (inode == NULL)
+    {
+        buffer_release (block);
+        return NULL;
+    }
+
+    memcopy (block->data + offset % block_size, &inode->disk,
+      sizeof (struct disk_inode));
+    buffer_release (block);
+
+    inode->number = number;
+    inode->next_block = 0;
+    inode->window = 0;
+    inode->ahead = 0;
+    inode->entry.key = number;
+    inode->entry.references = 1;
+    cache_insert (&inodes, &inode->entry);
+
+    return inode;
+}
+
+/**********************************************************/
+
+/**
+ *  Give up a reference to an inode, which stays in the cache.
+ */
+    PRIVATE void
+put_inode (inode)
+    struct inode *inode;
+{
+    inode->entry.references --;
+}
+
+/**********************************************************/
+
+/**
+ *  Copy an inode into its buffer of the inode table, and mark it dirty.
+ *  If clear is set, the rest of the inode's space in the table, past
+ *  the part that we know about, is cleared too.
+ */
+    PRIVATE bool
+write_inode (inode, clear)
+    struct inode *inode;
+    bool clear;
+{
+    uint32_t index = (inode->number - 1) % super->inodes_per_group;
+    uint32_t offset = index * inode_size;
+    struct group_descriptor *group;
+    struct buffer *group_buffer;
+    struct buffer *block;
+    uint8_t *place;
+
+    group = get_group ((inode->number - 1) / super->inodes_per_group,
+      &group_buffer);
+
+    if (group == NULL)
+        return false;
+
+    block = read_block (group->inode_table + offset / block_size);
+    buffer_release (group_buffer);
+
+    if (block == NULL)
+        return false;
+
+    place = block->data + offset % block_size;
+
+    if (clear)
+        memset (place, 0, inode_size);
+
+    memcopy (&inode->disk, place, sizeof (struct disk_inode));
+    buffer_dirty (block);
+    buffer_release (block);
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Find the disk block that holds a block of a file, going through the
+ *  indirect blocks as needed. If allocate is set, missing blocks are
+ *  allocated on the way, and fresh says whether the data block was.
+ *  Returns 0 for a hole, or if a block could not be read or allocated.
+ */
+    PRIVATE uint32_t
+map_block (inode, logical, allocate, fresh)
+    struct inode *inode;
+    uint32_t logical;           // block of the file
+    bool allocate;
+    bool *fresh;                // set if the block is new, or NULL
+{
+    uint32_t per_block = pointers_per_block;
+    uint32_t *slot;
+    struct buffer *holder = NULL;
+    uint32_t indices [3];
+    int levels;
+    uint32_t goal;
+
+    if (fresh != NULL)
+        *fresh = false;
+
+    if (logical < DIRECT_BLOCKS)
+    {
+        levels = 0;
+        slot = &inode->disk.block [logical];
+    }
+    else if ((logical -= DIRECT_BLOCKS) < per_block)
+    {
+        levels = 1;
+        slot = &inode->disk.block [DIRECT_BLOCKS];
+        indices [0] = logical;
+    }
+    else if ((logical -= per_block) < per_block * per_block)
+    {
+        levels = 2;
+        slot = &inode->disk.block [DIRECT_BLOCKS + 1];
+        indices [0] = logical / per_block;
+        indices [1] = logical % per_block;
+    }
+    else
+    {
+        logical -= per_block * per_block;
+
+        if (logical / per_block / per_block >= per_block)
+            return 0;
+
+        levels = 3;
+        slot = &inode->disk.block [DIRECT_BLOCKS + 2];
+        indices [0] = logical / per_block / per_block;
+        indices [1] = logical / per_block % per_block;
+        indices [2] = logical % per_block;
+    }
+
+    /** each block goes after the last one allocated in the file, if it
+     *  can, or else at the start of the inode's group */
+    goal = super->first_data_block + (inode->number - 1) /
+      super->inodes_per_group * super->blocks_per_group;
+
+    for (int level = 0; ; level ++)
+    {
+        uint32_t block = *slot;
+
+        if (block == 0)
+        {
+            struct buffer *fresh_block;
+
+            if (!allocate || read_only)
+                break;
+
+            block = allocate_block (inode, goal);
+
+            if (block == 0)
+                break;
+
+            /** an indirect block starts out empty, and is zeroed before
+             *  anything points at it */
+            if (level < levels)
+            {
+                fresh_block = zero_block (block);
+
+                if (fresh_block == NULL)
+                {
+                    free_block (inode, block);
+                    break;
+                }
+
+                buffer_release (fresh_block);
+            }
+            else if (fresh != NULL)
+            {
+                *fresh = true;
+            }
+
+            *slot = block;
+
+            if (holder != NULL)
+                buffer_dirty (holder);
+            else
+                write_inode (inode, false);
+        }
+
+        goal = block + 1;
+
+        if (holder != NULL)
+            buffer_release (holder);
+
+        holder = NULL;
+
+        if (level == levels)
+            return block;
+
+        holder = read_block (block);
+
+        if (holder == NULL)
+            return 0;
+
+        slot = (uint32_t *) holder->data + indices [level];
+    }
+
+    if (holder != NULL)
+        buffer_release (holder);
+
+    return 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate a block for a file, as close after goal as there is room,
+ *  and count it in the file's size on disk. Returns 0 if the disk is
+ *  full.
+ */
+    PRIVATE uint32_t
+allocate_block (inode, goal)
+    struct inode *inode;
+    uint32_t goal;              // block we would like
+{
+    uint32_t per_group = super->blocks_per_group;
+    uint32_t goal_group;
+
+    if (goal < super->first_data_block || goal >= super->blocks)
+        goal = super->first_data_block;
+
+    goal_group = (goal - super->first_data_block) / per_group;
+
+    for (uint32_t i = 0; i <= group_count; i ++)
+    {
+        uint32_t group_index = (goal_group + i) % group_count;
+        uint32_t first = super->first_data_block + group_index * per_group;
+        uint32_t bits = super->blocks - first < per_group ?
+          super->blocks - first : per_group;
+        uint32_t start = i == 0 ? goal - first : 0;
+        struct group_descriptor *group;
+        struct buffer *group_buffer;
+        struct buffer *bitmap;
+        int bit;
+
+        group = get_group (group_index, &group_buffer);
+
+        if (group == NULL)
+            return 0;
+
+        if (group->free_blocks == 0 ||
+          (bitmap = read_block (group->block_bitmap)) == NULL)
+        {
+            buffer_release (group_buffer);
+            continue;
+        }
+
+        bit = find_free_bit (bitmap->data, bits, start);
+
+        if (bit >= 0)
+        {
+            bitmap->data [bit / 8] |= 1 << (bit % 8);
+            buffer_dirty (bitmap);
+            group->free_blocks --;
+            buffer_dirty (group_buffer);
+            super->free_blocks --;
+            buffer_dirty (super_buffer);
+            inode->disk.sectors += sectors_per_block;
+        }
+
+        buffer_release (bitmap);
+        buffer_release (group_buffer);
+
+        if (bit >= 0)
+            return first + bit;
+    }
+
+    return 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Give back a block that allocate_block gave the file, when it turns
+ *  out not to be needed.
+ */
+    PRIVATE void
+free_block (inode, block)
+    struct inode *inode;
+    uint32_t block;
+{
+    uint32_t bit = (block - super->first_data_block) %
+      super->blocks_per_group;
+    struct group_descriptor *group;
+    struct buffer *group_buffer;
+    struct buffer *bitmap;
+
+    group = get_group ((block - super->first_data_block) /
+      super->blocks_per_group, &group_buffer);
+
+    if (group == NULL)
+        return;
+
+    bitmap = read_block (group->block_bitmap);
+
+    if (bitmap != NULL)
+    {
+        bitmap->data [bit / 8] &= ~(1 << (bit % 8));
+        buffer_dirty (bitmap);
+        buffer_release (bitmap);
+        group->free_blocks ++;
+        buffer_dirty (group_buffer);
+        super->free_blocks ++;
+        buffer_dirty (super_buffer);
+        inode->disk.sectors -= sectors_per_block;
+    }
+
+    buffer_release (group_buffer);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate an inode, in the goal group if there is room. Returns its
+ *  number, or 0 if there are none left.
+ */
+    PRIVATE uint32_t
+allocate_inode (goal_group, directory)
+    uint32_t goal_group;
+    bool directory;
+{
+    uint32_t per_group = super->inodes_per_group;
+
+    for (uint32_t i = 0; i < group_count; i ++)
+    {
+        uint32_t group_index = (goal_group + i) % group_count;
+        struct group_descriptor *group;
+        struct buffer *group_buffer;
+        struct buffer *bitmap;
+        uint32_t start = 0;
+        int bit;
+
+        /** the first inodes are reserved */
+        if (group_index * per_group < first_inode - 1)
+            start = first_inode - 1 - group_index * per_group;
+
+        if (start >= per_group)
+            continue;
+
+        group = get_group (group_index, &group_buffer);
+
+        if (group == NULL)
+            return 0;
+
+        if (group->free_inodes == 0 ||
+          (bitmap = read_block (group->inode_bitmap)) == NULL)
+        {
+            buffer_release (group_buffer);
+            continue;
+        }
+
+        bit = find_free_bit (bitmap->data, per_group, start);
+
+        /** the search wraps round, so it can find a reserved one */
+        if (bit >= 0 && (uint32_t) bit < start)
+            bit = -1;
+
+        if (bit >= 0)
+        {
+            bitmap->data [bit / 8] |= 1 << (bit % 8);
+            buffer_dirty (bitmap);
+            group->free_inodes --;
+
+            if (directory)
+                group->directories ++;
+
+            buffer_dirty (group_buffer);
+            super->free_inodes --;
+            buffer_dirty (super_buffer);
+        }
+
+        buffer_release (bitmap);
+        buffer_release (group_buffer);
+
+        if (bit >= 0)
+            return group_index * per_group + bit + 1;
+    }
+
+    return 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Give back an inode that allocate_inode gave out, when it turns out
+ *  not to be needed. The inode itself should have been cleared.
+ */
+    PRIVATE void
+free_inode (number, directory)
+    uint32_t number;
+    bool directory;
+{
+    uint32_t bit = (number - 1) % super->inodes_per_group;
+    struct group_descriptor *group;
+    struct buffer *group_buffer;
+    struct buffer *bitmap;
+
+    group = get_group ((number - 1) / super->inodes_per_group,
+      &group_buffer);
+
+    if (group == NULL)
+        return;
+
+    bitmap = read_block (group->inode_bitmap);
+
+    if (bitmap != NULL)
+    {
+        bitmap->data [bit / 8] &= ~(1 << (bit % 8));
+        buffer_dirty (bitmap);
+        buffer_release (bitmap);
+        group->free_inodes ++;
+
+        if (directory)
+            group->directories --;
+
+        buffer_dirty (group_buffer);
+        super->free_inodes ++;
+        buffer_dirty (super_buffer);
+    }
+
+    buffer_release (group_buffer);
+}
+
+/**********************************************************/
+
+/**
+ *  Find a clear bit in a bitmap, starting from start and wrapping round
+ *  to the beginning. Whole bytes of set bits are skipped. Returns -1 if
+ *  every bit is set.
+ */
+    PRIVATE int
+find_free_bit (bitmap, bits, start)
+    uint8_t *bitmap;
+    uint32_t bits;              // size of the bitmap
+    uint32_t start;
+{
+    uint32_t bit = start < bits ? start : 0;
+
+    for (uint32_t checked = 0; checked < bits; )
+    {
+        if ((bit & 7) == 0 && bits - bit >= 8 && bitmap [bit / 8] == 0xFF)
+        {
+            bit += 8;
+            checked += 8;
+        }
+        else
+        {
+            if (!(bitmap [bit / 8] & (1 << (bit & 7))))
+                return bit;
+
+            bit ++;
+            checked ++;
+        }
+
+        if (bit >= bits)
+            bit = 0;
+    }
+
+    return -1;
+}
+
+/**********************************************************/
+
+/**
+ *  Called before each block of a file is read. If the reader has gone
+ *  on from where it last was, and is getting close to the end of what
+ *  has been read ahead, start reading the next batch, which is twice
+ *  the size of the last, up to READ_AHEAD_MAX_BYTES. A read anywhere
+ *  else stops reading ahead until the reader goes in order again.
+ */
+    PRIVATE void
+read_ahead (inode, logical)
+    struct inode *inode;
+    uint32_t logical;           // block about to be read
+{
+    uint32_t file_blocks = (inode->disk.size + block_size - 1) / block_size;
+    uint32_t most = READ_AHEAD_MAX_BYTES / block_size;
+    uint32_t start;
+    uint32_t end;
+
+    if (logical + 1 == inode->next_block)
+        return;
+
+    if (logical != inode->next_block)
+    {
+        inode->window = 0;
+        inode->ahead = 0;
+        inode->next_block = logical + 1;
+        return;
+    }
+
+    inode->next_block = logical + 1;
+
+    if (inode->window == 0)
+        inode->window = READ_AHEAD_MIN_BYTES / block_size;
+
+    if (inode->ahead > logical + inode->window / 2)
+        return;
+
+    start = inode->ahead > logical ? inode->ahead : logical;
+    end = logical + 1 + inode->window;
+
+    if (end > file_blocks)
+        end = file_blocks;
+
+    if (start >= end)
+        return;
+
+    /** mapping the blocks can read indirect blocks, which would wait for
+     *  the plug to time out, so they are mapped once before plugging */
+    for (uint32_t block = start; block < end; block ++)
+        map_block (inode, block, false, NULL);
+
+    block_plug (disk);
+
+    for (uint32_t block = start; block < end; block ++)
+    {
+        uint32_t physical = map_block (inode, block, false, NULL);
+
+        if (physical != 0)
+        {
+            buffer_read_ahead (disk, first_sector +
+              (uint64_t) physical * sectors_per_block, block_size);
+        }
+    }
+
+    block_unplug (disk);
+
+    read_ahead_batches ++;
+    inode->ahead = end;
+
+    if (inode->window < most)
+        inode->window *= 2;
+}
+
+/**********************************************************/
+
+/**
+ *  Look up a name in a directory, through the directory entry cache.
+ *  Returns the inode number, or 0 if it is not there.
+ */
+    PRIVATE uint32_t
+lookup_name (directory, name, length)
+    struct inode *directory;
+    const char *name;
+    uint32_t length;
+{
+    uint32_t key = name_hash (directory->number, name, length);
+    uint32_t number;
+
+    if (length <= DENTRY_NAME_MAX)
+    {
+        for (struct cache_entry *entry = dentries.buckets [key %
+          CACHE_BUCKETS]; entry != NULL; entry = entry->hash_next)
+        {
+            struct dentry *dentry = (struct dentry *) entry;
+
+            if (entry->key == key && dentry->directory == directory->number
+              && dentry->length == length &&
+              memcompare (dentry->name, name, length) == 0)
+            {
+                dentries.hits ++;
+                cache_touch (&dentries, entry);
+                return dentry->inode;
+            }
+        }
+    }
+
+    dentries.misses ++;
+    number = search_directory (directory, name, length);
+    remember_name (directory->number, name, length, number);
+
+    return number;
+}
+
+/**********************************************************/
+
+/**
+ *  Look through the blocks of a directory for a name. Returns the inode
+ *  number, or 0 if it is not there.
+ */
+    PRIVATE uint32_t
+search_directory (directory, name, length)
+    struct inode *directory;
+    const char *name;
+    uint32_t length;
+{
+    uint32_t blocks = directory->disk.size / block_size;
+
+    for (uint32_t logical = 0; logical < blocks; logical ++)
+    {
+        uint32_t physical = map_block (directory, logical, false, NULL);
+        struct buffer *block;
+        uint32_t offset = 0;
+
+        if (physical == 0 || (block = read_block (physical)) == NULL)
+            continue;
+
+        while (offset + ENTRY_HEADER <= block_size)
+        {
+            struct dir_entry *entry =
+              (struct dir_entry *) (block->data + offset);
+
+            if (entry->length < ENTRY_HEADER)
+                break;
+
+            if (entry->inode != 0 && entry->name_length == length &&
+              memcompare (entry->name, name, length) == 0)
+            {
+                uint32_t number = entry->inode;
+
+                buffer_release (block);
+                return number;
+            }
+
+            offset += entry->length;
+        }
+
+        buffer_release (block);
+    }
+
+    return 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Add an entry to a directory, in the spare space at the end of an
+ *  existing entry if there is room, or else in a new block.
+ */
+    PRIVATE bool
+add_entry (directory, name, length, number, type)
+    struct inode *directory;
+    const char *name;
+    uint32_t length;
+    uint32_t number;            // inode it names
+    int type;
+{
+    uint32_t needed = ENTRY_SIZE (length);
+    uint32_t blocks = directory->disk.size / block_size;
+    struct dir_entry *entry = NULL;
+    struct buffer *block = NULL;
+
+    for (uint32_t logical = 0; logical < blocks && entry == NULL;
+      logical ++)
+    {
+        uint32_t physical = map_block (directory, logical, false, NULL);
+        uint32_t offset = 0;
+
+        if (physical == 0 || (block = read_block (physical)) == NULL)
+            continue;
+
+        while (offset + ENTRY_HEADER <= block_size)
+        {
+            struct dir_entry *old =
+              (struct dir_entry *) (block->data + offset);
+            uint32_t used = old->inode != 0 ?
+              ENTRY_SIZE (old->name_length) : 0;
+
+            if (old->length < ENTRY_HEADER)
+                break;
+
+            if (old->length >= used + needed)
+            {
+                if (used == 0)
+                {
+                    entry = old;
+                }
+                else
+                {
+                    entry = (struct dir_entry *) (block->data + offset +
+                      used);
+                    entry->length = old->length - used;
+                    old->length = used;
+                }
+
+                break;
+            }
+
+            offset += old->length;
+        }
+
+        if (entry == NULL)
+            buffer_release (block);
+    }
+
+    if (entry == NULL)
+    {
+        bool fresh;
+        uint32_t physical = map_block (directory, blocks, true, &fresh);
+
+        if (physical == 0 || (block = zero_block (physical)) == NULL)
+            return false;
+
+        entry = (struct dir_entry *) block->data;
+        entry->length = block_size;
+        directory->disk.size += block_size;
+    }
+
+    entry->inode = number;
+    entry->name_length = length;
+    entry->type = entry_types ? type : EXT2_TYPE_UNKNOWN;
+    memcopy (name, entry->name, length);
+    buffer_dirty (block);
+    buffer_release (block);
+
+    /** the hashed index no longer has every entry in it */
+    directory->disk.flags &= ~INODE_FLAG_INDEX;
+    write_inode (directory, false);
+
+    remember_name (directory->number, name, length, number);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Follow the first length characters of a path from the root, with the
+ *  filesystem locked. Returns the inode number, or 0 if it is not there.
+ */
+    PRIVATE uint32_t
+walk_path (path, length)
+    const char *path;
+    uint32_t length;
+{
+    uint32_t number = EXT2_ROOT_INODE;
+    uint32_t i = 0;
+
+    while (i < length)
+    {
+        struct inode *directory;
+        uint32_t start;
+
+        while (i < length && path [i] == '/')
+            i ++;
+
+        start = i;
+
+        while (i < length && path [i] != '/')
+            i ++;
+
+        if (i == start || (i - start == 1 && path [start] == '.'))
+            continue;
+
+        directory = get_inode (number);
+
+        if (directory == NULL)
+            return 0;
+
+        number = 0;
+
+        if ((directory->disk.mode & EXT2_MODE_TYPE) == EXT2_MODE_DIRECTORY)
+            number = lookup_name (directory, path + start, i - start);
+
+        put_inode (directory);
+
+        if (number == 0)
+            return 0;
+    }
+
+    return number;
+}
+
+/**********************************************************/
+
+/**
+ *  Hash a name in a directory, with FNV-1a.
+ */
+    PRIVATE uint32_t
+name_hash (directory, name, length)
+    uint32_t directory;
+    const char *name;
+    uint32_t length;
+{
+    return fnv_hash (FNV_BASIS ^ directory, name, length);
+}
+
+/**********************************************************/
+
+/**
+ *  Put the result of looking up a name in the directory entry cache, or
+ *  update it if it is there already. Long names are not kept.
+ */
+    PRIVATE void
+remember_name (directory, name, length, number)
+    uint32_t directory;
+    const char *name;
+    uint32_t length;
+    uint32_t number;            // 0 if it is not there
+{
+    uint32_t key = name_hash (directory, name, length);
+    struct dentry *dentry;
+
+    if (length > DENTRY_NAME_MAX)
+        return;
+
+    for (struct cache_entry *entry = dentries.buckets [key % CACHE_BUCKETS];
+      entry != NULL; entry = entry->hash_next)
+    {
+        dentry = (struct dentry *) entry;
+
+        if (entry->key == key && dentry->directory == directory &&
+          dentry->length == length &&
+          memcompare (dentry->name, name, length) == 0)
+        {
+            dentry->inode = number;
+            return;
+        }
+    }
+
+    dentry = (struct dentry *) cache_new (&dentries);
+
+    if (dentry == NULL)
+        return;
+
+    dentry->directory = directory;
+    dentry->inode = number;
+    dentry->length = length;
+    memcopy (name, dentry->name, length);
+    dentry->entry.key = key;
+    dentry->entry.references = 0;
+    cache_insert (&dentries, &dentry->entry);
+}
+
+/**********************************************************/
+
+/**
+ *  Get an entry for a cache: a new one while the cache is below its
+ *  limit, or else the least recently used one that is not referenced,
+ *  taken out of the cache. Returns NULL if there is none.
+ */
+    PRIVATE struct cache_entry *
+cache_new (cache)
+    struct cache *cache;
+{
+    struct cache_entry *entry;
+
+    if (cache->count < cache->limit)
+    {
+        entry = slab_alloc (cache->slab);
+
+        if (entry != NULL)
+        {
+            cache->count ++;
+            return entry;
+        }
+    }
+
+    for (entry = cache->tail; entry != NULL; entry = entry->lru_prev)
+    {
+        if (entry->references == 0)
+        {
+            cache_remove (cache, entry);
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Add an entry to a cache's hash table, at the front of its list.
+ */
+    PRIVATE void
+cache_insert (cache, entry)
+    struct cache *cache;
+    struct cache_entry *entry;
+{
+    struct cache_entry **bucket = &cache->buckets [entry->key %
+      CACHE_BUCKETS];
+
+    entry->hash_next = *bucket;
+    *bucket = entry;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->head;
+
+    if (cache->head != NULL)
+        cache->head->lru_prev = entry;
+    else
+        cache->tail = entry;
+
+    cache->head = entry;
+}
+
+/**********************************************************/
+
+/**
+ *  Take an entry out of a cache's hash table and list.
+ */
+    PRIVATE void
+cache_remove (cache, entry)
+    struct cache *cache;
+    struct cache_entry *entry;
+{
+    struct cache_entry **link = &cache->buckets [entry->key % CACHE_BUCKETS];
+
+    while (*link != entry)
+        link = &(*link)->hash_next;
+
+    *link = entry->hash_next;
+
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        cache->head = entry->lru_next;
+
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->tail = entry->lru_prev;
+}
+
+/**********************************************************/
+
+/**
+ *  Move an entry to the front of its cache's list.
+ */
+    PRIVATE void
+cache_touch (cache, entry)
+    struct cache *cache;
+    struct cache_entry *entry;
+{
+    if (cache->head == entry)
+        return;
+
+    entry->lru_prev->lru_next = entry->lru_next;
+
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        cache->tail = entry->lru_prev;
+
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->head;
+    cache->head->lru_prev = entry;
+    cache->head = entry;
+}
+
+/**********************************************************/
+
+/**
+ *  Free every entry of a cache that is not referenced.
+ */
+    PRIVATE void
+cache_clear (cache)
+    struct cache *cache;
+{
+    struct cache_entry *entry = cache->head;
+
+    while (entry != NULL)
+    {
+        struct cache_entry *next = entry->lru_next;
+
+        if (entry->references == 0)
+        {
+            cache_remove (cache, entry);
+            slab_free (cache->slab, entry);
+            cache->count --;
+        }
+
+        entry = next;
+    }
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
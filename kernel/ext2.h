@@ -0,0 +1,77 @@
+/**
+ *  The ext2 filesystem, on any block device, through the buffer cache.
+ *  One filesystem is mounted at a time, and files are named by path
+ *  from its root, or by inode number.
+ */
+
+#ifndef _EXT2_H
+#define _EXT2_H
+
+#include "stdint.h"
+#include "block.h"
+#include "utils.h"
+
+#define EXT2_NAME_MAX           255
+#define EXT2_ROOT_INODE         2
+
+/** types of directory entries */
+#define EXT2_TYPE_UNKNOWN       0
+#define EXT2_TYPE_FILE          1
+#define EXT2_TYPE_DIRECTORY     2
+
+/** the type bits of an inode's mode */
+#define EXT2_MODE_TYPE          0xF000
+#define EXT2_MODE_FILE          0x8000
+#define EXT2_MODE_DIRECTORY     0x4000
+
+/**********************************************************/
+
+/**
+ *  What ext2_stat says about a file.
+ */
+struct ext2_stat
+{
+    uint32_t inode;
+    uint16_t mode;
+    uint16_t links;
+    uint32_t size;
+    uint32_t blocks;            // in units of 512 bytes
+};
+
+/**
+ *  A directory entry, as returned by ext2_read_dir. The name is
+ *  terminated.
+ */
+struct ext2_dirent
+{
+    uint32_t inode;
+    int type;
+    uint32_t length;
+    char name [EXT2_NAME_MAX + 1];
+};
+
+/**********************************************************/
+
+void ext2_initialise (void);
+bool ext2_mount (struct block_device *device);
+bool ext2_mounted (void);
+uint32_t ext2_lookup (const char *path);
+bool ext2_stat (uint32_t inode, struct ext2_stat *stat);
+int32_t ext2_read (uint32_t inode, uint32_t offset, void *buffer,
+  uint32_t size);
+int32_t ext2_write (uint32_t inode, uint32_t offset, const void *buffer,
+  uint32_t size);
+uint32_t ext2_create (const char *path);
+bool ext2_read_dir (uint32_t inode, uint32_t *offset,
+  struct ext2_dirent *entry);
+bool ext2_sync (void);
+void ext2_drop_caches (void);
+void ext2_reset_stats (void);
+void ext2_dump_stats (void);
+
+/**********************************************************/
+
+
+#endif /** _EXT2_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,596 @@
+/**
+ *  Physical memory manager.
+ *
+ *  The memory map that the multiboot loader passes in is used to find the
+ *  RAM in the machine. Everything that is already in use when the kernel
+ *  starts is reserved: the first MiB, which holds the BIOS data, the
+ *  video memory and the boot stack; the kernel image; and the multiboot
+ *  information and modules. The rest is handed to a buddy allocator.
+ *
+ *  The buddy allocator deals in blocks of 2^order frames, aligned to
+ *  their size. There is a free list for each order. An allocation takes
+ *  a block from the list for the order wanted, or splits a bigger block
+ *  in half as many times as needed, putting the unused halves on the
+ *  lower lists. When a block is freed, it is merged with its buddy (the
+ *  other half of the block it was split from) for as long as the buddy
+ *  is also free. Both take at most MAX_FRAME_ORDER steps.
+ *
+ *  Each frame has a struct frame in a table, which is put in the first
+ *  place in memory that is big enough for it. The free lists are linked
+ *  through the table, so free memory itself is never touched.
+ *
+ *  Only memory in the direct map is managed, so that the kernel can get
+ *  at any frame it allocates without having to map it first.
+ */
+
+#include "frames.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "memutils.h"
+#include "multiboot.h"
+#include "output.h"
+#include "paging.h"
+#include "utils.h"
+
+/** the most ranges of memory of each kind that we keep track of */
+#define MAX_REGIONS             32
+#define MAX_RESERVED            32
+
+/** everything below 1 MiB is left alone */
+#define LOW_MEMORY_END          0x00100000
+
+
+/** round addresses to a frame boundary */
+#define FRAME_MASK              (FRAME_SIZE - 1)
+#define FRAME_ROUND_DOWN(x)     ((x) & ~(uint64_t) FRAME_MASK)
+#define FRAME_ROUND_UP(x)       FRAME_ROUND_DOWN ((x) + FRAME_MASK)
+
+/**********************************************************/
+
+/**
+ *  A range of physical memory, from start up to but not including end.
+ */
+struct range
+{
+    uint32_t start;
+    uint32_t end;
+};
+
+/**********************************************************/
+
+PRIVATE void read_memory_map (const struct multiboot_info *info);
+PRIVATE void add_region (uint64_t start, uint64_t end);
+PRIVATE void reserve (uint32_t start, uint32_t end);
+PRIVATE void reserve_multiboot (const struct multiboot_info *info);
+PRIVATE uint32_t string_end (uint32_t address);
+PRIVATE bool range_is_free (uint32_t start, uint32_t end);
+PRIVATE uint32_t find_free_range (uint32_t size);
+PRIVATE void release_range (uint32_t start, uint32_t end, int index);
+PRIVATE void add_block (uint32_t index, int order);
+PRIVATE void remove_block (struct frame *frame);
+PRIVATE void free_block (uint32_t index, int order);
+
+/**********************************************************/
+
+/** the kernel image, from the linker script */
+extern char kernel_start [];
+extern char kernel_end [];
+
+/** available memory, and memory that is in use already */
+PRIVATE struct range regions [MAX_REGIONS];
+PRIVATE int num_regions;
+PRIVATE struct range reserved [MAX_RESERVED];
+PRIVATE int num_reserved;
+
+/** the frame table, which covers all frames up to the end of the highest
+ *  available region */
+PRIVATE struct frame *frames;
+PRIVATE uint32_t num_frames;
+
+/** the number of frames given to the allocator, and free now */
+PRIVATE uint32_t total_frames;
+PRIVATE uint32_t free_frames;
+
+/** free blocks of each order, and how many there are */
+PRIVATE struct frame *free_lists [MAX_FRAME_ORDER + 1];
+PRIVATE uint32_t free_blocks [MAX_FRAME_ORDER + 1];
+
+/**********************************************************/
+
+/**
+ *  Find the available memory, set up the frame table, and free all of
+ *  the frames that are not in use.
+ */
+    PUBLIC void
+frames_initialise (info)
+    const struct multiboot_info *info;  // from the loader
+{
+    uint32_t table_size;
+    uint32_t table;
+
+    read_memory_map (info);
+
+    reserve (0, LOW_MEMORY_END);
+    reserve (virtual_to_physical (kernel_start),
+      virtual_to_physical (kernel_end));
+    reserve_multiboot (info);
+
+    for (int i = 0; i < num_regions; i ++)
+    {
+        if (regions [i].end >> FRAME_SHIFT > num_frames)
+            num_frames = regions [i].end >> FRAME_SHIFT;
+    }
+
+    table_size = FRAME_ROUND_UP (num_frames * sizeof (struct frame));
+    table = find_free_range (table_size);
+
+    if (table == 0)
+        panic ("No room for a frame table of %u KiB\n", table_size >> 10);
+
+    reserve (table, table + table_size);
+    frames = physical_to_virtual (table);
+    memset (frames, 0, table_size);
+
+    for (int i = 0; i < num_regions; i ++)
+        release_range (regions [i].start, regions [i].end, 0);
+
+    kprintf ("memory: %u MiB in %u frames, %u KiB frame table\n",
+      total_frames >> (20 - FRAME_SHIFT), total_frames, table_size >> 10);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate a block of 2^order frames, aligned to its size. Returns the
+ *  physical address of the block, or 0 if there is no block that big
+ *  free. Frame 0 is always reserved, so 0 is never a valid block.
+ */
+    PUBLIC uint32_t
+frame_alloc (order)
+    int order;
+{
+    uint32_t flags;
+    struct frame *frame;
+    uint32_t index;
+    int found = order;
+
+    if (order < 0 || order > MAX_FRAME_ORDER)
+        return 0;
+
+    flags = interrupts_save ();
+
+    while (found <= MAX_FRAME_ORDER && free_lists [found] == NULL)
+        found ++;
+
+    if (found > MAX_FRAME_ORDER)
+    {
+        interrupts_restore (flags);
+        return 0;
+    }
+
+    frame = free_lists [found];
+    remove_block (frame);
+    index = frame - frames;
+
+    // give back the upper half of the block until it is the right size.
+    while (found > order)
+    {
+        found --;
+        add_block (index + (1 << found), found);
+    }
+
+    frame->order = order;
+    free_frames -= 1 << order;
+
+    interrupts_restore (flags);
+
+    return index << FRAME_SHIFT;
+}
+
+/**********************************************************/
+
+/**
+ *  Free a block of frames allocated by frame_alloc. The order must be
+ *  the one that it was allocated with.
+ */
+    PUBLIC void
+frame_free (address, order)
+    uint32_t address;           // physical address of the block
+    int order;                  // as passed to frame_alloc
+{
+    uint32_t index = address >> FRAME_SHIFT;
+    uint32_t flags;
+
+    if (order < 0 || order > MAX_FRAME_ORDER || index >= num_frames
+      || (frames [index].flags & FRAME_FREE)
+      || (index & ((1 << order) - 1)) != 0)
+        panic ("Bad frame free: %p order %d\n", address, order);
+
+    flags = interrupts_save ();
+    free_frames += 1 << order;
+    free_block (index, order);
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the smallest order of block that holds size bytes, which is
+ *  more than MAX_FRAME_ORDER if no block does.
+ */
+    PUBLIC int
+frame_order (size)
+    uint32_t size;
+{
+    int order = 0;
+
+    while (order <= MAX_FRAME_ORDER && (uint32_t) FRAME_SIZE << order < size)
+        order ++;
+
+    return order;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the frame table entry for the frame that an address is in.
+ */
+    PUBLIC struct frame *
+frame_lookup (address)
+    uint32_t address;
+{
+    return &frames [address >> FRAME_SHIFT];
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the number of frames that are free.
+ */
+    PUBLIC uint32_t
+frames_free_count (void)
+{
+    return free_frames;
+}
+
+/**
+ *  Returns the number of free blocks of the given order.
+ */
+    PUBLIC uint32_t
+frames_free_blocks (order)
+    int order;
+{
+    return free_blocks [order];
+}
+
+/**
+ *  Returns the number of frames managed by the allocator, free or not.
+ */
+    PUBLIC uint32_t
+frames_total (void)
+{
+    return total_frames;
+}
+
+/**********************************************************/
+
+/**
+ *  Build the list of available memory regions, from the memory map if
+ *  there is one, or otherwise from the memory sizes.
+ */
+    PRIVATE void
+read_memory_map (info)
+    const struct multiboot_info *info;
+{
+    if (info->flags & MULTIBOOT_INFO_MMAP)
+    {
+        uint32_t address = info->mmap_addr;
+        uint32_t end = info->mmap_addr + info->mmap_length;
+
+        while (address < end)
+        {
+            const struct multiboot_mmap_entry *entry =
+                physical_to_virtual (address);
+
+            if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+                add_region (entry->address, entry->address + entry->length);
+
+            address += entry->size + sizeof (entry->size);
+        }
+    }
+    else if (info->flags & MULTIBOOT_INFO_MEMORY)
+    {
+        add_region (0, (uint64_t) info->mem_lower << 10);
+        add_region (LOW_MEMORY_END,
+          LOW_MEMORY_END + ((uint64_t) info->mem_upper << 10));
+    }
+    else
+    {
+        panic ("The loader did not say how much memory there is\n");
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Add a region of available memory, leaving out any partial frames at
+ *  either end and anything past the end of the direct map.
+ */
+    PRIVATE void
+add_region (start, end)
+    uint64_t start;
+    uint64_t end;
+{
+    start = FRAME_ROUND_UP (start);
+    end = FRAME_ROUND_DOWN (end);
+
+    if (end > DIRECT_MAP_SIZE)
+        end = DIRECT_MAP_SIZE;
+
+    if (start >= end)
+        return;
+
+    if (num_regions == MAX_REGIONS)
+    {
+        kprintf ("memory: too many regions, ignoring %p\n",
+          (uint32_t) start);
+        return;
+    }
+
+    regions [num_regions].start = (uint32_t) start;
+    regions [num_regions].end = (uint32_t) end;
+    num_regions ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Mark a range of memory as in use, rounding it out to whole frames.
+ */
+    PRIVATE void
+reserve (start, end)
+    uint32_t start;
+    uint32_t end;
+{
+    if (num_reserved == MAX_RESERVED)
+        panic ("Too many reserved memory ranges\n");
+
+    reserved [num_reserved].start = FRAME_ROUND_DOWN (start);
+    reserved [num_reserved].end = FRAME_ROUND_UP ((uint64_t) end);
+    num_reserved ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Reserve the multiboot info structure, and everything it points to that
+ *  the kernel may still want once it is up and running.
+ */
+    PRIVATE void
+reserve_multiboot (info)
+    const struct multiboot_info *info;
+{
+    reserve (virtual_to_physical (info), virtual_to_physical (info + 1));
+
+    if (info->flags & MULTIBOOT_INFO_MMAP)
+        reserve (info->mmap_addr, info->mmap_addr + info->mmap_length);
+
+    if (info->flags & MULTIBOOT_INFO_CMDLINE)
+        reserve (info->cmdline, string_end (info->cmdline));
+
+    if (info->flags & MULTIBOOT_INFO_MODULES)
+    {
+        const struct multiboot_module *modules =
+            physical_to_virtual (info->mods_addr);
+
+        reserve (info->mods_addr,
+          virtual_to_physical (modules + info->mods_count));
+
+        for (uint32_t i = 0; i < info->mods_count; i ++)
+        {
+            reserve (modules [i].mod_start, modules [i].mod_end);
+
+            if (modules [i].string != 0)
+                reserve (modules [i].string, string_end (modules [i].string));
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the address just past the terminating NUL of a string.
+ */
+    PRIVATE uint32_t
+string_end (address)
+    uint32_t address;
+{
+    const char *string = physical_to_virtual (address);
+
+    while (*string != '\0')
+        string ++;
+
+    return virtual_to_physical (string + 1);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if the range is all in one available region, and does
+ *  not overlap any reserved range.
+ */
+    PRIVATE bool
+range_is_free (start, end)
+    uint32_t start;
+    uint32_t end;
+{
+    bool available = false;
+
+    for (int i = 0; i < num_regions; i ++)
+    {
+        if (regions [i].start <= start && end <= regions [i].end)
+            available = true;
+    }
+
+    for (int i = 0; i < num_reserved && available; i ++)
+    {
+        if (reserved [i].start < end && start < reserved [i].end)
+            available = false;
+    }
+
+    return available;
+}
+
+/**********************************************************/
+
+/**
+ *  Find the lowest free range of memory of the given size. The lowest
+ *  one must start either at the start of an available region, or at the
+ *  end of a reserved range, so only those places are tried. Returns 0 if
+ *  there is nowhere big enough.
+ */
+    PRIVATE uint32_t
+find_free_range (size)
+    uint32_t size;
+{
+    uint32_t best = 0;
+
+    for (int i = 0; i < num_regions + num_reserved; i ++)
+    {
+        uint32_t start = i < num_regions ? regions [i].start :
+            reserved [i - num_regions].end;
+
+        if (start + size > start && range_is_free (start, start + size)
+          && (best == 0 || start < best))
+            best = start;
+    }
+
+    return best;
+}
+
+/**********************************************************/
+
+/**
+ *  Give the frames of an available range of memory to the allocator,
+ *  except for those that are reserved. The parts of the range either
+ *  side of the first reserved range that overlaps it are released
+ *  recursively, only checking the reserved ranges after that one.
+ */
+    PRIVATE void
+release_range (start, end, index)
+    uint32_t start;
+    uint32_t end;
+    int index;                  // first reserved range to check
+{
+    uint32_t first = start >> FRAME_SHIFT;
+    uint32_t last = end >> FRAME_SHIFT;
+
+    for (; index < num_reserved; index ++)
+    {
+        const struct range *range = &reserved [index];
+
+        if (range->start < end && start < range->end)
+        {
+            if (start < range->start)
+                release_range (start, range->start, index + 1);
+
+            if (range->end < end)
+                release_range (range->end, end, index + 1);
+
+            return;
+        }
+    }
+
+    // free the range in the biggest aligned blocks that fit.
+    while (first < last)
+    {
+        int order = 0;
+
+        while (order < MAX_FRAME_ORDER
+          && (first & ((2 << order) - 1)) == 0
+          && first + (2 << order) <= last)
+            order ++;
+
+        free_block (first, order);
+        total_frames += 1 << order;
+        free_frames += 1 << order;
+        first += 1 << order;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Put a block on the free list for its order.
+ */
+    PRIVATE void
+add_block (index, order)
+    uint32_t index;             // first frame of the block
+    int order;
+{
+    struct frame *frame = &frames [index];
+
+    frame->order = order;
+    frame->flags |= FRAME_FREE;
+
+    frame->next = free_lists [order];
+    frame->pprev = &free_lists [order];
+
+    if (frame->next != NULL)
+        frame->next->pprev = &frame->next;
+
+    free_lists [order] = frame;
+    free_blocks [order] ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a block off its free list.
+ */
+    PRIVATE void
+remove_block (frame)
+    struct frame *frame;        // first frame of the block
+{
+    *frame->pprev = frame->next;
+
+    if (frame->next != NULL)
+        frame->next->pprev = frame->pprev;
+
+    frame->next = NULL;
+    frame->pprev = NULL;
+    frame->flags &= ~FRAME_FREE;
+    free_blocks [frame->order] --;
+}
+
+/**********************************************************/
+
+/**
+ *  Free a block, merging it with its buddy for as long as the buddy is a
+ *  free block of the same size. Frames that were never given to the
+ *  allocator are never marked free, so nothing is merged with them.
+ */
+    PRIVATE void
+free_block (index, order)
+    uint32_t index;
+    int order;
+{
+    while (order < MAX_FRAME_ORDER)
+    {
+        uint32_t buddy = index ^ (1 << order);
+
+        if (buddy >= num_frames || !(frames [buddy].flags & FRAME_FREE)
+          || frames [buddy].order != order)
+            break;
+
+        remove_block (&frames [buddy]);
+        index &= ~(1 << order);
+        order ++;
+    }
+
+    add_block (index, order);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
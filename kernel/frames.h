@@ -0,0 +1,59 @@
+/**
+ *  Physical memory, managed in page frames by a buddy allocator.
+ */
+
+#ifndef _FRAMES_H
+#define _FRAMES_H
+
+#include "stdint.h"
+#include "multiboot.h"
+#include "utils.h"
+
+#define FRAME_SHIFT             12
+#define FRAME_SIZE              (1 << FRAME_SHIFT)
+
+/** blocks of up to 2^MAX_FRAME_ORDER frames (4 MiB) can be allocated */
+#define MAX_FRAME_ORDER         10
+
+/** values of the flags field of struct frame */
+#define FRAME_FREE              0x01
+#define FRAME_SLAB              0x02
+
+/**********************************************************/
+
+/**
+ *  Everything we keep track of about a page frame. There is one of these
+ *  for every frame of physical memory, so it should stay small.
+ */
+struct frame
+{
+    /** links in the free list for the block size, if this is the first
+     *  frame of a free block */
+    struct frame *next;
+    struct frame **pprev;
+
+    /** size of the block this frame starts, as a power of two */
+    uint8_t order;
+    uint8_t flags;
+
+    /** for frames of a slab, the slab that the frame is part of */
+    void *owner;
+};
+
+/**********************************************************/
+
+void frames_initialise (const struct multiboot_info *info);
+uint32_t frame_alloc (int order);
+void frame_free (uint32_t address, int order);
+int frame_order (uint32_t size);
+uint32_t frames_free_count (void);
+uint32_t frames_free_blocks (int order);
+uint32_t frames_total (void);
+struct frame *frame_lookup (uint32_t address);
+
+/**********************************************************/
+
+
+#endif /** _FRAMES_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,944 @@
+/**
+ *  Driver for ATA disks on an IDE controller.
+ *
+ *  The controller is found on the PCI bus. Each of its two channels is
+ *  either at the legacy ISA ports and IRQs, or, in native mode, wherever
+ *  its BARs say. If there is no PCI IDE controller, the legacy ports are
+ *  tried anyway, without DMA.
+ *
+ *  Each drive is registered with the block layer, as "hda" and so on,
+ *  and transfers come through it. Each is up to IDE_MAX_SECTORS sectors,
+ *  possibly gathered from the buffers of several requests, and completes
+ *  by interrupt:
+ *
+ *  - with bus master DMA, the buffers are described to the controller by
+ *    a table of physical regions (PRDs), built a page at a time from the
+ *    page tables so that any mapped kernel buffer will do. Contiguous
+ *    pages share a region, as long as it does not cross a 64 KiB
+ *    boundary, which the controller does not allow. The controller moves
+ *    the data and interrupts once at the end.
+ *  - with programmed IO, the drive interrupts once per sector, and the
+ *    interrupt handler moves the sector through the data port with a
+ *    single rep insw or rep outsw.
+ *
+ *  Only one transfer is in progress on a channel at a time, and the two
+ *  drives on a channel take turns. The next transfer is started from
+ *  the interrupt handler of the last.
+ */
+
+#include "ide.h"
+#include "stdint.h"
+#include "block.h"
+#include "clock.h"
+#include "cpu.h"
+#include "frames.h"
+#include "io.h"
+#include "irq.h"
+#include "lock.h"
+#include "output.h"
+#include "paging.h"
+#include "pci.h"
+#include "utils.h"
+
+/** the legacy ports and IRQs of each channel */
+#define PRIMARY_PORT            0x1F0
+#define PRIMARY_CONTROL         0x3F6
+#define SECONDARY_PORT          0x170
+#define SECONDARY_CONTROL       0x376
+
+/** offsets of the command block registers from the channel's port */
+#define DATA                    0
+#define ERROR                   1
+#define FEATURES                1
+#define SECTOR_COUNT            2
+#define LBA_LOW                 3
+#define LBA_MID                 4
+#define LBA_HIGH                5
+#define DRIVE_SELECT            6
+#define STATUS                  7
+#define COMMAND                 7
+
+/** the control port reads as the alternate status register, which does
+ *  not acknowledge an interrupt, and is written as the device control
+ *  register */
+#define CONTROL_NO_INTERRUPT    0x02
+
+/** status register */
+#define STATUS_ERROR            0x01
+#define STATUS_DRQ              0x08
+#define STATUS_FAULT            0x20
+#define STATUS_READY            0x40
+#define STATUS_BUSY             0x80
+
+/** value of the status register when there is nothing on the channel */
+#define STATUS_FLOATING         0xFF
+
+/** drive select register: use LBA, the slave, and the top 4 bits of a
+ *  28 bit LBA */
+#define SELECT_LBA              0xE0
+#define SELECT_SLAVE            0x10
+
+/** commands */
+#define COMMAND_READ_PIO        0x20
+#define COMMAND_READ_PIO_EXT    0x24
+#define COMMAND_READ_DMA        0xC8
+#define COMMAND_READ_DMA_EXT    0x25
+#define COMMAND_WRITE_PIO       0x30
+#define COMMAND_WRITE_PIO_EXT   0x34
+#define COMMAND_WRITE_DMA       0xCA
+#define COMMAND_WRITE_DMA_EXT   0x35
+#define COMMAND_IDENTIFY        0xEC
+
+/** words of the IDENTIFY data */
+#define IDENTIFY_WORDS          256
+#define ID_MODEL                27
+#define ID_MODEL_WORDS          20
+#define ID_CAPABILITIES         49
+#define ID_LBA28_SECTORS        60
+#define ID_COMMAND_SETS         83
+#define ID_LBA48_SECTORS        100
+
+#define CAPABILITY_DMA          0x0100
+#define CAPABILITY_LBA          0x0200
+#define COMMAND_SET_LBA48       0x0400
+
+/** a 28 bit LBA can address this many sectors */
+#define LBA28_LIMIT             (1u << 28)
+
+/** the bus master registers of the secondary channel follow those of
+ *  the primary */
+#define BUS_MASTER_SECONDARY    8
+
+/** offsets of the bus master registers */
+#define BM_COMMAND              0
+#define BM_STATUS               2
+#define BM_PRD_TABLE            4
+
+/** bus master command register. With BM_READ set, the controller writes
+ *  to memory, for a read from the disk. */
+#define BM_START                0x01
+#define BM_READ                 0x08
+
+/** bus master status register. The error and interrupt bits are cleared
+ *  by writing 1 to them. */
+#define BM_ACTIVE               0x01
+#define BM_ERROR                0x02
+#define BM_INTERRUPT            0x04
+
+/** prog_if bits of an IDE controller */
+#define PROG_IF_PRIMARY_NATIVE  0x01
+#define PROG_IF_SECONDARY_NATIVE 0x04
+#define PROG_IF_BUS_MASTER      0x80
+
+/** BAR of the bus master registers */
+#define BUS_MASTER_BAR          4
+
+/** the last entry in a PRD table has this flag. A region cannot cross
+ *  a 64 KiB boundary, and a size of 0 means 64 KiB. The table takes a
+ *  page, and a region never covers less than part of a page, so the
+ *  block layer is told how many pages a transfer can span. */
+#define PRD_END                 0x8000
+#define PRD_BOUNDARY            0x10000
+#define PRD_ENTRIES             (PAGE_SIZE / sizeof (struct prd))
+
+/** how long to wait for a drive to be ready */
+#define READY_TIMEOUT_NS        NS_PER_SECOND
+
+#define NUM_CHANNELS            2
+
+/**********************************************************/
+
+/**
+ *  An entry in a PRD table.
+ */
+struct prd
+{
+    uint32_t address;
+    uint16_t size;
+    uint16_t flags;
+}
+__attribute__ ((packed));
+
+struct ide_channel
+{
+    uint16_t port;
+    uint16_t control;
+
+    /** bus master registers, or 0 if the channel cannot do DMA */
+    uint16_t bus_master;
+    int irq;
+
+    struct prd *prd_table;
+    uint32_t prd_physical;
+
+    /** transfers waiting for the channel, and the one using it */
+    struct block_request *waiting;
+    struct block_request *waiting_tail;
+    struct block_request *request;
+    struct spinlock lock;
+
+    /** the transfer in progress. The interrupt handler only looks at
+     *  these while active is set. A PIO transfer moves the sectors of
+     *  each part of the request in turn. */
+    bool active;
+    bool dma;
+    bool write;
+    struct block_request *part;
+    uint8_t *buffer;
+    uint32_t part_left;         // sectors left in the part
+    uint32_t remaining;         // sectors left in all
+};
+
+struct ide_drive
+{
+    struct ide_channel *channel;
+    bool slave;
+    bool lba48;
+    bool dma;
+    uint32_t sectors;
+    char model [ID_MODEL_WORDS * 2 + 1];
+    struct block_device block;
+};
+
+/**********************************************************/
+
+PRIVATE void setup_channel (struct ide_channel *channel, uint16_t port,
+  uint16_t control, uint16_t bus_master, int irq);
+PRIVATE void probe_drive (struct ide_channel *channel, bool slave);
+PRIVATE void register_drive (struct ide_drive *drive, int index);
+PRIVATE void ide_start (struct block_device *device,
+  struct block_request *list);
+PRIVATE void start_next (struct ide_channel *channel,
+  struct block_request ***done);
+PRIVATE bool issue (struct ide_channel *channel,
+  struct block_request *request);
+PRIVATE bool build_prd_table (struct ide_channel *channel,
+  struct block_request *request);
+PRIVATE void next_sector (struct ide_channel *channel);
+PRIVATE void finish (struct ide_channel *channel, bool error,
+  struct block_request ***done);
+PRIVATE uint8_t wait_not_busy (struct ide_channel *channel);
+PRIVATE void select_delay (struct ide_channel *channel);
+PRIVATE void ide_interrupt (int irq);
+PRIVATE void channel_interrupt (struct ide_channel *channel);
+PRIVATE void service (struct ide_channel *channel,
+  struct block_request ***done);
+
+/**********************************************************/
+
+PRIVATE struct ide_channel channels [NUM_CHANNELS];
+PRIVATE struct ide_drive drives [IDE_MAX_DRIVES];
+PRIVATE int drive_count;
+
+PRIVATE const char *drive_names [IDE_MAX_DRIVES] =
+  { "hda", "hdb", "hdc", "hdd" };
+
+/** false to make transfers by programmed IO even if DMA is possible */
+PRIVATE bool use_dma = true;
+
+/** cycles spent issuing transfers and in the interrupt handler */
+PRIVATE uint64_t cpu_cycles;
+
+/**********************************************************/
+
+/**
+ *  Find the controller and the drives on it. Drives are numbered in the
+ *  order primary master, primary slave, secondary master, secondary
+ *  slave, skipping any that are not there.
+ */
+    PUBLIC void
+ide_initialise (void)
+{
+    struct pci_device *device =
+      pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    uint16_t ports [NUM_CHANNELS] = { PRIMARY_PORT, SECONDARY_PORT };
+    uint16_t controls [NUM_CHANNELS] = { PRIMARY_CONTROL, SECONDARY_CONTROL };
+    int irqs [NUM_CHANNELS] = { IRQ_PRIMARY_ATA, IRQ_SECONDARY_ATA };
+    uint16_t bus_master = 0;
+
+    if (device != NULL)
+    {
+        uint8_t native [NUM_CHANNELS] =
+          { PROG_IF_PRIMARY_NATIVE, PROG_IF_SECONDARY_NATIVE };
+
+        for (int i = 0; i < NUM_CHANNELS; i ++)
+        {
+            if (device->prog_if & native [i])
+            {
+                ports [i] = device->bars [i * 2] & PCI_BAR_IO_MASK;
+                controls [i] = (device->bars [i * 2 + 1] & PCI_BAR_IO_MASK)
+                  + 2;
+                irqs [i] = device->irq;
+            }
+        }
+
+        if (device->prog_if & PROG_IF_BUS_MASTER)
+        {
+            bus_master = device->bars [BUS_MASTER_BAR] & PCI_BAR_IO_MASK;
+            pci_enable (device, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+        }
+        else
+        {
+            pci_enable (device, PCI_COMMAND_IO);
+        }
+    }
+
+    for (int i = 0; i < NUM_CHANNELS; i ++)
+    {
+        setup_channel (&channels [i], ports [i], controls [i],
+          bus_master == 0 ? 0 : bus_master + i * BUS_MASTER_SECONDARY,
+          irqs [i]);
+    }
+
+    for (int i = 0; i < drive_count; i ++)
+    {
+        register_drive (&drives [i], i);
+        kprintf ("ide: drive %u, %s, %u MiB, %s\n", i, drives [i].model,
+          drives [i].sectors / (1024 * 1024 / IDE_SECTOR_SIZE),
+          drives [i].dma ? "dma" : "pio");
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  The number of drives found, and the size of each in sectors.
+ */
+    PUBLIC int
+ide_drive_count (void)
+{
+    return drive_count;
+}
+
+    PUBLIC uint32_t
+ide_drive_sectors (drive)
+    int drive;
+{
+    return drives [drive].sectors;
+}
+
+/**********************************************************/
+
+/**
+ *  Read or write count sectors starting at sector lba, through the block
+ *  layer, blocking until the transfer is done. The buffer can be
+ *  anywhere in kernel memory that is mapped, but must be 2 byte aligned.
+ *  Returns false if the request was out of range or the drive reported
+ *  an error.
+ */
+    PUBLIC bool
+ide_read (drive, lba, count, buffer)
+    int drive;                  // index from 0 to ide_drive_count () - 1
+    uint32_t lba;               // first sector
+    uint32_t count;             // 1 to IDE_MAX_SECTORS
+    void *buffer;
+{
+    if (drive < 0 || drive >= drive_count)
+        return false;
+
+    return block_read (&drives [drive].block, lba, count, buffer);
+}
+
+    PUBLIC bool
+ide_write (drive, lba, count, buffer)
+    int drive;
+    uint32_t lba;
+    uint32_t count;
+    const void *buffer;
+{
+    if (drive < 0 || drive >= drive_count)
+        return false;
+
+    return block_write (&drives [drive].block, lba, count, buffer);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if the controller can do bus master DMA.
+ */
+    PUBLIC bool
+ide_dma_available (void)
+{
+    return channels [0].bus_master != 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Choose between DMA, where the controller and drive support it, and
+ *  programmed IO, for the transfers that follow.
+ */
+    PUBLIC void
+ide_use_dma (enabled)
+    bool enabled;
+{
+    use_dma = enabled;
+}
+
+/**********************************************************/
+
+/**
+ *  The number of cycles that the processor has spent on transfers,
+ *  setting them up and handling their interrupts, but not waiting for
+ *  them.
+ */
+    PUBLIC uint64_t
+ide_cpu_cycles (void)
+{
+    return cpu_cycles;
+}
+
+/**********************************************************/
+
+/**
+ *  Set up a channel and look for its drives. The drives' interrupts are
+ *  disabled while they are identified, since that is done by polling.
+ */
+    PRIVATE void
+setup_channel (channel, port, control, bus_master, irq)
+    struct ide_channel *channel;
+    uint16_t port;              // command block registers
+    uint16_t control;           // device control register
+    uint16_t bus_master;        // bus master registers, or 0
+    int irq;
+{
+    int first_drive = drive_count;
+
+    channel->port = port;
+    channel->control = control;
+    channel->bus_master = bus_master;
+    channel->irq = irq;
+
+    if (inb (port + STATUS) == STATUS_FLOATING)
+        return;
+
+    outb (control, CONTROL_NO_INTERRUPT);
+    probe_drive (channel, false);
+    probe_drive (channel, true);
+    outb (control, 0);
+
+    if (drive_count == first_drive)
+        return;
+
+    if (bus_master != 0)
+    {
+        channel->prd_physical = frame_alloc (0);
+
+        if (channel->prd_physical == 0)
+            channel->bus_master = 0;
+        else
+            channel->prd_table = physical_to_virtual (channel->prd_physical);
+    }
+
+    irq_register (irq, ide_interrupt);
+}
+
+/**********************************************************/
+
+/**
+ *  Identify the master or slave drive on a channel, and add it to the
+ *  list of drives if it is an ATA disk. ATAPI devices abort IDENTIFY,
+ *  and are skipped.
+ */
+    PRIVATE void
+probe_drive (channel, slave)
+    struct ide_channel *channel;
+    bool slave;
+{
+    struct ide_drive *drive = &drives [drive_count];
+    uint16_t identify [IDENTIFY_WORDS];
+    uint8_t status;
+
+    outb (channel->port + DRIVE_SELECT, SELECT_LBA |
+      (slave ? SELECT_SLAVE : 0));
+    select_delay (channel);
+
+    outb (channel->port + SECTOR_COUNT, 0);
+    outb (channel->port + LBA_LOW, 0);
+    outb (channel->port + LBA_MID, 0);
+    outb (channel->port + LBA_HIGH, 0);
+    outb (channel->port + COMMAND, COMMAND_IDENTIFY);
+
+    if (inb (channel->port + STATUS) == 0)
+        return;
+
+    status = wait_not_busy (channel);
+
+    if (status & (STATUS_BUSY | STATUS_ERROR) || !(status & STATUS_DRQ))
+        return;
+
+    insw (channel->port + DATA, identify, IDENTIFY_WORDS);
+
+    if (!(identify [ID_CAPABILITIES] & CAPABILITY_LBA))
+        return;
+
+    drive->channel = channel;
+    drive->slave = slave;
+    drive->dma = (identify [ID_CAPABILITIES] & CAPABILITY_DMA) != 0;
+    drive->lba48 = (identify [ID_COMMAND_SETS] & COMMAND_SET_LBA48) != 0;
+
+    /** a 32 bit sector count is enough for 2 TiB */
+    if (drive->lba48)
+        drive->sectors = identify [ID_LBA48_SECTORS] |
+          (uint32_t) identify [ID_LBA48_SECTORS + 1] << 16;
+    else
+        drive->sectors = identify [ID_LBA28_SECTORS] |
+          (uint32_t) identify [ID_LBA28_SECTORS + 1] << 16;
+
+    /** the model name is in words of two characters, high byte first,
+     *  padded with spaces */
+    for (int i = 0; i < ID_MODEL_WORDS; i ++)
+    {
+        drive->model [i * 2] = (char) (identify [ID_MODEL + i] >> 8);
+        drive->model [i * 2 + 1] = (char) identify [ID_MODEL + i];
+    }
+
+    drive->model [ID_MODEL_WORDS * 2] = '\0';
+
+    for (int i = ID_MODEL_WORDS * 2 - 1; i > 0 && drive->model [i] == ' ';
+      i --)
+    {
+        drive->model [i] = '\0';
+    }
+
+    drive_count ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Describe a drive to the block layer. The channel takes one transfer
+ *  at a time, so the block layer keeps the rest, where they can still
+ *  be merged.
+ */
+    PRIVATE void
+register_drive (drive, index)
+    struct ide_drive *drive;
+    int index;
+{
+    drive->block.name = drive_names [index];
+    drive->block.sectors = drive->sectors;
+    drive->block.max_sectors = IDE_MAX_SECTORS;
+    drive->block.max_segments = PRD_ENTRIES;
+    drive->block.queue_depth = 1;
+    drive->block.start = ide_start;
+    drive->block.data = drive;
+
+    block_register (&drive->block);
+}
+
+/**********************************************************/
+
+/**
+ *  The block layer's start function. Adds a list of transfers to those
+ *  waiting for the drive's channel, and starts the first if the channel
+ *  is free.
+ */
+    PRIVATE void
+ide_start (device, list)
+    struct block_device *device;
+    struct block_request *list;
+{
+    struct ide_drive *drive = device->data;
+    struct ide_channel *channel = drive->channel;
+    struct block_request *done = NULL;
+    struct block_request **tail = &done;
+    uint64_t begin = read_tsc ();
+    uint32_t flags = spin_acquire_irqsave (&channel->lock);
+
+    if (channel->waiting == NULL)
+        channel->waiting = list;
+    else
+        channel->waiting_tail->next = list;
+
+    while (list->next != NULL)
+        list = list->next;
+
+    channel->waiting_tail = list;
+    start_next (channel, &tail);
+
+    cpu_cycles += read_tsc () - begin;
+    spin_release_irqrestore (&channel->lock, flags);
+
+    block_complete_list (done);
+}
+
+/**********************************************************/
+
+/**
+ *  Start the next waiting transfer if the channel is free, with its lock
+ *  held. Any that cannot be started are added to the done list with an
+ *  error.
+ */
+    PRIVATE void
+start_next (channel, done)
+    struct ide_channel *channel;
+    struct block_request ***done;   // tail of the list of finished ones
+{
+    while (channel->request == NULL && channel->waiting != NULL)
+    {
+        struct block_request *request = channel->waiting;
+
+        channel->waiting = request->next;
+        request->next = NULL;
+
+        if (!issue (channel, request))
+        {
+            request->error = true;
+            **done = request;
+            *done = &request->next;
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Program the drive's registers and send the command. For a DMA
+ *  transfer the controller is started after the command, and for a PIO
+ *  write the first sector is written once the drive asks for it; the
+ *  interrupt handler does the rest. Returns false if the drive is not
+ *  ready.
+ */
+    PRIVATE bool
+issue (channel, request)
+    struct ide_channel *channel;
+    struct block_request *request;
+{
+    struct ide_drive *drive = request->device->data;
+    uint16_t port = channel->port;
+    uint32_t lba = (uint32_t) request->sector;
+    uint32_t count = request->total;
+    bool write = request->write;
+    bool lba48 = drive->lba48 && (lba + count > LBA28_LIMIT);
+    uint8_t select = SELECT_LBA | (drive->slave ? SELECT_SLAVE : 0);
+    uint8_t command;
+    bool dma;
+
+    dma = use_dma && drive->dma && channel->bus_master != 0 &&
+      build_prd_table (channel, request);
+
+    if (wait_not_busy (channel) & STATUS_BUSY)
+        return false;
+
+    channel->request = request;
+    channel->dma = dma;
+    channel->write = write;
+    channel->part = request;
+    channel->buffer = request->buffer;
+    channel->part_left = request->count;
+    channel->remaining = count;
+
+    if (dma)
+    {
+        outl (channel->bus_master + BM_PRD_TABLE, channel->prd_physical);
+        outb (channel->bus_master + BM_COMMAND, write ? 0 : BM_READ);
+        outb (channel->bus_master + BM_STATUS, BM_ERROR | BM_INTERRUPT);
+    }
+
+    if (lba48)
+    {
+        outb (port + DRIVE_SELECT, select);
+        outb (port + SECTOR_COUNT, (uint8_t) (count >> 8));
+        outb (port + LBA_LOW, (uint8_t) (lba >> 24));
+        outb (port + LBA_MID, 0);
+        outb (port + LBA_HIGH, 0);
+        command = dma ? (write ? COMMAND_WRITE_DMA_EXT : COMMAND_READ_DMA_EXT)
+          : (write ? COMMAND_WRITE_PIO_EXT : COMMAND_READ_PIO_EXT);
+    }
+    else
+    {
+        outb (port + DRIVE_SELECT, select | (uint8_t) (lba >> 24 & 0x0F));
+        command = dma ? (write ? COMMAND_WRITE_DMA : COMMAND_READ_DMA)
+          : (write ? COMMAND_WRITE_PIO : COMMAND_READ_PIO);
+    }
+
+    /** a count of 256 is written as 0 */
+    outb (port + SECTOR_COUNT, (uint8_t) count);
+    outb (port + LBA_LOW, (uint8_t) lba);
+    outb (port + LBA_MID, (uint8_t) (lba >> 8));
+    outb (port + LBA_HIGH, (uint8_t) (lba >> 16));
+
+    channel->active = true;
+    outb (port + COMMAND, command);
+
+    if (dma)
+    {
+        outb (channel->bus_master + BM_COMMAND,
+          BM_START | (write ? 0 : BM_READ));
+    }
+    else if (write)
+    {
+        uint8_t status = wait_not_busy (channel);
+
+        if ((status & (STATUS_BUSY | STATUS_ERROR)) || !(status & STATUS_DRQ))
+        {
+            channel->active = false;
+            channel->request = NULL;
+            return false;
+        }
+
+        outsw (port + DATA, channel->buffer, IDE_SECTOR_SIZE / 2);
+        next_sector (channel);
+    }
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Fill in the channel's PRD table for the buffers of a transfer.
+ *  Returns false if part of a buffer is not mapped, or one is not word
+ *  aligned.
+ */
+    PRIVATE bool
+build_prd_table (channel, request)
+    struct ide_channel *channel;
+    struct block_request *request;
+{
+    struct prd *prd = channel->prd_table - 1;
+    uint32_t region_size = 0;
+
+    for (struct block_request *part = request; part != NULL;
+      part = part->merged)
+    {
+        uint32_t address = (uint32_t) part->buffer;
+        uint32_t size = part->count * IDE_SECTOR_SIZE;
+
+        if (address & 1)
+            return false;
+
+        while (size != 0)
+        {
+            uint32_t physical = paging_lookup (address);
+            uint32_t chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+
+            if (physical == 0)
+                return false;
+
+            if (chunk > size)
+                chunk = size;
+
+            /** pages never cross a 64 KiB boundary, so a region can only
+             *  be extended by a chunk that does not start on one */
+            if (region_size != 0 && prd->address + region_size == physical
+              && (physical & (PRD_BOUNDARY - 1)) != 0)
+            {
+                region_size += chunk;
+            }
+            else
+            {
+                prd ++;
+                prd->address = physical;
+                region_size = chunk;
+            }
+
+            prd->size = (uint16_t) region_size;
+            prd->flags = 0;
+
+            address += chunk;
+            size -= chunk;
+        }
+    }
+
+    prd->flags = PRD_END;
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Move on a sector in a PIO transfer, and on to the next part's buffer
+ *  at the end of each part.
+ */
+    PRIVATE void
+next_sector (channel)
+    struct ide_channel *channel;
+{
+    channel->buffer += IDE_SECTOR_SIZE;
+    channel->remaining --;
+
+    if (-- channel->part_left == 0 && channel->part->merged != NULL)
+    {
+        channel->part = channel->part->merged;
+        channel->buffer = channel->part->buffer;
+        channel->part_left = channel->part->count;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  End the transfer in progress on a channel, adding it to the done
+ *  list, and start the next.
+ */
+    PRIVATE void
+finish (channel, error, done)
+    struct ide_channel *channel;
+    bool error;
+    struct block_request ***done;   // tail of the list of finished ones
+{
+    struct block_request *request = channel->request;
+
+    channel->active = false;
+    channel->request = NULL;
+
+    request->error = error;
+    **done = request;
+    *done = &request->next;
+
+    start_next (channel, done);
+}
+
+/**********************************************************/
+
+/**
+ *  Wait for the busy bit to clear, and return the status. The status is
+ *  read from the alternate status register, so as not to acknowledge an
+ *  interrupt. If the drive is still busy after READY_TIMEOUT_NS, the
+ *  returned status has the busy bit set.
+ */
+    PRIVATE uint8_t
+wait_not_busy (channel)
+    struct ide_channel *channel;
+{
+    uint64_t timeout = clock_now_ns () + READY_TIMEOUT_NS;
+    uint8_t status;
+
+    while ((status = inb (channel->control)) & STATUS_BUSY)
+    {
+        if (clock_now_ns () > timeout)
+            break;
+
+        cpu_relax ();
+    }
+
+    return status;
+}
+
+/**********************************************************/
+
+/**
+ *  After a drive is selected, it has 400 ns to put its status on the
+ *  bus. Each read of the alternate status register takes at least 100.
+ */
+    PRIVATE void
+select_delay (channel)
+    struct ide_channel *channel;
+{
+    for (int i = 0; i < 4; i ++)
+        inb (channel->control);
+}
+
+/**********************************************************/
+
+/**
+ *  Interrupt handler for both channels, which may share an IRQ.
+ */
+    PRIVATE void
+ide_interrupt (irq)
+    int irq;
+{
+    for (int i = 0; i < NUM_CHANNELS; i ++)
+    {
+        if (channels [i].irq == irq)
+            channel_interrupt (&channels [i]);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Handle an interrupt from a channel, with its lock held, then hand
+ *  back whatever has finished. The block layer's callbacks are not
+ *  counted as the driver's time.
+ */
+    PRIVATE void
+channel_interrupt (channel)
+    struct ide_channel *channel;
+{
+    struct block_request *done = NULL;
+    struct block_request **tail = &done;
+    uint64_t begin = read_tsc ();
+
+    spin_acquire (&channel->lock);
+    service (channel, &tail);
+    cpu_cycles += read_tsc () - begin;
+    spin_release (&channel->lock);
+
+    block_complete_list (done);
+}
+
+/**********************************************************/
+
+/**
+ *  Handle an interrupt from a channel. Reading the status register
+ *  acknowledges the drive's interrupt. At the end of a DMA transfer, the
+ *  controller is stopped and its status cleared; during a PIO transfer,
+ *  the sector that the drive has ready is read, or the next one to be
+ *  written is written.
+ */
+    PRIVATE void
+service (channel, done)
+    struct ide_channel *channel;
+    struct block_request ***done;   // tail of the list of finished ones
+{
+    uint16_t port = channel->port;
+    uint8_t status;
+
+    if (!channel->active)
+    {
+        inb (port + STATUS);
+        return;
+    }
+
+    if (channel->dma)
+    {
+        uint8_t bm_status = inb (channel->bus_master + BM_STATUS);
+
+        if (!(bm_status & BM_INTERRUPT))
+            return;
+
+        outb (channel->bus_master + BM_COMMAND, 0);
+        status = inb (port + STATUS);
+        outb (channel->bus_master + BM_STATUS, BM_ERROR | BM_INTERRUPT);
+
+        finish (channel, (bm_status & BM_ERROR) ||
+          (status & (STATUS_ERROR | STATUS_FAULT)), done);
+        return;
+    }
+
+    status = inb (port + STATUS);
+
+    if (status & (STATUS_ERROR | STATUS_FAULT))
+    {
+        finish (channel, true, done);
+        return;
+    }
+
+    if (channel->write)
+    {
+        if (channel->remaining == 0)
+        {
+            finish (channel, false, done);
+            return;
+        }
+
+        outsw (port + DATA, channel->buffer, IDE_SECTOR_SIZE / 2);
+    }
+    else
+    {
+        insw (port + DATA, channel->buffer, IDE_SECTOR_SIZE / 2);
+    }
+
+    next_sector (channel);
+
+    if (!channel->write && channel->remaining == 0)
+        finish (channel, false, done);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
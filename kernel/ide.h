@@ -0,0 +1,38 @@
+/**
+ *  Driver for ATA disks on an IDE controller, using bus master DMA where
+ *  the controller supports it and programmed IO where it does not.
+ */
+
+#ifndef _IDE_H
+#define _IDE_H
+
+#include "stdint.h"
+#include "utils.h"
+
+#define IDE_SECTOR_SIZE         512
+
+/** most sectors in one transfer, which is the most a 28 bit LBA command
+ *  can ask for: 128 KiB */
+#define IDE_MAX_SECTORS         256
+
+/** two channels, each with a master and a slave */
+#define IDE_MAX_DRIVES          4
+
+/**********************************************************/
+
+void ide_initialise (void);
+int ide_drive_count (void);
+uint32_t ide_drive_sectors (int drive);
+bool ide_read (int drive, uint32_t lba, uint32_t count, void *buffer);
+bool ide_write (int drive, uint32_t lba, uint32_t count,
+  const void *buffer);
+bool ide_dma_available (void);
+void ide_use_dma (bool enabled);
+uint64_t ide_cpu_cycles (void);
+
+/**********************************************************/
+
+
+#endif /** _IDE_H */
+
+/** vim: set ts=4 sw=4 et : */
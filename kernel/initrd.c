@@ -0,0 +1,574 @@
+/**
+ *  The initial ramdisk.
+ *
+ *  The loader puts each module named in grub.cfg in memory after the
+ *  kernel, page aligned, and the frame allocator keeps it reserved. The
+ *  first module that is a tar archive (ustar or the older v7 format) or
+ *  a cpio archive (the "newc" format, as Linux uses) is the ramdisk.
+ *
+ *  At boot its headers are read once, and an index is built of its
+ *  regular files and directories: a table with an entry for each, and a
+ *  hash table of their names. Nothing is copied; an entry's name and
+ *  data point into the module, which stays where the loader put it for
+ *  as long as the kernel runs. A file that appears more than once is the
+ *  last copy, as when the archive is unpacked.
+ *
+ *  The module list and the strings it points to may be in low memory,
+ *  where the trampoline that starts the other processors is copied, so
+ *  this must be done before smp_initialise.
+ */
+
+#include "initrd.h"
+#include "stdint.h"
+#include "frames.h"
+#include "memutils.h"
+#include "multiboot.h"
+#include "output.h"
+#include "paging.h"
+#include "utils.h"
+
+/** a cpio "newc" header: a magic number, then 13 fields of 8 hex
+ *  digits, of which we want the mode, file size and name size. The name
+ *  follows, with its terminating NUL, and then the data; each is padded
+ *  to a multiple of 4 bytes. A file named TRAILER!!! marks the end. */
+#define CPIO_MAGIC              "070701"
+#define CPIO_CRC_MAGIC          "070702"
+#define CPIO_MAGIC_LENGTH       6
+#define CPIO_HEADER_SIZE        110
+#define CPIO_FIELD_LENGTH       8
+#define CPIO_MODE               1
+#define CPIO_FILE_SIZE          6
+#define CPIO_NAME_SIZE          11
+#define CPIO_ALIGN              4
+#define CPIO_TRAILER            "TRAILER!!!"
+#define CPIO_TRAILER_SIZE       11      // with the NUL
+
+/** a tar header, which takes a block of its own, followed by the data in
+ *  whole blocks. Numbers are in octal. The archive ends with a block of
+ *  zeroes. */
+#define TAR_BLOCK_SIZE          512
+#define TAR_NAME                0
+#define TAR_NAME_LENGTH         100
+#define TAR_MODE                100
+#define TAR_MODE_LENGTH         8
+#define TAR_SIZE                124
+#define TAR_SIZE_LENGTH         12
+#define TAR_CHECKSUM            148
+#define TAR_CHECKSUM_LENGTH     8
+#define TAR_TYPE                156
+#define TAR_PREFIX              345
+
+/** types of tar entry that we keep */
+#define TAR_TYPE_FILE           '0'
+#define TAR_TYPE_OLD_FILE       '\0'
+#define TAR_TYPE_DIRECTORY      '5'
+
+/** permission bits of a file's mode */
+#define MODE_PERMISSIONS        0x0FFF
+
+/** the hash table has a bucket for each file, rounded up to a power of
+ *  two, and at least this many */
+#define MIN_BUCKETS             16
+
+#define ROUND_UP(x, n)          (((x) + (n) - 1) & ~((n) - 1))
+
+/**********************************************************/
+
+/**
+ *  Formats of archive.
+ */
+enum format
+{
+    FORMAT_NONE,
+    FORMAT_TAR,
+    FORMAT_CPIO
+};
+
+/**********************************************************/
+
+PRIVATE enum format identify (const uint8_t *start, uint32_t size);
+PRIVATE uint32_t parse_cpio (const uint8_t *start, const uint8_t *end,
+  struct initrd_file *files);
+PRIVATE uint32_t parse_tar (const uint8_t *start, const uint8_t *end,
+  struct initrd_file *files);
+PRIVATE bool tar_checksum_ok (const uint8_t *header);
+PRIVATE bool parse_number (const uint8_t *text, uint32_t length,
+  uint32_t base, uint32_t *value);
+PRIVATE bool set_entry (struct initrd_file *file, const char *name,
+  uint32_t length, const uint8_t *data, uint32_t size, uint32_t mode);
+PRIVATE const char *trim_name (const char *name, uint32_t *length);
+
+/**********************************************************/
+
+/** the index: an entry for each file, in the order of the archive, and
+ *  the hash table of their names */
+PRIVATE struct initrd_file *files;
+PRIVATE uint32_t file_count;
+PRIVATE struct initrd_file **buckets;
+PRIVATE uint32_t bucket_mask;
+
+/**********************************************************/
+
+/**
+ *  Find the ramdisk among the modules the loader passed in, and index
+ *  it.
+ */
+    PUBLIC void
+initrd_initialise (info)
+    const struct multiboot_info *info;  // from the loader
+{
+    const struct multiboot_module *modules;
+
+    if (!(info->flags & MULTIBOOT_INFO_MODULES) || info->mods_count == 0)
+        return;
+
+    modules = physical_to_virtual (info->mods_addr);
+
+    for (uint32_t i = 0; i < info->mods_count && files == NULL; i ++)
+    {
+        const struct multiboot_module *module = &modules [i];
+        const char *name = module->string != 0 ?
+          physical_to_virtual (module->string) : "";
+        const uint8_t *start;
+        const uint8_t *end;
+        enum format format;
+        uint32_t count;
+        uint32_t bucket_count = MIN_BUCKETS;
+        uint32_t table_size;
+        uint32_t table;
+
+        if (module->mod_end <= module->mod_start ||
+          module->mod_end > DIRECT_MAP_SIZE)
+        {
+            kprintf ("initrd: module %s is not in the direct map\n", name);
+            continue;
+        }
+
+        start = physical_to_virtual (module->mod_start);
+        end = physical_to_virtual (module->mod_end);
+        format = identify (start, end - start);
+
+        if (format == FORMAT_NONE)
+            continue;
+
+        count = format == FORMAT_TAR ? parse_tar (start, end, NULL) :
+          parse_cpio (start, end, NULL);
+
+        while (bucket_count < count)
+            bucket_count *= 2;
+
+        table_size = count * sizeof (struct initrd_file) +
+          bucket_count * sizeof (struct initrd_file *);
+
+        if (frame_order (table_size) > MAX_FRAME_ORDER ||
+          (table = frame_alloc (frame_order (table_size))) == 0)
+        {
+            kprintf ("initrd: no room to index the %u files of %s\n", count,
+              name);
+            return;
+        }
+
+        files = physical_to_virtual (table);
+        buckets = (struct initrd_file **) (files + count);
+        bucket_mask = bucket_count - 1;
+        memset (buckets, 0, bucket_count * sizeof (struct initrd_file *));
+
+        file_count = format == FORMAT_TAR ? parse_tar (start, end, files) :
+          parse_cpio (start, end, files);
+
+        /** later copies go in front of earlier ones */
+        for (uint32_t j = 0; j < file_count; j ++)
+        {
+            struct initrd_file **bucket = &buckets [fnv_hash (FNV_BASIS,
+              files [j].name, files [j].length) & bucket_mask];
+
+            files [j].hash_next = *bucket;
+            *bucket = &files [j];
+        }
+
+        kprintf ("initrd: %s, %s archive of %u KiB, %u files\n", name,
+          format == FORMAT_TAR ? "tar" : "cpio",
+          (module->mod_end - module->mod_start) >> 10, file_count);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if there is a ramdisk.
+ */
+    PUBLIC bool
+initrd_present (void)
+{
+    return files != NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Find a file or directory by its path. A leading slash or "./" is
+ *  optional. Returns NULL if there is no such file.
+ */
+    PUBLIC const struct initrd_file *
+initrd_lookup (path)
+    const char *path;
+{
+    uint32_t length = 0;
+    const char *name;
+
+    if (files == NULL)
+        return NULL;
+
+    while (path [length] != '\0')
+        length ++;
+
+    name = trim_name (path, &length);
+
+    for (struct initrd_file *file = buckets [fnv_hash (FNV_BASIS, name,
+      length) & bucket_mask]; file != NULL; file = file->hash_next)
+    {
+        if (file->length == length &&
+          memcompare (file->name, name, length) == 0)
+        {
+            return file;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Get the contents of a regular file, which are in the module, and must
+ *  not be changed. Returns NULL if there is no such file.
+ */
+    PUBLIC const void *
+initrd_read (path, size)
+    const char *path;
+    uint32_t *size;             // set to the file's size
+{
+    const struct initrd_file *file = initrd_lookup (path);
+
+    if (file == NULL || (file->mode & INITRD_MODE_TYPE) != INITRD_MODE_FILE)
+        return NULL;
+
+    *size = file->size;
+    return file->data;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the number of files and directories in the ramdisk.
+ */
+    PUBLIC uint32_t
+initrd_file_count (void)
+{
+    return file_count;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns a file by its place in the archive, from 0.
+ */
+    PUBLIC const struct initrd_file *
+initrd_file (index)
+    uint32_t index;
+{
+    return index < file_count ? &files [index] : NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Work out what kind of archive a module is from its first header.
+ */
+    PRIVATE enum format
+identify (start, size)
+    const uint8_t *start;
+    uint32_t size;
+{
+    if (size >= CPIO_HEADER_SIZE &&
+      (memcompare (start, CPIO_MAGIC, CPIO_MAGIC_LENGTH) == 0 ||
+      memcompare (start, CPIO_CRC_MAGIC, CPIO_MAGIC_LENGTH) == 0))
+    {
+        return FORMAT_CPIO;
+    }
+
+    if (size >= TAR_BLOCK_SIZE && tar_checksum_ok (start))
+        return FORMAT_TAR;
+
+    return FORMAT_NONE;
+}
+
+/**********************************************************/
+
+/**
+ *  Go through the headers of a cpio archive, filling in an entry of the
+ *  table for each file if there is a table. Stops at the trailer, or at
+ *  anything that does not make sense. Returns the number of files.
+ */
+    PRIVATE uint32_t
+parse_cpio (start, end, files)
+    const uint8_t *start;
+    const uint8_t *end;
+    struct initrd_file *files;  // or NULL just to count them
+{
+    const uint8_t *header = start;
+    uint32_t count = 0;
+
+    while (end - header >= CPIO_HEADER_SIZE &&
+      (memcompare (header, CPIO_MAGIC, CPIO_MAGIC_LENGTH) == 0 ||
+      memcompare (header, CPIO_CRC_MAGIC, CPIO_MAGIC_LENGTH) == 0))
+    {
+        const uint8_t *fields = header + CPIO_MAGIC_LENGTH;
+        const char *name = (const char *) header + CPIO_HEADER_SIZE;
+        const uint8_t *data;
+        uint32_t mode;
+        uint32_t size;
+        uint32_t name_size;
+
+        if (!parse_number (fields + CPIO_MODE * CPIO_FIELD_LENGTH,
+          CPIO_FIELD_LENGTH, 16, &mode) ||
+          !parse_number (fields + CPIO_FILE_SIZE * CPIO_FIELD_LENGTH,
+          CPIO_FIELD_LENGTH, 16, &size) ||
+          !parse_number (fields + CPIO_NAME_SIZE * CPIO_FIELD_LENGTH,
+          CPIO_FIELD_LENGTH, 16, &name_size) ||
+          name_size == 0 || name_size > (uint32_t) (end - header) -
+          CPIO_HEADER_SIZE)
+        {
+            break;
+        }
+
+        if (name_size == CPIO_TRAILER_SIZE &&
+          memcompare (name, CPIO_TRAILER, CPIO_TRAILER_SIZE) == 0)
+        {
+            break;
+        }
+
+        data = start + ROUND_UP ((uint32_t) ((const uint8_t *) name +
+          name_size - start), CPIO_ALIGN);
+
+        if (data > end || size > (uint32_t) (end - data))
+            break;
+
+        if (set_entry (files != NULL ? &files [count] : NULL, name,
+          name_size - 1, data, size, mode))
+        {
+            count ++;
+        }
+
+        header = start + ROUND_UP ((uint32_t) (data + size - start),
+          CPIO_ALIGN);
+    }
+
+    return count;
+}
+
+/**********************************************************/
+
+/**
+ *  Go through the headers of a tar archive, as parse_cpio does. Names
+ *  that are split between the prefix and name fields are skipped, since
+ *  they are not in one piece in the module.
+ */
+    PRIVATE uint32_t
+parse_tar (start, end, files)
+    const uint8_t *start;
+    const uint8_t *end;
+    struct initrd_file *files;
+{
+    const uint8_t *header = start;
+    uint32_t count = 0;
+
+    while (end - header >= TAR_BLOCK_SIZE && tar_checksum_ok (header))
+    {
+        const char *name = (const char *) header + TAR_NAME;
+        const uint8_t *data = header + TAR_BLOCK_SIZE;
+        uint8_t type = header [TAR_TYPE];
+        uint32_t length = 0;
+        uint32_t mode;
+        uint32_t size;
+
+        if (!parse_number (header + TAR_MODE, TAR_MODE_LENGTH, 8, &mode) ||
+          !parse_number (header + TAR_SIZE, TAR_SIZE_LENGTH, 8, &size) ||
+          size > (uint32_t) (end - data))
+        {
+            break;
+        }
+
+        while (length < TAR_NAME_LENGTH && name [length] != '\0')
+            length ++;
+
+        mode &= MODE_PERMISSIONS;
+
+        if (type == TAR_TYPE_FILE || type == TAR_TYPE_OLD_FILE)
+            mode |= INITRD_MODE_FILE;
+        else if (type == TAR_TYPE_DIRECTORY)
+            mode |= INITRD_MODE_DIRECTORY;
+
+        if (header [TAR_PREFIX] == '\0' && set_entry (files != NULL ?
+          &files [count] : NULL, name, length, data, size, mode))
+        {
+            count ++;
+        }
+
+        header = data + ROUND_UP (size, TAR_BLOCK_SIZE);
+    }
+
+    return count;
+}
+
+/**********************************************************/
+
+/**
+ *  Check the checksum of a tar header, which is the sum of its bytes
+ *  with the checksum field counted as spaces. A block of zeroes, which
+ *  ends the archive, fails.
+ */
+    PRIVATE bool
+tar_checksum_ok (header)
+    const uint8_t *header;
+{
+    uint32_t sum = 0;
+    uint32_t stored;
+
+    for (int i = 0; i < TAR_BLOCK_SIZE; i ++)
+    {
+        if (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + TAR_CHECKSUM_LENGTH)
+            sum += ' ';
+        else
+            sum += header [i];
+    }
+
+    return header [TAR_NAME] != '\0' && parse_number (header + TAR_CHECKSUM,
+      TAR_CHECKSUM_LENGTH, 8, &stored) && stored == sum;
+}
+
+/**********************************************************/
+
+/**
+ *  Read a number in a fixed width field of an archive header. Leading
+ *  spaces are skipped, and a space or NUL ends the number early. Returns
+ *  false if there are other characters, or no digits.
+ */
+    PRIVATE bool
+parse_number (text, length, base, value)
+    const uint8_t *text;
+    uint32_t length;
+    uint32_t base;              // 8 or 16
+    uint32_t *value;
+{
+    uint32_t i = 0;
+    uint32_t digits = 0;
+
+    *value = 0;
+
+    while (i < length && text [i] == ' ')
+        i ++;
+
+    for (; i < length && text [i] != ' ' && text [i] != '\0'; i ++)
+    {
+        uint8_t c = text [i];
+        uint32_t digit;
+
+        if (c >= '0' && c <= '9')
+            digit = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            digit = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            digit = c - 'A' + 10;
+        else
+            return false;
+
+        if (digit >= base)
+            return false;
+
+        *value = *value * base + digit;
+        digits ++;
+    }
+
+    return digits != 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Fill in an entry for a file, if there is a table, and it is a kind
+ *  of file that we keep. Returns false if it is not, or its name is
+ *  empty once trimmed.
+ */
+    PRIVATE bool
+set_entry (file, name, length, data, size, mode)
+    struct initrd_file *file;   // or NULL
+    const char *name;
+    uint32_t length;
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t mode;
+{
+    uint32_t type = mode & INITRD_MODE_TYPE;
+
+    if (type != INITRD_MODE_FILE && type != INITRD_MODE_DIRECTORY)
+        return false;
+
+    name = trim_name (name, &length);
+
+    if (length == 0)
+        return false;
+
+    if (file != NULL)
+    {
+        file->name = name;
+        file->length = length;
+        file->data = data;
+        file->size = type == INITRD_MODE_FILE ? size : 0;
+        file->mode = mode;
+        file->hash_next = NULL;
+    }
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Take any leading "/" and "./", and any trailing "/", off a name.
+ */
+    PRIVATE const char *
+trim_name (name, length)
+    const char *name;
+    uint32_t *length;
+{
+    for (;;)
+    {
+        if (*length >= 1 && name [0] == '/')
+        {
+            name ++;
+            (*length) --;
+        }
+        else if (*length >= 2 && name [0] == '.' && name [1] == '/')
+        {
+            name += 2;
+            *length -= 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (*length == 1 && name [0] == '.')
+        *length = 0;
+
+    while (*length != 0 && name [*length - 1] == '/')
+        (*length) --;
+
+    return name;
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,49 @@
+/**
+ *  The initial ramdisk: a tar or cpio archive that the loader passes in
+ *  as a multiboot module, read in place.
+ */
+
+#ifndef _INITRD_H
+#define _INITRD_H
+
+#include "stdint.h"
+#include "multiboot.h"
+#include "utils.h"
+
+/** the type bits of a file's mode, as in ext2 */
+#define INITRD_MODE_TYPE        0xF000
+#define INITRD_MODE_FILE        0x8000
+#define INITRD_MODE_DIRECTORY   0x4000
+
+/**********************************************************/
+
+/**
+ *  A file in the archive. The name and data point into the module, so
+ *  the name is not terminated; it has no leading or trailing slashes.
+ */
+struct initrd_file
+{
+    const char *name;
+    uint32_t length;            // of the name
+    const uint8_t *data;
+    uint32_t size;              // bytes
+    uint32_t mode;
+
+    struct initrd_file *hash_next;
+};
+
+/**********************************************************/
+
+void initrd_initialise (const struct multiboot_info *info);
+bool initrd_present (void);
+const struct initrd_file *initrd_lookup (const char *path);
+const void *initrd_read (const char *path, uint32_t *size);
+uint32_t initrd_file_count (void);
+const struct initrd_file *initrd_file (uint32_t index);
+
+/**********************************************************/
+
+
+#endif /** _INITRD_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,189 @@
+/**
+ *  Table driven dispatching of interrupts and exceptions to C handlers.
+ */
+
+#include "interrupt.h"
+#include "stdint.h"
+#include "output.h"
+#include "utils.h"
+
+/** size of each of the entry stubs in interrupts.s. This must match the
+ *  value used there. */
+#define ISR_STUB_SIZE           16
+
+/**********************************************************/
+
+/** the entry stubs, defined in interrupts.s */
+extern char isr_stubs [];
+
+/** handlers that need the full register set, called from
+ *  interrupt_dispatch */
+PRIVATE interrupt_handler handlers [NUM_INTERRUPT_VECTORS];
+
+/** fast handlers. The entry code in interrupts.s looks in this table
+ *  itself, so it can not be private. A null entry means that the vector
+ *  takes the normal path through interrupt_dispatch. */
+fast_interrupt_handler fast_interrupt_handlers [NUM_INTERRUPT_VECTORS];
+
+/** number of interrupts received that had no handler */
+PRIVATE uint32_t unhandled_count;
+
+PRIVATE const char *exception_names [NUM_EXCEPTIONS] =
+{
+    "divide error",
+    "debug",
+    "non maskable interrupt",
+    "breakpoint",
+    "overflow",
+    "bound range exceeded",
+    "invalid opcode",
+    "device not available",
+    "double fault",
+    "coprocessor segment overrun",
+    "invalid TSS",
+    "segment not present",
+    "stack segment fault",
+    "general protection fault",
+    "page fault",
+    "reserved",
+    "x87 floating point error",
+    "alignment check",
+    "machine check",
+    "SIMD floating point error",
+    "virtualisation exception",
+    "control protection exception",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "reserved",
+    "hypervisor injection exception",
+    "VMM communication exception",
+    "security exception",
+    "reserved",
+};
+
+/**********************************************************/
+
+void interrupt_dispatch (struct interrupt_frame *frame);
+
+/**********************************************************/
+
+/**
+ *  Returns the address of the entry stub for the given vector, to be put
+ *  in the IDT.
+ */
+    PUBLIC uint32_t
+interrupt_stub_address (vector)
+    int vector;
+{
+    return (uint32_t) isr_stubs + vector * ISR_STUB_SIZE;
+}
+
+/**********************************************************/
+
+/**
+ *  Set the handler for the given vector. The handler will be passed all
+ *  of the registers of the interrupted code. This replaces any existing
+ *  handler for the vector, fast or not.
+ */
+    PUBLIC void
+register_interrupt_handler (vector, handler)
+    int vector;                 // interrupt vector number
+    interrupt_handler handler;  // function to call for the interrupt
+{
+    if (vector < 0 || vector >= NUM_INTERRUPT_VECTORS)
+        return;
+
+    fast_interrupt_handlers [vector] = NULL;
+    handlers [vector] = handler;
+}
+
+/**********************************************************/
+
+/**
+ *  Set a fast handler for the given vector. The entry code will skip
+ *  saving the full register set, and call the handler with just the
+ *  vector number and error code.
+ */
+    PUBLIC void
+register_fast_interrupt_handler (vector, handler)
+    int vector;                 // interrupt vector number
+    fast_interrupt_handler handler;
+{
+    if (vector < 0 || vector >= NUM_INTERRUPT_VECTORS)
+        return;
+
+    handlers [vector] = NULL;
+    fast_interrupt_handlers [vector] = handler;
+}
+
+/**********************************************************/
+
+/**
+ *  Remove any handler for the given vector.
+ */
+    PUBLIC void
+unregister_interrupt_handler (vector)
+    int vector;
+{
+    if (vector < 0 || vector >= NUM_INTERRUPT_VECTORS)
+        return;
+
+    fast_interrupt_handlers [vector] = NULL;
+    handlers [vector] = NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Called from the entry code in interrupts.s for any vector that does
+ *  not have a fast handler.
+ */
+    PUBLIC void
+interrupt_dispatch (frame)
+    struct interrupt_frame *frame;
+{
+    interrupt_handler handler = handlers [frame->vector];
+
+    if (handler != NULL)
+    {
+        handler (frame);
+    }
+    else if (frame->vector < NUM_EXCEPTIONS)
+    {
+        unhandled_exception (frame);
+    }
+    else
+    {
+        unhandled_count ++;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  An exception with no handler is a bug in the kernel. Show what we
+ *  know about it and stop. Exception handlers also come here for any
+ *  exception that they cannot deal with.
+ */
+    PUBLIC void
+unhandled_exception (frame)
+    struct interrupt_frame *frame;
+{
+    kprintf ("\nexception %u (%s), error code %x\n", frame->vector,
+      exception_names [frame->vector], frame->error_code);
+    kprintf ("eip %p cs %x eflags %x\n", frame->eip, frame->cs,
+      frame->eflags);
+    kprintf ("eax %p ebx %p ecx %p edx %p\n", frame->eax, frame->ebx,
+      frame->ecx, frame->edx);
+    kprintf ("esi %p edi %p ebp %p esp %p\n", frame->esi, frame->edi,
+      frame->ebp, frame->esp);
+
+    panic ("unhandled exception");
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
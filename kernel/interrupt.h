@@ -0,0 +1,87 @@
+/**
+ *  Interrupt and exception dispatching.
+ *
+ *  Every IDT vector points to an assembly stub in interrupts.s, which
+ *  hands over to the handler registered for that vector. There are two
+ *  kinds of handler:
+ *
+ *  - ordinary handlers are given a pointer to an interrupt_frame holding
+ *    every register of the interrupted code, which they may inspect or
+ *    modify.
+ *  - fast handlers are only given the vector and error code. The entry
+ *    code does not save the full register set for them, so the latency
+ *    from the interrupt to the handler is much lower. Most device
+ *    interrupts do not need anything else.
+ */
+
+#ifndef _INTERRUPT_H
+#define _INTERRUPT_H
+
+#include "stdint.h"
+
+/** number of interrupt vectors on x86 CPUs */
+#define NUM_INTERRUPT_VECTORS   256
+
+/** the first 32 vectors are reserved for CPU exceptions */
+#define NUM_EXCEPTIONS          32
+
+/** some exception vectors that are handled specially */
+#define EXCEPTION_BREAKPOINT    3
+#define EXCEPTION_DOUBLE_FAULT  8
+#define EXCEPTION_PAGE_FAULT    14
+
+/**********************************************************/
+
+/**
+ *  The registers of the interrupted code, in the order that the entry
+ *  code pushes them onto the stack.
+ */
+struct interrupt_frame
+{
+    /** data segment registers */
+    uint32_t gs;
+    uint32_t fs;
+    uint32_t es;
+    uint32_t ds;
+
+    /** general registers, as pushed by the pusha instruction */
+    uint32_t edi;
+    uint32_t esi;
+    uint32_t ebp;
+    uint32_t esp;
+    uint32_t ebx;
+    uint32_t edx;
+    uint32_t ecx;
+    uint32_t eax;
+
+    /** pushed by the stub for this vector */
+    uint32_t vector;
+    uint32_t error_code;
+
+    /** pushed by the CPU */
+    uint32_t eip;
+    uint32_t cs;
+    uint32_t eflags;
+}
+__attribute__ ((packed));
+
+typedef void (*interrupt_handler) (struct interrupt_frame *frame);
+typedef void (*fast_interrupt_handler) (uint32_t vector,
+  uint32_t error_code);
+
+/**********************************************************/
+
+uint32_t interrupt_stub_address (int vector);
+void register_interrupt_handler (int vector, interrupt_handler handler);
+void register_fast_interrupt_handler (int vector,
+  fast_interrupt_handler handler);
+void unregister_interrupt_handler (int vector);
+void unhandled_exception (struct interrupt_frame *frame)
+    __attribute__ ((noreturn));
+
+/**********************************************************/
+
+
+#endif /** _INTERRUPT_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,118 @@
+/**
+ *  Entry points for all 256 interrupt vectors.
+ *
+ *  Each vector has a small stub which pushes the vector number, and a
+ *  dummy error code for those exceptions where the CPU does not push
+ *  one, so that the stack always has the same layout. The stubs then
+ *  jump to a common entry point, which takes one of two paths:
+ *
+ *  - if a fast handler is registered for the vector, only the registers
+ *    that a C function may clobber (eax, ecx and edx) are saved, and the
+ *    handler is called with the vector and error code as arguments.
+ *  - otherwise, all registers are saved in an interrupt_frame structure
+ *    (see interrupt.h), and interrupt_dispatch is called with a pointer
+ *    to it.
+ */
+
+.section .text
+
+/** each stub is padded out to this many bytes, so that the address of
+ *  the stub for a vector is isr_stubs + vector * ISR_STUB_SIZE. This must
+ *  match ISR_STUB_SIZE in interrupt.c */
+.set ISR_STUB_SIZE, 16
+
+/** selector for the kernel data segment, see protect.h */
+.set KERNEL_DATA_SELECTOR, 0x10
+
+/** offset of interrupt_entry_time in struct cpu, see smp.h. gs always
+ *  holds the running processor's data segment. */
+.set CPU_INTERRUPT_ENTRY_TIME, 4
+
+/**********************************************************/
+
+/**
+ *  The stubs. Only vectors 8, 10 to 14, 17, 21, 29 and 30 have an error
+ *  code pushed by the CPU.
+ */
+    .globl _isr_stubs
+    .align ISR_STUB_SIZE
+_isr_stubs:
+.set vector, 0
+.rept 256
+    .align ISR_STUB_SIZE
+    .if (vector == 8 || (vector >= 10 && vector <= 14) || vector == 17 || vector == 21 || vector == 29 || vector == 30)
+    .else
+    push    $0
+    .endif
+    push    $vector
+    jmp     interrupt_common
+    .set vector, vector + 1
+.endr
+
+/**********************************************************/
+
+/**
+ *  Common entry point. On entry the stack holds the vector number, the
+ *  error code and then the eip, cs and eflags pushed by the CPU.
+ */
+interrupt_common:
+# the direction flag may be set in the interrupted code, but C code
+# expects it to be clear. iret restores the original flags.
+    cld
+    push    %eax
+    push    %edx
+
+# record when we got here, for measuring the latency to the handler.
+    rdtsc
+    mov     %eax, %gs:CPU_INTERRUPT_ENTRY_TIME
+    pop     %edx
+
+    mov     4(%esp), %eax
+    cmpl    $0, _fast_interrupt_handlers(, %eax, 4)
+    je      full_save
+
+# fast path. The handler is an ordinary C function, which preserves ebx,
+# esi, edi and ebp itself. We only run in ring 0, so the data segment
+# registers already hold the kernel data segment.
+    push    %ecx
+    push    %edx
+    pushl   16(%esp)
+    push    %eax
+    call    *_fast_interrupt_handlers(, %eax, 4)
+    add     $8, %esp
+    pop     %edx
+    pop     %ecx
+    pop     %eax
+
+# discard the vector number and error code.
+    add     $8, %esp
+    iret
+
+full_save:
+    pop     %eax
+    pusha
+    push    %ds
+    push    %es
+    push    %fs
+    push    %gs
+
+    mov     $KERNEL_DATA_SELECTOR, %ax
+    mov     %ax, %ds
+    mov     %ax, %es
+
+# the stack pointer now points at the interrupt_frame structure.
+    push    %esp
+    call    _interrupt_dispatch
+    add     $4, %esp
+
+    pop     %gs
+    pop     %fs
+    pop     %es
+    pop     %ds
+    popa
+    add     $8, %esp
+    iret
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -6,7 +6,11 @@
  *  functions are wrappers to these assembly instructions, making it
  *  simpler to communicate with hardware devices from C code.
  *
- *  These functions are implemented in assembly language.
+ *  The functions are all defined inline, so that each port access costs
+ *  only the in or out instruction itself, not a function call. The
+ *  string versions transfer a whole buffer with a single rep prefixed
+ *  instruction, which is the fastest way to move a block of data such as
+ *  a disk sector through a port.
  */
 
 #ifndef _IO_H
@@ -14,10 +18,126 @@
 
 #include "stdint.h"
 
+/** writing to this unused port takes a fixed, short amount of time */
+#define IO_WAIT_PORT            0x80
+
+/**********************************************************/
+
+/**
+ *  Write a byte, word (16 bits) or long (32 bits) on the given port.
+ */
+    static inline void
+outb (uint16_t port, uint8_t value)
+{
+    __asm__ volatile ("outb %0, %1" : : "a" (value), "Nd" (port));
+}
+
+    static inline void
+outw (uint16_t port, uint16_t value)
+{
+    __asm__ volatile ("outw %0, %1" : : "a" (value), "Nd" (port));
+}
+
+    static inline void
+outl (uint16_t port, uint32_t value)
+{
+    __asm__ volatile ("outl %0, %1" : : "a" (value), "Nd" (port));
+}
+
+/**********************************************************/
+
+/**
+ *  Read a byte, word or long from the given port.
+ */
+    static inline uint8_t
+inb (uint16_t port)
+{
+    uint8_t value;
+
+    __asm__ volatile ("inb %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+    static inline uint16_t
+inw (uint16_t port)
+{
+    uint16_t value;
+
+    __asm__ volatile ("inw %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+    static inline uint32_t
+inl (uint16_t port)
+{
+    uint32_t value;
+
+    __asm__ volatile ("inl %1, %0" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
 /**********************************************************/
 
-void outb (uint16_t port, uint8_t value);
-uint8_t inb (uint16_t port);
+/**
+ *  Wait a short time, for devices which need a delay between accesses.
+ */
+    static inline void
+io_wait (void)
+{
+    outb (IO_WAIT_PORT, 0);
+}
+
+/**********************************************************/
+
+/**
+ *  Read count bytes, words or longs from the given port into a buffer.
+ */
+    static inline void
+insb (uint16_t port, void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep insb"
+      : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+    static inline void
+insw (uint16_t port, void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep insw"
+      : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+    static inline void
+insl (uint16_t port, void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep insl"
+      : "+D" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+/**********************************************************/
+
+/**
+ *  Write count bytes, words or longs from a buffer on the given port.
+ */
+    static inline void
+outsb (uint16_t port, const void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep outsb"
+      : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+    static inline void
+outsw (uint16_t port, const void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep outsw"
+      : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
+
+    static inline void
+outsl (uint16_t port, const void *buffer, size_t count)
+{
+    __asm__ volatile ("cld; rep outsl"
+      : "+S" (buffer), "+c" (count) : "d" (port) : "memory");
+}
 
 /**********************************************************/
 
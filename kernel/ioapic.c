@@ -0,0 +1,197 @@
+/**
+ *  Driver for IO APICs.
+ *
+ *  Each IO APIC has a number of inputs, which are numbered globally as
+ *  global system interrupts (GSIs) starting from the base GSI given for
+ *  that IO APIC in the MADT. Each input has a redirection table entry
+ *  which says which vector to raise on which processor.
+ *
+ *  The registers are accessed indirectly: the register number is written
+ *  to IOREGSEL, and then the register can be read or written in IOWIN.
+ */
+
+#include "ioapic.h"
+#include "stdint.h"
+#include "acpi.h"
+#include "paging.h"
+#include "utils.h"
+
+/** offsets of the two memory mapped registers, in 32 bit words */
+#define IOREGSEL                0
+#define IOWIN                   4
+
+/** indirect registers */
+#define IOAPIC_VERSION          0x01
+#define IOAPIC_REDIRECTION      0x10
+
+/** bit of the low half of a redirection entry that masks the input */
+#define REDIRECTION_MASKED      0x00010000
+
+/**********************************************************/
+
+PRIVATE const struct ioapic_info *find_ioapic (uint32_t gsi, int *pin);
+PRIVATE uint32_t ioapic_read (const struct ioapic_info *ioapic,
+  uint8_t reg);
+PRIVATE void ioapic_write (const struct ioapic_info *ioapic, uint8_t reg,
+  uint32_t value);
+
+/**********************************************************/
+
+/** number of inputs on each IO APIC listed in the MADT, and where its
+ *  registers are mapped */
+PRIVATE int num_pins [MAX_IOAPICS];
+PRIVATE volatile uint32_t *registers [MAX_IOAPICS];
+
+/**********************************************************/
+
+/**
+ *  Find out how many inputs each IO APIC has, and mask all of them.
+ */
+    PUBLIC void
+ioapic_initialise (void)
+{
+    const struct madt_info *madt = acpi_madt ();
+
+    if (madt == NULL)
+        return;
+
+    for (int i = 0; i < madt->num_ioapics; i ++)
+    {
+        const struct ioapic_info *ioapic = &madt->ioapics [i];
+
+        registers [i] = paging_map_physical (ioapic->address, PAGE_SIZE,
+          PAGE_KERNEL_IO);
+        num_pins [i] = (ioapic_read (ioapic, IOAPIC_VERSION) >> 16 & 0xFF)
+            + 1;
+
+        for (int pin = 0; pin < num_pins [i]; pin ++)
+        {
+            ioapic_write (ioapic, IOAPIC_REDIRECTION + pin * 2,
+              REDIRECTION_MASKED);
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Route a GSI to the given vector on the given processor. The input is
+ *  left masked.
+ */
+    PUBLIC void
+ioapic_route (gsi, vector, apic_id, flags)
+    uint32_t gsi;               // global system interrupt number
+    uint8_t vector;             // vector to raise
+    uint8_t apic_id;            // local APIC ID of the processor
+    uint32_t flags;             // polarity and trigger mode
+{
+    int pin;
+    const struct ioapic_info *ioapic = find_ioapic (gsi, &pin);
+
+    if (ioapic == NULL)
+        return;
+
+    ioapic_write (ioapic, IOAPIC_REDIRECTION + pin * 2 + 1,
+      (uint32_t) apic_id << 24);
+    ioapic_write (ioapic, IOAPIC_REDIRECTION + pin * 2,
+      REDIRECTION_MASKED | flags | vector);
+}
+
+/**********************************************************/
+
+/**
+ *  Disable or enable a single input.
+ */
+    PUBLIC void
+ioapic_mask (gsi)
+    uint32_t gsi;
+{
+    int pin;
+    const struct ioapic_info *ioapic = find_ioapic (gsi, &pin);
+    uint8_t reg;
+
+    if (ioapic == NULL)
+        return;
+
+    reg = IOAPIC_REDIRECTION + pin * 2;
+    ioapic_write (ioapic, reg, ioapic_read (ioapic, reg) |
+      REDIRECTION_MASKED);
+}
+
+    PUBLIC void
+ioapic_unmask (gsi)
+    uint32_t gsi;
+{
+    int pin;
+    const struct ioapic_info *ioapic = find_ioapic (gsi, &pin);
+    uint8_t reg;
+
+    if (ioapic == NULL)
+        return;
+
+    reg = IOAPIC_REDIRECTION + pin * 2;
+    ioapic_write (ioapic, reg, ioapic_read (ioapic, reg) &
+      ~REDIRECTION_MASKED);
+}
+
+/**********************************************************/
+
+/**
+ *  Find the IO APIC that handles the given GSI, and which of its inputs
+ *  the GSI is. Returns NULL if there is no such IO APIC.
+ */
+    PRIVATE const struct ioapic_info *
+find_ioapic (gsi, pin)
+    uint32_t gsi;
+    int *pin;                   // set to the input number
+{
+    const struct madt_info *madt = acpi_madt ();
+
+    if (madt == NULL)
+        return NULL;
+
+    for (int i = 0; i < madt->num_ioapics; i ++)
+    {
+        const struct ioapic_info *ioapic = &madt->ioapics [i];
+
+        if (gsi >= ioapic->gsi_base && gsi < ioapic->gsi_base + num_pins [i])
+        {
+            *pin = gsi - ioapic->gsi_base;
+            return ioapic;
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Read or write one of the indirect registers.
+ */
+    PRIVATE uint32_t
+ioapic_read (ioapic, reg)
+    const struct ioapic_info *ioapic;
+    uint8_t reg;
+{
+    volatile uint32_t *window = registers [ioapic - acpi_madt ()->ioapics];
+
+    window [IOREGSEL] = reg;
+    return window [IOWIN];
+}
+
+    PRIVATE void
+ioapic_write (ioapic, reg, value)
+    const struct ioapic_info *ioapic;
+    uint8_t reg;
+    uint32_t value;
+{
+    volatile uint32_t *window = registers [ioapic - acpi_madt ()->ioapics];
+
+    window [IOREGSEL] = reg;
+    window [IOWIN] = value;
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,28 @@
+/**
+ *  Driver for IO APICs, which route interrupts from devices to the local
+ *  APICs of the processors.
+ */
+
+#ifndef _IOAPIC_H
+#define _IOAPIC_H
+
+#include "stdint.h"
+
+/** flags for ioapic_route */
+#define IOAPIC_ACTIVE_LOW       0x00002000
+#define IOAPIC_LEVEL_TRIGGERED  0x00008000
+
+/**********************************************************/
+
+void ioapic_initialise (void);
+void ioapic_route (uint32_t gsi, uint8_t vector, uint8_t apic_id,
+  uint32_t flags);
+void ioapic_mask (uint32_t gsi);
+void ioapic_unmask (uint32_t gsi);
+
+/**********************************************************/
+
+
+#endif /** _IOAPIC_H */
+
+/** vim: set ts=4 sw=4 et : */
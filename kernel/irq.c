@@ -0,0 +1,335 @@
+/**
+ *  Hardware interrupt handling.
+ *
+ *  If the machine has an MADT describing an IO APIC, the PICs are masked
+ *  and interrupts are delivered through the APICs, otherwise the PICs
+ *  are used. Either way the PICs are first remapped, so that they do not
+ *  raise the vectors that belong to CPU exceptions if they fire.
+ *
+ *  Every IRQ vector has the same fast handler, which records how long the
+ *  interrupt took to get from the entry code to the handler, calls the
+ *  handler registered for the IRQ, and signals the end of the interrupt.
+ *  The time taken by the EOI is recorded as well, so that the cost of the
+ *  two interrupt controllers can be compared.
+ */
+
+#include "irq.h"
+#include "stdint.h"
+#include "acpi.h"
+#include "apic.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "ioapic.h"
+#include "output.h"
+#include "pic.h"
+#include "smp.h"
+#include "thread.h"
+#include "utils.h"
+
+/** one latency histogram bucket for each possible bit length of a 32 bit
+ *  cycle count, including zero. */
+#define NUM_LATENCY_BUCKETS     33
+
+/** ISA IRQs default to active high, edge triggered, and PCI interrupts
+ *  are active low and level triggered. */
+#define ISA_DEFAULT_FLAGS       0
+#define PCI_DEFAULT_FLAGS       (IOAPIC_ACTIVE_LOW | IOAPIC_LEVEL_TRIGGERED)
+
+/**********************************************************/
+
+PRIVATE void irq_entry (uint32_t vector, uint32_t error_code);
+PRIVATE void apic_spurious_entry (uint32_t vector, uint32_t error_code);
+PRIVATE uint32_t irq_gsi (int irq);
+PRIVATE uint32_t irq_flags (int irq);
+PRIVATE int bit_length (uint32_t value);
+
+/**********************************************************/
+
+PRIVATE irq_handler handlers [NUM_IRQS];
+
+/** true if interrupts are delivered by the APIC rather than the PICs */
+PRIVATE bool using_apic;
+
+/** processor that each IRQ is routed to, when using the APIC */
+PRIVATE uint8_t irq_destination [NUM_IRQS];
+
+/** statistics */
+PRIVATE uint32_t latency_histogram [NUM_LATENCY_BUCKETS];
+PRIVATE uint32_t unhandled_count;
+PRIVATE uint32_t spurious_count;
+PRIVATE uint64_t eoi_cycles;
+PRIVATE uint32_t eoi_count;
+
+/**********************************************************/
+
+/**
+ *  Set up whichever interrupt controller we are going to use, with all
+ *  IRQs masked. Interrupts are unmasked as handlers are registered.
+ */
+    PUBLIC void
+irq_initialise (void)
+{
+    const struct madt_info *madt = acpi_madt ();
+
+    pic_remap (IRQ_BASE_VECTOR, IRQ_BASE_VECTOR + 8);
+
+    if (madt != NULL && apic_available ())
+    {
+        pic_mask_all ();
+        apic_initialise (madt->local_apic_address);
+        ioapic_initialise ();
+        using_apic = true;
+
+        register_fast_interrupt_handler (APIC_SPURIOUS_VECTOR,
+          apic_spurious_entry);
+    }
+
+    for (int irq = 0; irq < NUM_IRQS; irq ++)
+    {
+        irq_destination [irq] = using_apic ? apic_id () : 0;
+        register_fast_interrupt_handler (IRQ_BASE_VECTOR + irq, irq_entry);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Set the handler for an IRQ, and unmask it. Returns false if the IRQ
+ *  does not exist on the interrupt controller in use.
+ */
+    PUBLIC bool
+irq_register (irq, handler)
+    int irq;                    // IRQ number
+    irq_handler handler;        // function to call for the IRQ
+{
+    if (irq < 0 || irq >= NUM_IRQS || (!using_apic && irq >= NUM_PIC_IRQS))
+        return false;
+
+    handlers [irq] = handler;
+
+    if (using_apic)
+    {
+        ioapic_route (irq_gsi (irq), IRQ_BASE_VECTOR + irq,
+          irq_destination [irq], irq_flags (irq));
+    }
+
+    irq_unmask (irq);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Mask an IRQ and remove its handler.
+ */
+    PUBLIC void
+irq_unregister (irq)
+    int irq;
+{
+    if (irq < 0 || irq >= NUM_IRQS)
+        return;
+
+    irq_mask (irq);
+    handlers [irq] = NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Disable or enable an IRQ at the interrupt controller.
+ */
+    PUBLIC void
+irq_mask (irq)
+    int irq;
+{
+    if (using_apic)
+        ioapic_mask (irq_gsi (irq));
+    else if (irq < NUM_PIC_IRQS)
+        pic_mask (irq);
+}
+
+    PUBLIC void
+irq_unmask (irq)
+    int irq;
+{
+    if (using_apic)
+        ioapic_unmask (irq_gsi (irq));
+    else if (irq < NUM_PIC_IRQS)
+        pic_unmask (irq);
+}
+
+/**********************************************************/
+
+/**
+ *  Send an IRQ to the processor with the given local APIC ID. This does
+ *  nothing when using the PICs, which can only interrupt the first
+ *  processor.
+ */
+    PUBLIC void
+irq_route (irq, apic_id)
+    int irq;
+    uint8_t apic_id;
+{
+    if (!using_apic || irq < 0 || irq >= NUM_IRQS)
+        return;
+
+    irq_destination [irq] = apic_id;
+
+    if (handlers [irq] != NULL)
+    {
+        ioapic_route (irq_gsi (irq), IRQ_BASE_VECTOR + irq, apic_id,
+          irq_flags (irq));
+        ioapic_unmask (irq_gsi (irq));
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if interrupts are delivered by the APIC.
+ */
+    PUBLIC bool
+irq_using_apic (void)
+{
+    return using_apic;
+}
+
+/**********************************************************/
+
+/**
+ *  Print the histogram of interrupt latencies, and the average cost of
+ *  signalling the end of an interrupt.
+ */
+    PUBLIC void
+irq_latency_dump (void)
+{
+    kprintf ("irq latency (%s): cycles from entry to handler\n",
+      using_apic ? "apic" : "pic");
+
+    for (int i = 0; i < NUM_LATENCY_BUCKETS; i ++)
+    {
+        if (latency_histogram [i] == 0)
+            continue;
+
+        kprintf ("  < %10u: %u\n", i < 32 ? 1u << i : ~0u,
+          latency_histogram [i]);
+    }
+
+    kprintf ("eoi: %u, average %u cycles; spurious %u, unhandled %u\n",
+      eoi_count, eoi_count == 0 ? 0 : (uint32_t) eoi_cycles / eoi_count,
+      spurious_count, unhandled_count);
+}
+
+/**********************************************************/
+
+/**
+ *  Fast interrupt handler for all of the IRQ vectors.
+ */
+    PRIVATE void
+irq_entry (vector, error_code)
+    uint32_t vector;
+    uint32_t error_code;
+{
+    int irq = vector - IRQ_BASE_VECTOR;
+    uint32_t latency = (uint32_t) read_tsc () -
+      this_cpu ()->interrupt_entry_time;
+    uint64_t eoi_start;
+
+    latency_histogram [bit_length (latency)] ++;
+
+    if (!using_apic && pic_is_spurious (irq))
+    {
+        spurious_count ++;
+        return;
+    }
+
+    if (handlers [irq] != NULL)
+        handlers [irq] (irq);
+    else
+        unhandled_count ++;
+
+    eoi_start = read_tsc ();
+
+    if (using_apic)
+        apic_eoi ();
+    else
+        pic_eoi (irq);
+
+    eoi_cycles += read_tsc () - eoi_start;
+    eoi_count ++;
+
+    thread_preempt ();
+}
+
+/**********************************************************/
+
+/**
+ *  The local APIC raises its spurious vector if an interrupt goes away
+ *  before it is delivered. These must not get an EOI.
+ */
+    PRIVATE void
+apic_spurious_entry (vector, error_code)
+    uint32_t vector;
+    uint32_t error_code;
+{
+    spurious_count ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the IO APIC input that the IRQ is connected to.
+ */
+    PRIVATE uint32_t
+irq_gsi (irq)
+    int irq;
+{
+    if (irq < NUM_ISA_IRQS)
+        return acpi_madt ()->isa_gsi [irq];
+
+    return irq;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the IO APIC polarity and trigger mode flags for the IRQ,
+ *  taking into account any override of the ISA defaults in the MADT.
+ */
+    PRIVATE uint32_t
+irq_flags (irq)
+    int irq;
+{
+    uint16_t madt_flags;
+    uint32_t flags = ISA_DEFAULT_FLAGS;
+
+    if (irq >= NUM_ISA_IRQS)
+        return PCI_DEFAULT_FLAGS;
+
+    madt_flags = acpi_madt ()->isa_flags [irq];
+
+    if ((madt_flags & MADT_POLARITY_MASK) == MADT_ACTIVE_LOW)
+        flags |= IOAPIC_ACTIVE_LOW;
+
+    if ((madt_flags & MADT_TRIGGER_MASK) == MADT_LEVEL_TRIGGERED)
+        flags |= IOAPIC_LEVEL_TRIGGERED;
+
+    return flags;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the number of bits needed to hold the value, ie the position
+ *  of the most significant set bit plus one.
+ */
+    PRIVATE int
+bit_length (value)
+    uint32_t value;
+{
+    return value == 0 ? 0 : 32 - __builtin_clz (value);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,48 @@
+/**
+ *  Hardware interrupt requests (IRQs), delivered either through the 8259
+ *  PICs or through the IO APIC and local APIC.
+ *
+ *  IRQ numbers 0 to 15 are the usual ISA IRQs, whichever controller is in
+ *  use. When the IO APIC is in use, higher IRQ numbers are the IO APIC
+ *  global system interrupts with the same number.
+ */
+
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** IRQ n is delivered on vector IRQ_BASE_VECTOR + n */
+#define IRQ_BASE_VECTOR         0x20
+#define NUM_IRQS                24
+
+/** some well known ISA IRQs */
+#define IRQ_TIMER               0
+#define IRQ_COM1                4
+#define IRQ_PRIMARY_ATA         14
+#define IRQ_SECONDARY_ATA       15
+
+/**********************************************************/
+
+/** handlers are called with interrupts disabled, and the end of the
+ *  interrupt is signalled to the controller after the handler returns. */
+typedef void (*irq_handler) (int irq);
+
+/**********************************************************/
+
+void irq_initialise (void);
+bool irq_register (int irq, irq_handler handler);
+void irq_unregister (int irq);
+void irq_mask (int irq);
+void irq_unmask (int irq);
+void irq_route (int irq, uint8_t apic_id);
+bool irq_using_apic (void);
+void irq_latency_dump (void);
+
+/**********************************************************/
+
+
+#endif /** _IRQ_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,383 @@
+/**
+ *  The kernel log.
+ *
+ *  Logging a message only stores a record of it: the time stamp counter,
+ *  the level, the format and the raw arguments. Each processor has a
+ *  ring of records of its own, and a processor only ever writes to its
+ *  own ring, so the only thing to guard against is an interrupt handler
+ *  logging in the middle of another message. A slot is claimed with an
+ *  xadd, which an interrupt cannot split, so no lock and no locked
+ *  instruction is needed, and interrupts stay enabled.
+ *
+ *  The records are formatted and written to the console later, in
+ *  batches, by klog_flush. Logging queues a work item to do that the
+ *  next time a processor is idle. If a ring fills up before it is
+ *  flushed, the oldest records are overwritten, and the flush reports
+ *  how many were lost.
+ *
+ *  Each record's sequence number is set last, once the rest of it has
+ *  been written. The flush only takes a record whose sequence number is
+ *  what it expects, and checks the number again after copying the
+ *  record, in case the writer has come round the ring and started to
+ *  overwrite it.
+ */
+
+#include "klog.h"
+#include "stdint.h"
+#include "stdarg.h"
+#include "acpi.h"
+#include "clock.h"
+#include "console.h"
+#include "cpu.h"
+#include "lock.h"
+#include "output.h"
+#include "slab.h"
+#include "smp.h"
+#include "utils.h"
+#include "work.h"
+
+#define RING_MASK               (KLOG_RING_SIZE - 1)
+
+/** size of the text that is built up before it is handed to the
+ *  console, and the longest line */
+#define BATCH_SIZE              1024
+#define LINE_SIZE               160
+
+/**********************************************************/
+
+struct klog_record
+{
+    /** index of the record in the ring plus 1, or 0 while it is being
+     *  written */
+    volatile uint32_t sequence;
+    uint32_t level;
+    uint64_t tsc;
+    const char *format;
+    uint32_t args [KLOG_MAX_ARGS];
+};
+
+struct klog_ring
+{
+    /** index of the next record to be written, and of the next to be
+     *  flushed */
+    volatile uint32_t head;
+    uint32_t tail;
+
+    /** records overwritten before they were flushed */
+    uint32_t lost;
+
+    struct klog_record records [KLOG_RING_SIZE];
+};
+
+/**
+ *  Text waiting to go to the console.
+ */
+struct batch
+{
+    char data [BATCH_SIZE];
+    size_t length;
+};
+
+/**********************************************************/
+
+PRIVATE void flush (void);
+PRIVATE void flush_ring (int index, struct klog_ring *ring,
+  struct batch *batch);
+PRIVATE void render (int index, struct klog_record *record,
+  struct batch *batch);
+PRIVATE void append (struct batch *batch, const char *text, size_t length);
+PRIVATE void write_batch (struct batch *batch);
+PRIVATE void flush_work (struct work *work, void *data);
+
+/**********************************************************/
+
+/** each processor's ring. The boot processor's is static, so that it can
+ *  log before there is a heap. */
+PRIVATE struct klog_ring boot_ring;
+PRIVATE struct klog_ring *rings [MAX_CPUS] = { &boot_ring };
+
+PRIVATE int log_level = KLOG_INFO;
+
+/** only one processor flushes at a time */
+PRIVATE struct spinlock flush_lock;
+
+PRIVATE struct work flush_item = { flush_work, NULL, 0 };
+
+PRIVATE const char level_names [] = "EWID";
+
+/**********************************************************/
+
+/**
+ *  Give an application processor a ring, before it is started. If there
+ *  is no memory for it, anything the processor logs is dropped. A ring
+ *  left over from a processor that failed to start is reused.
+ */
+    PUBLIC void
+klog_initialise_cpu (index)
+    int index;                  // the processor's index in smp.c
+{
+    struct klog_ring *ring;
+
+    if (rings [index] != NULL)
+        return;
+
+    ring = kmalloc (sizeof (struct klog_ring));
+
+    if (ring != NULL)
+    {
+        ring->head = 0;
+        ring->tail = 0;
+        ring->lost = 0;
+
+        for (int i = 0; i < KLOG_RING_SIZE; i ++)
+            ring->records [i].sequence = 0;
+    }
+
+    rings [index] = ring;
+}
+
+/**********************************************************/
+
+/**
+ *  Store a record of a message in this processor's ring. Use the klog
+ *  macro rather than calling this directly.
+ */
+    PUBLIC void
+klog_record (int level, int count, const char *format, ...)
+{
+    struct klog_ring *ring;
+    struct klog_record *record;
+    uint32_t index;
+    va_list args;
+
+    if (level > log_level)
+        return;
+
+    ring = rings [this_cpu ()->index];
+
+    if (ring == NULL)
+        return;
+
+    index = local_fetch_add (&ring->head, 1);
+    record = &ring->records [index & RING_MASK];
+
+    record->sequence = 0;
+    compiler_barrier ();
+
+    record->tsc = read_tsc ();
+    record->level = level;
+    record->format = format;
+
+    /** klog cannot count past twice KLOG_MAX_ARGS arguments */
+    if (count > KLOG_MAX_ARGS)
+        count = KLOG_MAX_ARGS;
+
+    va_start (args, format);
+
+    for (int i = 0; i < count; i ++)
+        record->args [i] = va_arg (args, uint32_t);
+
+    va_end (args);
+
+    compiler_barrier ();
+    record->sequence = index + 1;
+
+    if (!flush_item.pending)
+        work_queue (&flush_item);
+}
+
+/**********************************************************/
+
+/**
+ *  Set the most detailed level of message that is kept.
+ */
+    PUBLIC void
+klog_set_level (level)
+    int level;                  // KLOG_ level
+{
+    log_level = level;
+}
+
+/**********************************************************/
+
+/**
+ *  Write every record waiting in the rings to the console. If another
+ *  processor is already doing so, leave it to that one.
+ */
+    PUBLIC void
+klog_flush (void)
+{
+    if (!spin_try_acquire (&flush_lock))
+        return;
+
+    flush ();
+    spin_release (&flush_lock);
+}
+
+/**********************************************************/
+
+/**
+ *  Write out whatever is left in the rings when the kernel panics. The
+ *  flush lock is ignored, since whoever holds it may never let go.
+ */
+    PUBLIC void
+klog_panic_flush (void)
+{
+    flush ();
+}
+
+/**********************************************************/
+
+/**
+ *  Write out the rings, oldest records first for each processor.
+ */
+    PRIVATE void
+flush (void)
+{
+    struct batch batch;
+
+    batch.length = 0;
+
+    for (int i = 0; i < smp_cpu_count (); i ++)
+    {
+        if (rings [i] != NULL)
+            flush_ring (i, rings [i], &batch);
+    }
+
+    write_batch (&batch);
+    console_done ();
+}
+
+/**********************************************************/
+
+/**
+ *  Render the records of one ring that have been written since the last
+ *  flush, stopping at the first that is still being written.
+ */
+    PRIVATE void
+flush_ring (index, ring, batch)
+    int index;                  // processor the ring belongs to
+    struct klog_ring *ring;
+    struct batch *batch;
+{
+    uint32_t tail = ring->tail;
+    uint32_t lost = 0;
+
+    for (;;)
+    {
+        struct klog_record *record = &ring->records [tail & RING_MASK];
+        struct klog_record copy;
+        uint32_t sequence = record->sequence;
+
+        if (ring->head - tail > KLOG_RING_SIZE)
+        {
+            /** the writer has lapped us, so skip to the oldest record
+             *  that is still there */
+            lost += ring->head - KLOG_RING_SIZE - tail;
+            tail = ring->head - KLOG_RING_SIZE;
+            continue;
+        }
+
+        if (sequence != tail + 1)
+            break;
+
+        copy = *record;
+        compiler_barrier ();
+
+        if (record->sequence != sequence)
+            continue;
+
+        render (index, &copy, batch);
+        tail ++;
+    }
+
+    ring->tail = tail;
+    ring->lost += lost;
+
+    if (lost != 0)
+    {
+        char line [LINE_SIZE];
+
+        append (batch, line, ksnprintf (line, LINE_SIZE,
+          "klog: cpu %u lost %u records\n", index, lost));
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Format a record as a line of text, with its time in seconds since
+ *  boot, processor and level in front.
+ */
+    PRIVATE void
+render (index, record, batch)
+    int index;                  // processor that logged the record
+    struct klog_record *record;
+    struct batch *batch;
+{
+    char line [LINE_SIZE];
+    uint32_t microseconds;
+    uint32_t seconds;
+    size_t length;
+
+    seconds = (uint32_t) udiv64 (udiv64 (clock_tsc_to_ns (record->tsc),
+      NS_PER_MICROSECOND, NULL), 1000000, &microseconds);
+
+    length = ksnprintf (line, LINE_SIZE, "[%5u.%06u] %u %c: ", seconds,
+      microseconds, index, level_names [record->level]);
+    length += ksnprintf (line + length, LINE_SIZE - length, record->format,
+      record->args [0], record->args [1], record->args [2],
+      record->args [3]);
+
+    append (batch, line, length);
+}
+
+/**********************************************************/
+
+/**
+ *  Add text to a batch, writing the batch out first if it is full.
+ */
+    PRIVATE void
+append (batch, text, length)
+    struct batch *batch;
+    const char *text;
+    size_t length;
+{
+    if (batch->length + length > BATCH_SIZE)
+        write_batch (batch);
+
+    for (size_t i = 0; i < length; i ++)
+        batch->data [batch->length ++] = text [i];
+}
+
+/**********************************************************/
+
+/**
+ *  Hand the text in a batch to the console, and empty it.
+ */
+    PRIVATE void
+write_batch (batch)
+    struct batch *batch;
+{
+    if (batch->length != 0)
+        console_write (batch->data, batch->length);
+
+    batch->length = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  The work item queued by klog_record.
+ */
+    PRIVATE void
+flush_work (work, data)
+    struct work *work;
+    void *data;
+{
+    klog_flush ();
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
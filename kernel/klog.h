@@ -0,0 +1,57 @@
+/**
+ *  The kernel log: cheap, timestamped messages that are written to the
+ *  console later.
+ */
+
+#ifndef _KLOG_H
+#define _KLOG_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** message levels. Messages above the level set by klog_set_level are
+ *  dropped as they are logged. */
+#define KLOG_ERROR              0
+#define KLOG_WARNING            1
+#define KLOG_INFO               2
+#define KLOG_DEBUG              3
+
+/** most arguments a message can have. Each must fit in 32 bits. */
+#define KLOG_MAX_ARGS           4
+
+/** number of records in each processor's ring. Must be a power of 2. */
+#define KLOG_RING_SIZE          256
+
+/**********************************************************/
+
+/**
+ *  Log a message at the given level. The format and arguments are those
+ *  of kprintf, but formatting is left until the message is written out,
+ *  so the format, and any string arguments, must still be valid then;
+ *  string constants are fine.
+ */
+#define klog(level, ...)                                                \
+    ((void) sizeof (char [KLOG_COUNT (__VA_ARGS__) <= KLOG_MAX_ARGS ?     \
+      1 : -1]),                                                         \
+    klog_record (level, KLOG_COUNT (__VA_ARGS__), __VA_ARGS__))
+
+/** number of arguments after the format. It counts up to twice
+ *  KLOG_MAX_ARGS, so that klog can refuse to compile with too many */
+#define KLOG_COUNT(...)                                                 \
+    KLOG_COUNT_ (__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define KLOG_COUNT_(format, a, b, c, d, e, f, g, h, count, ...) count
+
+/**********************************************************/
+
+void klog_initialise_cpu (int index);
+void klog_record (int level, int count, const char *format, ...);
+void klog_set_level (int level);
+void klog_flush (void);
+void klog_panic_flush (void);
+
+/**********************************************************/
+
+
+#endif /** _KLOG_H */
+
+/** vim: set ts=4 sw=4 et : */
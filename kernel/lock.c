@@ -0,0 +1,330 @@
+/**
+ *  Spinlocks, ticket locks and MCS queue locks.
+ *
+ *  All of the waiting loops only read the lock until it looks free, and
+ *  use pause, so that waiters do not keep stealing the cache line from
+ *  the holder with locked writes. Releases are plain stores after a
+ *  compiler barrier, since x86 does not let earlier loads or stores pass
+ *  a later store.
+ */
+
+#include "lock.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "output.h"
+#include "utils.h"
+
+/**********************************************************/
+
+#ifdef LOCK_STATS
+
+PRIVATE void stats_acquired (struct lock_stats *stats, bool contended,
+  uint32_t spins);
+PRIVATE void stats_releasing (struct lock_stats *stats);
+
+#define STATS_ACQUIRED(lock, contended, spins)                          \
+    stats_acquired (&(lock)->stats, contended, spins)
+#define STATS_RELEASING(lock)           stats_releasing (&(lock)->stats)
+
+#else
+
+#define STATS_ACQUIRED(lock, contended, spins)                          \
+    ((void) (contended), (void) (spins))
+#define STATS_RELEASING(lock)
+
+#endif
+
+/**********************************************************/
+
+/**
+ *  Take a spinlock, waiting for as long as it takes.
+ */
+    PUBLIC void
+spin_acquire (lock)
+    struct spinlock *lock;
+{
+    uint32_t spins = 0;
+    bool contended = false;
+
+    while (atomic_exchange (&lock->locked, 1) != 0)
+    {
+        contended = true;
+
+        while (lock->locked != 0)
+        {
+            cpu_relax ();
+            spins ++;
+        }
+    }
+
+    STATS_ACQUIRED (lock, contended, spins);
+}
+
+/**********************************************************/
+
+/**
+ *  Release a spinlock.
+ */
+    PUBLIC void
+spin_release (lock)
+    struct spinlock *lock;
+{
+    STATS_RELEASING (lock);
+
+    compiler_barrier ();
+    lock->locked = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a spinlock only if it is free. Returns true if it was taken.
+ */
+    PUBLIC bool
+spin_try_acquire (lock)
+    struct spinlock *lock;
+{
+    if (lock->locked != 0 || atomic_exchange (&lock->locked, 1) != 0)
+        return false;
+
+    STATS_ACQUIRED (lock, false, 0);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Disable interrupts and take a spinlock. Returns the flags to give to
+ *  spin_release_irqrestore.
+ */
+    PUBLIC uint32_t
+spin_acquire_irqsave (lock)
+    struct spinlock *lock;
+{
+    uint32_t flags = interrupts_save ();
+
+    spin_acquire (lock);
+    return flags;
+}
+
+    PUBLIC void
+spin_release_irqrestore (lock, flags)
+    struct spinlock *lock;
+    uint32_t flags;             // from spin_acquire_irqsave
+{
+    spin_release (lock);
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Take a ticket, and wait until it is served.
+ */
+    PUBLIC void
+ticket_acquire (lock)
+    struct ticket_lock *lock;
+{
+    uint32_t old = atomic_fetch_add ((volatile uint32_t *) lock, 1 << 16);
+    uint16_t ticket = (uint16_t) (old >> 16);
+    uint32_t spins = 0;
+
+    if ((uint16_t) old != ticket)
+    {
+        while (lock->owner != ticket)
+        {
+            cpu_relax ();
+            spins ++;
+        }
+    }
+
+    /** a ticket behind someone else's was contended, even if the owner
+     *  had moved on by the time it was first checked */
+    STATS_ACQUIRED (lock, (uint16_t) old != ticket, spins);
+}
+
+/**********************************************************/
+
+/**
+ *  Serve the next ticket. Only the holder writes the owner half, so a 16
+ *  bit store is enough; an add to the whole word could carry into the
+ *  next ticket.
+ */
+    PUBLIC void
+ticket_release (lock)
+    struct ticket_lock *lock;
+{
+    STATS_RELEASING (lock);
+
+    compiler_barrier ();
+    lock->owner = lock->owner + 1;
+}
+
+/**********************************************************/
+
+/**
+ *  Disable interrupts and take a ticket lock. Returns the flags to give
+ *  to ticket_release_irqrestore.
+ */
+    PUBLIC uint32_t
+ticket_acquire_irqsave (lock)
+    struct ticket_lock *lock;
+{
+    uint32_t flags = interrupts_save ();
+
+    ticket_acquire (lock);
+    return flags;
+}
+
+    PUBLIC void
+ticket_release_irqrestore (lock, flags)
+    struct ticket_lock *lock;
+    uint32_t flags;             // from ticket_acquire_irqsave
+{
+    ticket_release (lock);
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Join the end of the queue for an MCS lock, and wait for the node in
+ *  front to hand the lock over.
+ */
+    PUBLIC void
+mcs_acquire (lock, node)
+    struct mcs_lock *lock;
+    struct mcs_node *node;      // caller's node, until mcs_release
+{
+    struct mcs_node *previous;
+    uint32_t spins = 0;
+
+    node->next = NULL;
+    node->waiting = 1;
+
+    previous = (struct mcs_node *) atomic_exchange (
+      (volatile uint32_t *) &lock->tail, (uint32_t) node);
+
+    if (previous != NULL)
+    {
+        previous->next = node;
+
+        while (node->waiting)
+        {
+            cpu_relax ();
+            spins ++;
+        }
+    }
+
+    STATS_ACQUIRED (lock, previous != NULL, spins);
+}
+
+/**********************************************************/
+
+/**
+ *  Hand an MCS lock to the next node in the queue. If there is no next
+ *  node, the lock is freed, unless another processor has swapped itself
+ *  in as the tail but not yet linked itself to us, in which case we wait
+ *  for the link.
+ */
+    PUBLIC void
+mcs_release (lock, node)
+    struct mcs_lock *lock;
+    struct mcs_node *node;      // the node given to mcs_acquire
+{
+    STATS_RELEASING (lock);
+
+    if (node->next == NULL)
+    {
+        if (atomic_compare_exchange ((volatile uint32_t *) &lock->tail,
+          (uint32_t) node, 0) == (uint32_t) node)
+            return;
+
+        while (node->next == NULL)
+            cpu_relax ();
+    }
+
+    compiler_barrier ();
+    node->next->waiting = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Disable interrupts and take an MCS lock. Returns the flags to give to
+ *  mcs_release_irqrestore.
+ */
+    PUBLIC uint32_t
+mcs_acquire_irqsave (lock, node)
+    struct mcs_lock *lock;
+    struct mcs_node *node;
+{
+    uint32_t flags = interrupts_save ();
+
+    mcs_acquire (lock, node);
+    return flags;
+}
+
+    PUBLIC void
+mcs_release_irqrestore (lock, node, flags)
+    struct mcs_lock *lock;
+    struct mcs_node *node;
+    uint32_t flags;             // from mcs_acquire_irqsave
+{
+    mcs_release (lock, node);
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+#ifdef LOCK_STATS
+
+/**
+ *  Print the contention counters of a lock.
+ */
+    PUBLIC void
+lock_stats_print (name, stats)
+    const char *name;
+    struct lock_stats *stats;
+{
+    kprintf ("lock %s: %u acquired, %u contended, %u spins, max hold %u "
+      "cycles\n", name, stats->acquisitions, stats->contended,
+      stats->spins, stats->max_hold_cycles);
+}
+
+/**********************************************************/
+
+/**
+ *  Update the counters of a lock that has just been taken, or is about
+ *  to be released.
+ */
+    PRIVATE void
+stats_acquired (stats, contended, spins)
+    struct lock_stats *stats;
+    bool contended;             // had to wait behind another holder
+    uint32_t spins;             // times round the wait loop
+{
+    stats->acquisitions ++;
+    stats->spins += spins;
+
+    if (contended)
+        stats->contended ++;
+
+    stats->acquired_at = (uint32_t) read_tsc ();
+}
+
+    PRIVATE void
+stats_releasing (stats)
+    struct lock_stats *stats;
+{
+    uint32_t held = (uint32_t) read_tsc () - stats->acquired_at;
+
+    if (held > stats->max_hold_cycles)
+        stats->max_hold_cycles = held;
+}
+
+/**********************************************************/
+
+#endif
+
+/** vim: set ts=4 sw=4 et : */
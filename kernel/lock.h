@@ -0,0 +1,121 @@
+/**
+ *  Locks for data shared between processors, or with interrupt
+ *  handlers.
+ *
+ *  There are three kinds, which all busy wait:
+ *
+ *  - spinlock, a test and test and set lock. Cheapest when there is
+ *    little contention, but waiters are not served in order, and all of
+ *    them hammer the same cache line when it is released.
+ *  - ticket_lock, which serves waiters in the order they arrived. Still
+ *    one shared cache line.
+ *  - mcs_lock, a queue lock where each waiter spins on a node of its
+ *    own, so a release only disturbs the next waiter's cache line. The
+ *    caller provides the node, usually on its stack, and must pass the
+ *    same node to the release.
+ *
+ *  Every lock is free when it is all zeros, so static locks need no
+ *  setup. The _irqsave variants also disable interrupts on the local
+ *  processor, for data that interrupt handlers use; they return the
+ *  flags for the matching _irqrestore.
+ *
+ *  If the kernel is built with LOCK_STATS, each lock counts how often it
+ *  is taken, how often it had to be waited for, how many times waiters
+ *  went round the spin loop, and the longest time it was held.
+ */
+
+#ifndef _LOCK_H
+#define _LOCK_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/**********************************************************/
+
+#ifdef LOCK_STATS
+
+/**
+ *  Contention counters of a lock. They are updated while the lock is
+ *  held, so need no atomic operations of their own.
+ */
+struct lock_stats
+{
+    uint32_t acquisitions;
+    uint32_t contended;
+    uint32_t spins;
+    uint32_t max_hold_cycles;
+
+    /** low 32 bits of the TSC when the lock was taken */
+    uint32_t acquired_at;
+};
+
+#define LOCK_STATS_FIELD        struct lock_stats stats;
+
+#else
+
+#define LOCK_STATS_FIELD
+
+#endif
+
+/**********************************************************/
+
+struct spinlock
+{
+    volatile uint32_t locked;
+    LOCK_STATS_FIELD
+};
+
+/**
+ *  The ticket being served is in the low half of the first word, and the
+ *  next ticket to hand out in the high half, so that a single atomic add
+ *  to the word both takes a ticket and reads which one is being served.
+ */
+struct ticket_lock
+{
+    volatile uint16_t owner;
+    volatile uint16_t next;
+    LOCK_STATS_FIELD
+};
+
+struct mcs_node
+{
+    struct mcs_node *volatile next;
+    volatile uint32_t waiting;
+};
+
+struct mcs_lock
+{
+    /** the last node in the queue, or NULL if the lock is free */
+    struct mcs_node *volatile tail;
+    LOCK_STATS_FIELD
+};
+
+/**********************************************************/
+
+void spin_acquire (struct spinlock *lock);
+void spin_release (struct spinlock *lock);
+bool spin_try_acquire (struct spinlock *lock);
+uint32_t spin_acquire_irqsave (struct spinlock *lock);
+void spin_release_irqrestore (struct spinlock *lock, uint32_t flags);
+
+void ticket_acquire (struct ticket_lock *lock);
+void ticket_release (struct ticket_lock *lock);
+uint32_t ticket_acquire_irqsave (struct ticket_lock *lock);
+void ticket_release_irqrestore (struct ticket_lock *lock, uint32_t flags);
+
+void mcs_acquire (struct mcs_lock *lock, struct mcs_node *node);
+void mcs_release (struct mcs_lock *lock, struct mcs_node *node);
+uint32_t mcs_acquire_irqsave (struct mcs_lock *lock, struct mcs_node *node);
+void mcs_release_irqrestore (struct mcs_lock *lock, struct mcs_node *node,
+  uint32_t flags);
+
+#ifdef LOCK_STATS
+void lock_stats_print (const char *name, struct lock_stats *stats);
+#endif
+
+/**********************************************************/
+
+
+#endif /** _LOCK_H */
+
+/** vim: set ts=4 sw=4 et : */
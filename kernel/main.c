@@ -4,16 +4,68 @@
 
 #include "output.h"
 #include "vga.h"
+#include "serial.h"
+#include "protect.h"
+#include "acpi.h"
+#include "frames.h"
+#include "initrd.h"
+#include "slab.h"
+#include "vm.h"
+#include "multiboot.h"
+#include "paging.h"
+#include "clock.h"
+#include "cpu.h"
+#include "irq.h"
+#include "ide.h"
+#include "pci.h"
+#include "timer.h"
+#include "thread.h"
+#include "smp.h"
+#include "virtio_blk.h"
+#include "buffer.h"
+#include "ext2.h"
+#include "bench.h"
+#include "benchmarks.h"
 #include "utils.h"
 
 /**********************************************************/
 
     PUBLIC void
-nightingale_main (void)
+nightingale_main (info_address)
+    uint32_t info_address;      // physical address of the multiboot info
 {
     vga_initialise ();
+    serial_initialise ();
+    initialise_tables ();
+    smp_initialise_boot_cpu ();
+    frames_initialise (physical_to_virtual (info_address));
+    paging_initialise ();
+    slab_initialise ();
+    initrd_initialise (physical_to_virtual (info_address));
+    vm_initialise ();
+    acpi_initialise ();
+    irq_initialise ();
+    serial_enable_interrupts ();
+    clock_initialise ();
+    timer_initialise ();
+    thread_initialise ();
+    smp_initialise ();
+    pci_initialise ();
+    ide_initialise ();
+    virtio_blk_initialise ();
+    buffer_initialise ();
+    interrupts_enable ();
+    ext2_initialise ();
+
     print_string ("It Works.\n");
     print_string ("Another line.\n");
+
+#ifdef BENCHMARKS
+    run_benchmarks ();
+    bench_exit (0);
+#endif
+
+    thread_exit ();
 }
 
 /**********************************************************/
@@ -1,5 +1,5 @@
 /**
- *  Functions for copying data.
+ *  Functions for copying, filling and comparing blocks of memory.
  */
 
 #ifndef _MEMUTILS_H
@@ -7,7 +7,11 @@
 
 #include "stdint.h"
 
-void memcopy (void *source, void *dest, size_t count);
+void memcopy (const void *source, void *dest, size_t count);
+void memmove (const void *source, void *dest, size_t count);
+void memset (void *dest, uint8_t value, size_t count);
+int memcompare (const void *first, const void *second, size_t count);
+void clear_page (void *page);
 
 
 #endif /** _MEMUTILS_H */
@@ -1,23 +1,35 @@
 /**
- *  Assembly functions for fast memory copies.
+ *  Assembly functions for fast memory copies, fills and comparisons.
+ *
+ *  Each of these functions works on the bulk of the buffer 4 bytes at a
+ *  time using the string instructions. Anything shorter than SMALL_COUNT
+ *  bytes is handled a byte at a time, since the cost of aligning the
+ *  buffers would outweigh the saving. For longer buffers, a few single
+ *  bytes are moved first so that the destination is 4 byte aligned, then
+ *  the bulk is moved in words, and finally any odd bytes left over at
+ *  the end are moved.
  */
 
 .section .text
 
+.set SMALL_COUNT, 16
+.set PAGE_SIZE, 4096
+
 /**********************************************************/
 
 /**
- *  void memcopy (void *from, void *to, size_t count)
+ *  void memcopy (const void *source, void *dest, size_t count)
  *
- *  Copies the specified number of bytes.
+ *  Copies the specified number of bytes. The source and destination must
+ *  not overlap, unless the destination comes first; use memmove for
+ *  anything else.
  */
     .globl _memcopy
 _memcopy:
     push    %ebp
-    mov     %ebp, %esp
+    mov     %esp, %ebp
     push    %esi
     push    %edi
-    push    %ecx
 
 # register esi must point to the source; edi points to the destination and
 # ecx contains the number of bytes to copy.
@@ -25,9 +37,194 @@ _memcopy:
     mov     12(%ebp), %edi
     mov     16(%ebp), %ecx
 
-rep movsb
+copy_forward:
+    cld
+    cmp     $SMALL_COUNT, %ecx
+    jb      1f
+
+# edx = number of bytes needed to bring the destination up to a 4 byte
+# boundary. Copy those, then ecx becomes the number of whole words.
+    mov     %edi, %edx
+    neg     %edx
+    and     $3, %edx
+    sub     %edx, %ecx
+    xchg    %edx, %ecx
+    rep movsb
+
+    mov     %edx, %ecx
+    shr     $2, %ecx
+    rep movsl
+
+# whatever is left over is less than 4 bytes.
+    mov     %edx, %ecx
+    and     $3, %ecx
+1:
+    rep movsb
+
+    pop     %edi
+    pop     %esi
+    pop     %ebp
+    ret
+
+/**********************************************************/
+
+/**
+ *  void memmove (const void *source, void *dest, size_t count)
+ *
+ *  Copies the specified number of bytes, giving the correct result even
+ *  if the source and destination overlap.
+ */
+    .globl _memmove
+_memmove:
+    push    %ebp
+    mov     %esp, %ebp
+    push    %esi
+    push    %edi
+
+    mov     8(%ebp), %esi
+    mov     12(%ebp), %edi
+    mov     16(%ebp), %ecx
+
+# a forward copy is only unsafe if the destination starts inside the
+# source buffer, ie source < dest < source + count. The unsigned compare
+# of dest - source against count catches both cases at once.
+    mov     %edi, %eax
+    sub     %esi, %eax
+    cmp     %ecx, %eax
+    jae     copy_forward
+
+# copy backwards, starting with the last byte of each buffer.
+    lea     -1(%esi, %ecx), %esi
+    lea     -1(%edi, %ecx), %edi
+    std
+    cmp     $SMALL_COUNT, %ecx
+    jb      1f
+
+# edx = number of bytes needed to bring the end of the destination down
+# to a 4 byte boundary.
+    lea     1(%edi), %edx
+    and     $3, %edx
+    sub     %edx, %ecx
+    xchg    %edx, %ecx
+    rep movsb
+
+# movsl moves the word starting at esi and edi, so point them at the
+# first byte of the last whole word rather than its last byte.
+    sub     $3, %esi
+    sub     $3, %edi
+    mov     %edx, %ecx
+    shr     $2, %ecx
+    rep movsl
+    add     $3, %esi
+    add     $3, %edi
+
+    mov     %edx, %ecx
+    and     $3, %ecx
+1:
+    rep movsb
+
+# the rest of the kernel expects the direction flag to be clear.
+    cld
+    pop     %edi
+    pop     %esi
+    pop     %ebp
+    ret
+
+/**********************************************************/
+
+/**
+ *  void memset (void *dest, uint8_t value, size_t count)
+ *
+ *  Fills the specified number of bytes with the given value.
+ */
+    .globl _memset
+_memset:
+    push    %ebp
+    mov     %esp, %ebp
+    push    %edi
+
+    mov     8(%ebp), %edi
+    movzbl  12(%ebp), %eax
+    mov     16(%ebp), %ecx
+
+# copy the value into all 4 bytes of eax, for storing whole words.
+    imul    $0x01010101, %eax, %eax
+
+    cld
+    cmp     $SMALL_COUNT, %ecx
+    jb      1f
+
+    mov     %edi, %edx
+    neg     %edx
+    and     $3, %edx
+    sub     %edx, %ecx
+    xchg    %edx, %ecx
+    rep stosb
+
+    mov     %edx, %ecx
+    shr     $2, %ecx
+    rep stosl
+
+    mov     %edx, %ecx
+    and     $3, %ecx
+1:
+    rep stosb
+
+    pop     %edi
+    pop     %ebp
+    ret
+
+/**********************************************************/
+
+/**
+ *  int memcompare (const void *first, const void *second, size_t count)
+ *
+ *  Compares two buffers. The return value is zero if they are the same,
+ *  otherwise it is negative or positive depending on whether the first
+ *  byte that differs is smaller or larger in the first buffer.
+ */
+    .globl _memcompare
+_memcompare:
+    push    %ebp
+    mov     %esp, %ebp
+    push    %esi
+    push    %edi
+
+    mov     8(%ebp), %esi
+    mov     12(%ebp), %edi
+    mov     16(%ebp), %edx
+
+# compare whole words first. If the count is less than a word, shr sets
+# the zero flag and we go straight on to the odd bytes.
+    cld
+    mov     %edx, %ecx
+    shr     $2, %ecx
+    repe cmpsl
+    je      1f
 
-    pop     %ecx
+# the last word compared was different. Step back and compare it a byte
+# at a time to find out which byte it was.
+    sub     $4, %esi
+    sub     $4, %edi
+    mov     $4, %ecx
+    jmp     2f
+
+1:
+    mov     %edx, %ecx
+    and     $3, %ecx
+
+# clearing eax also sets the zero flag, so if ecx is zero the buffers
+# are equal.
+2:
+    xor     %eax, %eax
+    repe cmpsb
+    je      3f
+
+    movzbl  -1(%esi), %eax
+    movzbl  -1(%edi), %edx
+    sub     %edx, %eax
+
+3:
     pop     %edi
     pop     %esi
     pop     %ebp
@@ -35,4 +232,26 @@ rep movsb
 
 /**********************************************************/
 
+/**
+ *  void clear_page (void *page)
+ *
+ *  Fills a 4 KiB page with zeroes. The page is aligned and its size is
+ *  fixed, so none of the checks and odd byte handling of memset are
+ *  needed, just one string store of the whole page.
+ */
+    .globl _clear_page
+_clear_page:
+    push    %edi
+
+    mov     8(%esp), %edi
+    mov     $(PAGE_SIZE / 4), %ecx
+    xor     %eax, %eax
+    cld
+    rep stosl
+
+    pop     %edi
+    ret
+
+/**********************************************************/
+
 /** vim: set ts=4 sw=4 et : */
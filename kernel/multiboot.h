@@ -0,0 +1,84 @@
+/**
+ *  The information that a multiboot loader passes to the kernel. Only
+ *  the parts that the kernel uses are described in any detail; see the
+ *  multiboot specification for the rest.
+ */
+
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+
+#include "stdint.h"
+
+/** bits of the flags field, saying which other fields are valid */
+#define MULTIBOOT_INFO_MEMORY   0x00000001
+#define MULTIBOOT_INFO_CMDLINE  0x00000004
+#define MULTIBOOT_INFO_MODULES  0x00000008
+#define MULTIBOOT_INFO_MMAP     0x00000040
+
+/** types of memory map entry. Only available memory may be used. */
+#define MULTIBOOT_MEMORY_AVAILABLE      1
+#define MULTIBOOT_MEMORY_RESERVED       2
+#define MULTIBOOT_MEMORY_ACPI           3
+#define MULTIBOOT_MEMORY_NVS            4
+
+/**********************************************************/
+
+/**
+ *  The multiboot info structure, which the loader leaves a pointer to in
+ *  ebx. All of the addresses in it are physical.
+ */
+struct multiboot_info
+{
+    uint32_t flags;
+
+    /** KiB of memory below 1 MiB, and above 1 MiB up to the first hole */
+    uint32_t mem_lower;
+    uint32_t mem_upper;
+
+    uint32_t boot_device;
+    uint32_t cmdline;
+
+    /** array of struct multiboot_module */
+    uint32_t mods_count;
+    uint32_t mods_addr;
+
+    uint32_t syms [4];
+
+    /** buffer of struct multiboot_mmap_entry */
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+}
+__attribute__ ((packed));
+
+/**
+ *  A module loaded along with the kernel. The module occupies the bytes
+ *  from mod_start up to but not including mod_end.
+ */
+struct multiboot_module
+{
+    uint32_t mod_start;
+    uint32_t mod_end;
+    uint32_t string;
+    uint32_t reserved;
+}
+__attribute__ ((packed));
+
+/**
+ *  An entry of the memory map. The size field does not count itself, so
+ *  the next entry starts size + 4 bytes after this one.
+ */
+struct multiboot_mmap_entry
+{
+    uint32_t size;
+    uint64_t address;
+    uint64_t length;
+    uint32_t type;
+}
+__attribute__ ((packed));
+
+/**********************************************************/
+
+
+#endif /** _MULTIBOOT_H */
+
+/** vim: set ts=4 sw=4 et : */
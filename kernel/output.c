@@ -1,39 +1,75 @@
 /**
- *  Functions for printing output onto the screen via the VGA
+ *  Functions for printing text to the console.
+ *
+ *  kprintf supports a small subset of the usual printf conversions:
+ *
+ *  %d, %u      signed and unsigned decimal integers.
+ *  %x, %X      unsigned hexadecimal integers, in lower or upper case.
+ *  %p          a pointer, as 0x followed by 8 hex digits.
+ *  %s          a string.
+ *  %c          a single character.
+ *  %%          a literal percent sign.
+ *
+ *  Each conversion may have a minimum field width, which by default is
+ *  padded with spaces on the left. A 0 flag pads numbers with zeros
+ *  instead, and a - flag pads on the right.
  */
 
 #include "output.h"
+#include "stdint.h"
+#include "stdarg.h"
 #include "vga.h"
+#include "colours.h"
+#include "console.h"
+#include "cpu.h"
+#include "klog.h"
 #include "utils.h"
 
+/** size of the buffer that kprintf formats into before printing */
+#define KPRINTF_BUFFER_SIZE     128
+
+/** enough digits for a 32 bit number in any base we support */
+#define MAX_DIGITS              32
+
+/** bits of the flags field of a conversion spec */
+#define PAD_ZERO                0x01
+#define PAD_RIGHT               0x02
+
+/**********************************************************/
+
+/**
+ *  Formatted text is collected in one of these. If console is true, the
+ *  buffer is printed whenever it fills up, otherwise any text that does
+ *  not fit is dropped.
+ */
+struct format_buffer
+{
+    char *data;
+    size_t size;
+    size_t length;
+    bool console;
+};
+
+/**********************************************************/
+
+PRIVATE void format (struct format_buffer *out, const char *format,
+  va_list args);
+PRIVATE void format_number (struct format_buffer *out, uint32_t value,
+  unsigned int base, bool negative, bool upper_case, int width,
+  int flags);
+PRIVATE void pad (struct format_buffer *out, char padding, int count);
+PRIVATE void emit (struct format_buffer *out, char character);
+
 /**********************************************************/
 
 /**
  *  Function to print an integer in human readable form (base 10).
- *
- *  This uses a recursive algorithm to ensure that we print the digits in
- *  the correct order (most significant first) without needing some kind
- *  of a buffer. For each recursive call, the value is divided by 10, and
- *  then the digits are printed as we come back out from the stack of
- *  calls. Since the bottom of the stack will have the most significant
- *  digit, this means that digits will be printed in order of most
- *  significant to least.
  */
     PUBLIC void
 print_integer (value)
     int value;                  // integer to be printed.
 {
-    // if the value is negative, we will print a - sign first.
-    if (value < 0)
-    {
-        print_char ('-');
-        value = ~value + 1; // two's complement hack for value *= -1.
-    }
-
-    if (value / 10 != 0)
-        print_integer (value / 10);
-
-    print_char ('0' + value % 10);
+    kprintf ("%d", value);
 }
 
 /**********************************************************/
@@ -46,40 +82,343 @@ print_integer (value)
 print_int_hex (value)
     int value;                  // value to be printed.
 {
-    const char *alphabet = "0123456789ABCDEF";
-    int mask;
-    int nibble_index = 32 - 4;
-    int nibble;
+    kprintf ("0x%08X", value);
+}
 
-    print_string ("0x");
+/**********************************************************/
 
-    for (mask = 0xF0000000; mask != 0; mask >>= 4)
+/**
+ *  Prints a string. The whole string goes to the console in one block,
+ *  so that it is not broken up by text from other processors.
+ */
+    PUBLIC void
+print_string (string)
+    const char *string;         // string to be printed.
+{
+    size_t length = 0;
+
+    while (string [length] != '\0')
+        length ++;
+
+    console_write (string, length);
+    console_done ();
+}
+
+/**********************************************************/
+
+/**
+ *  Print formatted text on the screen. The text is formatted into a
+ *  buffer on the stack and handed to the console in one go, and the
+ *  display and cursor are only updated once at the end.
+ */
+    PUBLIC void
+kprintf (const char *format, ...)
+{
+    va_list args;
+
+    va_start (args, format);
+    vkprintf (format, args);
+    va_end (args);
+}
+
+/**********************************************************/
+
+/**
+ *  Same as kprintf, but takes the arguments as a va_list.
+ */
+    PUBLIC void
+vkprintf (format_string, args)
+    const char *format_string;  // text and conversions to be printed
+    va_list args;               // values for the conversions
+{
+    char data [KPRINTF_BUFFER_SIZE];
+    struct format_buffer out =
     {
-        // mask out the next 4 bit part of the int, starting with the
-        // most significant part.
-        nibble = (value & mask) >> nibble_index;
-        print_char (alphabet [nibble]);
+        .data = data,
+        .size = KPRINTF_BUFFER_SIZE,
+        .length = 0,
+        .console = true,
+    };
 
-        nibble_index -= 4;
-    }
+    format (&out, format_string, args);
+
+    console_write (out.data, out.length);
+    console_done ();
+}
+
+/**********************************************************/
 
-    print_done ();
+/**
+ *  Format text into the given buffer. At most size - 1 characters are
+ *  written, followed by a null terminator. Returns the number of
+ *  characters written, not counting the terminator.
+ */
+    PUBLIC size_t
+ksnprintf (char *buffer, size_t size, const char *format_string, ...)
+{
+    va_list args;
+    struct format_buffer out =
+    {
+        .data = buffer,
+        .size = size - 1,
+        .length = 0,
+        .console = false,
+    };
+
+    if (size == 0)
+        return 0;
+
+    va_start (args, format_string);
+    format (&out, format_string, args);
+    va_end (args);
+
+    buffer [out.length] = '\0';
+    return out.length;
 }
 
 /**********************************************************/
 
 /**
- *  Prints a string. This is pretty standard, although probably could be
- *  optimised in assembly language.
+ *  Report a fatal error in the kernel and stop the CPU. Anything still
+ *  waiting in the kernel log is written out first.
  */
     PUBLIC void
-print_string (string)
-    const char *string;         // string to be printed.
+panic (const char *format_string, ...)
 {
-    while (*string != '\0')
-        print_char (*string ++);
+    va_list args;
+
+    interrupts_disable ();
+    klog_panic_flush ();
+
+    set_colour (TEXT_COLOUR (BRIGHT (GREY), RED));
+    kprintf ("\nPANIC: ");
+
+    va_start (args, format_string);
+    vkprintf (format_string, args);
+    va_end (args);
+
+    kprintf ("\n");
+    halt_forever ();
+}
+
+/**********************************************************/
+
+/**
+ *  Step through the format string, copying ordinary characters to the
+ *  output and expanding each conversion.
+ */
+    PRIVATE void
+format (out, format_string, args)
+    struct format_buffer *out;  // where the text goes
+    const char *format_string;  // text and conversions
+    va_list args;               // values for the conversions
+{
+    for (const char *c = format_string; *c != '\0'; c ++)
+    {
+        int flags = 0;
+        int width = 0;
+        int value;
+        int length;
+        const char *string;
+
+        if (*c != '%')
+        {
+            emit (out, *c);
+            continue;
+        }
+
+        c ++;
+
+        // flags come first, then the field width.
+        for (;; c ++)
+        {
+            if (*c == '0')
+                flags |= PAD_ZERO;
+            else if (*c == '-')
+                flags |= PAD_RIGHT;
+            else
+                break;
+        }
+
+        while (*c >= '0' && *c <= '9')
+            width = width * 10 + (*c ++ - '0');
+
+        switch (*c)
+        {
+        case 'd':
+            value = va_arg (args, int);
+
+            // negating as unsigned gives the right magnitude, even for
+            // the most negative int.
+            format_number (out, value < 0 ? 0u - (uint32_t) value :
+              (uint32_t) value, 10, value < 0, false, width, flags);
+            break;
+
+        case 'u':
+            format_number (out, va_arg (args, uint32_t), 10, false, false,
+              width, flags);
+            break;
+
+        case 'x':
+        case 'X':
+            format_number (out, va_arg (args, uint32_t), 16, false,
+              *c == 'X', width, flags);
+            break;
+
+        case 'p':
+            emit (out, '0');
+            emit (out, 'x');
+            format_number (out, (uint32_t) va_arg (args, void *), 16,
+              false, false, 8, PAD_ZERO);
+            break;
+
+        case 's':
+            string = va_arg (args, const char *);
+
+            if (string == NULL)
+                string = "(null)";
+
+            length = 0;
+
+            while (string [length] != '\0')
+                length ++;
+
+            if (!(flags & PAD_RIGHT))
+                pad (out, ' ', width - length);
+
+            for (int i = 0; i < length; i ++)
+                emit (out, string [i]);
+
+            if (flags & PAD_RIGHT)
+                pad (out, ' ', width - length);
+
+            break;
+
+        case 'c':
+            if (!(flags & PAD_RIGHT))
+                pad (out, ' ', width - 1);
+
+            emit (out, (char) va_arg (args, int));
+
+            if (flags & PAD_RIGHT)
+                pad (out, ' ', width - 1);
+
+            break;
+
+        case '%':
+            emit (out, '%');
+            break;
+
+        case '\0':
+            // a lone % at the end of the format string.
+            return;
+
+        default:
+            // print unknown conversions as they are, so that the mistake
+            // is visible.
+            emit (out, '%');
+            emit (out, *c);
+            break;
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Convert a number to text in the given base. The digits are generated
+ *  least significant first into a small array, which is then copied out
+ *  in reverse with any padding needed to fill the field width.
+ */
+    PRIVATE void
+format_number (out, value, base, negative, upper_case, width, flags)
+    struct format_buffer *out;  // where the text goes
+    uint32_t value;             // magnitude of the number
+    unsigned int base;          // 10 or 16
+    bool negative;              // true to print a - sign
+    bool upper_case;            // use upper case hex digits
+    int width;                  // minimum number of characters to print
+    int flags;                  // PAD_ZERO and/or PAD_RIGHT
+{
+    const char *alphabet = upper_case ? "0123456789ABCDEF" :
+        "0123456789abcdef";
+    char digits [MAX_DIGITS];
+    int count = 0;
+
+    do
+    {
+        digits [count ++] = alphabet [value % base];
+        value /= base;
+    }
+    while (value != 0);
+
+    width -= count + (negative ? 1 : 0);
+
+    // the sign goes before zero padding, but after space padding.
+    if (flags & PAD_RIGHT)
+    {
+        if (negative)
+            emit (out, '-');
+    }
+    else if (flags & PAD_ZERO)
+    {
+        if (negative)
+            emit (out, '-');
+
+        pad (out, '0', width);
+    }
+    else
+    {
+        pad (out, ' ', width);
+
+        if (negative)
+            emit (out, '-');
+    }
+
+    while (count > 0)
+        emit (out, digits [-- count]);
+
+    if (flags & PAD_RIGHT)
+        pad (out, ' ', width);
+}
+
+/**********************************************************/
+
+/**
+ *  Emit the padding character count times. Does nothing if count is zero
+ *  or negative.
+ */
+    PRIVATE void
+pad (out, padding, count)
+    struct format_buffer *out;
+    char padding;
+    int count;
+{
+    while (count -- > 0)
+        emit (out, padding);
+}
+
+/**********************************************************/
+
+/**
+ *  Add a single character to the output buffer. If the buffer is full,
+ *  it is either printed and emptied, or the character is dropped.
+ */
+    PRIVATE void
+emit (out, character)
+    struct format_buffer *out;
+    char character;
+{
+    if (out->length == out->size)
+    {
+        if (!out->console)
+            return;
+
+        console_write (out->data, out->length);
+        out->length = 0;
+    }
 
-    print_done ();
+    out->data [out->length ++] = character;
 }
 
 /**********************************************************/
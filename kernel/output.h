@@ -1,12 +1,12 @@
 /**
- *  Functions for printing strings and numbers onto the screen via the
- *  VGA.
+ *  Functions for printing strings and numbers to the console.
  */
 
 #ifndef _OUTPUT_H
 #define _OUTPUT_H
 
-#include <stdint.h>
+#include "stdint.h"
+#include "stdarg.h"
 
 /**********************************************************/
 
@@ -14,6 +14,12 @@ void print_string (const char *string);
 void print_int_hex (int value);
 void print_integer (int value);
 
+void kprintf (const char *format, ...);
+void vkprintf (const char *format, va_list args);
+size_t ksnprintf (char *buffer, size_t size, const char *format, ...);
+
+void panic (const char *format, ...) __attribute__ ((noreturn));
+
 /**********************************************************/
 
 #endif // _OUTPUT_H
@@ -0,0 +1,229 @@
+/**
+ *  Page tables.
+ *
+ *  Paging is turned on by start.s, before any C code runs, using the
+ *  kernel page directory below. At that point it has the direct map of
+ *  physical memory at KERNEL_BASE, made of 4 MiB pages, and the same
+ *  4 MiB pages at address 0 so that start.s can carry on running at its
+ *  physical address until it jumps up to the kernel's own addresses. The
+ *  direct map pages are global, so they stay in the TLB when CR3 is
+ *  reloaded.
+ *
+ *  All other mappings are of 4 KiB pages, in the area above the direct
+ *  map. Virtual addresses there are handed out in order and not reused,
+ *  which is all the kernel needs for mapping device registers and
+ *  firmware tables.
+ */
+
+#include "paging.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "frames.h"
+#include "memutils.h"
+#include "output.h"
+#include "utils.h"
+
+#define ENTRIES_PER_TABLE       1024
+#define ENTRY_ADDRESS(x)        ((x) & ~(PAGE_SIZE - 1))
+
+/** number of the page directory entry for an address, and of its entry
+ *  in that page table */
+#define DIRECTORY_INDEX(x)      ((x) >> LARGE_PAGE_SHIFT)
+#define TABLE_INDEX(x)          (((x) >> PAGE_SHIFT) & (ENTRIES_PER_TABLE - 1))
+
+/**********************************************************/
+
+PRIVATE uint32_t *page_table_entry (uint32_t address, bool create);
+
+/**********************************************************/
+
+/** the page directory, which start.s fills in and loads */
+uint32_t kernel_page_directory [ENTRIES_PER_TABLE]
+    __attribute__ ((aligned (PAGE_SIZE)));
+
+/** next free address in the area for 4 KiB mappings */
+PRIVATE uint32_t next_vmap = VMAP_START;
+
+/**********************************************************/
+
+/**
+ *  Remove the mapping at address 0 that start.s needed, so that null
+ *  pointers fault. Everything since start.s has used the kernel's own
+ *  addresses.
+ */
+    PUBLIC void
+paging_initialise (void)
+{
+    kernel_page_directory [0] = 0;
+    write_cr3 (read_cr3 ());
+
+    kprintf ("paging: %u MiB direct mapped at %p with 4 MiB pages\n",
+      DIRECT_MAP_SIZE >> 20, KERNEL_BASE);
+}
+
+/**********************************************************/
+
+/**
+ *  Map the 4 KiB page at a virtual address to a physical frame. Any
+ *  existing mapping of the page is replaced.
+ */
+    PUBLIC void
+paging_map (address, physical, flags)
+    uint32_t address;           // virtual address of the page
+    uint32_t physical;          // physical address of the frame
+    uint32_t flags;             // PAGE_ flags for the entry
+{
+    uint32_t saved = interrupts_save ();
+    uint32_t *entry = page_table_entry (address, true);
+
+    *entry = ENTRY_ADDRESS (physical) | flags;
+    invalidate_page ((void *) address);
+
+    interrupts_restore (saved);
+}
+
+/**********************************************************/
+
+/**
+ *  Remove the mapping of a 4 KiB page, if it has one.
+ */
+    PUBLIC void
+paging_unmap (address)
+    uint32_t address;
+{
+    uint32_t flags = interrupts_save ();
+    uint32_t *entry = page_table_entry (address, false);
+
+    if (entry != NULL)
+    {
+        *entry = 0;
+        invalidate_page ((void *) address);
+    }
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the physical address that a virtual address is mapped to, or
+ *  0 if it is not mapped.
+ */
+    PUBLIC uint32_t
+paging_lookup (address)
+    uint32_t address;
+{
+    uint32_t directory = kernel_page_directory [DIRECTORY_INDEX (address)];
+    uint32_t *entry;
+
+    if (directory & PAGE_LARGE)
+        return (directory & ~(LARGE_PAGE_SIZE - 1)) |
+            (address & (LARGE_PAGE_SIZE - 1));
+
+    entry = page_table_entry (address, false);
+
+    if (entry == NULL || !(*entry & PAGE_PRESENT))
+        return 0;
+
+    return ENTRY_ADDRESS (*entry) | (address & (PAGE_SIZE - 1));
+}
+
+/**********************************************************/
+
+/**
+ *  Set aside a range of virtual addresses for 4 KiB mappings. Each range
+ *  is followed by an unmapped page, to catch overruns. Returns 0 if
+ *  there is no room left.
+ */
+    PUBLIC uint32_t
+paging_reserve (size)
+    uint32_t size;
+{
+    uint32_t flags = interrupts_save ();
+    uint32_t address = next_vmap;
+    uint32_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    if (pages >= (VMAP_END - address) >> PAGE_SHIFT)
+        address = 0;
+    else
+        next_vmap += (pages + 1) << PAGE_SHIFT;
+
+    interrupts_restore (flags);
+
+    return address;
+}
+
+/**********************************************************/
+
+/**
+ *  Map a range of physical memory, such as device registers or firmware
+ *  tables, and return its virtual address. Ordinary memory that is in
+ *  the direct map is not mapped again.
+ */
+    PUBLIC void *
+paging_map_physical (physical, size, flags)
+    uint32_t physical;          // start of the range
+    uint32_t size;              // length of the range in bytes
+    uint32_t flags;             // PAGE_KERNEL, or PAGE_KERNEL_IO
+{
+    uint32_t offset = physical & (PAGE_SIZE - 1);
+    uint32_t address;
+
+    if (flags == PAGE_KERNEL && physical + size <= DIRECT_MAP_SIZE
+      && physical + size >= physical)
+        return physical_to_virtual (physical);
+
+    address = paging_reserve (offset + size);
+
+    if (address == 0)
+        panic ("No room to map %u bytes at %p\n", size, physical);
+
+    for (uint32_t done = 0; done < offset + size; done += PAGE_SIZE)
+        paging_map (address + done, physical - offset + done, flags);
+
+    return (void *) (address + offset);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns a pointer to the page table entry for a virtual address, or
+ *  NULL if it has no page table and create is false. Page tables are
+ *  allocated as needed if create is true. Called with interrupts
+ *  disabled.
+ */
+    PRIVATE uint32_t *
+page_table_entry (address, create)
+    uint32_t address;
+    bool create;
+{
+    uint32_t *directory = &kernel_page_directory [DIRECTORY_INDEX (address)];
+    uint32_t *table;
+
+    if (*directory & PAGE_LARGE)
+        panic ("%p is in a 4 MiB page\n", address);
+
+    if (!(*directory & PAGE_PRESENT))
+    {
+        uint32_t frame;
+
+        if (!create)
+            return NULL;
+
+        frame = frame_alloc (0);
+
+        if (frame == 0)
+            panic ("No memory for a page table\n");
+
+        memset (physical_to_virtual (frame), 0, PAGE_SIZE);
+        *directory = frame | PAGE_PRESENT | PAGE_WRITE;
+    }
+
+    table = physical_to_virtual (ENTRY_ADDRESS (*directory));
+
+    return &table [TABLE_INDEX (address)];
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,83 @@
+/**
+ *  Virtual memory layout, and page table management.
+ *
+ *  The kernel runs in the top quarter of the address space. Physical
+ *  memory up to DIRECT_MAP_SIZE is mapped at KERNEL_BASE with 4 MiB
+ *  pages, which covers the kernel image and all of the memory that the
+ *  frame allocator hands out. The space above that is for mappings of
+ *  single 4 KiB pages.
+ */
+
+#ifndef _PAGING_H
+#define _PAGING_H
+
+#include "stdint.h"
+
+/** where physical memory is mapped, and how much of it */
+#define KERNEL_BASE             0xC0000000
+#define DIRECT_MAP_SIZE         0x38000000
+
+/** area for 4 KiB mappings, above the direct map */
+#define VMAP_START              (KERNEL_BASE + DIRECT_MAP_SIZE)
+#define VMAP_END                0xFFC00000
+
+#define PAGE_SHIFT              12
+#define PAGE_SIZE               (1 << PAGE_SHIFT)
+#define LARGE_PAGE_SHIFT        22
+#define LARGE_PAGE_SIZE         (1 << LARGE_PAGE_SHIFT)
+
+/** bits of page directory and page table entries */
+#define PAGE_PRESENT            0x001
+#define PAGE_WRITE              0x002
+#define PAGE_USER               0x004
+#define PAGE_WRITE_THROUGH      0x008
+#define PAGE_NO_CACHE           0x010
+#define PAGE_ACCESSED           0x020
+#define PAGE_DIRTY              0x040
+#define PAGE_LARGE              0x080
+#define PAGE_GLOBAL             0x100
+
+/** the usual flags for kernel data, and for memory mapped registers */
+#define PAGE_KERNEL             (PAGE_PRESENT | PAGE_WRITE | PAGE_GLOBAL)
+#define PAGE_KERNEL_IO          (PAGE_KERNEL | PAGE_NO_CACHE)
+
+/**********************************************************/
+
+/**
+ *  Convert between physical addresses and their virtual addresses in the
+ *  direct map. These only work for physical addresses below
+ *  DIRECT_MAP_SIZE.
+ */
+    static inline void *
+physical_to_virtual (uint32_t physical)
+{
+    return (void *) (physical + KERNEL_BASE);
+}
+
+    static inline uint32_t
+virtual_to_physical (const void *address)
+{
+    return (uint32_t) address - KERNEL_BASE;
+}
+
+/**********************************************************/
+
+/** the page directory, which is set up by start.s */
+extern uint32_t kernel_page_directory [];
+
+/**********************************************************/
+
+void paging_initialise (void);
+void paging_map (uint32_t address, uint32_t physical, uint32_t flags);
+void paging_unmap (uint32_t address);
+uint32_t paging_lookup (uint32_t address);
+uint32_t paging_reserve (uint32_t size);
+void *paging_map_physical (uint32_t physical, uint32_t size,
+  uint32_t flags);
+
+/**********************************************************/
+
+
+#endif /** _PAGING_H */
+
+/** vim: set ts=4 sw=4 et : */
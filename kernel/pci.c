@@ -0,0 +1,320 @@
+/**
+ *  PCI configuration space access and bus enumeration.
+ *
+ *  Configuration space is reached through configuration mechanism 1: the
+ *  bus, slot, function and register are written to the address port,
+ *  and the register is then read or written through the data port. Each
+ *  access is two port writes or reads, so the interesting parts of each
+ *  device's header are read once while scanning and kept.
+ *
+ *  Every bus number is scanned, rather than following bridges, which is
+ *  slower but finds everything without having to understand bridges.
+ *  Slots with nothing in them read as vendor 0xFFFF, and only function 0
+ *  of a single function device is looked at.
+ */
+
+#include "pci.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "io.h"
+#include "lock.h"
+#include "output.h"
+#include "utils.h"
+
+/** ports of configuration mechanism 1 */
+#define CONFIG_ADDRESS          0xCF8
+#define CONFIG_DATA             0xCFC
+
+#define CONFIG_ENABLE           0x80000000
+#define CONFIG_ADDRESS_OF(bus, slot, function, offset) \
+    (CONFIG_ENABLE | (uint32_t) (bus) << 16 | (uint32_t) (slot) << 11 | \
+     (uint32_t) (function) << 8 | ((offset) & 0xFC))
+
+#define NUM_BUSES               256
+#define NUM_SLOTS               32
+#define NUM_FUNCTIONS           8
+
+/** vendor ID read from an empty slot */
+#define NO_DEVICE               0xFFFF
+
+/** bit of the header type for devices with more than one function */
+#define HEADER_MULTIFUNCTION    0x80
+#define HEADER_TYPE_MASK        0x7F
+#define HEADER_GENERAL          0x00
+
+#define NO_IRQ                  0xFF
+
+/**********************************************************/
+
+PRIVATE uint32_t config_read (uint8_t bus, uint8_t slot, uint8_t function,
+  uint8_t offset);
+PRIVATE void scan_function (uint8_t bus, uint8_t slot, uint8_t function);
+
+/**********************************************************/
+
+/** the address and data ports are a pair, so each access holds this */
+PRIVATE struct spinlock config_lock;
+
+PRIVATE struct pci_device devices [PCI_MAX_DEVICES];
+PRIVATE int device_count;
+
+/**********************************************************/
+
+/**
+ *  Scan the bus and record every function found.
+ */
+    PUBLIC void
+pci_initialise (void)
+{
+    for (int bus = 0; bus < NUM_BUSES; bus ++)
+    {
+        for (int slot = 0; slot < NUM_SLOTS; slot ++)
+        {
+            uint32_t header;
+
+            if ((config_read (bus, slot, 0, PCI_VENDOR_ID) & 0xFFFF) ==
+              NO_DEVICE)
+            {
+                continue;
+            }
+
+            scan_function (bus, slot, 0);
+            header = config_read (bus, slot, 0, PCI_HEADER_TYPE & 0xFC);
+
+            if (!(header >> 16 & HEADER_MULTIFUNCTION))
+                continue;
+
+            for (int function = 1; function < NUM_FUNCTIONS; function ++)
+            {
+                if ((config_read (bus, slot, function, PCI_VENDOR_ID) &
+                  0xFFFF) != NO_DEVICE)
+                {
+                    scan_function (bus, slot, function);
+                }
+            }
+        }
+    }
+
+    kprintf ("pci: %u devices\n", device_count);
+}
+
+/**********************************************************/
+
+/**
+ *  The number of devices found, and each device by its index.
+ */
+    PUBLIC int
+pci_device_count (void)
+{
+    return device_count;
+}
+
+    PUBLIC struct pci_device *
+pci_device (index)
+    int index;
+{
+    return &devices [index];
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the first device of the given class and subclass, or NULL if
+ *  there is none.
+ */
+    PUBLIC struct pci_device *
+pci_find_class (class_code, subclass)
+    uint8_t class_code;
+    uint8_t subclass;
+{
+    for (int i = 0; i < device_count; i ++)
+    {
+        if (devices [i].class_code == class_code &&
+          devices [i].subclass == subclass)
+        {
+            return &devices [i];
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the first device with the given vendor and device IDs, or
+ *  NULL if there is none.
+ */
+    PUBLIC struct pci_device *
+pci_find_device (vendor_id, device_id)
+    uint16_t vendor_id;
+    uint16_t device_id;
+{
+    for (int i = 0; i < device_count; i ++)
+    {
+        if (devices [i].vendor_id == vendor_id &&
+          devices [i].device_id == device_id)
+        {
+            return &devices [i];
+        }
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Read a register of a device's configuration space. The offset of a
+ *  16 or 32 bit register must be aligned to its size.
+ */
+    PUBLIC uint32_t
+pci_read32 (device, offset)
+    const struct pci_device *device;
+    uint8_t offset;
+{
+    return config_read (device->bus, device->slot, device->function,
+      offset);
+}
+
+    PUBLIC uint16_t
+pci_read16 (device, offset)
+    const struct pci_device *device;
+    uint8_t offset;
+{
+    return (uint16_t) (pci_read32 (device, offset) >> (offset & 2) * 8);
+}
+
+    PUBLIC uint8_t
+pci_read8 (device, offset)
+    const struct pci_device *device;
+    uint8_t offset;
+{
+    return (uint8_t) (pci_read32 (device, offset) >> (offset & 3) * 8);
+}
+
+/**********************************************************/
+
+/**
+ *  Write a register of a device's configuration space.
+ */
+    PUBLIC void
+pci_write32 (device, offset, value)
+    const struct pci_device *device;
+    uint8_t offset;
+    uint32_t value;
+{
+    uint32_t flags = spin_acquire_irqsave (&config_lock);
+
+    outl (CONFIG_ADDRESS, CONFIG_ADDRESS_OF (device->bus, device->slot,
+      device->function, offset));
+    outl (CONFIG_DATA, value);
+
+    spin_release_irqrestore (&config_lock, flags);
+}
+
+    PUBLIC void
+pci_write16 (device, offset, value)
+    const struct pci_device *device;
+    uint8_t offset;
+    uint16_t value;
+{
+    uint32_t flags = spin_acquire_irqsave (&config_lock);
+
+    outl (CONFIG_ADDRESS, CONFIG_ADDRESS_OF (device->bus, device->slot,
+      device->function, offset));
+    outw (CONFIG_DATA + (offset & 2), value);
+
+    spin_release_irqrestore (&config_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Turn on bits of a device's command register, such as decoding of its
+ *  IO ports and memory, and bus mastering.
+ */
+    PUBLIC void
+pci_enable (device, command)
+    const struct pci_device *device;
+    uint16_t command;           // PCI_COMMAND_ bits
+{
+    pci_write16 (device, PCI_COMMAND,
+      pci_read16 (device, PCI_COMMAND) | command);
+}
+
+/**********************************************************/
+
+/**
+ *  Read the 32 bit configuration register that holds the given offset.
+ */
+    PRIVATE uint32_t
+config_read (bus, slot, function, offset)
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t offset;
+{
+    uint32_t flags = spin_acquire_irqsave (&config_lock);
+    uint32_t value;
+
+    outl (CONFIG_ADDRESS, CONFIG_ADDRESS_OF (bus, slot, function, offset));
+    value = inl (CONFIG_DATA);
+
+    spin_release_irqrestore (&config_lock, flags);
+    return value;
+}
+
+/**********************************************************/
+
+/**
+ *  Record a function that is present. Bridges and other header types
+ *  have no BARs where an ordinary device has them, so theirs are left
+ *  at 0.
+ */
+    PRIVATE void
+scan_function (bus, slot, function)
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+{
+    struct pci_device *device;
+    uint32_t id;
+    uint32_t class;
+    uint8_t header;
+
+    if (device_count == PCI_MAX_DEVICES)
+        return;
+
+    device = &devices [device_count ++];
+    id = config_read (bus, slot, function, PCI_VENDOR_ID);
+    class = config_read (bus, slot, function, PCI_PROG_IF & 0xFC);
+    header = (uint8_t) (config_read (bus, slot, function,
+      PCI_HEADER_TYPE & 0xFC) >> 16);
+
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendor_id = (uint16_t) id;
+    device->device_id = (uint16_t) (id >> 16);
+    device->prog_if = (uint8_t) (class >> 8);
+    device->subclass = (uint8_t) (class >> 16);
+    device->class_code = (uint8_t) (class >> 24);
+    device->irq = NO_IRQ;
+
+    for (int i = 0; i < PCI_NUM_BARS; i ++)
+        device->bars [i] = 0;
+
+    if ((header & HEADER_TYPE_MASK) != HEADER_GENERAL)
+        return;
+
+    for (int i = 0; i < PCI_NUM_BARS; i ++)
+        device->bars [i] = config_read (bus, slot, function, PCI_BAR0 + i * 4);
+
+    device->irq = (uint8_t) config_read (bus, slot, function,
+      PCI_INTERRUPT_LINE);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
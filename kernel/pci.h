@@ -0,0 +1,89 @@
+/**
+ *  Finding devices on the PCI bus, and reading and writing their
+ *  configuration space.
+ */
+
+#ifndef _PCI_H
+#define _PCI_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** most devices that we keep track of */
+#define PCI_MAX_DEVICES         32
+
+/** offsets in the configuration space header */
+#define PCI_VENDOR_ID           0x00
+#define PCI_DEVICE_ID           0x02
+#define PCI_COMMAND             0x04
+#define PCI_STATUS              0x06
+#define PCI_PROG_IF             0x09
+#define PCI_SUBCLASS            0x0A
+#define PCI_CLASS               0x0B
+#define PCI_HEADER_TYPE         0x0E
+#define PCI_BAR0                0x10
+#define PCI_CAPABILITIES        0x34
+#define PCI_INTERRUPT_LINE      0x3C
+
+/** bits of the command register */
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_MASTER      0x0004
+
+/** bit 0 of a BAR is set for IO ports, clear for memory */
+#define PCI_BAR_IO              0x01
+#define PCI_BAR_IO_MASK         0xFFFFFFFC
+#define PCI_BAR_MEMORY_MASK     0xFFFFFFF0
+#define PCI_NUM_BARS            6
+
+/** device classes that we have drivers for */
+#define PCI_CLASS_STORAGE       0x01
+#define PCI_SUBCLASS_IDE        0x01
+
+/**********************************************************/
+
+/**
+ *  A function of a device on the bus, with the parts of its header that
+ *  drivers look for.
+ */
+struct pci_device
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+
+    /** ISA IRQ that the firmware routed the device's interrupt to, or
+     *  0xFF if none */
+    uint8_t irq;
+
+    uint32_t bars [PCI_NUM_BARS];
+};
+
+/**********************************************************/
+
+void pci_initialise (void);
+int pci_device_count (void);
+struct pci_device *pci_device (int index);
+struct pci_device *pci_find_class (uint8_t class_code, uint8_t subclass);
+struct pci_device *pci_find_device (uint16_t vendor_id, uint16_t device_id);
+uint32_t pci_read32 (const struct pci_device *device, uint8_t offset);
+uint16_t pci_read16 (const struct pci_device *device, uint8_t offset);
+uint8_t pci_read8 (const struct pci_device *device, uint8_t offset);
+void pci_write32 (const struct pci_device *device, uint8_t offset,
+  uint32_t value);
+void pci_write16 (const struct pci_device *device, uint8_t offset,
+  uint16_t value);
+void pci_enable (const struct pci_device *device, uint16_t command);
+
+/**********************************************************/
+
+
+#endif /** _PCI_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,177 @@
+/**
+ *  Driver for the pair of 8259 programmable interrupt controllers.
+ *
+ *  The master PIC handles IRQs 0 to 7, and the slave handles IRQs 8 to
+ *  15, passing them on to the master through IRQ 2. By default the BIOS
+ *  sets the master to use vectors 8 to 15, which are also used by CPU
+ *  exceptions, so the first thing we have to do is move them elsewhere.
+ */
+
+#include "pic.h"
+#include "stdint.h"
+#include "io.h"
+#include "utils.h"
+
+/** command and data ports of each PIC */
+#define MASTER_COMMAND          0x20
+#define MASTER_DATA             0x21
+#define SLAVE_COMMAND           0xA0
+#define SLAVE_DATA              0xA1
+
+/** initialisation command words */
+#define ICW1_NEED_ICW4          0x01
+#define ICW1_INITIALISE         0x10
+#define ICW4_8086_MODE          0x01
+
+/** operation command words */
+#define OCW2_END_OF_INTERRUPT   0x20
+#define OCW3_READ_ISR           0x0B
+
+/** the slave PIC is attached to this line of the master */
+#define CASCADE_IRQ             2
+
+/** the lowest priority line of each PIC, which is where a spurious
+ *  interrupt turns up */
+#define MASTER_SPURIOUS_IRQ     7
+#define SLAVE_SPURIOUS_IRQ      15
+
+/**********************************************************/
+
+PRIVATE uint16_t read_isr (void);
+
+/**********************************************************/
+
+/**
+ *  Reinitialise both PICs, so that their interrupts use the given vector
+ *  numbers. All lines except the cascade line are left masked.
+ */
+    PUBLIC void
+pic_remap (master_vector, slave_vector)
+    uint8_t master_vector;      // vector for IRQ 0, a multiple of 8
+    uint8_t slave_vector;       // vector for IRQ 8, a multiple of 8
+{
+    // the PICs expect the initialisation words in a fixed sequence, on
+    // alternating ports.
+    outb (MASTER_COMMAND, ICW1_INITIALISE | ICW1_NEED_ICW4);
+    io_wait ();
+    outb (SLAVE_COMMAND, ICW1_INITIALISE | ICW1_NEED_ICW4);
+    io_wait ();
+
+    outb (MASTER_DATA, master_vector);
+    io_wait ();
+    outb (SLAVE_DATA, slave_vector);
+    io_wait ();
+
+    // tell the master which line has the slave on it (as a bitmap), and
+    // tell the slave which line it is on (as a number).
+    outb (MASTER_DATA, 1 << CASCADE_IRQ);
+    io_wait ();
+    outb (SLAVE_DATA, CASCADE_IRQ);
+    io_wait ();
+
+    outb (MASTER_DATA, ICW4_8086_MODE);
+    io_wait ();
+    outb (SLAVE_DATA, ICW4_8086_MODE);
+    io_wait ();
+
+    outb (MASTER_DATA, (uint8_t) ~(1 << CASCADE_IRQ));
+    outb (SLAVE_DATA, 0xFF);
+}
+
+/**********************************************************/
+
+/**
+ *  Disable or enable a single interrupt line.
+ */
+    PUBLIC void
+pic_mask (irq)
+    int irq;
+{
+    if (irq < 8)
+        outb (MASTER_DATA, inb (MASTER_DATA) | 1 << irq);
+    else
+        outb (SLAVE_DATA, inb (SLAVE_DATA) | 1 << (irq - 8));
+}
+
+    PUBLIC void
+pic_unmask (irq)
+    int irq;
+{
+    if (irq < 8)
+        outb (MASTER_DATA, inb (MASTER_DATA) & ~(1 << irq));
+    else
+        outb (SLAVE_DATA, inb (SLAVE_DATA) & ~(1 << (irq - 8)));
+}
+
+/**********************************************************/
+
+/**
+ *  Disable every line of both PICs, for when interrupts are delivered by
+ *  the APIC instead.
+ */
+    PUBLIC void
+pic_mask_all (void)
+{
+    outb (MASTER_DATA, 0xFF);
+    outb (SLAVE_DATA, 0xFF);
+}
+
+/**********************************************************/
+
+/**
+ *  Signal the end of an interrupt, so that the PIC will deliver more
+ *  interrupts of the same or lower priority. Interrupts from the slave
+ *  need an EOI on both PICs.
+ */
+    PUBLIC void
+pic_eoi (irq)
+    int irq;
+{
+    if (irq >= 8)
+        outb (SLAVE_COMMAND, OCW2_END_OF_INTERRUPT);
+
+    outb (MASTER_COMMAND, OCW2_END_OF_INTERRUPT);
+}
+
+/**********************************************************/
+
+/**
+ *  The PIC raises IRQ 7 or 15 if an interrupt goes away before the CPU
+ *  acknowledges it. These spurious interrupts can be recognised because
+ *  the in service bit is not set. They must not get an EOI, except that
+ *  the master does need one for a spurious interrupt from the slave.
+ */
+    PUBLIC bool
+pic_is_spurious (irq)
+    int irq;
+{
+    if (irq != MASTER_SPURIOUS_IRQ && irq != SLAVE_SPURIOUS_IRQ)
+        return false;
+
+    if (read_isr () & 1 << irq)
+        return false;
+
+    if (irq == SLAVE_SPURIOUS_IRQ)
+        outb (MASTER_COMMAND, OCW2_END_OF_INTERRUPT);
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Read the in service registers of both PICs, with the slave in the
+ *  high byte.
+ */
+    PRIVATE uint16_t
+read_isr (void)
+{
+    outb (MASTER_COMMAND, OCW3_READ_ISR);
+    outb (SLAVE_COMMAND, OCW3_READ_ISR);
+
+    return (uint16_t) inb (SLAVE_COMMAND) << 8 | inb (MASTER_COMMAND);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,29 @@
+/**
+ *  Driver for the pair of 8259 programmable interrupt controllers (PIC)
+ *  found on every PC.
+ */
+
+#ifndef _PIC_H
+#define _PIC_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** number of interrupt lines on the two PICs together */
+#define NUM_PIC_IRQS            16
+
+/**********************************************************/
+
+void pic_remap (uint8_t master_vector, uint8_t slave_vector);
+void pic_mask (int irq);
+void pic_unmask (int irq);
+void pic_mask_all (void);
+void pic_eoi (int irq);
+bool pic_is_spurious (int irq);
+
+/**********************************************************/
+
+
+#endif /** _PIC_H */
+
+/** vim: set ts=4 sw=4 et : */
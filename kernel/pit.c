@@ -0,0 +1,133 @@
+/**
+ *  Driver for the programmable interval timer.
+ *
+ *  The PIT has three channels. Channel 0 is connected to IRQ 0, and is
+ *  used as a timer interrupt when there is no local APIC timer. Channel 2
+ *  is normally used for the PC speaker, but its gate input and output
+ *  can both be controlled and read through port 0x61 without making any
+ *  noise, which makes it ideal for timing a fixed interval when
+ *  calibrating the TSC.
+ */
+
+#include "pit.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "io.h"
+#include "utils.h"
+
+/** data ports for each channel, and the mode/command port */
+#define PIT_CHANNEL0            0x40
+#define PIT_CHANNEL2            0x42
+#define PIT_COMMAND             0x43
+
+/** fields of the command byte */
+#define SELECT_CHANNEL0         0x00
+#define SELECT_CHANNEL2         0x80
+#define ACCESS_LOW_HIGH         0x30
+#define MODE_INTERRUPT_ON_COUNT 0x00
+#define MODE_RATE_GENERATOR     0x04
+
+/** port 0x61 controls the channel 2 gate and the speaker, and shows the
+ *  state of the channel 2 output */
+#define SYSTEM_CONTROL_PORT     0x61
+#define CHANNEL2_GATE           0x01
+#define SPEAKER_ENABLE          0x02
+#define CHANNEL2_OUTPUT         0x20
+
+/**********************************************************/
+
+PRIVATE void write_count (uint8_t channel_port, uint16_t count);
+
+/**********************************************************/
+
+/**
+ *  Count the number of TSC cycles it takes for the PIT to count down
+ *  from the given count, which takes count / PIT_FREQUENCY seconds.
+ */
+    PUBLIC uint64_t
+pit_measure_tsc (count)
+    uint16_t count;             // number of PIT ticks to time
+{
+    uint8_t control = inb (SYSTEM_CONTROL_PORT);
+    uint64_t start;
+    uint64_t end;
+
+    // hold the gate low while the count is loaded, with the speaker off.
+    outb (SYSTEM_CONTROL_PORT, control & ~(CHANNEL2_GATE | SPEAKER_ENABLE));
+
+    outb (PIT_COMMAND, SELECT_CHANNEL2 | ACCESS_LOW_HIGH |
+      MODE_INTERRUPT_ON_COUNT);
+    write_count (PIT_CHANNEL2, count);
+
+    // the count starts when the gate goes high, and the output goes high
+    // when it reaches zero.
+    outb (SYSTEM_CONTROL_PORT, (control & ~SPEAKER_ENABLE) | CHANNEL2_GATE);
+    start = read_tsc ();
+
+    while ((inb (SYSTEM_CONTROL_PORT) & CHANNEL2_OUTPUT) == 0)
+        ;
+
+    end = read_tsc ();
+    outb (SYSTEM_CONTROL_PORT, control);
+
+    return end - start;
+}
+
+/**********************************************************/
+
+/**
+ *  Make channel 0 raise IRQ 0 every count ticks.
+ */
+    PUBLIC void
+pit_periodic (count)
+    uint16_t count;
+{
+    outb (PIT_COMMAND, SELECT_CHANNEL0 | ACCESS_LOW_HIGH |
+      MODE_RATE_GENERATOR);
+    write_count (PIT_CHANNEL0, count);
+}
+
+/**********************************************************/
+
+/**
+ *  Make channel 0 raise IRQ 0 once, after count ticks.
+ */
+    PUBLIC void
+pit_one_shot (count)
+    uint16_t count;
+{
+    outb (PIT_COMMAND, SELECT_CHANNEL0 | ACCESS_LOW_HIGH |
+      MODE_INTERRUPT_ON_COUNT);
+    write_count (PIT_CHANNEL0, count);
+}
+
+/**********************************************************/
+
+/**
+ *  Stop channel 0 from raising any more interrupts. Reprogramming the
+ *  mode stops the count until a new count is written.
+ */
+    PUBLIC void
+pit_stop (void)
+{
+    outb (PIT_COMMAND, SELECT_CHANNEL0 | ACCESS_LOW_HIGH |
+      MODE_INTERRUPT_ON_COUNT);
+}
+
+/**********************************************************/
+
+/**
+ *  Load a channel's counter, low byte first.
+ */
+    PRIVATE void
+write_count (channel_port, count)
+    uint8_t channel_port;
+    uint16_t count;
+{
+    outb (channel_port, (uint8_t) (count & 0xFF));
+    outb (channel_port, (uint8_t) (count >> 8));
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
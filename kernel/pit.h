@@ -0,0 +1,28 @@
+/**
+ *  Driver for the 8253/8254 programmable interval timer (PIT).
+ */
+
+#ifndef _PIT_H
+#define _PIT_H
+
+#include "stdint.h"
+
+/** the PIT counts down at this rate, in Hz */
+#define PIT_FREQUENCY           1193182
+
+/** the longest count the PIT can be programmed with */
+#define PIT_MAX_COUNT           0xFFFF
+
+/**********************************************************/
+
+uint64_t pit_measure_tsc (uint16_t count);
+void pit_periodic (uint16_t count);
+void pit_one_shot (uint16_t count);
+void pit_stop (void);
+
+/**********************************************************/
+
+
+#endif /** _PIT_H */
+
+/** vim: set ts=4 sw=4 et : */
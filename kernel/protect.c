@@ -1,47 +1,58 @@
 /**
  *  Functions for setting up the global descriptor table and the interrupt
  *  descriptor table.
+ *
+ *  All processors share the IDT, but each has a GDT of its own, which
+ *  lives in its struct cpu. The GDTs only differ in the base of the
+ *  CPU_DATA_SELECTOR segment.
  */
 
 #include "protect.h"
 #include "stdint.h"
 #include "descriptors.h"
+#include "interrupt.h"
+#include "smp.h"
 #include "utils.h"
 
 /**********************************************************/
 
-PRIVATE void flat_gdt (void);
-PRIVATE void empty_idt (void);
+PRIVATE void flat_gdt (struct gdt_entry *gdt, uint32_t cpu_data);
+PRIVATE void populate_idt (void);
+
+/**********************************************************/
+
+struct table_descriptor idtr;
+struct idt_entry idt [NUM_IDT_ENTRIES];
 
 /**********************************************************/
 
 /**
- *  Initialise the gdt and idt tables declared in protect.h, and set the
- *  values for the CPU GDT and IDT registers.
+ *  Initialise the idt table declared in protect.h. It is loaded, along
+ *  with a GDT, by load_tables.
  */
     PUBLIC void
 initialise_tables (void)
 {
-    flat_gdt ();
-    empty_idt ();
-
-    gdtr.base_address = (uint32_t) &gdt;
-    gdtr.size = sizeof (struct gdt_entry) * NUM_GDT_ENTRIES;
+    populate_idt ();
 
+    // the size field is actually the offset of the last byte.
     idtr.base_address = (uint32_t) &idt;
-    idtr.size = sizeof (struct idt_entry) * NUM_IDT_ENTRIES;
+    idtr.size = sizeof (struct idt_entry) * NUM_IDT_ENTRIES - 1;
 }
 
 /**********************************************************/
 
 /**
- *  Initialise the GDT with 3 entries, the null entry which is always
+ *  Initialise a GDT with 4 entries, the null entry which is always
  *  kept in GDT[0], and code and data segments in 1 and 2. The code and
  *  data segments will have a base of 0 and limit of 4 GiB, hence the name
- *  flat gdt.
+ *  flat gdt. Entry 3 is a data segment covering just the processor's
+ *  struct cpu.
  */
     PRIVATE void
-flat_gdt (void)
+flat_gdt (gdt, cpu_data)
+    struct gdt_entry *gdt;      // the GDT to fill in
+    uint32_t cpu_data;          // address of the processor's struct cpu
 {
     // first entry in the GDT (GDT[0]) cannot be used, and we will set
     // the base and limit to 0.
@@ -50,26 +61,75 @@ flat_gdt (void)
     // kernel code segment.
     make_gdt_entry (&gdt [1], 0, 0xFFFFF, 
       GDT_GRANULARITY (1) | GDT_SIZE (1),
-      GDT_PRESENT (1) | GDT_RING_LEVEL (0) | GDT_EXECUTABLE (1) | 
-      GDT_READ_WRITE (1));
+      GDT_PRESENT (1) | GDT_RING_LEVEL (0) | GDT_CODE_OR_DATA (1) |
+      GDT_EXECUTABLE (1) | GDT_READ_WRITE (1));
 
     // kernel data segment.
     make_gdt_entry (&gdt [2], 0, 0xFFFFF,
       GDT_GRANULARITY (1) | GDT_SIZE (1),
-      GDT_PRESENT (1) | GDT_RING_LEVEL (0) | GDT_READ_WRITE (1));
+      GDT_PRESENT (1) | GDT_RING_LEVEL (0) | GDT_CODE_OR_DATA (1) |
+      GDT_READ_WRITE (1));
+
+    // per processor data segment, with a byte granular limit.
+    make_gdt_entry (&gdt [3], cpu_data, sizeof (struct cpu) - 1,
+      GDT_SIZE (1),
+      GDT_PRESENT (1) | GDT_RING_LEVEL (0) | GDT_CODE_OR_DATA (1) |
+      GDT_READ_WRITE (1));
 }
 
 /**********************************************************/
 
 /**
- *  Create an empty interrupt descriptor table by stepping through all
- *  the entries and clear the present bit in each one.
+ *  Point every entry of the interrupt descriptor table at its entry stub
+ *  in interrupts.s. All vectors are interrupt gates, so that interrupts
+ *  are disabled until the handler returns.
  */
     PRIVATE void
-empty_idt (void)
+populate_idt (void)
 {
     for (int i = 0; i < NUM_IDT_ENTRIES; i ++)
-        idt [i].attributes &= ~IDT_PRESENT;
+    {
+        make_idt_entry (&idt [i], interrupt_stub_address (i),
+          KERNEL_CODE_SELECTOR,
+          IDT_TYPE (IDT_INTERRUPT_GATE) | IDT_RING_LEVEL (0));
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Build the GDT of a processor, and load it and the IDT into the
+ *  processor we are running on. The segment registers still hold
+ *  descriptors from the boot loader's GDT, or the trampoline's, so they
+ *  are reloaded with our own selectors; cs can only be changed by a far
+ *  jump. gs gets the processor's own data segment.
+ */
+    PUBLIC void
+load_tables (cpu)
+    struct cpu *cpu;            // the processor we are running on
+{
+    struct table_descriptor gdtr;
+
+    flat_gdt (cpu->gdt, (uint32_t) cpu);
+
+    // the size field is actually the offset of the last byte.
+    gdtr.base_address = (uint32_t) cpu->gdt;
+    gdtr.size = sizeof (struct gdt_entry) * NUM_GDT_ENTRIES - 1;
+
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "mov %2, %%ds\n\t"
+        "mov %2, %%es\n\t"
+        "mov %2, %%fs\n\t"
+        "mov %2, %%ss\n\t"
+        "mov %3, %%gs\n\t"
+        "lidt %4"
+        :
+        : "m" (gdtr), "i" (KERNEL_CODE_SELECTOR),
+          "r" (KERNEL_DATA_SELECTOR), "r" (CPU_DATA_SELECTOR), "m" (idtr)
+        : "memory");
 }
 
 /**********************************************************/
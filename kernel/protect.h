@@ -8,17 +8,23 @@
 
 #include "descriptors.h"
 
-#define NUM_GDT_ENTRIES         3
+#define NUM_GDT_ENTRIES         4
 #define NUM_IDT_ENTRIES         256
 
-struct table_descriptor gdtr;
-struct table_descriptor idtr;
+/** segment selectors for the entries in the flat GDT, and for the
+ *  segment holding the processor's own data (see smp.h) */
+#define KERNEL_CODE_SELECTOR    0x08
+#define KERNEL_DATA_SELECTOR    0x10
+#define CPU_DATA_SELECTOR       0x18
 
-struct gdt_entry gdt [NUM_GDT_ENTRIES];
-struct idt_entry idt [NUM_IDT_ENTRIES];
+struct cpu;
+
+extern struct table_descriptor idtr;
+extern struct idt_entry idt [NUM_IDT_ENTRIES];
 
 
 void initialise_tables (void);
+void load_tables (struct cpu *cpu);
 
 
 #endif /** _PROTECT_H */
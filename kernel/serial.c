@@ -0,0 +1,517 @@
+/**
+ *  Driver for the 16550 UART on COM1, as a console and a source of input.
+ *
+ *  Text written to the port goes into a transmit ring, and is moved from
+ *  there to the UART's transmit FIFO. Whenever the transmit holding
+ *  register is empty, a whole FIFO's worth of bytes is written without
+ *  looking at the line status register again, and the UART raises an
+ *  interrupt when the FIFO has drained so that the next lot can be
+ *  written. A writer only waits for the UART if the ring is full, or if
+ *  it has interrupts disabled and so cannot rely on the interrupt.
+ *
+ *  Bytes that arrive are read out of the receive FIFO by the interrupt
+ *  handler into a receive ring, where serial_read finds them.
+ *
+ *  Until serial_enable_interrupts is called, which needs the interrupt
+ *  controllers, all output is written out by polling.
+ */
+
+#include "serial.h"
+#include "stdint.h"
+#include "console.h"
+#include "cpu.h"
+#include "io.h"
+#include "irq.h"
+#include "lock.h"
+#include "output.h"
+#include "utils.h"
+
+/** offsets of the UART registers from the base port. The divisor latch
+ *  replaces the data and interrupt enable registers while LINE_DLAB is
+ *  set, and the FIFO control register is written at the same offset as
+ *  the interrupt identification register is read. */
+#define DATA                    0
+#define INTERRUPT_ENABLE        1
+#define DIVISOR_LOW             0
+#define DIVISOR_HIGH            1
+#define INTERRUPT_ID            2
+#define FIFO_CONTROL            2
+#define LINE_CONTROL            3
+#define MODEM_CONTROL           4
+#define LINE_STATUS             5
+#define MODEM_STATUS            6
+
+#define REGISTER(offset)        (COM1_PORT + (offset))
+
+/** the divisor latch divides this clock down to the bit rate */
+#define UART_CLOCK              115200
+
+/** interrupt enable register */
+#define ENABLE_RECEIVE          0x01
+#define ENABLE_TRANSMIT         0x02
+#define ENABLE_LINE_STATUS      0x04
+
+/** FIFO control register. The 64 byte FIFO of a 16750 can only be
+ *  turned on while the divisor latch is selected. */
+#define FIFO_ENABLE             0x01
+#define FIFO_CLEAR_RECEIVE      0x02
+#define FIFO_CLEAR_TRANSMIT     0x04
+#define FIFO_64_BYTES           0x20
+#define FIFO_TRIGGER_14         0xC0
+
+/** interrupt identification register: bit 0 is clear while an interrupt
+ *  is pending, bits 1 to 3 give its cause, and the top bits show what
+ *  kind of FIFO there is. */
+#define ID_NONE_PENDING         0x01
+#define ID_CAUSE_MASK           0x0E
+#define ID_MODEM_STATUS         0x00
+#define ID_TRANSMIT_EMPTY       0x02
+#define ID_RECEIVE_DATA         0x04
+#define ID_LINE_STATUS          0x06
+#define ID_RECEIVE_TIMEOUT      0x0C
+#define ID_FIFO_64_BYTES        0x20
+#define ID_FIFO_MASK            0xC0
+#define ID_FIFO_WORKING         0xC0
+
+/** line control register: 8 data bits, no parity, 1 stop bit */
+#define LINE_8N1                0x03
+#define LINE_DLAB               0x80
+
+/** modem control register. OUT2 connects the UART's interrupt line to
+ *  the interrupt controller on a PC. */
+#define MODEM_DTR               0x01
+#define MODEM_RTS               0x02
+#define MODEM_OUT2              0x08
+#define MODEM_LOOPBACK          0x10
+
+/** line status register */
+#define STATUS_DATA_READY       0x01
+#define STATUS_OVERRUN          0x02
+#define STATUS_THR_EMPTY        0x20
+
+/** any byte will do to check that the UART is there */
+#define LOOPBACK_TEST_BYTE      0xAE
+
+#define TX_MASK                 (SERIAL_TX_RING_SIZE - 1)
+#define RX_MASK                 (SERIAL_RX_RING_SIZE - 1)
+
+/**********************************************************/
+
+PRIVATE int detect_fifo (void);
+PRIVATE void put_byte (char byte);
+PRIVATE void start_transmit (void);
+PRIVATE int fill_fifo (void);
+PRIVATE void drain (void);
+PRIVATE void receive (void);
+PRIVATE void serial_interrupt (int irq);
+
+/**********************************************************/
+
+/** guards the rings, the counters and the UART registers */
+PRIVATE struct spinlock serial_lock;
+
+PRIVATE bool present;
+PRIVATE bool interrupt_driven;
+
+/** number of bytes that can be written when the transmit holding
+ *  register is empty */
+PRIVATE int fifo_size;
+
+/** the rings. head is where the next byte is added, and tail where the
+ *  next is taken from. */
+PRIVATE char tx_ring [SERIAL_TX_RING_SIZE];
+PRIVATE uint32_t tx_head, tx_tail;
+PRIVATE char rx_ring [SERIAL_RX_RING_SIZE];
+PRIVATE uint32_t rx_head, rx_tail;
+
+/** bytes sent and received, transmit interrupts, times the transmit
+ *  ring filled up, and bytes lost because the receive ring or FIFO was
+ *  full */
+PRIVATE uint32_t tx_bytes;
+PRIVATE uint32_t rx_bytes;
+PRIVATE uint32_t tx_interrupts;
+PRIVATE uint32_t tx_ring_full;
+PRIVATE uint32_t rx_dropped;
+
+PRIVATE const struct console serial_console =
+{
+    .name = "serial",
+    .write = serial_write,
+    .done = serial_done,
+};
+
+/**********************************************************/
+
+/**
+ *  Check that there is a UART on COM1, set it up for 115200 bits per
+ *  second, 8N1, with its FIFOs on, and register it as a console. Output
+ *  is polled until serial_enable_interrupts is called.
+ */
+    PUBLIC void
+serial_initialise (void)
+{
+    uint16_t divisor = UART_CLOCK / SERIAL_BAUD_RATE;
+
+    outb (REGISTER (INTERRUPT_ENABLE), 0);
+
+    /** in loopback mode, whatever is sent comes straight back, so we can
+     *  tell whether anything is there */
+    outb (REGISTER (MODEM_CONTROL), MODEM_LOOPBACK);
+    outb (REGISTER (DATA), LOOPBACK_TEST_BYTE);
+
+    if (inb (REGISTER (DATA)) != LOOPBACK_TEST_BYTE)
+        return;
+
+    outb (REGISTER (LINE_CONTROL), LINE_DLAB);
+    outb (REGISTER (DIVISOR_LOW), (uint8_t) (divisor & 0xFF));
+    outb (REGISTER (DIVISOR_HIGH), (uint8_t) (divisor >> 8));
+
+    fifo_size = detect_fifo ();
+
+    outb (REGISTER (LINE_CONTROL), LINE_8N1);
+    outb (REGISTER (MODEM_CONTROL), MODEM_DTR | MODEM_RTS);
+
+    present = true;
+    console_register (&serial_console);
+}
+
+/**********************************************************/
+
+/**
+ *  Switch to interrupt driven transmit and receive.
+ */
+    PUBLIC void
+serial_enable_interrupts (void)
+{
+    uint32_t flags;
+
+    if (!present || !irq_register (IRQ_COM1, serial_interrupt))
+        return;
+
+    flags = spin_acquire_irqsave (&serial_lock);
+
+    outb (REGISTER (MODEM_CONTROL), MODEM_DTR | MODEM_RTS | MODEM_OUT2);
+    outb (REGISTER (INTERRUPT_ENABLE), ENABLE_RECEIVE | ENABLE_TRANSMIT |
+      ENABLE_LINE_STATUS);
+    interrupt_driven = true;
+
+    spin_release_irqrestore (&serial_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if there is a UART on COM1.
+ */
+    PUBLIC bool
+serial_present (void)
+{
+    return present;
+}
+
+/**********************************************************/
+
+/**
+ *  The size of the transmit FIFO, or 1 if the UART has none that works.
+ */
+    PUBLIC int
+serial_fifo_size (void)
+{
+    return fifo_size;
+}
+
+/**********************************************************/
+
+/**
+ *  Add a block of text to the transmit ring, with each newline turned
+ *  into a carriage return and newline, and start sending it if the UART
+ *  is idle. If the ring fills up, this waits for the UART to make room.
+ */
+    PUBLIC void
+serial_write (buffer, length)
+    const char *buffer;         // characters to be sent
+    size_t length;              // number of characters in the buffer
+{
+    uint32_t flags;
+
+    if (!present)
+        return;
+
+    flags = spin_acquire_irqsave (&serial_lock);
+
+    for (size_t i = 0; i < length; i ++)
+    {
+        if (buffer [i] == '\n')
+            put_byte ('\r');
+
+        put_byte (buffer [i]);
+    }
+
+    start_transmit ();
+    spin_release_irqrestore (&serial_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  The console's done call. If the transmit interrupt cannot be relied
+ *  on to send what is left in the ring, because interrupts are not set
+ *  up yet or the caller has them disabled, send it now.
+ */
+    PUBLIC void
+serial_done (void)
+{
+    uint32_t flags;
+
+    if (!present)
+        return;
+
+    flags = spin_acquire_irqsave (&serial_lock);
+
+    if (!interrupt_driven || (flags & EFLAGS_INTERRUPT) == 0)
+        drain ();
+
+    spin_release_irqrestore (&serial_lock, flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Wait until everything in the transmit ring has been handed to the
+ *  UART.
+ */
+    PUBLIC void
+serial_flush (void)
+{
+    uint32_t flags = interrupts_save ();
+
+    interrupts_restore (flags);
+
+    if (interrupt_driven && (flags & EFLAGS_INTERRUPT))
+    {
+        while (tx_head != tx_tail)
+            cpu_relax ();
+    }
+    else
+    {
+        serial_done ();
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Copy up to size bytes that have been received into the buffer,
+ *  without waiting for any. Returns the number copied.
+ */
+    PUBLIC size_t
+serial_read (buffer, size)
+    char *buffer;
+    size_t size;                // most bytes to copy
+{
+    uint32_t flags = spin_acquire_irqsave (&serial_lock);
+    size_t count = 0;
+
+    while (count < size && rx_tail != rx_head)
+        buffer [count ++] = rx_ring [rx_tail ++ & RX_MASK];
+
+    spin_release_irqrestore (&serial_lock, flags);
+    return count;
+}
+
+/**********************************************************/
+
+/**
+ *  Print the transfer counters.
+ */
+    PUBLIC void
+serial_dump_stats (void)
+{
+    kprintf ("serial: fifo %u, sent %u in %u interrupts, ring full %u; "
+      "received %u, dropped %u\n", fifo_size, tx_bytes, tx_interrupts,
+      tx_ring_full, rx_bytes, rx_dropped);
+}
+
+/**********************************************************/
+
+/**
+ *  Turn on the FIFOs, with the receive interrupt raised once 14 bytes
+ *  have arrived, and work out how big the transmit FIFO is from the
+ *  interrupt identification register. An 8250 or 16450 has no FIFO, and
+ *  the FIFO of the original 16550 does not work. Must be called with the
+ *  divisor latch selected.
+ */
+    PRIVATE int
+detect_fifo (void)
+{
+    uint8_t id;
+
+    outb (REGISTER (FIFO_CONTROL), FIFO_ENABLE | FIFO_CLEAR_RECEIVE |
+      FIFO_CLEAR_TRANSMIT | FIFO_64_BYTES | FIFO_TRIGGER_14);
+    id = inb (REGISTER (INTERRUPT_ID));
+
+    if ((id & ID_FIFO_MASK) != ID_FIFO_WORKING)
+    {
+        outb (REGISTER (FIFO_CONTROL), 0);
+        return 1;
+    }
+
+    return (id & ID_FIFO_64_BYTES) ? 64 : 16;
+}
+
+/**********************************************************/
+
+/**
+ *  Add a byte to the transmit ring, with the lock held. If the ring is
+ *  full, move bytes to the UART by polling until there is room.
+ */
+    PRIVATE void
+put_byte (byte)
+    char byte;
+{
+    if (tx_head - tx_tail == SERIAL_TX_RING_SIZE)
+    {
+        tx_ring_full ++;
+
+        while (tx_head - tx_tail == SERIAL_TX_RING_SIZE)
+        {
+            while ((inb (REGISTER (LINE_STATUS)) & STATUS_THR_EMPTY) == 0)
+                cpu_relax ();
+
+            fill_fifo ();
+        }
+    }
+
+    tx_ring [tx_head ++ & TX_MASK] = byte;
+}
+
+/**********************************************************/
+
+/**
+ *  If the transmitter is idle, give it the next FIFO's worth of bytes. If
+ *  it is busy, the transmit interrupt will do so when it is done.
+ */
+    PRIVATE void
+start_transmit (void)
+{
+    if (tx_head != tx_tail &&
+      (inb (REGISTER (LINE_STATUS)) & STATUS_THR_EMPTY))
+    {
+        fill_fifo ();
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Move as many bytes from the transmit ring to the UART as its FIFO
+ *  holds, with the lock held. The transmit holding register must be
+ *  empty, which means the whole FIFO is. Returns the number moved.
+ */
+    PRIVATE int
+fill_fifo (void)
+{
+    int count = 0;
+
+    while (count < fifo_size && tx_tail != tx_head)
+    {
+        outb (REGISTER (DATA), tx_ring [tx_tail ++ & TX_MASK]);
+        count ++;
+    }
+
+    tx_bytes += count;
+    return count;
+}
+
+/**********************************************************/
+
+/**
+ *  Send everything in the transmit ring by polling, with the lock held.
+ */
+    PRIVATE void
+drain (void)
+{
+    while (tx_head != tx_tail)
+    {
+        while ((inb (REGISTER (LINE_STATUS)) & STATUS_THR_EMPTY) == 0)
+            cpu_relax ();
+
+        fill_fifo ();
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Empty the receive FIFO into the receive ring, with the lock held.
+ */
+    PRIVATE void
+receive (void)
+{
+    uint8_t status;
+
+    while ((status = inb (REGISTER (LINE_STATUS))) & STATUS_DATA_READY)
+    {
+        char byte = inb (REGISTER (DATA));
+
+        if (status & STATUS_OVERRUN)
+            rx_dropped ++;
+
+        if (rx_head - rx_tail == SERIAL_RX_RING_SIZE)
+        {
+            rx_dropped ++;
+            continue;
+        }
+
+        rx_ring [rx_head ++ & RX_MASK] = byte;
+        rx_bytes ++;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Handle every cause of interrupt that the UART has pending. Reading
+ *  the interrupt identification register acknowledges a transmit
+ *  interrupt, and reading the line or modem status the others.
+ */
+    PRIVATE void
+serial_interrupt (irq)
+    int irq;
+{
+    uint8_t id;
+
+    spin_acquire (&serial_lock);
+
+    while (((id = inb (REGISTER (INTERRUPT_ID))) & ID_NONE_PENDING) == 0)
+    {
+        switch (id & ID_CAUSE_MASK)
+        {
+        case ID_TRANSMIT_EMPTY:
+            tx_interrupts ++;
+            fill_fifo ();
+            break;
+
+        case ID_RECEIVE_DATA:
+        case ID_RECEIVE_TIMEOUT:
+            receive ();
+            break;
+
+        case ID_LINE_STATUS:
+            if (inb (REGISTER (LINE_STATUS)) & STATUS_OVERRUN)
+                rx_dropped ++;
+
+            break;
+
+        case ID_MODEM_STATUS:
+            inb (REGISTER (MODEM_STATUS));
+            break;
+        }
+    }
+
+    spin_release (&serial_lock);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
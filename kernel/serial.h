@@ -0,0 +1,36 @@
+/**
+ *  Driver for the 16550 UART on the first serial port (COM1).
+ */
+
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** IO ports of the first serial port, and its speed in bits per second */
+#define COM1_PORT               0x3F8
+#define SERIAL_BAUD_RATE        115200
+
+/** sizes of the transmit and receive rings. Must be powers of 2. */
+#define SERIAL_TX_RING_SIZE     4096
+#define SERIAL_RX_RING_SIZE     256
+
+/**********************************************************/
+
+void serial_initialise (void);
+void serial_enable_interrupts (void);
+bool serial_present (void);
+int serial_fifo_size (void);
+void serial_write (const char *buffer, size_t length);
+void serial_done (void);
+void serial_flush (void);
+size_t serial_read (char *buffer, size_t size);
+void serial_dump_stats (void);
+
+/**********************************************************/
+
+
+#endif /** _SERIAL_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,496 @@
+/**
+ *  Slab allocator.
+ *
+ *  Objects of each size are kept in a cache, which carves them out of
+ *  slabs: blocks of one or more frames from the frame allocator. Each
+ *  slab starts with a header, which is followed by the objects in slots
+ *  of equal size. Slots are a power of two up to the size of a cache
+ *  line, so that no object straddles two lines, and a whole number of
+ *  cache lines after that, so that every object starts on a line.
+ *
+ *  The free slots of a slab are kept in a list of slot indices in the
+ *  header, rather than in the free objects themselves. This way an
+ *  object keeps whatever its constructor put in it while it is free,
+ *  and the constructor only runs when the slab is created. Allocating
+ *  and freeing an object take a slot off or put it back on this list,
+ *  and occasionally move the slab between the cache's lists.
+ *
+ *  kfree finds the slab that an object belongs to through the frame
+ *  table, which records the slab for each frame of a slab.
+ *
+ *  kmalloc has a cache for each power of two size from 16 bytes to
+ *  2 KiB. Bigger blocks come straight from the frame allocator.
+ */
+
+#include "slab.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "frames.h"
+#include "output.h"
+#include "paging.h"
+#include "utils.h"
+
+/** slabs have at least this many objects, unless that would make them
+ *  bigger than 2^MAX_SLAB_ORDER frames */
+#define MIN_SLAB_OBJECTS        8
+#define MAX_SLAB_ORDER          3
+
+/** marks the end of a slab's free list */
+#define SLAB_END                0xFFFF
+
+#define ROUND_UP(x, n)          (((x) + (n) - 1) & ~((n) - 1))
+
+/**********************************************************/
+
+/**
+ *  The header at the start of every slab. next_free has an entry for
+ *  each slot, giving the next free slot after it.
+ */
+struct slab
+{
+    struct slab *next;
+    struct slab **pprev;
+    struct slab_cache *cache;
+    uint8_t *objects;
+    uint16_t in_use;
+    uint16_t free;
+    uint16_t next_free [];
+};
+
+/**********************************************************/
+
+PRIVATE void cache_setup (struct slab_cache *cache, const char *name,
+  size_t size, slab_constructor constructor);
+PRIVATE uint32_t header_size (uint32_t objects);
+PRIVATE struct slab *slab_create (struct slab_cache *cache);
+PRIVATE void slab_destroy (struct slab *slab);
+PRIVATE void slab_link (struct slab **list, struct slab *slab);
+PRIVATE void slab_unlink (struct slab *slab);
+
+/**********************************************************/
+
+/** the cache that slab caches themselves are allocated from */
+PRIVATE struct slab_cache cache_cache;
+
+/** kmalloc caches, smallest first, and their names */
+PRIVATE struct slab_cache *kmalloc_caches [KMALLOC_CLASSES];
+
+PRIVATE const char *kmalloc_names [KMALLOC_CLASSES] =
+{
+    "kmalloc-16",
+    "kmalloc-32",
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+    "kmalloc-2048",
+};
+
+/** every cache, most recently created first */
+PRIVATE struct slab_cache *all_caches;
+
+/**********************************************************/
+
+/**
+ *  Set up the cache of caches, and the kmalloc caches. This needs the
+ *  frame allocator.
+ */
+    PUBLIC void
+slab_initialise (void)
+{
+    cache_setup (&cache_cache, "slab_cache", sizeof (struct slab_cache),
+      NULL);
+
+    for (int i = 0; i < KMALLOC_CLASSES; i ++)
+    {
+        kmalloc_caches [i] = slab_cache_create (kmalloc_names [i],
+          1 << (i + KMALLOC_MIN_SHIFT), NULL);
+
+        if (kmalloc_caches [i] == NULL)
+            panic ("No memory for %s\n", kmalloc_names [i]);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Create a cache of objects of the given size. If there is a
+ *  constructor, it is run on each object when the slab it is in is
+ *  created, and objects must be in their constructed state when they are
+ *  freed. Returns NULL if there is no memory for the cache.
+ */
+    PUBLIC struct slab_cache *
+slab_cache_create (name, size, constructor)
+    const char *name;           // for the statistics
+    size_t size;                // size of each object
+    slab_constructor constructor;  // or NULL
+{
+    struct slab_cache *cache = slab_alloc (&cache_cache);
+
+    if (cache != NULL)
+        cache_setup (cache, name, size, constructor);
+
+    return cache;
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate an object from a cache. Returns NULL if there is no memory.
+ */
+    PUBLIC void *
+slab_alloc (cache)
+    struct slab_cache *cache;
+{
+    uint32_t flags = interrupts_save ();
+    struct slab *slab = cache->partial;
+    uint32_t index;
+
+    if (slab == NULL)
+    {
+        slab = cache->empty;
+
+        if (slab == NULL)
+            slab = slab_create (cache);
+
+        if (slab == NULL)
+        {
+            cache->failures ++;
+            interrupts_restore (flags);
+            return NULL;
+        }
+
+        slab_unlink (slab);
+        slab_link (&cache->partial, slab);
+    }
+
+    index = slab->free;
+    slab->free = slab->next_free [index];
+    slab->in_use ++;
+
+    if (slab->free == SLAB_END)
+    {
+        slab_unlink (slab);
+        slab_link (&cache->full, slab);
+    }
+
+    cache->allocs ++;
+    cache->active ++;
+
+    interrupts_restore (flags);
+
+    return slab->objects + index * cache->slot_size;
+}
+
+/**********************************************************/
+
+/**
+ *  Return an object to the cache it came from.
+ */
+    PUBLIC void
+slab_free (cache, object)
+    struct slab_cache *cache;
+    void *object;
+{
+    struct frame *frame = frame_lookup (virtual_to_physical (object));
+    struct slab *slab = frame->owner;
+    uint32_t flags;
+    uint32_t index;
+
+    if (!(frame->flags & FRAME_SLAB) || slab->cache != cache)
+        panic ("Freeing %p, which is not from %s\n", object, cache->name);
+
+    index = (uint32_t) (((uint64_t) ((uint8_t *) object - slab->objects)
+      * cache->reciprocal) >> 32);
+
+    flags = interrupts_save ();
+
+    slab->next_free [index] = slab->free;
+    slab->free = index;
+    slab->in_use --;
+
+    cache->frees ++;
+    cache->active --;
+
+    // a slab that was full has room again; one that is now empty is kept
+    // for the next allocation, unless there is already an empty slab.
+    if (slab->in_use == 0)
+    {
+        slab_unlink (slab);
+
+        if (cache->empty == NULL)
+            slab_link (&cache->empty, slab);
+        else
+            slab_destroy (slab);
+    }
+    else if (slab->next_free [index] == SLAB_END)
+    {
+        slab_unlink (slab);
+        slab_link (&cache->partial, slab);
+    }
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate a block of at least size bytes. Blocks of up to 2 KiB come
+ *  from the cache for the next power of two; bigger blocks are whole
+ *  frames. Returns NULL if there is no memory.
+ */
+    PUBLIC void *
+kmalloc (size)
+    size_t size;
+{
+    int shift = KMALLOC_MIN_SHIFT;
+    uint32_t address;
+
+    while (shift <= KMALLOC_MAX_SHIFT && (1u << shift) < size)
+        shift ++;
+
+    if (shift <= KMALLOC_MAX_SHIFT)
+        return slab_alloc (kmalloc_caches [shift - KMALLOC_MIN_SHIFT]);
+
+    // too big for a cache, so get enough frames for it.
+    while (shift < FRAME_SHIFT || (1u << shift) < size)
+        shift ++;
+
+    address = frame_alloc (shift - FRAME_SHIFT);
+
+    return address != 0 ? physical_to_virtual (address) : NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Free a block from kmalloc. The frame table says whether it is in a
+ *  slab, or was a block of frames; for frames, it also has the size.
+ */
+    PUBLIC void
+kfree (object)
+    void *object;
+{
+    struct frame *frame;
+
+    if (object == NULL)
+        return;
+
+    frame = frame_lookup (virtual_to_physical (object));
+
+    if (frame->flags & FRAME_SLAB)
+        slab_free (((struct slab *) frame->owner)->cache, object);
+    else
+        frame_free (virtual_to_physical (object), frame->order);
+}
+
+/**********************************************************/
+
+/**
+ *  Print the counters of every cache.
+ */
+    PUBLIC void
+slab_dump_stats (void)
+{
+    print_string ("cache           size  slot  active   slabs"
+      "     allocs      frees fail\n");
+
+    for (struct slab_cache *cache = all_caches; cache != NULL;
+      cache = cache->next)
+    {
+        kprintf ("%-14s %5u %5u %7u %7u %10u %10u %4u\n", cache->name,
+          cache->object_size, cache->slot_size, cache->active,
+          cache->slabs, cache->allocs, cache->frees, cache->failures);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Work out the slot size and the shape of the slabs of a new cache, and
+ *  add it to the list of caches.
+ */
+    PRIVATE void
+cache_setup (cache, name, size, constructor)
+    struct slab_cache *cache;
+    const char *name;
+    size_t size;
+    slab_constructor constructor;
+{
+    uint32_t slot = sizeof (uint32_t);
+    uint32_t objects;
+
+    if (size > CACHE_LINE_SIZE)
+    {
+        slot = ROUND_UP (size, CACHE_LINE_SIZE);
+    }
+    else
+    {
+        while (slot < size)
+            slot <<= 1;
+    }
+
+    cache->name = name;
+    cache->constructor = constructor;
+    cache->object_size = size;
+    cache->slot_size = slot;
+    cache->reciprocal = (uint32_t) udiv64 ((1ull << 32) + slot - 1, slot,
+      NULL);
+
+    // use bigger slabs for bigger objects, so that not too much is wasted
+    // at the end of each slab.
+    cache->order = 0;
+
+    while (cache->order < MAX_SLAB_ORDER &&
+      (FRAME_SIZE << cache->order) / slot < MIN_SLAB_OBJECTS)
+        cache->order ++;
+
+    objects = (FRAME_SIZE << cache->order) / slot;
+
+    while (objects > 1 && header_size (objects) + objects * slot >
+      (FRAME_SIZE << cache->order))
+        objects --;
+
+    cache->first_object = header_size (objects);
+    cache->slab_objects = objects;
+
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+
+    cache->allocs = 0;
+    cache->frees = 0;
+    cache->active = 0;
+    cache->slabs = 0;
+    cache->failures = 0;
+
+    cache->next = all_caches;
+    all_caches = cache;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the size of the header of a slab with the given number of
+ *  objects, rounded up so that the first object starts on a cache line.
+ */
+    PRIVATE uint32_t
+header_size (objects)
+    uint32_t objects;
+{
+    return ROUND_UP (sizeof (struct slab) + objects * sizeof (uint16_t),
+      CACHE_LINE_SIZE);
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate and set up a new slab for a cache, and put it on the empty
+ *  list. Returns NULL if there is no memory.
+ */
+    PRIVATE struct slab *
+slab_create (cache)
+    struct slab_cache *cache;
+{
+    uint32_t address = frame_alloc (cache->order);
+    struct slab *slab;
+
+    if (address == 0)
+        return NULL;
+
+    slab = physical_to_virtual (address);
+
+    for (int i = 0; i < 1 << cache->order; i ++)
+    {
+        struct frame *frame = frame_lookup (address + i * FRAME_SIZE);
+
+        frame->flags |= FRAME_SLAB;
+        frame->owner = slab;
+    }
+
+    slab->cache = cache;
+    slab->objects = (uint8_t *) slab + cache->first_object;
+    slab->in_use = 0;
+    slab->free = 0;
+
+    for (uint32_t i = 0; i < cache->slab_objects; i ++)
+    {
+        slab->next_free [i] = i + 1;
+
+        if (cache->constructor != NULL)
+            cache->constructor (slab->objects + i * cache->slot_size);
+    }
+
+    slab->next_free [cache->slab_objects - 1] = SLAB_END;
+
+    slab_link (&cache->empty, slab);
+    cache->slabs ++;
+
+    return slab;
+}
+
+/**********************************************************/
+
+/**
+ *  Give the frames of an empty slab back to the frame allocator.
+ */
+    PRIVATE void
+slab_destroy (slab)
+    struct slab *slab;
+{
+    struct slab_cache *cache = slab->cache;
+    uint32_t address = virtual_to_physical (slab);
+
+    for (int i = 0; i < 1 << cache->order; i ++)
+    {
+        struct frame *frame = frame_lookup (address + i * FRAME_SIZE);
+
+        frame->flags &= ~FRAME_SLAB;
+        frame->owner = NULL;
+    }
+
+    cache->slabs --;
+    frame_free (address, cache->order);
+}
+
+/**********************************************************/
+
+/**
+ *  Add a slab to the front of one of its cache's lists.
+ */
+    PRIVATE void
+slab_link (list, slab)
+    struct slab **list;
+    struct slab *slab;
+{
+    slab->next = *list;
+    slab->pprev = list;
+
+    if (slab->next != NULL)
+        slab->next->pprev = &slab->next;
+
+    *list = slab;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a slab off whichever list it is on.
+ */
+    PRIVATE void
+slab_unlink (slab)
+    struct slab *slab;
+{
+    *slab->pprev = slab->next;
+
+    if (slab->next != NULL)
+        slab->next->pprev = slab->pprev;
+
+    slab->next = NULL;
+    slab->pprev = NULL;
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,82 @@
+/**
+ *  Slab allocator for kernel objects, and kmalloc on top of it.
+ */
+
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** size of a cache line. Slots of this size or more start on a line. */
+#define CACHE_LINE_SIZE         64
+
+/** size classes of kmalloc. Bigger requests get whole frames. */
+#define KMALLOC_MIN_SHIFT       4
+#define KMALLOC_MAX_SHIFT       11
+#define KMALLOC_CLASSES         (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1)
+
+/**********************************************************/
+
+/** called for each object when its slab is created */
+typedef void (*slab_constructor) (void *object);
+
+struct slab;
+
+/**
+ *  A cache of objects of one size. Objects are carved out of slabs of
+ *  one or more frames; the cache keeps lists of slabs with some free
+ *  objects, with none, and at most one slab with no objects in use.
+ */
+struct slab_cache
+{
+    const char *name;
+    slab_constructor constructor;
+
+    /** size asked for, and the size of the slot each object takes */
+    uint32_t object_size;
+    uint32_t slot_size;
+
+    /** 2^32 / slot_size rounded up, to find an object's index without a
+     *  division */
+    uint32_t reciprocal;
+
+    /** shape of a slab: its size as a frame order, where the first
+     *  object starts, and how many objects there are */
+    int order;
+    uint32_t first_object;
+    uint32_t slab_objects;
+
+    struct slab *partial;
+    struct slab *full;
+    struct slab *empty;
+
+    /** counters */
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t active;
+    uint32_t slabs;
+    uint32_t failures;
+
+    /** list of all caches */
+    struct slab_cache *next;
+};
+
+/**********************************************************/
+
+void slab_initialise (void);
+struct slab_cache *slab_cache_create (const char *name, size_t size,
+  slab_constructor constructor);
+void *slab_alloc (struct slab_cache *cache);
+void slab_free (struct slab_cache *cache, void *object);
+void slab_dump_stats (void);
+
+void *kmalloc (size_t size);
+void kfree (void *object);
+
+/**********************************************************/
+
+
+#endif /** _SLAB_H */
+
+/** vim: set ts=4 sw=4 et : */
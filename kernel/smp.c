@@ -0,0 +1,344 @@
+/**
+ *  Starting the application processors (APs).
+ *
+ *  The boot processor wakes each AP listed in the MADT in turn, with the
+ *  INIT, startup, startup IPI sequence from the Intel MultiProcessor
+ *  Specification. The startup IPI starts the AP in real mode in the
+ *  trampoline (see trampoline.s), which brings it up to the kernel's
+ *  paging and stack, and into smp_ap_main.
+ *
+ *  Each processor has a struct cpu, and its own GDT whose
+ *  CPU_DATA_SELECTOR segment covers that structure. The APs do not run
+ *  threads yet, since the run queues are not locked; once started, they
+ *  wait in an idle loop, where smp_call can hand them a function to run,
+ *  and where they run deferred work (see work.c).
+ */
+
+#include "smp.h"
+#include "stdint.h"
+#include "acpi.h"
+#include "apic.h"
+#include "clock.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "klog.h"
+#include "memutils.h"
+#include "output.h"
+#include "paging.h"
+#include "protect.h"
+#include "thread.h"
+#include "utils.h"
+#include "vm.h"
+#include "work.h"
+
+/** delays in the startup sequence. The 10 ms after INIT and 200 us after
+ *  each startup IPI are from the MultiProcessor Specification; the
+ *  processor then has until START_TIMEOUT_NS to show up. */
+#define INIT_DELAY_NS           (10 * NS_PER_MILLISECOND)
+#define STARTUP_DELAY_NS        (200 * NS_PER_MICROSECOND)
+#define START_TIMEOUT_NS        (100 * NS_PER_MILLISECOND)
+
+/**********************************************************/
+
+/**
+ *  What the trampoline needs to know about the processor it is starting.
+ *  This must match the layout at trampoline_params in trampoline.s.
+ */
+struct trampoline_params
+{
+    uint32_t page_directory;    // physical address, for cr3
+    uint32_t stack;             // initial stack pointer
+    struct cpu *cpu;            // argument for smp_ap_main
+};
+
+/** in trampoline.s */
+extern uint8_t trampoline_start [];
+extern uint8_t trampoline_end [];
+extern struct trampoline_params trampoline_params;
+
+/** called from trampoline.s, so cannot be private */
+void smp_ap_main (struct cpu *cpu) __attribute__ ((noreturn));
+
+PRIVATE bool start_cpu (struct cpu *cpu, struct trampoline_params *params);
+PRIVATE bool wait_online (struct cpu *cpu, uint64_t timeout_ns);
+PRIVATE void wake_interrupt (uint32_t vector, uint32_t error_code);
+
+/**********************************************************/
+
+PRIVATE struct cpu cpus [MAX_CPUS];
+
+/** number of processors that are running */
+PRIVATE int cpu_count = 1;
+
+/**********************************************************/
+
+/**
+ *  Set up the struct cpu of the boot processor, and load its GDT and the
+ *  IDT. This has to come before anything uses this_cpu, and so before
+ *  interrupts are enabled.
+ */
+    PUBLIC void
+smp_initialise_boot_cpu (void)
+{
+    struct cpu *cpu = &cpus [0];
+
+    cpu->self = cpu;
+    cpu->index = 0;
+    cpu->online = true;
+    load_tables (cpu);
+}
+
+/**********************************************************/
+
+/**
+ *  Start every other processor in the MADT. This needs the local APIC,
+ *  the clock, and vm regions for the stacks. The first 4 MiB are mapped
+ *  at 0 again while the trampoline needs them.
+ */
+    PUBLIC void
+smp_initialise (void)
+{
+    const struct madt_info *madt = acpi_madt ();
+    struct trampoline_params *params;
+    uint8_t *low = physical_to_virtual (TRAMPOLINE_ADDRESS);
+    uint64_t begin;
+
+    if (madt == NULL || local_apic == NULL)
+    {
+        print_string ("smp: no local APIC, only the boot processor runs\n");
+        return;
+    }
+
+    cpus [0].apic_id = apic_id ();
+    register_fast_interrupt_handler (SMP_WAKE_VECTOR, wake_interrupt);
+
+    memcopy (trampoline_start, low, trampoline_end - trampoline_start);
+    params = (struct trampoline_params *)
+      (low + ((uint8_t *) &trampoline_params - trampoline_start));
+    params->page_directory = virtual_to_physical (kernel_page_directory);
+
+    kernel_page_directory [0] = PAGE_PRESENT | PAGE_WRITE | PAGE_LARGE;
+    begin = read_tsc ();
+
+    for (int i = 0; i < madt->num_cpus && cpu_count < MAX_CPUS; i ++)
+    {
+        struct cpu *cpu = &cpus [cpu_count];
+
+        if (madt->cpu_apic_ids [i] == cpus [0].apic_id)
+            continue;
+
+        cpu->self = cpu;
+        cpu->index = cpu_count;
+        cpu->apic_id = madt->cpu_apic_ids [i];
+
+        if (start_cpu (cpu, params))
+            cpu_count ++;
+        else
+            klog (KLOG_WARNING,
+              "smp: processor with APIC ID %u did not start\n",
+              cpu->apic_id);
+    }
+
+    kernel_page_directory [0] = 0;
+    write_cr3 (read_cr3 ());
+
+    kprintf ("smp: %u of %u processors running, %u us to start them\n",
+      cpu_count, madt->num_cpus, (uint32_t) udiv64 (
+      clock_cycles_to_ns (read_tsc () - begin), NS_PER_MICROSECOND, NULL));
+}
+
+/**********************************************************/
+
+/**
+ *  The number of processors running.
+ */
+    PUBLIC int
+smp_cpu_count (void)
+{
+    return cpu_count;
+}
+
+/**********************************************************/
+
+/**
+ *  The data of a processor, by its index from 0 to smp_cpu_count () - 1.
+ *  The boot processor is always 0.
+ */
+    PUBLIC struct cpu *
+smp_cpu (index)
+    int index;
+{
+    return &cpus [index];
+}
+
+/**********************************************************/
+
+/**
+ *  Have an AP run function (data) from its idle loop, with interrupts
+ *  enabled. If the AP is still running an earlier function, this waits
+ *  for it to finish first. Use smp_call_wait to wait for this one.
+ */
+    PUBLIC void
+smp_call (cpu, function, data)
+    struct cpu *cpu;            // any processor but the boot processor
+    smp_function function;
+    void *data;
+{
+    smp_call_wait (cpu);
+
+    cpu->call_data = data;
+    compiler_barrier ();
+    cpu->call_function = function;
+
+    smp_wake (cpu);
+}
+
+/**********************************************************/
+
+/**
+ *  Wait for the function given to an AP by smp_call to return.
+ */
+    PUBLIC void
+smp_call_wait (cpu)
+    struct cpu *cpu;
+{
+    while (cpu->call_function != NULL)
+        cpu_relax ();
+}
+
+/**********************************************************/
+
+/**
+ *  Wake a processor that may be waiting for an interrupt in its idle
+ *  loop, so that it looks for something to do.
+ */
+    PUBLIC void
+smp_wake (cpu)
+    struct cpu *cpu;
+{
+    apic_send_ipi (cpu->apic_id, SMP_WAKE_VECTOR);
+}
+
+/**********************************************************/
+
+/**
+ *  Where an AP arrives from the trampoline, on its own stack but still
+ *  with the trampoline's GDT. The identity mapping of the first 4 MiB is
+ *  flushed from the TLB, since the boot processor removes it once all
+ *  the APs are up.
+ *
+ *  After that the AP runs deferred work, or sleeps until smp_call or
+ *  work_queue gives it something to do. The check is made with
+ *  interrupts disabled, so that the IPI cannot arrive between the check
+ *  and the hlt.
+ */
+    PUBLIC void
+smp_ap_main (cpu)
+    struct cpu *cpu;
+{
+    load_tables (cpu);
+    write_cr3 (read_cr3 ());
+    apic_enable ();
+
+    cpu->online = true;
+
+    for (;;)
+    {
+        smp_function function;
+
+        interrupts_disable ();
+        function = cpu->call_function;
+
+        if (function == NULL)
+        {
+            work_idle ();
+            continue;
+        }
+
+        interrupts_enable ();
+        function (cpu->call_data);
+
+        compiler_barrier ();
+        cpu->call_function = NULL;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Give a processor a stack, and send it the startup sequence. The
+ *  second startup IPI is only needed if the first was missed. Returns
+ *  true once the processor has reached smp_ap_main.
+ */
+    PRIVATE bool
+start_cpu (cpu, params)
+    struct cpu *cpu;
+    struct trampoline_params *params;   // in the copy of the trampoline
+{
+    uint32_t startup = APIC_ICR_STARTUP | (TRAMPOLINE_ADDRESS >> PAGE_SHIFT);
+
+    cpu->stack = vm_alloc (THREAD_STACK_SIZE, VM_BACKED);
+
+    if (cpu->stack == NULL)
+        return false;
+
+    klog_initialise_cpu (cpu->index);
+    params->stack = (uint32_t) cpu->stack + THREAD_STACK_SIZE;
+    params->cpu = cpu;
+
+    apic_send_ipi (cpu->apic_id, APIC_ICR_INIT | APIC_ICR_ASSERT |
+      APIC_ICR_LEVEL);
+    clock_delay_ns (INIT_DELAY_NS);
+
+    apic_send_ipi (cpu->apic_id, startup);
+
+    if (!wait_online (cpu, STARTUP_DELAY_NS))
+    {
+        apic_send_ipi (cpu->apic_id, startup);
+
+        if (!wait_online (cpu, START_TIMEOUT_NS))
+        {
+            vm_free (cpu->stack);
+            cpu->stack = NULL;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Wait for up to timeout_ns for a processor to come online.
+ */
+    PRIVATE bool
+wait_online (cpu, timeout_ns)
+    struct cpu *cpu;
+    uint64_t timeout_ns;
+{
+    uint64_t deadline = clock_now_ns () + timeout_ns;
+
+    while (!cpu->online && clock_now_ns () < deadline)
+        cpu_relax ();
+
+    return cpu->online;
+}
+
+/**********************************************************/
+
+/**
+ *  The SMP_WAKE_VECTOR IPI only has to wake the processor up, which
+ *  taking the interrupt has already done.
+ */
+    PRIVATE void
+wake_interrupt (vector, error_code)
+    uint32_t vector;
+    uint32_t error_code;
+{
+    apic_eoi ();
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,103 @@
+/**
+ *  Starting the other processors, and the data that each processor keeps
+ *  for itself.
+ */
+
+#ifndef _SMP_H
+#define _SMP_H
+
+#include "stdint.h"
+#include "acpi.h"
+#include "descriptors.h"
+#include "protect.h"
+#include "slab.h"
+#include "utils.h"
+
+/** physical address the application processors start at. It must be
+ *  page aligned and below 1 MiB, and the frame allocator never hands out
+ *  the low 1 MiB. */
+#define TRAMPOLINE_ADDRESS      0x00008000
+
+/** offset of interrupt_entry_time in struct cpu, which interrupts.s
+ *  writes through the per CPU segment */
+#define CPU_INTERRUPT_ENTRY_TIME 4
+
+/** vector of the IPI that wakes an idle processor, to run a function or
+ *  deferred work */
+#define SMP_WAKE_VECTOR         0x41
+
+/**********************************************************/
+
+struct thread;
+
+/** a function for smp_call to run on another processor */
+typedef void (*smp_function) (void *data);
+
+/**
+ *  Data private to one processor. The CPU_DATA_SELECTOR segment of each
+ *  processor's GDT starts at its own structure, and gs always holds that
+ *  selector, so any code can find the structure for the processor it is
+ *  running on without knowing which one that is. Each structure has its
+ *  own cache lines, so processors do not fight over them.
+ */
+struct cpu
+{
+    /** the address of this structure, for this_cpu */
+    struct cpu *self;
+
+    /** low 32 bits of the time stamp counter when the entry code for
+     *  the latest interrupt started */
+    uint32_t interrupt_entry_time;
+
+    int index;
+    uint8_t apic_id;
+    volatile bool online;
+
+    /** the thread that is running, and whether the scheduler should
+     *  run at the next chance */
+    struct thread *current;
+    bool need_resched;
+
+    /** the stack the processor started on, or NULL for the boot
+     *  processor */
+    void *stack;
+
+    /** function for an idle AP to run, set by smp_call. It goes back
+     *  to NULL once the function has returned. */
+    volatile smp_function call_function;
+    void *volatile call_data;
+
+    struct gdt_entry gdt [NUM_GDT_ENTRIES];
+}
+__attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/**********************************************************/
+
+void smp_initialise_boot_cpu (void);
+void smp_initialise (void);
+int smp_cpu_count (void);
+struct cpu *smp_cpu (int index);
+void smp_call (struct cpu *cpu, smp_function function, void *data);
+void smp_call_wait (struct cpu *cpu);
+void smp_wake (struct cpu *cpu);
+
+/**********************************************************/
+
+/**
+ *  Returns the per processor data of the processor we are running on.
+ */
+    static inline struct cpu *
+this_cpu (void)
+{
+    struct cpu *cpu;
+
+    __asm__ ("mov %%gs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+/**********************************************************/
+
+
+#endif /** _SMP_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -8,19 +8,44 @@
  *  - segment registers set up to have a base of 0 and limit of 4GiB.
  *  - ebx points to a multiboot info struct.
  *
- *  The purpose of this code is to set up the GDT and IDT; set up a stack
- *  and then hand over to the main C code.
+ *  The kernel is linked to run at KERNEL_BASE + 1 MiB, but is loaded at
+ *  1 MiB, and paging is off. So the first thing to do is to turn paging
+ *  on with a page directory that maps physical memory at KERNEL_BASE,
+ *  and also at 0 so that this code can keep running until it jumps to
+ *  its proper address. Until then, the addresses of kernel symbols have
+ *  to have KERNEL_BASE taken off them. The mappings are all 4 MiB pages,
+ *  so no page tables are needed; the processor must support them (PSE),
+ *  and global pages (PGE), which every processor since the Pentium Pro
+ *  does.
+ *
+ *  After that, set up a stack and then hand over to the main C code.
  */
 
-.section .text
+/** these must match paging.h */
+.set KERNEL_BASE,           0xC0000000
+.set DIRECT_MAP_PAGES,      0x38000000 >> 22
+.set KERNEL_DIRECTORY_INDEX, KERNEL_BASE >> 22
 
+/** page directory entry flags: present, writable, 4 MiB and global */
+.set LARGE_PAGE,            0x00000083
+.set GLOBAL_PAGE,           0x00000100
+.set LARGE_PAGE_SIZE,       0x00400000
 
-/**********************************************************/
+/** control register bits */
+.set CR0_PAGING,            0x80000000
+.set CR0_WRITE_PROTECT,     0x00010000
+.set CR4_PSE,               0x00000010
+.set CR4_PGE,               0x00000080
 
-    .globl NIGHTINGALE
-NIGHTINGALE:
-    jmp     over_multiboot_header
+/** top of the boot processor's stack, which grows down from 512 KiB */
+.set STACK_TOP,             0x00080000
 
+/**
+ *  The multiboot header must be within the first 8 KiB of the kernel
+ *  image, so it has a section of its own which the linker script puts
+ *  ahead of all of the code.
+ */
+.section .multiboot
 
 .align 4
 
@@ -37,10 +62,48 @@ multiboot_header:
 .long -(0x1BADB002 + 0x00000003)
 
 
-over_multiboot_header:
-# set up the stack for our kernel.
-    mov     $0xB002, %eax
-    mov     $0x0007FFFF, %esp
+.section .text
+
+/**********************************************************/
+
+    .globl NIGHTINGALE
+NIGHTINGALE:
+# fill in the direct map entries of the page directory.
+    mov     $(_kernel_page_directory - KERNEL_BASE), %edi
+    mov     $(LARGE_PAGE | GLOBAL_PAGE), %eax
+    xor     %ecx, %ecx
+
+1:
+    mov     %eax, (KERNEL_DIRECTORY_INDEX * 4)(%edi, %ecx, 4)
+    add     $LARGE_PAGE_SIZE, %eax
+    inc     %ecx
+    cmp     $DIRECT_MAP_PAGES, %ecx
+    jb      1b
+
+# map the first 4 MiB at 0 as well, but not as a global page, since it is
+# removed again once the kernel is up.
+    movl    $LARGE_PAGE, (%edi)
+
+# turn on 4 MiB and global pages, then paging. Write protect makes the
+# kernel respect read only pages too.
+    mov     %cr4, %eax
+    or      $(CR4_PSE | CR4_PGE), %eax
+    mov     %eax, %cr4
+
+    mov     %edi, %cr3
+
+    mov     %cr0, %eax
+    or      $(CR0_PAGING | CR0_WRITE_PROTECT), %eax
+    mov     %eax, %cr0
+
+# jump to the kernel's own address.
+    mov     $higher_half, %eax
+    jmp     *%eax
+
+higher_half:
+# set up the stack for our kernel. ebx has the physical address of the
+# multiboot info structure.
+    mov     $(KERNEL_BASE + STACK_TOP), %esp
     mov     %esp, %ebp
 
     push    %ebx
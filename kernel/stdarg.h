@@ -0,0 +1,21 @@
+/**
+ *  Macros for functions that take a variable number of arguments.
+ *
+ *  Like stdint.h, this keeps nightingale independant of the header files
+ *  of the host system. The macros simply use the compiler builtins.
+ */
+
+#ifndef _STDARG_H
+#define _STDARG_H
+
+typedef __builtin_va_list       va_list;
+
+#define va_start(list, last)    __builtin_va_start (list, last)
+#define va_arg(list, type)      __builtin_va_arg (list, type)
+#define va_end(list)            __builtin_va_end (list)
+#define va_copy(dest, source)   __builtin_va_copy (dest, source)
+
+
+#endif /** _STDARG_H */
+
+/** vim: set ts=4 sw=4 et : */
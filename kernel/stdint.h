@@ -15,6 +15,11 @@ typedef unsigned int            uint32_t;
 typedef unsigned short int      uint16_t;
 typedef unsigned char           uint8_t;
 
+typedef long long int           int64_t;
+typedef int                     int32_t;
+typedef short int               int16_t;
+typedef signed char             int8_t;
+
 /** type for the size of buffers */
 typedef unsigned int            size_t;
 
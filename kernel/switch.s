@@ -0,0 +1,57 @@
+/**
+ *  Context switching between kernel threads.
+ *
+ *  A switch always happens inside a call to switch_context, so only the
+ *  registers that a C function must preserve need to be saved: the
+ *  caller has already saved anything else it cares about. They are
+ *  pushed onto the old thread's stack, and popped off the new one's.
+ */
+
+.section .text
+
+/**********************************************************/
+
+/**
+ *  void switch_context (uint32_t *save_esp, uint32_t new_esp)
+ *
+ *  Save the callee saved registers on the current stack, store the stack
+ *  pointer in save_esp, then switch to the stack at new_esp and restore
+ *  the registers that were saved on it. The return is to wherever the
+ *  new thread called switch_context from, or to thread_start for a new
+ *  thread.
+ */
+    .globl _switch_context
+_switch_context:
+    mov     4(%esp), %eax
+    mov     8(%esp), %edx
+
+    push    %ebp
+    push    %ebx
+    push    %esi
+    push    %edi
+
+    mov     %esp, (%eax)
+    mov     %edx, %esp
+
+    pop     %edi
+    pop     %esi
+    pop     %ebx
+    pop     %ebp
+    ret
+
+/**********************************************************/
+
+/**
+ *  void thread_start (void)
+ *
+ *  The first switch to a new thread returns here, since thread_create
+ *  puts this address where switch_context expects its return address.
+ *  thread_run never returns.
+ */
+    .globl _thread_start
+_thread_start:
+    call    _thread_run
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,465 @@
+/**
+ *  Kernel threads and the scheduler.
+ *
+ *  Each priority has its own FIFO queue of ready threads, and a bitmap
+ *  has a bit set for each queue that is not empty, so picking the next
+ *  thread takes the same time however many threads there are: find the
+ *  highest set bit, and take the thread at the head of that queue.
+ *
+ *  A thread runs until it blocks, yields or exits, or until a thread of
+ *  a higher priority is woken. A periodic timer also asks for the
+ *  processor to be given to the next thread of the same priority every
+ *  THREAD_TIMESLICE_NS. A wake or a timeslice that happens inside an
+ *  interrupt handler only sets need_resched; the switch is made by
+ *  thread_preempt on the way out of the handler, once the interrupt has
+ *  been acknowledged.
+ *
+ *  The running thread and need_resched are kept in the processor's
+ *  struct cpu. For now only the boot processor runs threads; the run
+ *  queues are not locked, so the other processors stay in their idle
+ *  loops in smp.c.
+ *
+ *  The scheduler runs with interrupts disabled. A thread that exits
+ *  cannot free the stack it is running on, so it is freed by the next
+ *  thread to run, just after the switch.
+ */
+
+#include "thread.h"
+#include "stdint.h"
+#include "clock.h"
+#include "cpu.h"
+#include "output.h"
+#include "slab.h"
+#include "smp.h"
+#include "timer.h"
+#include "utils.h"
+#include "vm.h"
+#include "work.h"
+
+/** how long a thread runs before the next thread of the same priority
+ *  gets a turn */
+#define THREAD_TIMESLICE_NS     (10 * NS_PER_MILLISECOND)
+
+/**********************************************************/
+
+/** in switch.s */
+void switch_context (uint32_t *save_esp, uint32_t new_esp);
+void thread_start (void);
+
+/** called from thread_start, so cannot be private */
+void thread_run (void) __attribute__ ((noreturn));
+
+PRIVATE void idle (void *data);
+PRIVATE void timeslice (struct timer *timer, void *data);
+PRIVATE void enqueue (struct thread *thread);
+PRIVATE struct thread *dequeue (void);
+PRIVATE void schedule (void);
+PRIVATE void finish_switch (void);
+
+/**********************************************************/
+
+PRIVATE struct slab_cache *thread_cache;
+
+/** queues of ready threads, and a bit for each queue that is not
+ *  empty */
+PRIVATE struct thread *ready_head [THREAD_PRIORITIES];
+PRIVATE struct thread *ready_tail [THREAD_PRIORITIES];
+PRIVATE uint32_t ready_mask;
+
+/** a thread that has exited, and is waiting to be freed */
+PRIVATE struct thread *dead_thread;
+
+PRIVATE struct timer timeslice_timer;
+
+/** number of switches between threads */
+PRIVATE uint32_t switches;
+
+/**********************************************************/
+
+/**
+ *  Turn the code that booted the kernel into the first thread, and start
+ *  the idle thread and the timeslice timer. This needs the slab
+ *  allocator, vm regions, and timers.
+ */
+    PUBLIC void
+thread_initialise (void)
+{
+    struct thread *current;
+
+    thread_cache = slab_cache_create ("thread", sizeof (struct thread),
+      NULL);
+
+    if (thread_cache == NULL || (current = slab_alloc (thread_cache)) == NULL)
+        panic ("No memory for the thread cache\n");
+
+    current->name = "main";
+    current->priority = THREAD_PRIORITY_NORMAL;
+    current->state = THREAD_RUNNING;
+    current->wakeup_pending = false;
+    current->stack = NULL;
+    current->entry = NULL;
+    current->data = NULL;
+    current->next = NULL;
+    this_cpu ()->current = current;
+
+    if (thread_create ("idle", THREAD_PRIORITY_IDLE, idle, NULL) == NULL)
+        panic ("Could not create the idle thread\n");
+
+    timer_start (&timeslice_timer, THREAD_TIMESLICE_NS, THREAD_TIMESLICE_NS,
+      timeslice, NULL);
+}
+
+/**********************************************************/
+
+/**
+ *  Create a thread which runs entry (data) with interrupts enabled, and
+ *  exits when it returns. The new thread is ready to run straight away,
+ *  and runs before the caller returns if its priority is higher. Returns
+ *  NULL if there is not enough memory.
+ */
+    PUBLIC struct thread *
+thread_create (name, priority, entry, data)
+    const char *name;
+    int priority;               // 0 to THREAD_PRIORITIES - 1
+    thread_entry entry;
+    void *data;
+{
+    struct thread *thread = slab_alloc (thread_cache);
+    struct cpu *cpu;
+    uint32_t *stack;
+    uint32_t flags;
+
+    if (thread == NULL)
+        return NULL;
+
+    thread->stack = vm_alloc (THREAD_STACK_SIZE, VM_BACKED);
+
+    if (thread->stack == NULL)
+    {
+        slab_free (thread_cache, thread);
+        return NULL;
+    }
+
+    thread->name = name;
+    thread->priority = priority;
+    thread->wakeup_pending = false;
+    thread->entry = entry;
+    thread->data = data;
+
+    /** build the stack that switch_context expects to find: the callee
+     *  saved registers, and thread_start as the return address. The word
+     *  above that is where thread_start's own return address would go. */
+    stack = (uint32_t *) ((uint8_t *) thread->stack + THREAD_STACK_SIZE);
+    *--stack = 0;
+    *--stack = (uint32_t) thread_start;
+    *--stack = 0;               // ebp
+    *--stack = 0;               // ebx
+    *--stack = 0;               // esi
+    *--stack = 0;               // edi
+    thread->esp = (uint32_t) stack;
+
+    flags = interrupts_save ();
+    cpu = this_cpu ();
+
+    thread->state = THREAD_READY;
+    enqueue (thread);
+
+    if (priority > cpu->current->priority)
+    {
+        cpu->need_resched = true;
+
+        if (flags & EFLAGS_INTERRUPT)
+            schedule ();
+    }
+
+    interrupts_restore (flags);
+    return thread;
+}
+
+/**********************************************************/
+
+/**
+ *  The thread that is running.
+ */
+    PUBLIC struct thread *
+thread_current (void)
+{
+    return this_cpu ()->current;
+}
+
+/**********************************************************/
+
+/**
+ *  Let any other ready thread of the same or a higher priority run.
+ */
+    PUBLIC void
+thread_yield (void)
+{
+    uint32_t flags = interrupts_save ();
+
+    schedule ();
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Stop running until another thread, or an interrupt handler, calls
+ *  thread_wake. If the thread was woken since it last blocked, this
+ *  returns straight away, so a wake that comes just before the block is
+ *  not lost.
+ */
+    PUBLIC void
+thread_block (void)
+{
+    uint32_t flags = interrupts_save ();
+    struct thread *current = this_cpu ()->current;
+
+    if (current->wakeup_pending)
+        current->wakeup_pending = false;
+    else
+    {
+        current->state = THREAD_BLOCKED;
+        schedule ();
+    }
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Make a blocked thread ready. If it has a higher priority than the
+ *  current thread it runs straight away, unless this is called with
+ *  interrupts disabled, in which case it runs at the next thread_preempt.
+ */
+    PUBLIC void
+thread_wake (thread)
+    struct thread *thread;
+{
+    uint32_t flags = interrupts_save ();
+    struct cpu *cpu = this_cpu ();
+
+    if (thread->state == THREAD_BLOCKED)
+    {
+        thread->state = THREAD_READY;
+        enqueue (thread);
+
+        if (thread->priority > cpu->current->priority)
+            cpu->need_resched = true;
+    }
+    else if (thread->state != THREAD_DEAD)
+        thread->wakeup_pending = true;
+
+    if (cpu->need_resched && (flags & EFLAGS_INTERRUPT))
+        schedule ();
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  End the current thread. Its stack and structure are freed by the next
+ *  thread to run.
+ */
+    PUBLIC void
+thread_exit (void)
+{
+    struct thread *current;
+
+    interrupts_disable ();
+
+    current = this_cpu ()->current;
+    current->state = THREAD_DEAD;
+    dead_thread = current;
+    schedule ();
+
+    panic ("Dead thread %s was scheduled\n", current->name);
+}
+
+/**********************************************************/
+
+/**
+ *  Switch threads if a higher priority thread has been woken, or the
+ *  timeslice is over. This is called by interrupt handlers once they
+ *  have acknowledged the interrupt, with interrupts disabled.
+ */
+    PUBLIC void
+thread_preempt (void)
+{
+    struct cpu *cpu = this_cpu ();
+
+    if (cpu->need_resched && cpu->current != NULL)
+        schedule ();
+}
+
+/**********************************************************/
+
+/**
+ *  The number of switches between threads since boot.
+ */
+    PUBLIC uint32_t
+thread_switch_count (void)
+{
+    return switches;
+}
+
+/**********************************************************/
+
+/**
+ *  Where a new thread starts, with interrupts disabled and the scheduler
+ *  having just switched to it.
+ */
+    PUBLIC void
+thread_run (void)
+{
+    struct thread *current;
+
+    finish_switch ();
+    interrupts_enable ();
+
+    current = this_cpu ()->current;
+    current->entry (current->data);
+    thread_exit ();
+}
+
+/**********************************************************/
+
+/**
+ *  The thread that runs when nothing else is ready. It runs deferred
+ *  work, or waits for an interrupt; any thread an interrupt wakes is
+ *  switched to on the way out of the interrupt handler.
+ */
+    PRIVATE void
+idle (data)
+    void *data;
+{
+    for (;;)
+    {
+        interrupts_disable ();
+        work_idle ();
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  The timeslice timer. Ask for a switch if another thread of the same
+ *  or a higher priority is ready.
+ */
+    PRIVATE void
+timeslice (timer, data)
+    struct timer *timer;
+    void *data;
+{
+    struct cpu *cpu = this_cpu ();
+
+    if (cpu->current != NULL && (ready_mask >> cpu->current->priority) != 0)
+        cpu->need_resched = true;
+}
+
+/**********************************************************/
+
+/**
+ *  Add a thread to the tail of the ready queue for its priority.
+ */
+    PRIVATE void
+enqueue (thread)
+    struct thread *thread;
+{
+    int priority = thread->priority;
+
+    thread->next = NULL;
+
+    if (ready_head [priority] == NULL)
+        ready_head [priority] = thread;
+    else
+        ready_tail [priority]->next = thread;
+
+    ready_tail [priority] = thread;
+    ready_mask |= 1u << priority;
+}
+
+/**********************************************************/
+
+/**
+ *  Take the thread at the head of the highest priority ready queue. The
+ *  idle thread is always ready or running, so this never finds nothing
+ *  when called by schedule.
+ */
+    PRIVATE struct thread *
+dequeue (void)
+{
+    int priority = 31 - __builtin_clz (ready_mask);
+    struct thread *thread = ready_head [priority];
+
+    ready_head [priority] = thread->next;
+
+    if (ready_head [priority] == NULL)
+        ready_mask &= ~(1u << priority);
+
+    return thread;
+}
+
+/**********************************************************/
+
+/**
+ *  Switch to the highest priority ready thread. If the current thread is
+ *  still running it goes to the back of its queue, so it only keeps the
+ *  processor if nothing else of its priority or higher is ready. Called
+ *  with interrupts disabled.
+ */
+    PRIVATE void
+schedule (void)
+{
+    struct cpu *cpu = this_cpu ();
+    struct thread *previous = cpu->current;
+    struct thread *next;
+
+    cpu->need_resched = false;
+
+    if (previous->state == THREAD_RUNNING)
+    {
+        previous->state = THREAD_READY;
+        enqueue (previous);
+    }
+
+    next = dequeue ();
+    next->state = THREAD_RUNNING;
+
+    if (next == previous)
+        return;
+
+    switches ++;
+    cpu->current = next;
+    switch_context (&previous->esp, next->esp);
+
+    /** running as previous again, after some later switch back to it */
+    finish_switch ();
+}
+
+/**********************************************************/
+
+/**
+ *  Free the thread that exited to make the last switch, if there is one.
+ */
+    PRIVATE void
+finish_switch (void)
+{
+    struct thread *thread = dead_thread;
+
+    if (thread == NULL)
+        return;
+
+    dead_thread = NULL;
+
+    if (thread->stack != NULL)
+        vm_free (thread->stack);
+
+    slab_free (thread_cache, thread);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
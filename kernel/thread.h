@@ -0,0 +1,74 @@
+/**
+ *  Kernel threads and the scheduler.
+ */
+
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** priorities run from 0, for the idle thread, up to 31. The thread
+ *  that started the kernel runs at THREAD_PRIORITY_NORMAL. */
+#define THREAD_PRIORITIES       32
+#define THREAD_PRIORITY_IDLE    0
+#define THREAD_PRIORITY_NORMAL  16
+
+/** size of each thread's stack */
+#define THREAD_STACK_SIZE       (16 * 1024)
+
+/**********************************************************/
+
+typedef void (*thread_entry) (void *data);
+
+enum thread_state
+{
+    THREAD_RUNNING,
+    THREAD_READY,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+struct thread
+{
+    /** stack pointer while the thread is not running. switch.s knows that
+     *  this is the first field. */
+    uint32_t esp;
+
+    const char *name;
+    int priority;
+    enum thread_state state;
+
+    /** set by thread_wake if the thread was not blocked, so that its next
+     *  thread_block returns straight away */
+    bool wakeup_pending;
+
+    /** the stack, or NULL for the boot stack */
+    void *stack;
+
+    thread_entry entry;
+    void *data;
+
+    /** link in the run queue for the thread's priority */
+    struct thread *next;
+};
+
+/**********************************************************/
+
+void thread_initialise (void);
+struct thread *thread_create (const char *name, int priority,
+  thread_entry entry, void *data);
+struct thread *thread_current (void);
+void thread_yield (void);
+void thread_block (void);
+void thread_wake (struct thread *thread);
+void thread_exit (void) __attribute__ ((noreturn));
+void thread_preempt (void);
+uint32_t thread_switch_count (void);
+
+/**********************************************************/
+
+
+#endif /** _THREAD_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,603 @@
+/**
+ *  Kernel timers.
+ *
+ *  Pending timers are kept in a hierarchical timing wheel. Time is
+ *  divided into ticks of 2^TICK_SHIFT ns (about a quarter of a
+ *  millisecond), and the wheel has NUM_LEVELS levels of WHEEL_SLOTS
+ *  slots each. Level 0 has one slot per tick, and covers the next 64
+ *  ticks. Each slot of level 1 covers 64 ticks, and the level covers the
+ *  next 64 * 64 ticks, and so on. A timer goes in the slot of the lowest
+ *  level whose range reaches its expiry time, so adding or cancelling a
+ *  timer is a constant time list operation.
+ *
+ *  When the wheel reaches the start of a slot in level 1 or above, the
+ *  timers in that slot are cascaded: each one is put back in the wheel,
+ *  and lands in a lower level now that it is closer to expiry. The slot
+ *  of level 0 for the current tick is then emptied and its callbacks run.
+ *
+ *  Each level has a bitmap of the slots that have timers in them, so
+ *  that the next tick at which there is anything to do can be found
+ *  quickly. In tickless mode the hardware timer is programmed for that
+ *  tick only, so an idle machine is not woken up every tick for nothing.
+ *
+ *  Three kinds of hardware are supported, in order of preference:
+ *
+ *  - the local APIC timer in TSC deadline mode, which is given the TSC
+ *    value at which to fire, so no conversion or calibration is needed.
+ *  - the local APIC timer in one shot mode, which counts down from a
+ *    value at a rate that is measured at boot.
+ *  - channel 0 of the PIT, which can only count for about 55 ms at a
+ *    time, so longer delays take several interrupts.
+ */
+
+#include "timer.h"
+#include "stdint.h"
+#include "apic.h"
+#include "clock.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "irq.h"
+#include "pit.h"
+#include "thread.h"
+#include "utils.h"
+
+/** length of a tick is 2^TICK_SHIFT ns */
+#define TICK_SHIFT              18
+
+/** shape of the wheel */
+#define LEVEL_BITS              6
+#define WHEEL_SLOTS             (1 << LEVEL_BITS)
+#define SLOT_MASK               (WHEEL_SLOTS - 1)
+#define NUM_LEVELS              5
+
+/** timers further away than the wheel can reach are put in the last slot
+ *  of the top level, and are put back in the wheel when it comes round */
+#define MAX_WHEEL_DELTA         ((1ull << (LEVEL_BITS * NUM_LEVELS)) - 1)
+
+/** no event is programmed */
+#define NO_EVENT                (~0ull)
+
+/** the longest delay the APIC timer is programmed for in one shot mode.
+ *  This keeps the count well within 32 bits. */
+#define MAX_APIC_DELAY_NS       NS_PER_SECOND
+
+/** the longest delay the PIT can be programmed for */
+#define MAX_PIT_DELAY_NS        \
+    ((uint64_t) PIT_MAX_COUNT * NS_PER_SECOND / PIT_FREQUENCY)
+
+/**********************************************************/
+
+/** the hardware used to generate timer interrupts */
+enum event_source
+{
+    EVENT_PIT,
+    EVENT_APIC_ONE_SHOT,
+    EVENT_APIC_DEADLINE,
+};
+
+PRIVATE const char *event_source_names [] =
+{
+    "pit",
+    "apic one shot",
+    "apic tsc deadline",
+};
+
+/**********************************************************/
+
+PRIVATE void add_timer (struct timer *timer);
+PRIVATE void remove_timer (struct timer *timer);
+PRIVATE uint64_t expiry_tick (struct timer *timer);
+PRIVATE int first_set_bit (uint64_t bits);
+PRIVATE uint64_t next_event_tick (void);
+PRIVATE void cascade (int level, int slot);
+PRIVATE void expire_slot (int slot);
+PRIVATE void process_tick (uint64_t tick);
+PRIVATE void program_event (uint64_t tick);
+PRIVATE void run_timers (void);
+PRIVATE void apic_timer_interrupt (uint32_t vector, uint32_t error_code);
+PRIVATE void pit_timer_interrupt (int irq);
+
+/**********************************************************/
+
+PRIVATE enum event_source event_source;
+
+/** rate of the APIC timer, for one shot mode */
+PRIVATE uint32_t apic_timer_hz;
+
+/** if false, the hardware is programmed to interrupt on every tick */
+PRIVATE bool tickless = true;
+
+/** the wheel, and a bitmap for each level showing which slots have
+ *  timers in them */
+PRIVATE struct timer *wheel [NUM_LEVELS][WHEEL_SLOTS];
+PRIVATE uint64_t occupied [NUM_LEVELS];
+
+/** the last tick that has been processed */
+PRIVATE uint64_t current_tick;
+
+/** the tick that the hardware is programmed to interrupt at */
+PRIVATE uint64_t programmed_tick = NO_EVENT;
+
+/**********************************************************/
+
+/**
+ *  Choose the best hardware timer available. This needs the clock and
+ *  the interrupt controllers to have been initialised.
+ */
+    PUBLIC void
+timer_initialise (void)
+{
+    current_tick = clock_now_ns () >> TICK_SHIFT;
+
+    if (irq_using_apic ())
+    {
+        if (apic_timer_has_tsc_deadline ())
+        {
+            event_source = EVENT_APIC_DEADLINE;
+        }
+        else
+        {
+            event_source = EVENT_APIC_ONE_SHOT;
+            apic_timer_hz = apic_timer_calibrate ();
+        }
+
+        apic_timer_stop ();
+        register_fast_interrupt_handler (APIC_TIMER_VECTOR,
+          apic_timer_interrupt);
+    }
+    else
+    {
+        event_source = EVENT_PIT;
+        pit_stop ();
+        irq_register (IRQ_TIMER, pit_timer_interrupt);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Start a timer, which will call the callback after delay_ns. If
+ *  period_ns is not zero, the callback will then be called again every
+ *  period_ns until the timer is cancelled. If the timer was already
+ *  pending, it is restarted.
+ *
+ *  Timers never fire early, but may fire up to a tick late.
+ */
+    PUBLIC void
+timer_start (timer, delay_ns, period_ns, callback, data)
+    struct timer *timer;        // storage for the timer
+    uint64_t delay_ns;          // time until the first call
+    uint64_t period_ns;         // time between calls, or 0
+    timer_callback callback;    // function to call
+    void *data;                 // passed to the callback
+{
+    uint32_t flags = interrupts_save ();
+    uint64_t tick;
+
+    if (timer->pending)
+        remove_timer (timer);
+
+    timer->expires = clock_now_ns () + delay_ns;
+    timer->period = period_ns;
+    timer->callback = callback;
+    timer->data = data;
+
+    add_timer (timer);
+
+    // the hardware only needs to be touched if this timer is due before
+    // the next interrupt.
+    tick = expiry_tick (timer);
+
+    if (tick < programmed_tick)
+        program_event (tick);
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Stop a timer, if it is pending. The hardware timer is left alone; if
+ *  it fires for a timer that has been cancelled, there will just be
+ *  nothing to do.
+ */
+    PUBLIC void
+timer_cancel (timer)
+    struct timer *timer;
+{
+    uint32_t flags = interrupts_save ();
+
+    if (timer->pending)
+        remove_timer (timer);
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the name of the hardware timer in use.
+ */
+    PUBLIC const char *
+timer_event_source (void)
+{
+    return event_source_names [event_source];
+}
+
+/**********************************************************/
+
+/**
+ *  Choose between tickless mode, where the hardware only interrupts when
+ *  there is a timer to run or cascade, and a regular tick.
+ */
+    PUBLIC void
+timer_set_tickless (enable)
+    bool enable;
+{
+    uint32_t flags = interrupts_save ();
+
+    tickless = enable;
+
+    if (!tickless)
+        program_event (current_tick + 1);
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Put a timer in the slot of the wheel that covers its expiry tick, in
+ *  the lowest level that reaches that far.
+ */
+    PRIVATE void
+add_timer (timer)
+    struct timer *timer;
+{
+    uint64_t tick = expiry_tick (timer);
+    uint64_t delta;
+    int level = 0;
+    int slot;
+
+    // this only happens while cascading, when the timer is due in the
+    // tick being processed and goes in the level 0 slot that is about to
+    // be run.
+    if (tick < current_tick)
+        tick = current_tick;
+
+    delta = tick - current_tick;
+
+    if (delta > MAX_WHEEL_DELTA)
+    {
+        delta = MAX_WHEEL_DELTA;
+        tick = current_tick + MAX_WHEEL_DELTA;
+    }
+
+    while (delta >= WHEEL_SLOTS)
+    {
+        delta >>= LEVEL_BITS;
+        level ++;
+    }
+
+    slot = (int) (tick >> (LEVEL_BITS * level)) & SLOT_MASK;
+
+    timer->next = wheel [level][slot];
+    timer->pprev = &wheel [level][slot];
+
+    if (timer->next != NULL)
+        timer->next->pprev = &timer->next;
+
+    wheel [level][slot] = timer;
+    occupied [level] |= 1ull << slot;
+    timer->pending = true;
+}
+
+/**********************************************************/
+
+/**
+ *  Take a timer out of the wheel. If it was the only timer in its slot,
+ *  the slot is marked empty, so that tickless mode does not wake up for
+ *  it.
+ */
+    PRIVATE void
+remove_timer (timer)
+    struct timer *timer;
+{
+    struct timer **head = &wheel [0][0];
+
+    *timer->pprev = timer->next;
+
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    else if (timer->pprev >= head
+      && timer->pprev < head + NUM_LEVELS * WHEEL_SLOTS
+      && *timer->pprev == NULL)
+    {
+        int index = timer->pprev - head;
+
+        occupied [index >> LEVEL_BITS] &= ~(1ull << (index & SLOT_MASK));
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->pending = false;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the first tick that starts after the expiry time of the
+ *  timer. Since the expiry time is never in the past when a timer is
+ *  started, this is always after the current tick.
+ */
+    PRIVATE uint64_t
+expiry_tick (timer)
+    struct timer *timer;
+{
+    return (timer->expires >> TICK_SHIFT) + 1;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the index of the lowest set bit, which must exist. The 64 bit
+ *  builtin would need a libgcc helper on this target.
+ */
+    PRIVATE int
+first_set_bit (bits)
+    uint64_t bits;
+{
+    if ((uint32_t) bits != 0)
+        return __builtin_ctz ((uint32_t) bits);
+
+    return 32 + __builtin_ctz ((uint32_t) (bits >> 32));
+}
+
+/**********************************************************/
+
+/**
+ *  Find the next tick at which something happens: either a slot of level
+ *  0 has timers to run, or a slot of a higher level has timers to
+ *  cascade. Returns NO_EVENT if the wheel is empty.
+ *
+ *  The slots of each level are searched starting from the one after the
+ *  current position, by rotating the bitmap so that slot comes first.
+ */
+    PRIVATE uint64_t
+next_event_tick (void)
+{
+    uint64_t next = NO_EVENT;
+
+    for (int level = 0; level < NUM_LEVELS; level ++)
+    {
+        int shift = LEVEL_BITS * level;
+        uint64_t position = current_tick >> shift;
+        int start = (int) (position + 1) & SLOT_MASK;
+        uint64_t rotated;
+        uint64_t tick;
+
+        if (occupied [level] == 0)
+            continue;
+
+        rotated = start == 0 ? occupied [level] :
+            occupied [level] >> start | occupied [level] << (64 - start);
+
+        // offset of the first occupied slot after the current one, from
+        // 1 to 64.
+        tick = (position + 1 + first_set_bit (rotated)) << shift;
+
+        if (tick < next)
+            next = tick;
+    }
+
+    return next;
+}
+
+/**********************************************************/
+
+/**
+ *  Empty a slot of the wheel, and put each of its timers back in the
+ *  wheel relative to the current tick.
+ */
+    PRIVATE void
+cascade (level, slot)
+    int level;
+    int slot;
+{
+    struct timer *timer = wheel [level][slot];
+
+    wheel [level][slot] = NULL;
+    occupied [level] &= ~(1ull << slot);
+
+    while (timer != NULL)
+    {
+        struct timer *next = timer->next;
+
+        add_timer (timer);
+        timer = next;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Run all of the timers in a slot of level 0. Periodic timers are put
+ *  back in the wheel before their callback is run, so that the callback
+ *  may cancel them.
+ */
+    PRIVATE void
+expire_slot (slot)
+    int slot;
+{
+    struct timer *list = wheel [0][slot];
+    uint64_t now = clock_now_ns ();
+
+    wheel [0][slot] = NULL;
+    occupied [0] &= ~(1ull << slot);
+
+    // the list is now detached from the wheel, so point the first timer
+    // back at the local list head, in case a callback cancels it.
+    if (list != NULL)
+        list->pprev = &list;
+
+    while (list != NULL)
+    {
+        struct timer *timer = list;
+
+        remove_timer (timer);
+
+        if (timer->period != 0)
+        {
+            timer->expires += timer->period;
+
+            // if we have fallen behind by more than a period, skip the
+            // missed calls rather than running them all at once.
+            if (timer->expires <= now)
+                timer->expires = now + timer->period;
+
+            add_timer (timer);
+        }
+
+        timer->callback (timer, timer->data);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Process a single tick: cascade any higher level slots that start at
+ *  this tick, highest level first so that timers can move down more
+ *  than one level at once, then run the timers due at this tick.
+ */
+    PRIVATE void
+process_tick (tick)
+    uint64_t tick;
+{
+    current_tick = tick;
+
+    for (int level = NUM_LEVELS - 1; level > 0; level --)
+    {
+        int shift = LEVEL_BITS * level;
+
+        if ((tick & ((1ull << shift) - 1)) == 0)
+            cascade (level, (int) (tick >> shift) & SLOT_MASK);
+    }
+
+    expire_slot ((int) tick & SLOT_MASK);
+}
+
+/**********************************************************/
+
+/**
+ *  Program the hardware to interrupt at the start of the given tick, or
+ *  as near to then as it can manage. NO_EVENT stops the timer. Called
+ *  with interrupts disabled.
+ */
+    PRIVATE void
+program_event (tick)
+    uint64_t tick;
+{
+    uint64_t now;
+    uint64_t delay;
+    uint32_t count;
+
+    programmed_tick = tick;
+
+    if (tick == NO_EVENT)
+    {
+        if (event_source == EVENT_PIT)
+            pit_stop ();
+        else
+            apic_timer_stop ();
+
+        return;
+    }
+
+    if (event_source == EVENT_APIC_DEADLINE)
+    {
+        apic_timer_deadline (clock_ns_to_tsc (tick << TICK_SHIFT));
+        return;
+    }
+
+    now = clock_now_ns ();
+    delay = tick << TICK_SHIFT > now ? (tick << TICK_SHIFT) - now : 0;
+
+    if (event_source == EVENT_APIC_ONE_SHOT)
+    {
+        if (delay > MAX_APIC_DELAY_NS)
+            delay = MAX_APIC_DELAY_NS;
+
+        count = (uint32_t) udiv64 (delay * apic_timer_hz, NS_PER_SECOND,
+          NULL);
+        apic_timer_one_shot (count > 0 ? count : 1);
+    }
+    else
+    {
+        if (delay > MAX_PIT_DELAY_NS)
+            delay = MAX_PIT_DELAY_NS;
+
+        count = (uint32_t) udiv64 (delay * PIT_FREQUENCY, NS_PER_SECOND,
+          NULL);
+        pit_one_shot (count > 0 ? count : 1);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Bring the wheel up to date with the clock, then program the hardware
+ *  for the next tick with anything to do. Ticks with nothing to do are
+ *  skipped over rather than being processed one at a time.
+ */
+    PRIVATE void
+run_timers (void)
+{
+    uint64_t now_tick = clock_now_ns () >> TICK_SHIFT;
+    uint64_t next;
+
+    for (;;)
+    {
+        next = next_event_tick ();
+
+        if (next > now_tick)
+            break;
+
+        process_tick (next);
+    }
+
+    if (current_tick < now_tick)
+        current_tick = now_tick;
+
+    if (!tickless)
+        next = current_tick + 1;
+
+    program_event (next);
+}
+
+/**********************************************************/
+
+/**
+ *  Interrupt handlers for each kind of hardware timer. The APIC timer
+ *  vector is not an IRQ, so it has to signal the EOI itself, and give
+ *  the scheduler its chance to preempt afterwards.
+ */
+    PRIVATE void
+apic_timer_interrupt (vector, error_code)
+    uint32_t vector;
+    uint32_t error_code;
+{
+    run_timers ();
+    apic_eoi ();
+    thread_preempt ();
+}
+
+    PRIVATE void
+pit_timer_interrupt (irq)
+    int irq;
+{
+    run_timers ();
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
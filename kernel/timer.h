@@ -0,0 +1,54 @@
+/**
+ *  Kernel timers, which call a function at a given time, either once or
+ *  periodically.
+ */
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/**********************************************************/
+
+struct timer;
+
+/** timer callbacks are run from the timer interrupt handler, with
+ *  interrupts disabled */
+typedef void (*timer_callback) (struct timer *timer, void *data);
+
+/**
+ *  A timer. The caller provides the storage for the structure, which
+ *  must stay valid until the timer has expired or been cancelled. The
+ *  fields should be treated as private to timer.c.
+ */
+struct timer
+{
+    uint64_t expires;           // clock time to run the callback
+    uint64_t period;            // 0 for a one shot timer
+    timer_callback callback;
+    void *data;
+
+    /** links in the list of timers in the same slot of the timer wheel.
+     *  pprev points at whatever points to this timer, so that the timer
+     *  can be removed without knowing which slot it is in. */
+    struct timer *next;
+    struct timer **pprev;
+    bool pending;
+};
+
+/**********************************************************/
+
+void timer_initialise (void);
+void timer_start (struct timer *timer, uint64_t delay_ns,
+  uint64_t period_ns, timer_callback callback, void *data);
+void timer_cancel (struct timer *timer);
+const char *timer_event_source (void);
+void timer_set_tickless (bool tickless);
+
+/**********************************************************/
+
+
+#endif /** _TIMER_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,111 @@
+/**
+ *  Start up code for the application processors.
+ *
+ *  A processor woken by a startup IPI begins in real mode, at the start
+ *  of the page whose number is the IPI's vector. smp.c copies this code
+ *  to TRAMPOLINE_ADDRESS, below 1 MiB, and fills in trampoline_params
+ *  in the copy before sending the IPI. So this code must not depend on
+ *  where it was linked: everything is addressed relative to
+ *  trampoline_start.
+ *
+ *  The trampoline switches to protected mode with a flat GDT of its own,
+ *  then turns on paging with the kernel's page directory. The processor
+ *  is still running at the trampoline's low address at that point, so
+ *  smp.c maps the first 4 MiB at 0 while processors are being started.
+ *  Finally it moves to its own stack and calls smp_ap_main with its
+ *  struct cpu, which loads the processor's own GDT.
+ */
+
+/** these must match smp.h and protect.h */
+.set TRAMPOLINE_ADDRESS,    0x00008000
+.set KERNEL_CODE_SELECTOR,  0x08
+.set KERNEL_DATA_SELECTOR,  0x10
+
+/** control register bits */
+.set CR0_PROTECT,           0x00000001
+.set CR0_PAGING,            0x80000000
+.set CR0_WRITE_PROTECT,     0x00010000
+.set CR4_PSE,               0x00000010
+.set CR4_PGE,               0x00000080
+
+.section .text
+
+/**********************************************************/
+
+    .globl _trampoline_start
+    .align 16
+_trampoline_start:
+.code16
+# data is addressed relative to the start of the trampoline, and absolute
+# addresses are the physical ones in the copy.
+    cli
+    mov     %cs, %ax
+    mov     %ax, %ds
+
+    lgdtl   (trampoline_gdtr - _trampoline_start)
+
+    mov     %cr0, %eax
+    or      $CR0_PROTECT, %eax
+    mov     %eax, %cr0
+
+    ljmpl   $KERNEL_CODE_SELECTOR, $(TRAMPOLINE_ADDRESS + protected_mode - _trampoline_start)
+
+.code32
+protected_mode:
+    mov     $KERNEL_DATA_SELECTOR, %ax
+    mov     %ax, %ds
+    mov     %ax, %es
+    mov     %ax, %fs
+    mov     %ax, %gs
+    mov     %ax, %ss
+
+# paging as in start.s: 4 MiB and global pages, and write protect.
+    mov     %cr4, %eax
+    or      $(CR4_PSE | CR4_PGE), %eax
+    mov     %eax, %cr4
+
+    mov     (TRAMPOLINE_ADDRESS + trampoline_page_directory - _trampoline_start), %eax
+    mov     %eax, %cr3
+
+    mov     %cr0, %eax
+    or      $(CR0_PAGING | CR0_WRITE_PROTECT), %eax
+    mov     %eax, %cr0
+
+# switch to the processor's stack, and jump to the kernel's own address.
+    mov     (TRAMPOLINE_ADDRESS + trampoline_stack - _trampoline_start), %esp
+    pushl   (TRAMPOLINE_ADDRESS + trampoline_cpu - _trampoline_start)
+    mov     $_smp_ap_main, %eax
+    call    *%eax
+
+/**********************************************************/
+
+/** the trampoline's GDT, with the same code and data selectors as the
+ *  kernel's */
+    .align 8
+trampoline_gdt:
+    .quad   0
+    .quad   0x00CF9A000000FFFF
+    .quad   0x00CF92000000FFFF
+
+trampoline_gdtr:
+    .word   trampoline_gdtr - trampoline_gdt - 1
+    .long   (TRAMPOLINE_ADDRESS + trampoline_gdt - _trampoline_start)
+
+/** filled in by smp.c for each processor. The layout must match struct
+ *  trampoline_params. */
+    .align 4
+    .globl _trampoline_params
+_trampoline_params:
+trampoline_page_directory:
+    .long   0
+trampoline_stack:
+    .long   0
+trampoline_cpu:
+    .long   0
+
+    .globl _trampoline_end
+_trampoline_end:
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
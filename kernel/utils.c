@@ -3,6 +3,7 @@
  */
 
 #include "utils.h"
+#include "stdint.h"
 
 /**********************************************************/
 
@@ -28,4 +29,55 @@ isprintable (character)
 
 /**********************************************************/
 
+/**
+ *  Divide a 64 bit number by a 32 bit one. We do not link against
+ *  libgcc, so the compiler can not do 64 bit division for us; instead
+ *  this does it as two 64 by 32 bit divl instructions, the first on the
+ *  high half of the dividend and the second on the remainder of that
+ *  and the low half. If remainder is not NULL, the remainder is stored
+ *  there.
+ */
+    PUBLIC uint64_t
+udiv64 (dividend, divisor, remainder)
+    uint64_t dividend;
+    uint32_t divisor;
+    uint32_t *remainder;        // may be NULL
+{
+    uint32_t high = (uint32_t) (dividend >> 32);
+    uint32_t quotient_high = high / divisor;
+    uint32_t quotient_low;
+    uint32_t rest = high % divisor;
+
+    __asm__ ("divl %4"
+      : "=a" (quotient_low), "=d" (rest)
+      : "a" ((uint32_t) dividend), "d" (rest), "rm" (divisor));
+
+    if (remainder != NULL)
+        *remainder = rest;
+
+    return (uint64_t) quotient_high << 32 | quotient_low;
+}
+
+/**********************************************************/
+
+/**
+ *  Hash some bytes with FNV-1a, carrying on from hash, which is
+ *  FNV_BASIS to start a new hash, or can have something else mixed in.
+ */
+    PUBLIC uint32_t
+fnv_hash (hash, data, length)
+    uint32_t hash;
+    const void *data;
+    uint32_t length;
+{
+    const uint8_t *bytes = data;
+
+    for (uint32_t i = 0; i < length; i ++)
+        hash = (hash ^ bytes [i]) * 16777619u;
+
+    return hash;
+}
+
+/**********************************************************/
+
 /** vim: set ts=4 sw=4 et : */
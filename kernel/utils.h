@@ -1,6 +1,8 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 
+#include "stdint.h"
+
 /** constants that may be used to specify the scope of functions. */
 #define PUBLIC
 #define PRIVATE         static
@@ -11,8 +13,16 @@ typedef int bool;
 #define true            1
 #define false           0
 
+/** null pointer */
+#define NULL            ((void *) 0)
+
+/** starting value for fnv_hash */
+#define FNV_BASIS       2166136261u
+
 
 bool isprintable (char character);
+uint64_t udiv64 (uint64_t dividend, uint32_t divisor, uint32_t *remainder);
+uint32_t fnv_hash (uint32_t hash, const void *data, uint32_t length);
 
 
 #endif /** _UTILS_H */
@@ -5,11 +5,15 @@
 #ifndef _VGA_H
 #define _VGA_H
 
+#include "stdint.h"
+
 void vga_initialise (void);
 void set_cursor (int row, int column);
 void set_colour (unsigned char colour);
 void print_char (char ch);
+void print_buffer (const char *buffer, size_t length);
 void print_done (void);
+void vga_flush (void);
 
 
 #endif /** _VGA_H */
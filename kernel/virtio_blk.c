@@ -0,0 +1,854 @@
+/**
+ *  Driver for virtio block devices, through the legacy virtio PCI
+ *  interface, which is all IO ports.
+ *
+ *  A virtqueue is three arrays in memory shared with the device: the
+ *  descriptors, each pointing at a buffer; the available ring, where we
+ *  put the first descriptor of each request; and the used ring, where
+ *  the device puts them back once they are done. Telling the device to
+ *  look at the available ring (a kick) is a port write, which traps to
+ *  the hypervisor and is by far the most expensive part of a request,
+ *  so:
+ *
+ *  - the block layer hands over a list of requests, which are all put
+ *    in the ring with one kick. Requests submitted by the completion
+ *    callbacks are kicked together once the callbacks have all run. No
+ *    kick is sent at all while the device says it is already looking.
+ *  - each request takes only one descriptor in the ring, which points
+ *    to an indirect table of descriptors for the header, each physically
+ *    contiguous part of its buffers, and the status byte. The tables,
+ *    headers and status bytes are kept in a slot per request in flight,
+ *    allocated with the queue. If the device cannot do indirect
+ *    descriptors, the table is copied into a chain in the ring instead.
+ *  - the interrupt handler turns off interrupts from a queue while it
+ *    empties the used ring, and checks the ring again after turning them
+ *    back on, so a burst of completions costs one interrupt.
+ *  - if the device has more than one queue, each processor submits to
+ *    its own, so that they do not contend for a queue's lock.
+ *
+ *  Requests that do not fit in a queue wait in a list until completions
+ *  make room.
+ *
+ *  The disk is registered with the block layer as "vda", and requests
+ *  come through it, already merged.
+ */
+
+#include "virtio_blk.h"
+#include "stdint.h"
+#include "block.h"
+#include "cpu.h"
+#include "frames.h"
+#include "io.h"
+#include "irq.h"
+#include "lock.h"
+#include "memutils.h"
+#include "output.h"
+#include "paging.h"
+#include "pci.h"
+#include "slab.h"
+#include "smp.h"
+#include "utils.h"
+
+/** PCI IDs of a virtio block device with the legacy interface */
+#define VIRTIO_VENDOR_ID        0x1AF4
+#define VIRTIO_BLK_DEVICE_ID    0x1001
+
+/** legacy registers, at offsets from the IO port BAR */
+#define DEVICE_FEATURES         0x00
+#define DRIVER_FEATURES         0x04
+#define QUEUE_ADDRESS           0x08
+#define QUEUE_SIZE              0x0C
+#define QUEUE_SELECT            0x0E
+#define QUEUE_NOTIFY            0x10
+#define DEVICE_STATUS           0x12
+#define ISR_STATUS              0x13
+#define DEVICE_CONFIG           0x14
+
+/** the block device's configuration */
+#define CONFIG_CAPACITY         0
+#define CONFIG_SEG_MAX          12
+#define CONFIG_NUM_QUEUES       34
+
+/** device status bits */
+#define STATUS_ACKNOWLEDGE      0x01
+#define STATUS_DRIVER           0x02
+#define STATUS_DRIVER_OK        0x04
+#define STATUS_FAILED           0x80
+
+/** bits of the ISR status, which is cleared by reading it */
+#define ISR_QUEUE               0x01
+
+/** feature bits that we use */
+#define FEATURE_SEG_MAX         (1u << 2)
+#define FEATURE_MQ              (1u << 12)
+#define FEATURE_INDIRECT        (1u << 28)
+
+/** the legacy interface puts the used ring on the next page boundary
+ *  after the available ring, and takes the address of the queue as a
+ *  page number */
+#define QUEUE_ALIGN             PAGE_SIZE
+
+/** descriptor flags */
+#define DESC_NEXT               0x0001
+#define DESC_WRITE              0x0002
+#define DESC_INDIRECT           0x0004
+
+/** available ring flag to ask for no interrupts, and used ring flag to
+ *  ask for no kicks */
+#define AVAIL_NO_INTERRUPT      0x0001
+#define USED_NO_NOTIFY          0x0001
+
+/** request types and status */
+#define REQUEST_READ            0
+#define REQUEST_WRITE           1
+#define REQUEST_OK              0
+
+/** a buffer that does not start on a page boundary has one more page
+ *  than its size suggests, and each request also has a header and a
+ *  status byte */
+#define MAX_SEGMENTS            (VIRTIO_BLK_MAX_BYTES / PAGE_SIZE + 1)
+#define MAX_DESCRIPTORS         (MAX_SEGMENTS + 2)
+
+#define NO_DESCRIPTOR           0xFFFF
+
+/**********************************************************/
+
+/**
+ *  What happened to a request that we tried to put in a queue.
+ */
+enum post_result
+{
+    POSTED,
+    QUEUE_FULL,
+    BAD_BUFFER,
+};
+
+/**********************************************************/
+
+struct vring_desc
+{
+    uint64_t address;
+    uint32_t length;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct vring_avail
+{
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring [];
+};
+
+struct vring_used_element
+{
+    uint32_t id;
+    uint32_t length;
+};
+
+struct vring_used
+{
+    volatile uint16_t flags;
+    volatile uint16_t index;
+    struct vring_used_element ring [];
+};
+
+/**
+ *  The header at the start of each request.
+ */
+struct request_header
+{
+    uint32_t type;
+    uint32_t priority;
+    uint64_t sector;
+};
+
+/**
+ *  What the device reads and writes for a request, apart from the data
+ *  itself. The table comes first, so that it is aligned.
+ */
+struct request_slot
+{
+    struct vring_desc table [MAX_DESCRIPTORS];
+    struct request_header header;
+    uint8_t status;
+}
+__attribute__ ((aligned (16)));
+
+struct virtqueue
+{
+    uint16_t index;
+    uint16_t size;
+
+    struct vring_desc *desc;
+    struct vring_avail *avail;
+    struct vring_used *used;
+
+    /** list of free descriptors, linked through their next fields */
+    uint16_t free_head;
+    uint16_t free_count;
+
+    /** our copy of the available index, which is only written to the
+     *  ring when the new entries are ready; the next entry of the used
+     *  ring to look at; and entries added since the last kick */
+    uint16_t avail_index;
+    uint16_t last_used;
+    uint16_t unkicked;
+
+    /** set while completion callbacks are being run, so that requests
+     *  they submit are kicked together at the end */
+    bool completing;
+
+    struct request_slot *slots;
+    int slot_count;
+    uint8_t free_slots [VIRTIO_BLK_QUEUE_DEPTH];
+    int free_slot_count;
+
+    /** request whose first descriptor has each index */
+    struct block_request **by_head;
+
+    /** requests that did not fit */
+    struct block_request *waiting;
+    struct block_request *waiting_tail;
+
+    struct spinlock lock;
+
+    /** statistics */
+    uint32_t submitted;
+    uint32_t completed;
+    uint32_t kicks;
+    uint32_t kicks_suppressed;
+    uint32_t interrupts;
+};
+
+/**********************************************************/
+
+PRIVATE bool setup_queue (struct virtqueue *queue, uint16_t index);
+PRIVATE enum post_result post (struct virtqueue *queue,
+  struct block_request *request);
+PRIVATE int build_segments (struct vring_desc *table, int count,
+  uint8_t *buffer, uint32_t size, uint16_t flags);
+PRIVATE void kick (struct virtqueue *queue);
+PRIVATE void drain (struct virtqueue *queue);
+PRIVATE void release (struct virtqueue *queue, uint16_t head);
+PRIVATE void post_waiting (struct virtqueue *queue,
+  struct block_request ***failed);
+PRIVATE void virtio_blk_start (struct block_device *device,
+  struct block_request *list);
+PRIVATE void virtio_blk_interrupt (int irq);
+
+/**********************************************************/
+
+PRIVATE uint16_t io_base;
+PRIVATE bool present;
+
+PRIVATE uint64_t capacity;
+PRIVATE bool indirect;
+PRIVATE int max_segments;
+
+PRIVATE struct virtqueue queues [VIRTIO_BLK_MAX_QUEUES];
+PRIVATE int queue_count;
+
+PRIVATE struct block_device disk;
+
+/**********************************************************/
+
+/**
+ *  Find a virtio block device, negotiate features with it, and set up
+ *  as many queues as it has, up to one per processor.
+ */
+    PUBLIC void
+virtio_blk_initialise (void)
+{
+    struct pci_device *device =
+      pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID);
+    uint32_t features;
+    int wanted = 1;
+
+    if (device == NULL || !(device->bars [0] & PCI_BAR_IO))
+        return;
+
+    io_base = device->bars [0] & PCI_BAR_IO_MASK;
+    pci_enable (device, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    outb (io_base + DEVICE_STATUS, 0);
+    outb (io_base + DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+
+    features = inl (io_base + DEVICE_FEATURES) &
+      (FEATURE_SEG_MAX | FEATURE_MQ | FEATURE_INDIRECT);
+    outl (io_base + DRIVER_FEATURES, features);
+
+    indirect = (features & FEATURE_INDIRECT) != 0;
+    max_segments = MAX_SEGMENTS;
+
+    if (features & FEATURE_SEG_MAX)
+    {
+        uint32_t seg_max = inl (io_base + DEVICE_CONFIG + CONFIG_SEG_MAX);
+
+        if (seg_max != 0 && seg_max < (uint32_t) max_segments)
+            max_segments = seg_max;
+    }
+
+    if (features & FEATURE_MQ)
+    {
+        wanted = inw (io_base + DEVICE_CONFIG + CONFIG_NUM_QUEUES);
+
+        if (wanted > smp_cpu_count ())
+            wanted = smp_cpu_count ();
+
+        if (wanted > VIRTIO_BLK_MAX_QUEUES)
+            wanted = VIRTIO_BLK_MAX_QUEUES;
+    }
+
+    capacity = inl (io_base + DEVICE_CONFIG + CONFIG_CAPACITY) |
+      (uint64_t) inl (io_base + DEVICE_CONFIG + CONFIG_CAPACITY + 4) << 32;
+
+    while (queue_count < wanted &&
+      setup_queue (&queues [queue_count], queue_count))
+    {
+        queue_count ++;
+    }
+
+    if (queue_count == 0 || !irq_register (device->irq,
+      virtio_blk_interrupt))
+    {
+        outb (io_base + DEVICE_STATUS, STATUS_FAILED);
+        return;
+    }
+
+    outb (io_base + DEVICE_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER |
+      STATUS_DRIVER_OK);
+    present = true;
+
+    /** requests are submitted from threads, which all run on the boot
+     *  processor, so they go to the first queue */
+    disk.name = "vda";
+    disk.sectors = capacity;
+    disk.max_sectors = VIRTIO_BLK_MAX_BYTES / VIRTIO_BLK_SECTOR_SIZE;
+    disk.max_segments = max_segments;
+    disk.queue_depth = queues [0].slot_count;
+    disk.start = virtio_blk_start;
+    block_register (&disk);
+
+    kprintf ("virtio-blk: %u MiB, %u queues of %u, %s descriptors\n",
+      (uint32_t) (capacity >> 11), queue_count, queues [0].size,
+      indirect ? "indirect" : "chained");
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if there is a virtio block device.
+ */
+    PUBLIC bool
+virtio_blk_present (void)
+{
+    return present;
+}
+
+/**********************************************************/
+
+/**
+ *  The size of the device in sectors.
+ */
+    PUBLIC uint64_t
+virtio_blk_sectors (void)
+{
+    return capacity;
+}
+
+/**********************************************************/
+
+/**
+ *  The number of queues in use.
+ */
+    PUBLIC int
+virtio_blk_queue_count (void)
+{
+    return queue_count;
+}
+
+/**********************************************************/
+
+/**
+ *  Print the counters for each queue.
+ */
+    PUBLIC void
+virtio_blk_dump_stats (void)
+{
+    for (int i = 0; i < queue_count; i ++)
+    {
+        struct virtqueue *queue = &queues [i];
+
+        kprintf ("virtio-blk: queue %u submitted %u, completed %u, kicks %u"
+          " (%u suppressed), interrupts %u\n", i, queue->submitted,
+          queue->completed, queue->kicks, queue->kicks_suppressed,
+          queue->interrupts);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Allocate the rings of a queue, and the slots for its requests, and
+ *  tell the device where the rings are. Returns false if the device has
+ *  no such queue, or there is no memory.
+ */
+    PRIVATE bool
+setup_queue (queue, index)
+    struct virtqueue *queue;
+    uint16_t index;
+{
+    uint32_t used_offset;
+    uint32_t ring_bytes;
+    uint32_t slot_bytes;
+    uint32_t rings;
+    uint32_t slots;
+    uint8_t *base;
+    uint16_t size;
+
+    outw (io_base + QUEUE_SELECT, index);
+    size = inw (io_base + QUEUE_SIZE);
+
+    if (size == 0)
+        return false;
+
+    used_offset = (sizeof (struct vring_desc) * size +
+      sizeof (struct vring_avail) + sizeof (uint16_t) * (size + 1) +
+      QUEUE_ALIGN - 1) & ~(QUEUE_ALIGN - 1);
+    ring_bytes = used_offset + sizeof (struct vring_used) +
+      sizeof (struct vring_used_element) * size + sizeof (uint16_t);
+
+    queue->slot_count = size < VIRTIO_BLK_QUEUE_DEPTH ? size :
+      VIRTIO_BLK_QUEUE_DEPTH;
+    slot_bytes = sizeof (struct request_slot) * queue->slot_count;
+
+    rings = frame_alloc (frame_order (ring_bytes));
+    slots = frame_alloc (frame_order (slot_bytes));
+    queue->by_head = kmalloc (sizeof (struct block_request *) * size);
+
+    if (rings == 0 || slots == 0 || queue->by_head == NULL)
+    {
+        if (rings != 0)
+            frame_free (rings, frame_order (ring_bytes));
+
+        if (slots != 0)
+            frame_free (slots, frame_order (slot_bytes));
+
+        if (queue->by_head != NULL)
+            kfree (queue->by_head);
+
+        return false;
+    }
+
+    base = physical_to_virtual (rings);
+    memset (base, 0, ring_bytes);
+
+    queue->index = index;
+    queue->size = size;
+    queue->desc = (struct vring_desc *) base;
+    queue->avail = (struct vring_avail *)
+      (base + sizeof (struct vring_desc) * size);
+    queue->used = (struct vring_used *) (base + used_offset);
+    queue->slots = physical_to_virtual (slots);
+
+    for (uint16_t i = 0; i < size; i ++)
+        queue->desc [i].next = i + 1 < size ? i + 1 : NO_DESCRIPTOR;
+
+    queue->free_head = 0;
+    queue->free_count = size;
+
+    for (int i = 0; i < queue->slot_count; i ++)
+        queue->free_slots [i] = i;
+
+    queue->free_slot_count = queue->slot_count;
+
+    outl (io_base + QUEUE_ADDRESS, rings >> PAGE_SHIFT);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Put a request in the available ring, with the queue's lock held. The
+ *  device does not see it until the ring's index is updated by kick.
+ */
+    PRIVATE enum post_result
+post (queue, request)
+    struct virtqueue *queue;
+    struct block_request *request;
+{
+    struct request_slot *slot;
+    uint16_t flags = request->write ? 0 : DESC_WRITE;
+    int count = 0;
+    int slot_index;
+    uint16_t head;
+
+    if (queue->free_slot_count == 0)
+        return QUEUE_FULL;
+
+    slot_index = queue->free_slots [queue->free_slot_count - 1];
+    slot = &queue->slots [slot_index];
+
+    for (struct block_request *part = request; part != NULL;
+      part = part->merged)
+    {
+        count = build_segments (slot->table + 1, count, part->buffer,
+          part->count * VIRTIO_BLK_SECTOR_SIZE, flags);
+
+        if (count < 0)
+            return BAD_BUFFER;
+    }
+
+    count += 2;
+
+    if (queue->free_count < (indirect ? 1 : count))
+        return QUEUE_FULL;
+
+    queue->free_slot_count --;
+
+    slot->header.type = request->write ? REQUEST_WRITE : REQUEST_READ;
+    slot->header.priority = 0;
+    slot->header.sector = request->sector;
+    slot->status = 0xFF;
+
+    slot->table [0].address = virtual_to_physical (&slot->header);
+    slot->table [0].length = sizeof (struct request_header);
+    slot->table [0].flags = 0;
+    slot->table [count - 1].address = virtual_to_physical (&slot->status);
+    slot->table [count - 1].length = 1;
+    slot->table [count - 1].flags = DESC_WRITE;
+
+    for (int i = 0; i < count - 1; i ++)
+    {
+        slot->table [i].flags |= DESC_NEXT;
+        slot->table [i].next = i + 1;
+    }
+
+    head = queue->free_head;
+
+    if (indirect)
+    {
+        struct vring_desc *desc = &queue->desc [head];
+
+        queue->free_head = desc->next;
+        queue->free_count --;
+
+        desc->address = virtual_to_physical (slot->table);
+        desc->length = sizeof (struct vring_desc) * count;
+        desc->flags = DESC_INDIRECT;
+    }
+    else
+    {
+        uint16_t index = head;
+
+        for (int i = 0; i < count; i ++)
+        {
+            struct vring_desc *desc = &queue->desc [index];
+            uint16_t next = desc->next;
+
+            desc->address = slot->table [i].address;
+            desc->length = slot->table [i].length;
+            desc->flags = slot->table [i].flags;
+
+            if (i == count - 1)
+                queue->free_head = next;
+            else
+                index = next;
+        }
+
+        queue->free_count -= count;
+    }
+
+    request->slot = slot_index;
+    request->tag = head;
+    queue->by_head [head] = request;
+
+    queue->avail->ring [queue->avail_index ++ % queue->size] = head;
+    queue->unkicked ++;
+    queue->submitted ++;
+
+    return POSTED;
+}
+
+/**********************************************************/
+
+/**
+ *  Describe a buffer with descriptors after the count already in the
+ *  table, one for each physically contiguous run of pages, carrying on
+ *  the last one if the buffer follows on from it. Returns the new number
+ *  of descriptors, or -1 if there would be more than the device allows,
+ *  or part of the buffer is not mapped.
+ */
+    PRIVATE int
+build_segments (table, count, buffer, size, flags)
+    struct vring_desc *table;
+    int count;                  // descriptors in the table so far
+    uint8_t *buffer;
+    uint32_t size;              // bytes
+    uint16_t flags;             // for each descriptor
+{
+    uint32_t address = (uint32_t) buffer;
+
+    while (size != 0)
+    {
+        uint32_t physical = paging_lookup (address);
+        uint32_t chunk = PAGE_SIZE - (address & (PAGE_SIZE - 1));
+
+        if (physical == 0)
+            return -1;
+
+        if (chunk > size)
+            chunk = size;
+
+        if (count != 0 &&
+          table [count - 1].address + table [count - 1].length == physical)
+        {
+            table [count - 1].length += chunk;
+        }
+        else
+        {
+            if (count == max_segments)
+                return -1;
+
+            table [count].address = physical;
+            table [count].length = chunk;
+            table [count].flags = flags;
+            count ++;
+        }
+
+        address += chunk;
+        size -= chunk;
+    }
+
+    return count;
+}
+
+/**********************************************************/
+
+/**
+ *  Make the requests posted since the last kick visible to the device,
+ *  and kick it unless it has said that it does not need one. The full
+ *  barrier makes sure we read the used ring's flags after the device can
+ *  see the new index, or we could miss that it had just gone to sleep.
+ */
+    PRIVATE void
+kick (queue)
+    struct virtqueue *queue;
+{
+    if (queue->unkicked == 0)
+        return;
+
+    compiler_barrier ();
+    queue->avail->index = queue->avail_index;
+    memory_barrier ();
+
+    if (queue->used->flags & USED_NO_NOTIFY)
+        queue->kicks_suppressed ++;
+    else
+    {
+        outw (io_base + QUEUE_NOTIFY, queue->index);
+        queue->kicks ++;
+    }
+
+    queue->unkicked = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Take everything out of a queue's used ring, with interrupts from the
+ *  queue turned off while we do, then run the callbacks of the requests
+ *  that have finished. Anything submitted by the callbacks, or waiting
+ *  for room, is kicked at the end.
+ */
+    PRIVATE void
+drain (queue)
+    struct virtqueue *queue;
+{
+    struct block_request *done = NULL;
+    struct block_request **tail = &done;
+
+    spin_acquire (&queue->lock);
+    queue->avail->flags = AVAIL_NO_INTERRUPT;
+
+    for (;;)
+    {
+        while (queue->last_used != queue->used->index)
+        {
+            struct vring_used_element *element;
+            struct block_request *request;
+
+            compiler_barrier ();
+            element = &queue->used->ring [queue->last_used ++ % queue->size];
+            request = queue->by_head [element->id];
+
+            if (queue->slots [request->slot].status != REQUEST_OK)
+                request->error = true;
+
+            release (queue, element->id);
+            queue->completed ++;
+
+            *tail = request;
+            tail = &request->next;
+        }
+
+        queue->avail->flags = 0;
+        memory_barrier ();
+
+        if (queue->last_used == queue->used->index)
+            break;
+
+        queue->avail->flags = AVAIL_NO_INTERRUPT;
+    }
+
+    post_waiting (queue, &tail);
+    *tail = NULL;
+    queue->completing = true;
+    spin_release (&queue->lock);
+
+    block_complete_list (done);
+
+    spin_acquire (&queue->lock);
+    queue->completing = false;
+    kick (queue);
+    spin_release (&queue->lock);
+}
+
+/**********************************************************/
+
+/**
+ *  Free the descriptors and slot of a finished request.
+ */
+    PRIVATE void
+release (queue, head)
+    struct virtqueue *queue;
+    uint16_t head;
+{
+    struct block_request *request = queue->by_head [head];
+    uint16_t last = head;
+    uint16_t count = 1;
+
+    if (!indirect)
+    {
+        while (queue->desc [last].flags & DESC_NEXT)
+        {
+            last = queue->desc [last].next;
+            count ++;
+        }
+    }
+
+    queue->desc [last].next = queue->free_head;
+    queue->free_head = head;
+    queue->free_count += count;
+
+    queue->free_slots [queue->free_slot_count ++] = request->slot;
+}
+
+/**********************************************************/
+
+/**
+ *  Post as many of the waiting requests as now fit, in order. Any with
+ *  a bad buffer are added to the end of the failed list.
+ */
+    PRIVATE void
+post_waiting (queue, failed)
+    struct virtqueue *queue;
+    struct block_request ***failed;    // tail of the list
+{
+    while (queue->waiting != NULL)
+    {
+        struct block_request *request = queue->waiting;
+        enum post_result result = post (queue, request);
+
+        if (result == QUEUE_FULL)
+            break;
+
+        queue->waiting = request->next;
+        request->next = NULL;
+
+        if (result == BAD_BUFFER)
+        {
+            request->error = true;
+            **failed = request;
+            *failed = &request->next;
+        }
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  The block layer's start function, which puts a list of requests on
+ *  this processor's queue with one kick for the lot. Requests with a
+ *  buffer that is not all mapped complete straight away with an error.
+ *  Can be called from a completion callback.
+ */
+    PRIVATE void
+virtio_blk_start (device, list)
+    struct block_device *device;
+    struct block_request *list;
+{
+    struct virtqueue *queue = &queues [this_cpu ()->index % queue_count];
+    struct block_request *failed = NULL;
+    uint32_t flags = spin_acquire_irqsave (&queue->lock);
+
+    while (list != NULL)
+    {
+        struct block_request *request = list;
+        enum post_result result = QUEUE_FULL;
+
+        list = list->next;
+        request->next = NULL;
+
+        if (queue->waiting == NULL)
+            result = post (queue, request);
+
+        if (result == BAD_BUFFER)
+        {
+            request->error = true;
+            request->next = failed;
+            failed = request;
+        }
+        else if (result == QUEUE_FULL)
+        {
+            if (queue->waiting == NULL)
+                queue->waiting = request;
+            else
+                queue->waiting_tail->next = request;
+
+            queue->waiting_tail = request;
+        }
+    }
+
+    if (!queue->completing)
+        kick (queue);
+
+    spin_release_irqrestore (&queue->lock, flags);
+    block_complete_list (failed);
+}
+
+/**********************************************************/
+
+/**
+ *  Interrupt handler. Reading the ISR status acknowledges the interrupt,
+ *  and says whether it was ours, since the line may be shared. All of
+ *  the queues share the one interrupt.
+ */
+    PRIVATE void
+virtio_blk_interrupt (irq)
+    int irq;
+{
+    if (!(inb (io_base + ISR_STATUS) & ISR_QUEUE))
+        return;
+
+    for (int i = 0; i < queue_count; i ++)
+    {
+        queues [i].interrupts ++;
+        drain (&queues [i]);
+    }
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
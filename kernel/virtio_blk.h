@@ -0,0 +1,34 @@
+/**
+ *  Driver for virtio block devices, as provided by QEMU and other
+ *  hypervisors. Reads and writes go through the block layer.
+ */
+
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+#include "stdint.h"
+#include "utils.h"
+
+#define VIRTIO_BLK_SECTOR_SIZE  512
+
+/** biggest transfer in one request */
+#define VIRTIO_BLK_MAX_BYTES    (128 * 1024)
+
+/** most queues used, and most requests in flight on each */
+#define VIRTIO_BLK_MAX_QUEUES   4
+#define VIRTIO_BLK_QUEUE_DEPTH  64
+
+/**********************************************************/
+
+void virtio_blk_initialise (void);
+bool virtio_blk_present (void);
+uint64_t virtio_blk_sectors (void);
+int virtio_blk_queue_count (void);
+void virtio_blk_dump_stats (void);
+
+/**********************************************************/
+
+
+#endif /** _VIRTIO_BLK_H */
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,297 @@
+/**
+ *  Kernel virtual memory regions.
+ *
+ *  vm_alloc sets aside a range of kernel addresses, for something like a
+ *  heap or a stack, without giving it any memory. The first time each
+ *  page of the range is touched there is a page fault, and the fault
+ *  handler allocates a frame, clears it and maps it. So a large region
+ *  that is only partly used only costs the frames for the pages that
+ *  are used. When lazy backing is turned off, vm_alloc backs the whole
+ *  region up front instead.
+ *
+ *  Kernel stacks are always backed up front. A fault on a stack page
+ *  that is not present would make the processor push the fault's frame
+ *  onto that same page, which is a double fault.
+ *
+ *  Address ranges are not returned to the paging code when a region is
+ *  freed, but are kept and reused for the next region of the same size.
+ */
+
+#include "vm.h"
+#include "stdint.h"
+#include "cpu.h"
+#include "frames.h"
+#include "interrupt.h"
+#include "memutils.h"
+#include "output.h"
+#include "paging.h"
+#include "slab.h"
+#include "utils.h"
+
+/** bits of the page fault error code */
+#define FAULT_PROTECTION        0x01
+#define FAULT_WRITE             0x02
+#define FAULT_USER              0x04
+
+/**********************************************************/
+
+/**
+ *  A range of kernel addresses handed out by vm_alloc.
+ */
+struct vm_region
+{
+    uint32_t start;
+    uint32_t size;
+    struct vm_region *next;
+};
+
+/**********************************************************/
+
+PRIVATE struct vm_region *find_region (struct vm_region *list,
+  uint32_t address);
+PRIVATE bool back_page (uint32_t address);
+PRIVATE void page_fault (struct interrupt_frame *frame);
+
+/**********************************************************/
+
+PRIVATE struct slab_cache *region_cache;
+
+/** regions in use, and freed regions whose addresses can be reused */
+PRIVATE struct vm_region *regions;
+PRIVATE struct vm_region *free_regions;
+
+/** if false, regions are backed as soon as they are allocated */
+PRIVATE bool lazy = true;
+
+/** counters */
+PRIVATE uint32_t resident_pages;
+PRIVATE uint32_t faults;
+
+/**********************************************************/
+
+/**
+ *  Set up the cache of regions and the page fault handler. This needs the
+ *  slab allocator.
+ */
+    PUBLIC void
+vm_initialise (void)
+{
+    region_cache = slab_cache_create ("vm_region", sizeof (struct vm_region),
+      NULL);
+
+    if (region_cache == NULL)
+        panic ("No memory for the vm region cache\n");
+
+    register_interrupt_handler (EXCEPTION_PAGE_FAULT, page_fault);
+}
+
+/**********************************************************/
+
+/**
+ *  Set aside a region of kernel address space of at least size bytes,
+ *  starting on a page boundary. The region is backed straight away if
+ *  flags has VM_BACKED, or lazy backing is off. Returns NULL if there is
+ *  no room, or not enough memory to back the region.
+ */
+    PUBLIC void *
+vm_alloc (size, vm_flags)
+    uint32_t size;
+    uint32_t vm_flags;          // VM_ flags
+{
+    uint32_t flags = interrupts_save ();
+    struct vm_region *region;
+    struct vm_region **link = &free_regions;
+
+    size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+    while (*link != NULL && (*link)->size != size)
+        link = &(*link)->next;
+
+    if (*link != NULL)
+    {
+        region = *link;
+        *link = region->next;
+    }
+    else
+    {
+        uint32_t start = paging_reserve (size);
+
+        region = start != 0 ? slab_alloc (region_cache) : NULL;
+
+        if (region == NULL)
+        {
+            interrupts_restore (flags);
+            return NULL;
+        }
+
+        region->start = start;
+        region->size = size;
+    }
+
+    region->next = regions;
+    regions = region;
+
+    interrupts_restore (flags);
+
+    if (!lazy || (vm_flags & VM_BACKED))
+    {
+        for (uint32_t offset = 0; offset < size; offset += PAGE_SIZE)
+        {
+            if (!back_page (region->start + offset))
+            {
+                vm_free ((void *) region->start);
+                return NULL;
+            }
+        }
+    }
+
+    return (void *) region->start;
+}
+
+/**********************************************************/
+
+/**
+ *  Free a region from vm_alloc, and the frames behind any of its pages
+ *  that have been used.
+ */
+    PUBLIC void
+vm_free (address)
+    void *address;              // as returned by vm_alloc
+{
+    uint32_t flags = interrupts_save ();
+    struct vm_region **link = &regions;
+    struct vm_region *region;
+
+    while (*link != NULL && (*link)->start != (uint32_t) address)
+        link = &(*link)->next;
+
+    region = *link;
+
+    if (region == NULL)
+        panic ("Freeing %p, which is not a vm region\n", address);
+
+    *link = region->next;
+
+    for (uint32_t page = region->start; page < region->start + region->size;
+      page += PAGE_SIZE)
+    {
+        uint32_t physical = paging_lookup (page);
+
+        if (physical != 0)
+        {
+            paging_unmap (page);
+            frame_free (physical, 0);
+            resident_pages --;
+        }
+    }
+
+    region->next = free_regions;
+    free_regions = region;
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Choose whether new regions are backed when they are first touched, or
+ *  straight away.
+ */
+    PUBLIC void
+vm_set_lazy (enable)
+    bool enable;
+{
+    lazy = enable;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the number of frames backing vm regions.
+ */
+    PUBLIC uint32_t
+vm_resident_pages (void)
+{
+    return resident_pages;
+}
+
+/**
+ *  Returns the number of page faults that have been handled by backing a
+ *  page.
+ */
+    PUBLIC uint32_t
+vm_fault_count (void)
+{
+    return faults;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns the region in a list that contains an address, or NULL.
+ */
+    PRIVATE struct vm_region *
+find_region (list, address)
+    struct vm_region *list;
+    uint32_t address;
+{
+    while (list != NULL &&
+      (address < list->start || address - list->start >= list->size))
+        list = list->next;
+
+    return list;
+}
+
+/**********************************************************/
+
+/**
+ *  Give the page at an address a cleared frame. Returns false if there
+ *  are no frames left.
+ */
+    PRIVATE bool
+back_page (address)
+    uint32_t address;
+{
+    uint32_t physical = frame_alloc (0);
+
+    if (physical == 0)
+        return false;
+
+    clear_page (physical_to_virtual (physical));
+    paging_map (address & ~(PAGE_SIZE - 1), physical, PAGE_KERNEL);
+    resident_pages ++;
+
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Page fault handler. A fault on a page that is not present, in a vm
+ *  region, is the first use of the page, so it gets a frame and the
+ *  faulting instruction is run again. Anything else is a bug.
+ */
+    PRIVATE void
+page_fault (frame)
+    struct interrupt_frame *frame;
+{
+    uint32_t address = read_cr2 ();
+
+    if (!(frame->error_code & FAULT_PROTECTION) &&
+      find_region (regions, address) != NULL)
+    {
+        if (!back_page (address))
+            panic ("Out of memory backing %p\n", address);
+
+        faults ++;
+        return;
+    }
+
+    kprintf ("\npage fault at %p on %s\n", address,
+      frame->error_code & FAULT_WRITE ? "write" : "read");
+    unhandled_exception (frame);
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
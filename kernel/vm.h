@@ -0,0 +1,28 @@
+/**
+ *  Kernel virtual memory regions, backed by frames on demand.
+ */
+
+#ifndef _VM_H
+#define _VM_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** flags for vm_alloc */
+#define VM_BACKED               0x01
+
+/**********************************************************/
+
+void vm_initialise (void);
+void *vm_alloc (uint32_t size, uint32_t flags);
+void vm_free (void *address);
+void vm_set_lazy (bool lazy);
+uint32_t vm_resident_pages (void);
+uint32_t vm_fault_count (void);
+
+/**********************************************************/
+
+
+#endif /** _VM_H */
+
+/** vim: set ts=4 sw=4 et : */
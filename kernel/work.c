@@ -0,0 +1,405 @@
+/**
+ *  Deferred work, spread over the processors by work stealing.
+ *
+ *  Each processor has a deque of work items, in the style of Chase and
+ *  Lev. The owner pushes and pops at the bottom without any locked
+ *  instructions, except when taking the last item; other processors
+ *  steal from the top with a compare and exchange. Interrupt handlers
+ *  queue work on the processor they run on, and the owner only touches
+ *  the bottom with interrupts disabled, so a handler never sees a push
+ *  or pop half done.
+ *
+ *  Work runs with interrupts enabled, from the idle loops: the idle
+ *  thread on the boot processor, and the AP idle loop in smp.c. A
+ *  processor that is idle looks at its own deque first, then steals from
+ *  the others. Queueing work wakes one processor that is waiting for an
+ *  interrupt, if there is one, so a burst of work taken by one
+ *  processor's interrupts is shared with the idle ones straight away.
+ */
+
+#include "work.h"
+#include "stdint.h"
+#include "acpi.h"
+#include "cpu.h"
+#include "output.h"
+#include "slab.h"
+#include "smp.h"
+#include "utils.h"
+
+#define DEQUE_MASK              (WORK_DEQUE_SIZE - 1)
+
+/**********************************************************/
+
+/**
+ *  A processor's deque. top and bottom only ever increase, and wrap
+ *  around at 2^32; the items between them are in use. top is written by
+ *  thieves and bottom by the owner, so they are kept in separate cache
+ *  lines.
+ */
+struct work_deque
+{
+    volatile uint32_t top;
+
+    volatile uint32_t bottom __attribute__ ((aligned (CACHE_LINE_SIZE)));
+    struct work *volatile items [WORK_DEQUE_SIZE];
+
+    /** counters, each written only by the owner */
+    uint32_t queued;
+    uint32_t run;
+    uint32_t stolen;
+    uint32_t overflows;
+}
+__attribute__ ((aligned (CACHE_LINE_SIZE)));
+
+/**********************************************************/
+
+PRIVATE bool push (struct work_deque *deque, struct work *work);
+PRIVATE struct work *pop (struct work_deque *deque);
+PRIVATE struct work *steal (struct work_deque *deque);
+PRIVATE struct work *steal_any (int self);
+PRIVATE bool work_available (void);
+PRIVATE void run_item (struct work_deque *deque, struct work *work);
+PRIVATE void wake_idle_cpu (int self);
+PRIVATE void clear_idle (uint32_t bit);
+
+/**********************************************************/
+
+PRIVATE struct work_deque deques [MAX_CPUS];
+
+/** bit for each processor that is waiting for an interrupt in its idle
+ *  loop */
+PRIVATE volatile uint32_t idle_mask;
+
+/**********************************************************/
+
+/**
+ *  Set up a work item.
+ */
+    PUBLIC void
+work_init (work, function, data)
+    struct work *work;
+    work_function function;
+    void *data;
+{
+    work->function = function;
+    work->data = data;
+    work->pending = 0;
+}
+
+/**********************************************************/
+
+/**
+ *  Queue a work item on this processor, if it is not already queued.
+ *  This may be called from interrupt handlers. If the deque is full,
+ *  the work is done straight away instead.
+ */
+    PUBLIC void
+work_queue (work)
+    struct work *work;
+{
+    struct work_deque *deque;
+    uint32_t flags;
+    int self;
+
+    if (atomic_exchange (&work->pending, 1) != 0)
+        return;
+
+    flags = interrupts_save ();
+    self = this_cpu ()->index;
+    deque = &deques [self];
+
+    if (!push (deque, work))
+    {
+        deque->overflows ++;
+        interrupts_restore (flags);
+        run_item (deque, work);
+        return;
+    }
+
+    deque->queued ++;
+
+    if (idle_mask & ~(1u << self))
+        wake_idle_cpu (self);
+
+    interrupts_restore (flags);
+}
+
+/**********************************************************/
+
+/**
+ *  Run work until there is none left on this processor's deque, or any
+ *  other that can be stolen from. Must be called with interrupts
+ *  enabled.
+ */
+    PUBLIC void
+work_run (void)
+{
+    int self = this_cpu ()->index;
+    struct work_deque *deque = &deques [self];
+
+    for (;;)
+    {
+        uint32_t flags = interrupts_save ();
+        struct work *work = pop (deque);
+
+        interrupts_restore (flags);
+
+        if (work == NULL)
+        {
+            work = steal_any (self);
+
+            if (work == NULL)
+                return;
+
+            deque->stolen ++;
+        }
+
+        run_item (deque, work);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  One pass of an idle loop, called with interrupts disabled. Either
+ *  runs whatever work there is, or waits for an interrupt. The processor
+ *  is marked idle before the last look for work, and the push in
+ *  work_queue is a full barrier before it reads idle_mask, so either
+ *  the look finds the new work or work_queue sees us idle and wakes us.
+ *  Returns with interrupts enabled.
+ */
+    PUBLIC void
+work_idle (void)
+{
+    uint32_t bit = 1u << this_cpu ()->index;
+
+    if (!work_available ())
+    {
+        atomic_fetch_add (&idle_mask, bit);
+
+        if (!work_available ())
+            wait_for_interrupt ();
+
+        clear_idle (bit);
+    }
+
+    interrupts_enable ();
+    work_run ();
+}
+
+/**********************************************************/
+
+/**
+ *  Print the counters for each processor.
+ */
+    PUBLIC void
+work_dump_stats (void)
+{
+    for (int i = 0; i < smp_cpu_count (); i ++)
+    {
+        kprintf ("work: cpu %u queued %u, ran %u, stole %u, overflowed %u\n",
+          i, deques [i].queued, deques [i].run, deques [i].stolen,
+          deques [i].overflows);
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Add an item at the bottom of a deque. The store to bottom publishes
+ *  the item to thieves; it is an exchange rather than a plain store so
+ *  that it is also a full barrier before work_queue reads idle_mask.
+ *  Returns false if the deque is full.
+ */
+    PRIVATE bool
+push (deque, work)
+    struct work_deque *deque;   // our own deque
+    struct work *work;
+{
+    uint32_t bottom = deque->bottom;
+
+    if (bottom - deque->top >= WORK_DEQUE_SIZE)
+        return false;
+
+    deque->items [bottom & DEQUE_MASK] = work;
+    atomic_exchange (&deque->bottom, bottom + 1);
+    return true;
+}
+
+/**********************************************************/
+
+/**
+ *  Take the item at the bottom of our own deque, or NULL if it is empty.
+ *  bottom is moved up before top is read, with a full barrier between,
+ *  so that a thief either sees the smaller deque or we see its steal.
+ *  Only for the last item can both want the same one, and then the
+ *  compare and exchange on top decides.
+ */
+    PRIVATE struct work *
+pop (deque)
+    struct work_deque *deque;
+{
+    uint32_t bottom = deque->bottom - 1;
+    uint32_t top;
+    struct work *work;
+
+    atomic_exchange (&deque->bottom, bottom);
+    top = deque->top;
+
+    if ((int32_t) (bottom - top) < 0)
+    {
+        deque->bottom = top;
+        return NULL;
+    }
+
+    work = deque->items [bottom & DEQUE_MASK];
+
+    if (bottom != top)
+        return work;
+
+    if (atomic_compare_exchange (&deque->top, top, top + 1) != top)
+        work = NULL;
+
+    deque->bottom = top + 1;
+    return work;
+}
+
+/**********************************************************/
+
+/**
+ *  Take the item at the top of another processor's deque. Returns NULL
+ *  if it is empty, or another processor got the item first.
+ */
+    PRIVATE struct work *
+steal (deque)
+    struct work_deque *deque;
+{
+    uint32_t top = deque->top;
+    struct work *work;
+
+    compiler_barrier ();
+
+    if ((int32_t) (deque->bottom - top) <= 0)
+        return NULL;
+
+    work = deque->items [top & DEQUE_MASK];
+
+    if (atomic_compare_exchange (&deque->top, top, top + 1) != top)
+        return NULL;
+
+    return work;
+}
+
+/**********************************************************/
+
+/**
+ *  Steal an item from any other processor, starting with the next one
+ *  along so that thieves do not all pick on the same victim.
+ */
+    PRIVATE struct work *
+steal_any (self)
+    int self;                   // index of this processor
+{
+    int count = smp_cpu_count ();
+
+    for (int i = 1; i < count; i ++)
+    {
+        struct work *work = steal (&deques [(self + i) % count]);
+
+        if (work != NULL)
+            return work;
+    }
+
+    return NULL;
+}
+
+/**********************************************************/
+
+/**
+ *  Returns true if any deque has work in it.
+ */
+    PRIVATE bool
+work_available (void)
+{
+    for (int i = 0; i < smp_cpu_count (); i ++)
+    {
+        if ((int32_t) (deques [i].bottom - deques [i].top) > 0)
+            return true;
+    }
+
+    return false;
+}
+
+/**********************************************************/
+
+/**
+ *  Run a work item. It is marked as not pending first, so that the
+ *  function can queue it again.
+ */
+    PRIVATE void
+run_item (deque, work)
+    struct work_deque *deque;   // this processor's deque, for the counter
+    struct work *work;
+{
+    work->pending = 0;
+    compiler_barrier ();
+
+    work->function (work, work->data);
+    deque->run ++;
+}
+
+/**********************************************************/
+
+/**
+ *  Wake one of the other processors that are waiting for an interrupt.
+ *  Its bit is cleared here, so that the next item queued wakes a
+ *  different one rather than sending another IPI to the same processor.
+ */
+    PRIVATE void
+wake_idle_cpu (self)
+    int self;                   // index of this processor
+{
+    uint32_t mask = idle_mask;
+
+    while ((mask & ~(1u << self)) != 0)
+    {
+        int index = __builtin_ctz (mask & ~(1u << self));
+        uint32_t seen = atomic_compare_exchange (&idle_mask, mask,
+          mask & ~(1u << index));
+
+        if (seen == mask)
+        {
+            smp_wake (smp_cpu (index));
+            return;
+        }
+
+        mask = seen;
+    }
+}
+
+/**********************************************************/
+
+/**
+ *  Clear a processor's idle bit, if wake_idle_cpu has not already.
+ */
+    PRIVATE void
+clear_idle (bit)
+    uint32_t bit;
+{
+    uint32_t mask = idle_mask;
+
+    while (mask & bit)
+    {
+        uint32_t seen = atomic_compare_exchange (&idle_mask, mask,
+          mask & ~bit);
+
+        if (seen == mask)
+            return;
+
+        mask = seen;
+    }
+}
+
+/**********************************************************/
+
+/** vim: set ts=4 sw=4 et : */
@@ -0,0 +1,47 @@
+/**
+ *  Deferred work, for interrupt handlers to hand off anything that does
+ *  not have to be done with interrupts disabled.
+ */
+
+#ifndef _WORK_H
+#define _WORK_H
+
+#include "stdint.h"
+#include "utils.h"
+
+/** number of items each processor's deque can hold. Must be a power of
+ *  2. */
+#define WORK_DEQUE_SIZE         256
+
+/**********************************************************/
+
+struct work;
+
+typedef void (*work_function) (struct work *work, void *data);
+
+/**
+ *  An item of deferred work. The caller provides the storage, which must
+ *  stay valid until the function has been called. An item that is
+ *  queued again before it has run is only run once.
+ */
+struct work
+{
+    work_function function;
+    void *data;
+    volatile uint32_t pending;
+};
+
+/**********************************************************/
+
+void work_init (struct work *work, work_function function, void *data);
+void work_queue (struct work *work);
+void work_run (void);
+void work_idle (void);
+void work_dump_stats (void);
+
+/**********************************************************/
+
+
+#endif /** _WORK_H */
+
+/** vim: set ts=4 sw=4 et : */